@@ -11,6 +11,8 @@
 #include "image.h"
 #include "ring_buffer.h"
 #include "uart_transport.h"
+#include "boot_counter.h"
+#include "boot_trace.h"
 
 /* Private variables ---------------------------------------------------------*/
 // Image header definition
@@ -22,8 +24,12 @@ __attribute__((section(".image_hdr"))) ImageHeader_t IMAGE_HEADER = {
   .version_major = 1,
   .version_minor = 0,
   .version_patch = 0,
-  ._padding = 0,
+  .flags = 0,
+#ifdef APP_SLOT_B
+  .vector_addr = 0x08080200,
+#else
   .vector_addr = 0x08020200,
+#endif
   .crc = 0,
   .data_size = 0
 };
@@ -34,6 +40,7 @@ static void MX_GPIO_Init(void);
 static void setup_leds(void);
 static void clear_screen(void);
 static void delay_ms(uint32_t ms);
+static void dump_boot_trace(void);
 
 /* Animation frames for serial terminal */
 static const char* FRAMES[] = {
@@ -169,6 +176,8 @@ static Transport_t uart_transport;
   * @retval int
   */
 int main(void) {
+    boot_trace_mark(BOOT_TRACE_APP_START);
+
     /* External symbol from the linker script for firmware size */
     extern uint32_t __firmware_size;
     uint32_t firmware_size = (uint32_t)&__firmware_size;
@@ -181,6 +190,7 @@ int main(void) {
 
     /* Configure the system clock */
     SystemClock_Config();
+    boot_trace_mark(BOOT_TRACE_APP_CLOCK);
     
     /* Initialize all configured peripherals */
     MX_GPIO_Init();
@@ -205,6 +215,10 @@ int main(void) {
     transport_send(&uart_transport, (const uint8_t*)BOOT_BANNER, strlen(BOOT_BANNER));
     delay_ms(2000);
     
+    // Came up fine, tell the loader to stop counting boot attempts
+    boot_counter_confirm();
+    boot_trace_mark(BOOT_TRACE_APP_READY);
+    
     // Animation loop variables
     uint8_t frame_index = 0;
     uint8_t led_index = 0;
@@ -216,6 +230,16 @@ int main(void) {
         // Process UART data
         transport_process(&uart_transport);
         
+        // 'T' pauses the animation and dumps the boot time trace until the next key
+        uint8_t key;
+        if (transport_receive(&uart_transport, &key, 1) > 0 && (key == 'T' || key == 't')) {
+            clear_screen();
+            dump_boot_trace();
+            while (transport_receive(&uart_transport, &key, 1) == 0) {
+                transport_process(&uart_transport);
+            }
+        }
+        
         // Get current time
         uint32_t current_time = HAL_GetTick();
         
@@ -266,6 +290,25 @@ static void clear_screen(void) {
     HAL_Delay(10);
 }
 
+/**
+  * @brief  Sends the boot time trace as CSV, one row per checkpoint
+  * @retval None
+  */
+static void dump_boot_trace(void) {
+    char row[64];
+    
+    transport_send(&uart_transport, (const uint8_t*)BOOT_TRACE_CSV_HEADER, strlen(BOOT_TRACE_CSV_HEADER));
+    for (uint32_t i = 0; i < boot_trace_count(); i++) {
+        size_t len = boot_trace_format_row(i, row, sizeof(row));
+        transport_send(&uart_transport, (const uint8_t*)row, len);
+        
+        // The TX ring buffer drops bytes when full, let it drain between rows
+        while (!uart_transport_is_tx_complete()) {
+            transport_process(&uart_transport);
+        }
+    }
+}
+
 /**
   * @brief  Delays execution for a number of milliseconds
   * @param  ms: delay in milliseconds
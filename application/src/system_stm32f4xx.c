@@ -105,8 +105,13 @@
   #else
   #define VECT_TAB_BASE_ADDRESS   FLASH_BASE      /*!< Vector Table base address field.
                                                        This value must be a multiple of 0x200. */
+  #if defined(APP_SLOT_B)
+  #define VECT_TAB_OFFSET         0x00080200U     /*!< Vector Table base offset field (A/B slot B).
+                                                       This value must be a multiple of 0x200. */
+  #else
   #define VECT_TAB_OFFSET         0x00020200U     /*!< Vector Table base offset field.
                                                        This value must be a multiple of 0x200. */
+  #endif /* APP_SLOT_B */
   #endif /* VECT_TAB_SRAM */
   #endif /* USER_VECT_TAB_ADDRESS */
   /******************************************************************************/
@@ -1,20 +1,33 @@
 #include "main.h"
 #include "image.h"
+#include "verify_cache.h"
+#include "boot_trace.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include "stm32f4xx.h"
-#include "stm32f4xx_ll_bus.h"
-#include "stm32f4xx_ll_gpio.h"
 
 /* Private function prototypes -----------------------------------------------*/
-void SystemClock_Config(void);
-static void MX_GPIO_Init(void);
+static void record_boot_cycles(uint32_t cycles);
 void Error_Handler(void);
 
+/**
+  * @brief        Stores the hand-off time for the loader to report.
+  * @param cycles: DWT cycles since reset (core clock is HSI)
+  * @retval None
+  */
+static void record_boot_cycles(uint32_t cycles) {
+  RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+  PWR->CR |= PWR_CR_DBP;
+
+  (&RTC->BKP0R)[BOOT_CYCLES_BKP_REG] = cycles;
+}
+
 /**
   * @brief        The application entry point.
   * @param addr:  Image header address
   * @retval None
+  * @note         The core is still on HSI with reset bus prescalers, only the clocks
+  *               enabled for the header check have to be turned off again.
   */
 static void boot_to_image(uint32_t addr) {
   uint32_t vector_addr = addr + IMAGE_HDR_SIZE;
@@ -23,8 +36,13 @@ static void boot_to_image(uint32_t addr) {
   uint32_t stack_addr = *((uint32_t*)(vector_addr));
   uint32_t reset_vector = *((uint32_t*)(vector_addr + 4U));
 
-  HAL_RCC_DeInit();
-  HAL_DeInit();
+  boot_trace_mark(BOOT_TRACE_BOOT_HANDOFF);
+  record_boot_cycles(DWT->CYCCNT);
+
+  // Back to reset state, except SYSCFG which is needed for the remap
+  RCC->AHB1ENR &= ~(RCC_AHB1ENR_CRCEN | RCC_AHB1ENR_BKPSRAMEN);
+  RCC->APB1ENR &= ~RCC_APB1ENR_PWREN;
+  RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
 
   SYSCFG->MEMRMP = 0x01;
 
@@ -54,23 +72,21 @@ static void boot_to_image(uint32_t addr) {
 /**
   * @brief  The application entry point.
   * @retval int
+  * @note   Runs on the 16 MHz HSI without HAL_Init() or a PLL. The loader sets up its
+  *         own clock tree, so locking HSE/PLL here only delayed the hand-off.
   */
 int main(void)
 {
+  boot_trace_reset();
+  boot_trace_mark(BOOT_TRACE_BOOT_START);
 
-  /* Reset of all peripherals, Initializes the Flash interface and the Systick. */
-  HAL_Init();
-
-  /* Configure the system clock */
-  SystemClock_Config();
-
-  /* Initialize all configured peripherals */
-  MX_GPIO_Init();
+  /* Flash prefetch and caches speed up the CRC on a verification cache miss */
+  FLASH->ACR |= FLASH_ACR_PRFTEN | FLASH_ACR_ICEN | FLASH_ACR_DCEN;
 
-  ImageHeader_t header;
-  memcpy(&header, (void*)LOADER_ADDR, sizeof(ImageHeader_t));
+  const ImageHeader_t* header = (const ImageHeader_t*)LOADER_ADDR;
 
-  if (header.image_magic == IMAGE_MAGIC_LOADER) {
+  // Full CRC check only runs when the loader changed since it was last verified
+  if (header->image_magic == IMAGE_MAGIC_LOADER && verify_image_cached(LOADER_ADDR, IMAGE_HDR_SIZE)) {
     boot_to_image(LOADER_ADDR);
   } else {
     boot_to_image(UPDATER_ADDR);
@@ -82,66 +98,6 @@ int main(void)
   }
 }
 
-/**
-  * @brief System Clock Configuration
-  * @retval None
-  */
-void SystemClock_Config(void)
-{
-  RCC_OscInitTypeDef RCC_OscInitStruct = {0};
-  RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
-
-  /** Configure the main internal regulator output voltage
-  */
-  __HAL_RCC_PWR_CLK_ENABLE();
-  __HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE1);
-
-  /** Initializes the RCC Oscillators according to the specified parameters
-  * in the RCC_OscInitTypeDef structure.
-  */
-  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE;
-  RCC_OscInitStruct.HSEState = RCC_HSE_ON;
-  RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
-  RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
-  RCC_OscInitStruct.PLL.PLLM = 4;
-  RCC_OscInitStruct.PLL.PLLN = 90;
-  RCC_OscInitStruct.PLL.PLLP = RCC_PLLP_DIV2;
-  RCC_OscInitStruct.PLL.PLLQ = 4;
-  if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
-  {
-    Error_Handler();
-  }
-
-  /** Initializes the CPU, AHB and APB buses clocks
-  */
-  RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
-                              |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
-  RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
-  RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
-  RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV4;
-  RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV2;
-
-  if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_2) != HAL_OK)
-  {
-    Error_Handler();
-  }
-}
-
-/**
-  * @brief GPIO Initialization Function
-  * @param None
-  * @retval None
-  */
-static void MX_GPIO_Init(void)
-{
-
-  /* GPIO Ports Clock Enable */
-  LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_GPIOH);
-  LL_AHB1_GRP1_EnableClock(LL_AHB1_GRP1_PERIPH_GPIOA);
-
-}
-
-
 /**
   * @brief  This function is executed in case of error occurrence.
   * @retval None
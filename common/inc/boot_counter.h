@@ -0,0 +1,61 @@
+#ifndef _BOOT_COUNTER_H
+#define _BOOT_COUNTER_H
+
+#include "stm32f4xx_hal.h"
+#include <stdint.h>
+
+// Counter lives in the RTC backup registers, they survive resets and image hand-offs
+#define BOOT_COUNTER_MAGIC          0x544F4F42  // "BOOT"
+#define BOOT_COUNTER_REG_MAGIC      0
+#define BOOT_COUNTER_REG_ADDR       1
+#define BOOT_COUNTER_REG_CRC        2
+#define BOOT_COUNTER_REG_ATTEMPTS   3
+#define BOOT_COUNTER_REG_CHECK      4
+
+// Unconfirmed boots before the loader gives up on an image
+#ifndef BOOT_COUNTER_MAX_ATTEMPTS
+    #define BOOT_COUNTER_MAX_ATTEMPTS   3
+#endif
+
+// Set in the attempts word once the application has confirmed itself
+#define BOOT_COUNTER_CONFIRMED      0x80000000U
+
+// Image under trial, identified by its slot and image CRC
+typedef struct {
+    uint32_t image_addr;        // Slot base address
+    uint32_t image_crc;         // Header CRC, a new image restarts the count
+    uint32_t attempts;          // Unconfirmed boots, BOOT_COUNTER_CONFIRMED when healthy
+} BootCounter_t;
+
+typedef enum {
+    BOOT_COUNTER_BOOT,          // Confirmed image, boot it
+    BOOT_COUNTER_TRY,           // Image on trial, boot it and count the attempt
+    BOOT_COUNTER_ROLLBACK       // Image used up its attempts without confirming
+} BootCounterDecision_t;
+
+// Decide what to do with the image at (addr, crc), no hardware access
+BootCounterDecision_t boot_counter_decide(const BootCounter_t* counter, uint32_t addr, uint32_t crc,
+                                          uint32_t max_attempts);
+
+// Count one boot of the image at (addr, crc), no hardware access
+void boot_counter_advance(BootCounter_t* counter, uint32_t addr, uint32_t crc);
+
+// Read the counter from the backup registers, returns 0 (and a cleared counter) if not valid
+int boot_counter_load(BootCounter_t* counter);
+
+// Write the counter to the backup registers
+void boot_counter_save(const BootCounter_t* counter);
+
+// Forget the image under trial
+void boot_counter_clear(void);
+
+// Decide for the image at addr using the stored counter
+BootCounterDecision_t boot_counter_check(uint32_t addr, uint32_t max_attempts);
+
+// Count a boot of the image at addr, called by the loader just before the jump
+void boot_counter_record_boot(uint32_t addr);
+
+// Mark the running image healthy, called by the application
+void boot_counter_confirm(void);
+
+#endif /* _BOOT_COUNTER_H */
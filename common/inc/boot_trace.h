@@ -0,0 +1,60 @@
+#ifndef _BOOT_TRACE_H
+#define _BOOT_TRACE_H
+
+#include "stm32f4xx_hal.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Trace lives in the last 256 bytes of CCM RAM, excluded from every linker script
+#define BOOT_TRACE_ADDR         (CCMDATARAM_BASE + 0xFF00)
+#define BOOT_TRACE_MAGIC        0x45435254  // "TRCE"
+#define BOOT_TRACE_ENTRIES      30
+
+// Column names of the rows produced by boot_trace_format_row()
+#define BOOT_TRACE_CSV_HEADER   "stage,cycles,mhz,delta_us,total_us\r\n"
+
+// Checkpoints, in the order they are normally reached
+typedef enum {
+    BOOT_TRACE_BOOT_START = 0,      // Boot stage main()
+    BOOT_TRACE_BOOT_HANDOFF,        // Boot stage jumps to the next image
+    BOOT_TRACE_LOADER_START,        // Loader main(), still on HSI
+    BOOT_TRACE_LOADER_CLOCK,        // Loader clock tree is up
+    BOOT_TRACE_LOADER_MENU,         // Loader menu shown, autoboot window starts
+    BOOT_TRACE_LOADER_EXIT,         // Loader leaves the menu (key press or timeout)
+    BOOT_TRACE_PREPARE_START,       // prepare_for_boot() entered
+    BOOT_TRACE_PREPARE_DONE,        // Clocks and peripherals torn down
+    BOOT_TRACE_UPDATER_START,       // Updater main(), still on HSI
+    BOOT_TRACE_UPDATER_CLOCK,       // Updater clock tree is up
+    BOOT_TRACE_UPDATER_READY,       // Updater menu shown
+    BOOT_TRACE_APP_START,           // Application main(), still on HSI
+    BOOT_TRACE_APP_CLOCK,           // Application clock tree is up
+    BOOT_TRACE_APP_READY,           // Application confirmed itself
+    BOOT_TRACE_POINT_COUNT
+} BootTracePoint_t;
+
+typedef struct {
+    uint8_t  point;             // BootTracePoint_t
+    uint8_t  reserved;
+    uint16_t clock_mhz;         // Core clock from this checkpoint on
+    uint32_t cycles;            // DWT CYCCNT, started by the boot stage at reset
+} BootTraceEntry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    BootTraceEntry_t entries[BOOT_TRACE_ENTRIES];
+} BootTrace_t;
+
+// Start a new trace, called once by the boot stage after reset
+void boot_trace_reset(void);
+
+// Record the cycle counter at a checkpoint
+void boot_trace_mark(BootTracePoint_t point);
+
+// Number of recorded checkpoints, 0 if the trace is not valid
+uint32_t boot_trace_count(void);
+
+// Format one CSV row, returns its length or 0 past the last checkpoint
+size_t boot_trace_format_row(uint32_t index, char* buffer, size_t size);
+
+#endif /* _BOOT_TRACE_H */
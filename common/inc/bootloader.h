@@ -4,6 +4,7 @@
 #include "stm32f4xx_hal.h"
 #include "image.h"
 #include "flash.h"
+#include "verify_cache.h"
 #include <stdint.h>
 
 // Boot config struct
@@ -12,6 +13,7 @@ typedef struct {
     uint32_t updater_addr;    // Updater addr
     uint32_t loader_addr;     // Loader addr
     uint32_t image_hdr_size;  // Size of image header
+    uint32_t app_b_addr;      // Second application slot (0 when not used)
 } BootConfig_t;
 
 // Boot options
@@ -26,6 +28,12 @@ typedef enum {
 // Check if firmware at given address is valid
 int is_firmware_valid(uint32_t addr, const BootConfig_t* config);
 
+// Check magic and image CRC (cached in backup SRAM after the first full check)
+int is_firmware_verified(uint32_t addr, const BootConfig_t* config);
+
+// Pick the application slot to boot (0 if none is bootable)
+uint32_t select_app_slot(const BootConfig_t* config);
+
 // Boot to app
 void boot_application(const BootConfig_t* config);
 
@@ -0,0 +1,170 @@
+#ifndef _COMMAND_H
+#define _COMMAND_H
+
+#include "bootloader.h"
+#include "image.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Frame: SOF, command, payload length (LE16), payload, CRC-16/XMODEM (LE16) of command,
+// length and payload. Multi-byte payload fields are little-endian.
+#define COMMAND_SOF                 0xA5
+#define COMMAND_PROTOCOL_VERSION    1
+#define COMMAND_MAX_PAYLOAD         128
+#define COMMAND_FRAME_OVERHEAD      6
+#define COMMAND_MAX_FRAME           (COMMAND_MAX_PAYLOAD + COMMAND_FRAME_OVERHEAD)
+
+// A frame whose bytes stop arriving for this long is dropped
+#define COMMAND_BYTE_TIMEOUT_MS     100
+
+// Set in the command byte of a reply, whose first payload byte is a CommandStatus_t
+#define COMMAND_REPLY               0x80
+
+// Hand-off word in the RTC backup registers (COMMAND_SESSION_BKP_REG), low byte is a boot target
+#define COMMAND_SESSION_MAGIC       0x53544100  // "STA"
+
+typedef enum {
+    COMMAND_HELLO           = 0x01,     // Start a session, menus are no longer drawn
+    COMMAND_GET_INFO        = 0x02,     // Headers of every image
+    COMMAND_START_UPDATE    = 0x03,     // [target], XMODEM starts after the reply
+    COMMAND_QUERY_PROGRESS  = 0x04,     // State of the last update started by command
+    COMMAND_VERIFY          = 0x05,     // [target], full CRC check of an image
+    COMMAND_BOOT            = 0x06,     // [target], the session carries over to a loader or updater
+    COMMAND_RESET           = 0x07,     // System reset
+    COMMAND_GET_BAUD        = 0x08,     // Current line rate and the rates SET_BAUD takes
+    COMMAND_SET_BAUD        = 0x09,     // [rate LE32], switch after the reply, again at the new rate to keep it
+    COMMAND_ECHO            = 0x0A      // Payload is sent back, link probe
+} CommandId_t;
+
+typedef enum {
+    COMMAND_STATUS_OK           = 0x00,
+    COMMAND_STATUS_UNSUPPORTED  = 0x01, // Not handled by this image
+    COMMAND_STATUS_BAD_LENGTH   = 0x02,
+    COMMAND_STATUS_BAD_TARGET   = 0x03,
+    COMMAND_STATUS_FAILED       = 0x04, // No valid image, or its CRC does not match
+    COMMAND_STATUS_BAD_RATE     = 0x05  // SET_BAUD rate not offered by GET_BAUD
+} CommandStatus_t;
+
+typedef enum {
+    COMMAND_TARGET_NONE         = 0,
+    COMMAND_TARGET_LOADER       = 1,
+    COMMAND_TARGET_UPDATER      = 2,
+    COMMAND_TARGET_APP          = 3,    // Slot the loader boots
+    COMMAND_TARGET_APP_PATCH    = 4,    // START_UPDATE only, streamed delta patch
+    COMMAND_TARGET_APP_DIRECT   = 5     // START_UPDATE only, straight into the slot
+} CommandTarget_t;
+
+typedef enum {
+    COMMAND_PROGRESS_IDLE,
+    COMMAND_PROGRESS_RECEIVING,         // Transfer or patch still running
+    COMMAND_PROGRESS_DONE,
+    COMMAND_PROGRESS_FAILED
+} CommandProgress_t;
+
+// Image entry of the GET_INFO and VERIFY replies
+#define COMMAND_INFO_VALID          0x01    // Header found
+#define COMMAND_INFO_BOOT           0x02    // Application slot the loader boots
+
+typedef struct __attribute__((packed)) {
+    uint8_t  image_type;        // IMAGE_TYPE_*
+    uint8_t  flags;             // COMMAND_INFO_* bits
+    uint8_t  version_major;
+    uint8_t  version_minor;
+    uint8_t  version_patch;
+    uint32_t addr;              // Slot address
+    uint32_t data_size;
+    uint32_t crc;
+} CommandImageInfo_t;
+
+// HELLO reply
+typedef struct __attribute__((packed)) {
+    uint8_t  protocol_version;  // COMMAND_PROTOCOL_VERSION
+    uint8_t  image_type;        // Image that answered, loader or updater
+    uint8_t  version_major;
+    uint8_t  version_minor;
+    uint8_t  version_patch;
+    uint16_t max_payload;       // COMMAND_MAX_PAYLOAD
+} CommandHello_t;
+
+// QUERY_PROGRESS reply
+typedef struct __attribute__((packed)) {
+    uint8_t  state;             // CommandProgress_t
+    uint8_t  target;            // CommandTarget_t of the START_UPDATE
+    uint8_t  transfer;          // XmodemError_t that ended the transfer
+    int16_t  patch_error;       // Patch handler result, 0 if none
+    uint32_t packets;           // XMODEM packets accepted
+    uint32_t elapsed_ms;        // Since START_UPDATE, frozen once finished
+} CommandProgressInfo_t;
+
+// Line rates offered by GET_BAUD, each if the USART clock generates it within
+// COMMAND_BAUD_TOLERANCE (per mille). The receiver of an STM32 USART takes about 3.3 %
+// total error at 16x oversampling and less at 8x, the rest is left to the station's adapter.
+#define COMMAND_BAUD_RATES          { 115200, 230400, 460800, 921600, 1000000, 1500000, 2000000, \
+                                      2500000, 3000000, 4000000 }
+#define COMMAND_BAUD_TOLERANCE      25
+
+// A rate set by SET_BAUD is dropped for the previous one unless SET_BAUD names it again
+// within this time, so a link that does not work at the new rate comes back by itself
+#define COMMAND_BAUD_CONFIRM_MS     1000
+
+// Without a valid frame for this long a kept rate goes back to the one the image started with
+#define COMMAND_BAUD_IDLE_MS        10000
+
+// GET_BAUD reply data: current rate, then every rate offered, LE32 each
+#define COMMAND_BAUD_MAX_RATES      11
+
+// Complete, CRC-checked frame, payload points into the parser
+typedef struct {
+    uint8_t id;
+    uint16_t length;
+    const uint8_t* payload;
+} CommandFrame_t;
+
+typedef enum {
+    COMMAND_PARSE_IDLE,         // Byte is not part of a frame
+    COMMAND_PARSE_BUSY,         // Byte taken into a frame
+    COMMAND_PARSE_FRAME,        // Frame complete
+    COMMAND_PARSE_ERROR         // Frame dropped, bad length or CRC
+} CommandParse_t;
+
+typedef struct {
+    uint8_t  state;
+    uint16_t fill;              // Bytes after SOF collected so far
+    uint16_t length;            // Payload length of the frame in progress
+    uint32_t last_byte_time;
+    uint8_t  frame[COMMAND_MAX_FRAME];
+} CommandParser_t;
+
+// Reset the parser to wait for a start of frame
+void command_parser_init(CommandParser_t* parser);
+
+// Feed one received byte, frame is filled in when COMMAND_PARSE_FRAME is returned
+CommandParse_t command_parse_byte(CommandParser_t* parser, uint8_t byte, uint32_t now, CommandFrame_t* frame);
+
+// Build a frame into out (COMMAND_MAX_FRAME bytes), returns its size
+size_t command_encode(uint8_t* out, uint8_t id, const void* payload, uint16_t len);
+
+// Build the reply to command id into out (COMMAND_MAX_FRAME bytes), returns its size
+size_t command_build_reply(uint8_t* out, uint8_t id, uint8_t status, const void* data, uint16_t len);
+
+// Address of a loader, updater or application target, 0 for any other
+uint32_t command_target_addr(uint8_t target, const BootConfig_t* config);
+
+// Describe the image at addr, returns 1 if its header is valid
+int command_image_info(uint32_t addr, const BootConfig_t* config, CommandImageInfo_t* info);
+
+// Fill the GET_INFO reply data (loader, updater, then each application slot), returns its length
+uint16_t command_build_info(uint8_t* out, const BootConfig_t* config);
+
+// Answer HELLO, GET_INFO, VERIFY and ECHO for the running image (self), returns the reply size
+// in out (COMMAND_MAX_FRAME bytes), 0 for a command the image handles itself
+size_t command_answer_common(const CommandFrame_t* frame, const BootConfig_t* config,
+                             const ImageHeader_t* self, uint8_t* out);
+
+// Tell the image about to be started that a station is attached, with a target it should boot
+void command_session_handoff(uint8_t boot_target);
+
+// Take the hand-off left by the previous image, returns 1 (and its boot target) if there was one
+int command_session_take(uint8_t* boot_target);
+
+#endif /* _COMMAND_H */
@@ -4,6 +4,9 @@
 #include "flash.h"
 #include "crc.h"
 #include "janpatch.h"
+#include "xmodem.h"
+#include "patch_journal.h"
+#include "lzss.h"
 #include <string.h>
 #include <stdint.h>
 #include <stddef.h>
@@ -12,9 +15,71 @@
 #define PATCH_SIZE          ((uint32_t)0x19000U)
 #define DELTA_BUFFER_SIZE   2048
 
+// janpatch page cache sizes (pages of DELTA_BUFFER_SIZE), the caches are placed in CCMRAM
+#ifndef DELTA_SOURCE_PAGES
+#define DELTA_SOURCE_PAGES  16  // LRU cache for scattered copies from the old image
+#endif
+#ifndef DELTA_PATCH_PAGES
+#define DELTA_PATCH_PAGES   2   // Patch is read sequentially, 2 pages absorb the rewinds
+#endif
+#ifndef DELTA_TARGET_PAGES
+#define DELTA_TARGET_PAGES  4   // Write-back cache for the new image
+#endif
+
+#if (DELTA_SOURCE_PAGES > JANPATCH_MAX_PAGES) || (DELTA_PATCH_PAGES > JANPATCH_MAX_PAGES) || \
+    (DELTA_TARGET_PAGES > JANPATCH_MAX_PAGES)
+#error "janpatch page cache larger than JANPATCH_MAX_PAGES"
+#endif
+
+#if ((DELTA_SOURCE_PAGES + DELTA_PATCH_PAGES + DELTA_TARGET_PAGES) * DELTA_BUFFER_SIZE) > 0xC000
+#error "janpatch page caches do not fit in the CCMRAM budget (48KB)"
+#endif
+
+#define DELTA_CCMRAM        __attribute__((section(".ccmram")))
+
+// Streamed patch window: current + previous janpatch page (rewinds) plus the overshoot of
+// one XMODEM block, which a compressed patch can expand to LZSS_MAX_EXPANSION(128) bytes
+#define DELTA_STREAM_BLOCK_SIZE     128
+#define DELTA_STREAM_WINDOW_SIZE    (2 * DELTA_BUFFER_SIZE + LZSS_MAX_EXPANSION(DELTA_STREAM_BLOCK_SIZE))
+#define DELTA_STREAM_TIMEOUT_MS     10000
+
+// Streamed patch error codes (in addition to the handle_firmware_patch ones)
+#define DELTA_ERR_TRANSFER          10
+#define DELTA_ERR_AUTHENTICATION    11
+
+// In-place patching: annotation block between the image header and the patch data
+#define INPLACE_ANNOTATION_MAGIC    0x31504C49  // "ILP1"
+#define INPLACE_MAX_SECTORS         PATCH_JOURNAL_MAX_SECTORS
+#define INPLACE_SCRATCH_SLOTS       2           // Scratch sectors in the backup area
+#define INPLACE_NONE                PATCH_JOURNAL_NONE
+
+// In-place patch error codes
+#define DELTA_ERR_SCRATCH           12
+#define DELTA_ERR_JOURNAL           13
+
+// Compressed patch error code
+#define DELTA_ERR_COMPRESSION       14
+
+// In-place patch received while A/B slots are in use
+#define DELTA_ERR_INPLACE_UNSUPPORTED 15
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             // INPLACE_ANNOTATION_MAGIC
+    uint32_t old_size;          // Data size of the image the patch applies to
+    uint32_t old_crc;           // CRC of that image
+    uint32_t patch_size;        // Size of the patch data after this block
+    uint32_t patch_crc;         // CRC of the patch data
+    uint32_t sector_size;       // Erase unit of the slot
+    uint8_t  sector_count;      // Number of slot sectors described below
+    uint8_t  reserved[3];
+    uint8_t  last_use[INPLACE_MAX_SECTORS];   // Last new sector copying from old sector i, or INPLACE_NONE
+    uint8_t  unchanged[INPLACE_MAX_SECTORS];  // 1 if sector i is identical in both images
+    uint32_t crc;               // CRC of the fields above
+} InplaceAnnotation_t;
+
 // Apply a delta patch to a firmware image
 int apply_delta_patch(uint32_t source_addr, uint32_t patch_addr, uint32_t target_addr,
-                      uint32_t source_size, uint32_t patch_size);
+                      uint32_t source_size, uint32_t patch_size, uint8_t patch_flags);
 
 // Verify the patched firmware
 int verify_patched_firmware(uint32_t target_addr, uint32_t header_size);
@@ -23,4 +88,16 @@ int verify_patched_firmware(uint32_t target_addr, uint32_t header_size);
 int handle_firmware_patch(uint32_t app_addr, uint32_t patch_addr, uint32_t target_addr, 
     uint32_t backup_addr, uint32_t header_size);
 
+// Receive a patch over XMODEM and apply it on the fly, without staging the patch in flash
+int handle_firmware_patch_stream(XmodemManager_t* xmodem, uint32_t source_addr, uint32_t target_addr,
+    uint32_t backup_addr, uint32_t header_size);
+
+// Apply an annotated patch in place, keeping only the sectors still needed as copy sources
+int handle_firmware_patch_inplace(uint32_t slot_addr, uint32_t patch_addr, uint32_t scratch_addr,
+    uint32_t header_size);
+
+// Finish an in-place patch that was interrupted by a reset or power loss
+int resume_firmware_patch_inplace(uint32_t slot_addr, uint32_t patch_addr, uint32_t scratch_addr,
+    uint32_t header_size);
+
 #endif /* _DELTA_UPDATE_H */
\ No newline at end of file
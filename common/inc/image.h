@@ -12,6 +12,14 @@
 
 #define IMAGE_VERSION_CURRENT 0x0100
 
+// Values of the is_patch header field
+#define IMAGE_PATCH_NONE      0   // Full image
+#define IMAGE_PATCH_DELTA     1   // Delta patch, applied with a full backup
+#define IMAGE_PATCH_INPLACE   2   // Annotated delta patch, applied in place
+
+// Bits of the flags header field
+#define IMAGE_FLAG_COMPRESSED 0x01  // Data after the header is an LZSS container (lzss.h)
+
 // Image types
 typedef enum {
     IMAGE_TYPE_LOADER   = 1,
@@ -23,11 +31,11 @@ typedef struct __attribute__((packed)) {
     uint32_t image_magic;        // Magic number (component-specific)
     uint16_t image_hdr_version;  // Header version
     uint8_t  image_type;         // Type of image
-    uint8_t  is_patch;           // Flag indicating if this is a delta patch (1) or full image (0)
+    uint8_t  is_patch;           // Patch kind, IMAGE_PATCH_* (0 for a full image)
     uint8_t  version_major;      // Major version number
     uint8_t  version_minor;      // Minor version number
     uint8_t  version_patch;      // Patch version number
-    uint8_t  _padding;           // Padding for alignment
+    uint8_t  flags;              // IMAGE_FLAG_* bits
     uint32_t vector_addr;        // Address of the vector table
     uint32_t crc;                // CRC of the image (excluding header)
     uint32_t data_size;          // Size of the image data
@@ -41,7 +49,7 @@ typedef struct __attribute__((packed)) {
     uint8_t  version_major;      // Major version number
     uint8_t  version_minor;      // Minor version number
     uint8_t  version_patch;      // Patch version number
-    uint8_t  _padding;           // Padding for alignment
+    uint8_t  flags;              // IMAGE_FLAG_* bits
     uint32_t vector_addr;        // Address of the vector table
     uint32_t crc;                // CRC of the image (excluding header)
     uint32_t data_size;          // Size of the image data
@@ -0,0 +1,53 @@
+#ifndef _LZSS_H
+#define _LZSS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * LZSS bitstream (heatshrink style), bits are packed MSB first:
+ *   1 + 8 bits                          literal byte
+ *   0 + window_bits + lookahead_bits    copy (count + 1) bytes from (index + 1) bytes back
+ * The stream is preceded by an LzssHeader_t and padded with zero bits to a byte.
+ */
+#define LZSS_MAGIC                  0x5A4C  // "LZ"
+#define LZSS_MIN_WINDOW_BITS        8
+#define LZSS_MAX_WINDOW_BITS        11      // Decoder window is 2KB
+#define LZSS_MIN_LOOKAHEAD_BITS     3
+#define LZSS_MAX_LOOKAHEAD_BITS     5
+
+// Upper bound of the output produced by n input bytes
+#define LZSS_MAX_EXPANSION(n) \
+    ((((n) * 8) / (1 + LZSS_MIN_WINDOW_BITS + LZSS_MIN_LOOKAHEAD_BITS) + 1) * (1 << LZSS_MAX_LOOKAHEAD_BITS))
+
+typedef struct __attribute__((packed)) {
+    uint16_t magic;             // LZSS_MAGIC
+    uint8_t  window_bits;       // log2 of the window size
+    uint8_t  lookahead_bits;    // log2 of the longest copy
+    uint32_t payload_size;      // Compressed bytes after this header
+    uint32_t raw_size;          // Decompressed size
+} LzssHeader_t;
+
+typedef struct {
+    uint8_t  window[1 << LZSS_MAX_WINDOW_BITS];
+    uint16_t head;              // Next window position
+    uint16_t distance;          // Pending copy: distance back
+    uint16_t remaining;         // Pending copy: bytes left
+    uint8_t  window_bits;
+    uint8_t  lookahead_bits;
+    uint8_t  state;
+    uint8_t  bit_count;         // Valid bits in the accumulator
+    uint32_t bits;              // Bit accumulator
+} LzssDecoder_t;
+
+// Check the container header fields against the decoder limits
+int lzss_header_valid(const LzssHeader_t* header);
+
+// Reset the decoder for a stream with the given parameters
+int lzss_decoder_init(LzssDecoder_t* decoder, uint8_t window_bits, uint8_t lookahead_bits);
+
+// Decode until the input is used up or the output is full
+size_t lzss_decode(LzssDecoder_t* decoder, const uint8_t* in, size_t in_len, size_t* in_used,
+                   uint8_t* out, size_t out_len);
+
+#endif /* _LZSS_H */
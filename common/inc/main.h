@@ -34,10 +34,24 @@ void Error_Handler(void);
 #define LOADER_ADDR         ((uint32_t)0x08004000U)
 #define UPDATER_ADDR        ((uint32_t)0x08010000U)
 #define APP_ADDR            ((uint32_t)0x08020000U)
+#ifdef AB_SLOTS
+// Two application slots of 384K (sectors 5-7 and 8-10), staging in sector 11
+#define APP_B_ADDR          ((uint32_t)0x08080000U)
+#define APP_SLOT_SIZE       ((uint32_t)0x00060000U)
+#define PATCH_ADDR          ((uint32_t)0x080E0000U)
+#else
 #define BACKUP_ADDR         ((uint32_t)0x08080000U)
 #define PATCH_ADDR          ((uint32_t)0x080C0000U)
+#endif
 #define IMAGE_HDR_SIZE      0x200
 
+// Boot stage hand-off time in DWT cycles, kept in the RTC backup register after the boot counter
+#define BOOT_CYCLES_BKP_REG 5
+#define BOOT_HSI_MHZ        16
+
+// Station session carried over an image hand-off, see command.h
+#define COMMAND_SESSION_BKP_REG 6
+
 
 #ifdef __cplusplus
 }
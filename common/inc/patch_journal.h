@@ -0,0 +1,51 @@
+#ifndef _PATCH_JOURNAL_H
+#define _PATCH_JOURNAL_H
+
+#include "flash.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// Journal lives in the last 4KB of the patch staging area (erased with it)
+#define PATCH_JOURNAL_ADDR          ((uint32_t)0x080FF000U)
+#define PATCH_JOURNAL_SIZE          0x1000
+#define PATCH_JOURNAL_MAGIC         0x4C4E524A  // "JRNL"
+#define PATCH_JOURNAL_MAX_SECTORS   8
+#define PATCH_JOURNAL_NONE          0xFF
+
+// Record types
+typedef enum {
+    PATCH_JOURNAL_BEGIN = 1,    // In-place patch started, value = patch id
+    PATCH_JOURNAL_SAVED = 2,    // Old contents of sector saved to scratch slot
+    PATCH_JOURNAL_DONE  = 3,    // All slot sectors below sector are written
+    PATCH_JOURNAL_END   = 4     // Patch finished or abandoned, value = result
+} PatchJournalType_t;
+
+// One append-only record, programmed once into erased flash
+typedef struct {
+    uint32_t magic;
+    uint8_t  type;
+    uint8_t  sector;
+    uint8_t  slot;
+    uint8_t  reserved;
+    uint32_t value;
+    uint32_t check;             // Integrity word, detects torn records
+} PatchJournalRecord_t;
+
+// State rebuilt from the records of the last session
+typedef struct {
+    int      active;            // BEGIN without a matching END
+    uint32_t patch_id;          // Value of the BEGIN record
+    uint8_t  done;              // Sectors below this one are finished
+    uint8_t  saved_slot[PATCH_JOURNAL_MAX_SECTORS]; // Scratch slot per sector or PATCH_JOURNAL_NONE
+} PatchJournalState_t;
+
+// Rebuild the journal state, returns 1 if an in-place patch is in progress
+int patch_journal_load(PatchJournalState_t* state);
+
+// Check whether an in-place patch is in progress
+int patch_journal_is_active(void);
+
+// Append a record, returns 1 on success
+int patch_journal_append(PatchJournalType_t type, uint8_t sector, uint8_t slot, uint32_t value);
+
+#endif /* _PATCH_JOURNAL_H */
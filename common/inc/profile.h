@@ -0,0 +1,62 @@
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include "stm32f4xx_hal.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Hot-path counters, compiled in with -DENABLE_PROFILING=ON. Timed sections
+ * accumulate DWT cycles and call counts, events only count. Without the option
+ * every macro expands to nothing.
+ */
+
+// Column names of the rows produced by profile_format_row()
+#define PROFILE_REPORT_HEADER   "counter          calls     total_us  avg_cyc  max_cyc\r\n"
+
+typedef enum {
+    PROFILE_XMODEM_BYTE = 0,    // xmodem_process_byte(), includes everything below
+    PROFILE_CRC16,              // XMODEM packet CRC-16
+    PROFILE_GCM_UPDATE,         // mbedtls_gcm_update() of a packet
+    PROFILE_FLASH_WRITE,        // flash_write()
+    PROFILE_FLASH_ERASE,        // flash_erase_sector()
+    PROFILE_RX_OVERFLOW,        // Byte dropped, RX ring buffer full (event)
+    PROFILE_TX_FULL,            // transport send cut short, TX ring buffer full (event)
+    PROFILE_COUNTER_COUNT
+} ProfileCounter_t;
+
+typedef struct {
+    uint32_t calls;
+    uint32_t max_cycles;
+    uint64_t cycles;
+} ProfileStats_t;
+
+#ifdef ENABLE_PROFILING
+
+#define PROFILE_BEGIN(id)   const uint32_t profile_start_##id = DWT->CYCCNT
+#define PROFILE_END(id)     profile_record((id), DWT->CYCCNT - profile_start_##id)
+#define PROFILE_EVENT(id)   profile_record((id), 0)
+#define PROFILE_RESET()     profile_reset()
+
+#else
+
+#define PROFILE_BEGIN(id)   do { } while (0)
+#define PROFILE_END(id)     do { } while (0)
+#define PROFILE_EVENT(id)   do { } while (0)
+#define PROFILE_RESET()     do { } while (0)
+
+#endif /* ENABLE_PROFILING */
+
+// Clear all counters and make sure the cycle counter runs
+void profile_reset(void);
+
+// Add one call of the given duration to a counter
+void profile_record(ProfileCounter_t id, uint32_t cycles);
+
+// Read a counter
+const ProfileStats_t* profile_get(ProfileCounter_t id);
+
+// Format one report row, returns its length or 0 past the last counter
+size_t profile_format_row(uint32_t index, char* buffer, size_t size);
+
+#endif /* _PROFILE_H */
@@ -15,7 +15,9 @@ void SVC_Handler(void);
 void DebugMon_Handler(void);
 void PendSV_Handler(void);
 void SysTick_Handler(void);
+void USART1_IRQHandler(void);
 void USART2_IRQHandler(void);
+void USART6_IRQHandler(void);
 
 #ifdef __cplusplus
 }
@@ -7,6 +7,27 @@
 #include "ring_buffer.h"
 #include <string.h>
 
+// Ports with their own state and buffers, one for the update path by default
+#ifndef UART_TRANSPORT_MAX_PORTS
+#define UART_TRANSPORT_MAX_PORTS 1
+#endif
+
+// USART the Loader and Updater take images on: USART2 (PA2/PA3) on the ST-LINK VCP,
+// or USART1 (PA9/PA10) or USART6 (PC6/PC7) on APB2 for twice the top line rate.
+// Their menus are served on the same port, USART2 is then left to the application
+#ifndef UPDATE_USART
+#define UPDATE_USART USART2
+#endif
+
+// RX ring buffer fill at which RTS is deasserted, with room left for the bytes a USB
+// adapter still sends after it sees RTS go, and the fill at which it is asserted again
+#ifndef UART_TRANSPORT_RTS_HIGH_WATER
+#define UART_TRANSPORT_RTS_HIGH_WATER (RING_BUFFER_SIZE - 256)
+#endif
+#ifndef UART_TRANSPORT_RTS_LOW_WATER
+#define UART_TRANSPORT_RTS_LOW_WATER (RING_BUFFER_SIZE / 2)
+#endif
+
 // UART transport configuration
 typedef struct {
     USART_TypeDef* usart;
@@ -17,13 +38,41 @@ typedef struct {
     uint32_t updater_addr;
     uint32_t loader_addr;
     uint32_t image_hdr_size;
+    GPIO_TypeDef* gpio;         // TX and RX pins, NULL for the instance's default ones
+    uint32_t tx_pin;
+    uint32_t rx_pin;
+    uint32_t alternate;
+    uint8_t flow_control;       // RTS/CTS on the instance's default pins, USART1 and USART2 only
 } UARTTransport_Config_t;
 
+// Receive errors counted since init
+typedef struct {
+    uint32_t overrun;           // Byte lost in the USART before the IRQ read the last one
+    uint32_t noise;
+    uint32_t framing;
+    uint32_t parity;
+    uint32_t dropped;           // Byte lost because the RX ring buffer was full
+} UARTTransport_Errors_t;
+
+void USART1_IRQHandler(void);
 void USART2_IRQHandler(void);
+void USART6_IRQHandler(void);
 
 // Initialize UART transport
 int uart_transport_init(void* config);
 
+// Make an initialized port the one the calls below act on
+int uart_transport_select(USART_TypeDef* usart);
+
+// Line rate the USART generates for baudrate, 0 if it cannot
+uint32_t uart_transport_actual_baudrate(uint32_t baudrate);
+
+// Change the line rate once transmission is finished
+int uart_transport_set_baudrate(uint32_t baudrate);
+
+// Line rate set now
+uint32_t uart_transport_get_baudrate(void);
+
 // Send data via UART
 int uart_transport_send(const uint8_t* data, size_t len);
 
@@ -42,6 +91,9 @@ int uart_transport_process(void);
 // Clear RX buffer
 void uart_transport_clear_rx(void);
 
+// Receive error counters
+void uart_transport_get_errors(UARTTransport_Errors_t* errors);
+
 // Deinitialize UART
 int uart_transport_deinit(void);
 
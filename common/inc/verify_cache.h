@@ -0,0 +1,42 @@
+#ifndef _VERIFY_CACHE_H
+#define _VERIFY_CACHE_H
+
+#include "stm32f4xx_hal.h"
+#include "image.h"
+#include <stdint.h>
+
+// Cache record lives at the start of the 4KB backup SRAM
+#define VERIFY_CACHE_ADDR       BKPSRAM_BASE
+#define VERIFY_CACHE_MAGIC      0x56434331  // "VCC1"
+#define VERIFY_CACHE_ENTRIES    4
+
+// Proof that the image at image_addr matched its header CRC
+typedef struct {
+    uint32_t image_addr;    // Slot base address (header location)
+    uint32_t header_crc;    // CRC of the compact header the proof belongs to
+    uint32_t image_crc;     // Verified image CRC (copy of header.crc)
+    uint32_t data_size;     // Verified image size (copy of header.data_size)
+    uint32_t check;         // Integrity word over the fields above
+} VerifyCacheEntry_t;
+
+typedef struct {
+    uint32_t magic;
+    VerifyCacheEntry_t entries[VERIFY_CACHE_ENTRIES];
+} VerifyCache_t;
+
+// Enable backup SRAM access and format the record if it is not valid
+void verify_cache_init(void);
+
+// Check whether a matching proof exists for the current header at addr
+int verify_cache_lookup(uint32_t addr);
+
+// Record a proof for the current header at addr (caller has verified the CRC)
+void verify_cache_store(uint32_t addr);
+
+// Drop the proof for addr, must be called before a slot is modified
+void verify_cache_invalidate(uint32_t addr);
+
+// Verify image at addr, using the cached proof when possible
+int verify_image_cached(uint32_t addr, uint32_t header_size);
+
+#endif /* _VERIFY_CACHE_H */
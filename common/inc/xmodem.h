@@ -3,6 +3,7 @@
 
 #include "flash.h"
 #include "image.h"
+#include "lzss.h"
 #include "stm32f4xx_hal.h"
 #include <stdint.h>
 #include <stddef.h>
@@ -14,13 +15,26 @@
 #endif
 
 #ifndef PATCH_ADDR
+  #ifdef AB_SLOTS
+    #define PATCH_ADDR          ((uint32_t)0x080E0000U)
+  #else
     #define PATCH_ADDR          ((uint32_t)0x080C0000U)
+  #endif
 #endif
 
 #ifndef APP_ADDR
     #define APP_ADDR            ((uint32_t)0x08020000U)
 #endif
 
+#if defined(AB_SLOTS) && !defined(APP_B_ADDR)
+    #define APP_B_ADDR          ((uint32_t)0x08080000U)
+#endif
+
+// Application area, also the size of each A/B slot
+#ifndef APP_SLOT_SIZE
+    #define APP_SLOT_SIZE       ((uint32_t)0x00060000U)
+#endif
+
 // XMODEM consts
 #define XMODEM_SOH 0x01  // Start of header
 #define XMODEM_EOT 0x04  // End of transmission
@@ -29,6 +43,12 @@
 #define XMODEM_CAN 0x18  // Cancel
 #define XMODEM_C   0x43  // 'C' character
 
+// Decompressed bytes collected before each flash write of a compressed image
+#define XMODEM_UNPACK_SIZE 128
+
+// Largest image header a direct transfer can hold back (IMAGE_HDR_SIZE)
+#define XMODEM_HELD_HEADER_SIZE 0x200
+
 typedef enum {
     XMODEM_STATE_IDLE,
     XMODEM_STATE_SENDING_INITIAL_C,
@@ -53,6 +73,9 @@ typedef enum {
     XMODEM_ERROR_AUTHENTICATION_FAILED
 } XmodemError_t;
 
+// Consumer for received image data, returns 1 on success and 0 to abort the transfer
+typedef int (*XmodemDataSink_t)(void* ctx, const uint8_t* data, size_t len);
+
 typedef struct {
     uint32_t app_addr;
     uint32_t updater_addr;
@@ -89,6 +112,20 @@ typedef struct {
     XmodemConfig_t config;
     uint8_t use_encryption;
     uint8_t is_patch;
+    XmodemDataSink_t data_sink;  // When set, data goes to the sink instead of the staging area
+    void* sink_ctx;
+    uint32_t staging_addr;       // Where full images are received, 0 for PATCH_ADDR
+    uint32_t area_end;           // End of the receive area, writes past it fail
+    uint8_t  hold_header;        // Direct mode: image header is kept in RAM until committed
+    uint16_t held_fill;          // Header bytes held so far
+    uint32_t stored_size;        // Plaintext bytes passed to storage (header included)
+    int8_t   compressed;         // -1 until the header is in, then 1 for a compressed full image
+    LzssHeader_t lz_header;      // Container header of a compressed image
+    uint8_t  lz_fill;            // Container header bytes received
+    uint32_t lz_consumed;        // Compressed payload bytes fed to the decoder
+    uint32_t lz_produced;        // Decompressed bytes
+    uint32_t unpack_size;        // Expected decompressed size (header data_size)
+    size_t   unpack_fill;        // Bytes waiting in the unpack buffer
     
 #ifdef FIRMWARE_ENCRYPTED
     mbedtls_gcm_context aes;
@@ -98,12 +135,28 @@ typedef struct {
     uint8_t gcm_initialized;
     uint32_t remaining_size;
     uint8_t tag_received;
+    uint8_t tag_fill;            // Tag bytes collected from the last packet(s)
 #endif
 } XmodemManager_t;
 
 // Initialize XMODEM manager struct
 void xmodem_init(XmodemManager_t* manager, const XmodemConfig_t* config);
 
+// Route received data to a sink instead of flash (NULL restores staging)
+void xmodem_set_sink(XmodemManager_t* manager, XmodemDataSink_t sink, void* ctx);
+
+// Receive full images at addr instead of the staging area (0 restores staging)
+void xmodem_set_staging(XmodemManager_t* manager, uint32_t addr);
+
+// Receive a full image straight into its slot, holding the header back until committed
+void xmodem_set_direct(XmodemManager_t* manager, uint32_t addr);
+
+// Header held by a direct transfer, NULL if there is none
+const ImageHeader_t* xmodem_get_held_header(XmodemManager_t* manager);
+
+// Write the held header once the image has been verified
+int xmodem_commit_header(XmodemManager_t* manager);
+
 // Start XMODEM transfer
 void xmodem_start(XmodemManager_t* manager, uint32_t addr);
 
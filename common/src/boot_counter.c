@@ -0,0 +1,174 @@
+#include "boot_counter.h"
+#include "image.h"
+#include <string.h>
+
+/* Private functions ---------------------------------------------------------*/
+static volatile uint32_t* boot_counter_regs(void);
+static uint32_t boot_counter_check_word(const BootCounter_t* counter);
+static int boot_counter_is_image(const BootCounter_t* counter, uint32_t addr, uint32_t crc);
+
+
+/**
+ * @brief  Returns the RTC backup registers with write access enabled.
+ * @return Pointer to RTC_BKP0R.
+ * @note   Access is re-enabled on every call because prepare_for_boot() resets the
+ *         PWR block (clearing DBP) before each hand-off.
+ */
+static volatile uint32_t* boot_counter_regs(void) {
+    __HAL_RCC_PWR_CLK_ENABLE();
+    HAL_PWR_EnableBkUpAccess();
+
+    return &RTC->BKP0R;
+}
+
+/**
+ * @brief  Computes the integrity word of the counter.
+ * @param  counter: [in] Counter contents.
+ * @return Integrity word.
+ * @note   Guards against random register contents after a backup domain reset.
+ */
+static uint32_t boot_counter_check_word(const BootCounter_t* counter) {
+    return ~(counter->image_addr ^ counter->image_crc ^ counter->attempts ^ BOOT_COUNTER_MAGIC);
+}
+
+/**
+ * @brief  Checks whether the counter belongs to a given image.
+ * @param  counter: [in] Counter contents.
+ * @param  addr: [in] Slot address of the image.
+ * @param  crc: [in] Image CRC from its header.
+ * @return 1 if the counter tracks this image, 0 otherwise.
+ */
+static int boot_counter_is_image(const BootCounter_t* counter, uint32_t addr, uint32_t crc) {
+    return counter->image_addr == addr && counter->image_crc == crc;
+}
+
+/**
+ * @brief  Decides how the loader treats an image.
+ * @param  counter: [in] Stored counter (cleared if none was stored).
+ * @param  addr: [in] Slot address of the image about to be booted.
+ * @param  crc: [in] Image CRC from its header.
+ * @param  max_attempts: [in] Unconfirmed boots allowed before rolling back.
+ * @return BOOT_COUNTER_BOOT, BOOT_COUNTER_TRY or BOOT_COUNTER_ROLLBACK.
+ * @note   Pure function of its arguments, the counter for another image means the
+ *         image is new and starts its trial.
+ */
+BootCounterDecision_t boot_counter_decide(const BootCounter_t* counter, uint32_t addr, uint32_t crc,
+                                          uint32_t max_attempts) {
+    if (!boot_counter_is_image(counter, addr, crc)) {
+        return BOOT_COUNTER_TRY;
+    }
+
+    if (counter->attempts & BOOT_COUNTER_CONFIRMED) {
+        return BOOT_COUNTER_BOOT;
+    }
+
+    return counter->attempts >= max_attempts ? BOOT_COUNTER_ROLLBACK : BOOT_COUNTER_TRY;
+}
+
+/**
+ * @brief  Counts one boot of an image.
+ * @param  counter: [in,out] Counter to update.
+ * @param  addr: [in] Slot address of the image being booted.
+ * @param  crc: [in] Image CRC from its header.
+ * @note   Pure function of its arguments. A confirmed image is not counted again.
+ */
+void boot_counter_advance(BootCounter_t* counter, uint32_t addr, uint32_t crc) {
+    if (!boot_counter_is_image(counter, addr, crc)) {
+        counter->image_addr = addr;
+        counter->image_crc = crc;
+        counter->attempts = 1;
+        return;
+    }
+
+    if (!(counter->attempts & BOOT_COUNTER_CONFIRMED)) {
+        counter->attempts++;
+    }
+}
+
+/**
+ * @brief  Reads the counter from the RTC backup registers.
+ * @param  counter: [out] Stored counter, cleared if the registers hold none.
+ * @return 1 if a valid counter was stored, 0 otherwise.
+ */
+int boot_counter_load(BootCounter_t* counter) {
+    volatile uint32_t* regs = boot_counter_regs();
+
+    counter->image_addr = regs[BOOT_COUNTER_REG_ADDR];
+    counter->image_crc = regs[BOOT_COUNTER_REG_CRC];
+    counter->attempts = regs[BOOT_COUNTER_REG_ATTEMPTS];
+
+    if (regs[BOOT_COUNTER_REG_MAGIC] != BOOT_COUNTER_MAGIC ||
+        regs[BOOT_COUNTER_REG_CHECK] != boot_counter_check_word(counter)) {
+        memset(counter, 0, sizeof(BootCounter_t));
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief  Writes the counter to the RTC backup registers.
+ * @param  counter: [in] Counter to store.
+ * @note   The check word is written last, a reset in between leaves an invalid
+ *         counter, which restarts the trial instead of skipping it.
+ */
+void boot_counter_save(const BootCounter_t* counter) {
+    volatile uint32_t* regs = boot_counter_regs();
+
+    regs[BOOT_COUNTER_REG_CHECK] = 0;
+    regs[BOOT_COUNTER_REG_MAGIC] = BOOT_COUNTER_MAGIC;
+    regs[BOOT_COUNTER_REG_ADDR] = counter->image_addr;
+    regs[BOOT_COUNTER_REG_CRC] = counter->image_crc;
+    regs[BOOT_COUNTER_REG_ATTEMPTS] = counter->attempts;
+    regs[BOOT_COUNTER_REG_CHECK] = boot_counter_check_word(counter);
+}
+
+/**
+ * @brief  Forgets the image under trial.
+ */
+void boot_counter_clear(void) {
+    volatile uint32_t* regs = boot_counter_regs();
+
+    regs[BOOT_COUNTER_REG_MAGIC] = 0;
+    regs[BOOT_COUNTER_REG_CHECK] = 0;
+}
+
+/**
+ * @brief  Decides how to treat the image at a slot using the stored counter.
+ * @param  addr: [in] Slot address of the image about to be booted.
+ * @param  max_attempts: [in] Unconfirmed boots allowed before rolling back.
+ * @return Decision from boot_counter_decide().
+ */
+BootCounterDecision_t boot_counter_check(uint32_t addr, uint32_t max_attempts) {
+    BootCounter_t counter;
+    boot_counter_load(&counter);
+
+    return boot_counter_decide(&counter, addr, ((const ImageHeader_t*)addr)->crc, max_attempts);
+}
+
+/**
+ * @brief  Counts a boot of the image at a slot.
+ * @param  addr: [in] Slot address of the image about to be booted.
+ * @note   Called by the loader right before it jumps to the application.
+ */
+void boot_counter_record_boot(uint32_t addr) {
+    BootCounter_t counter;
+    boot_counter_load(&counter);
+
+    boot_counter_advance(&counter, addr, ((const ImageHeader_t*)addr)->crc);
+    boot_counter_save(&counter);
+}
+
+/**
+ * @brief  Marks the running image as healthy.
+ * @note   Called by the application once it is up. A confirmed image is booted without
+ *         counting until a different image is installed.
+ */
+void boot_counter_confirm(void) {
+    BootCounter_t counter;
+
+    if (boot_counter_load(&counter) && !(counter.attempts & BOOT_COUNTER_CONFIRMED)) {
+        counter.attempts |= BOOT_COUNTER_CONFIRMED;
+        boot_counter_save(&counter);
+    }
+}
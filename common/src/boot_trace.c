@@ -0,0 +1,140 @@
+#include "boot_trace.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char* const BOOT_TRACE_NAMES[BOOT_TRACE_POINT_COUNT] = {
+    "boot_start",
+    "boot_handoff",
+    "loader_start",
+    "loader_clock",
+    "loader_menu",
+    "loader_exit",
+    "prepare_start",
+    "prepare_done",
+    "updater_start",
+    "updater_clock",
+    "updater_ready",
+    "app_start",
+    "app_clock",
+    "app_ready"
+};
+
+/* Private functions ---------------------------------------------------------*/
+static BootTrace_t* boot_trace_get(void);
+static uint16_t boot_trace_clock_mhz(void);
+
+
+/**
+ * @brief  Returns the trace record in CCM RAM with its clock enabled.
+ * @return Pointer to the trace record.
+ * @note   CCM RAM is clocked after reset, the enable only guards against an image
+ *         that turned it off before the hand-off.
+ */
+static BootTrace_t* boot_trace_get(void) {
+    RCC->AHB1ENR |= RCC_AHB1ENR_CCMDATARAMEN;
+
+    return (BootTrace_t*)BOOT_TRACE_ADDR;
+}
+
+/**
+ * @brief  Returns the current core clock in MHz.
+ * @return Core clock in MHz.
+ * @note   prepare_for_boot() switches back to HSI without updating SystemCoreClock,
+ *         so the clock switch status is checked first.
+ */
+static uint16_t boot_trace_clock_mhz(void) {
+    if ((RCC->CFGR & RCC_CFGR_SWS) == RCC_CFGR_SWS_HSI) {
+        return (uint16_t)(HSI_VALUE / 1000000U);
+    }
+
+    return (uint16_t)(SystemCoreClock / 1000000U);
+}
+
+/**
+ * @brief  Starts a new trace.
+ * @note   Called by the boot stage only, right after SystemInit() zeroed the cycle counter.
+ */
+void boot_trace_reset(void) {
+    BootTrace_t* trace = boot_trace_get();
+
+    memset(trace, 0, sizeof(BootTrace_t));
+    trace->magic = BOOT_TRACE_MAGIC;
+}
+
+/**
+ * @brief  Records the cycle counter at a checkpoint.
+ * @param  point: [in] Checkpoint reached.
+ * @note   Checkpoints past BOOT_TRACE_ENTRIES are dropped. The counter wraps after
+ *         about 25 s at 168 MHz, which is more than the loader's autoboot window.
+ */
+void boot_trace_mark(BootTracePoint_t point) {
+    BootTrace_t* trace = boot_trace_get();
+
+    if (trace->magic != BOOT_TRACE_MAGIC || trace->count >= BOOT_TRACE_ENTRIES) {
+        return;
+    }
+
+    BootTraceEntry_t* entry = &trace->entries[trace->count];
+    entry->cycles = DWT->CYCCNT;
+    entry->point = (uint8_t)point;
+    entry->reserved = 0;
+    entry->clock_mhz = boot_trace_clock_mhz();
+    trace->count++;
+}
+
+/**
+ * @brief  Returns the number of recorded checkpoints.
+ * @return Checkpoint count, 0 if the trace is not valid.
+ */
+uint32_t boot_trace_count(void) {
+    BootTrace_t* trace = boot_trace_get();
+
+    if (trace->magic != BOOT_TRACE_MAGIC || trace->count > BOOT_TRACE_ENTRIES) {
+        return 0;
+    }
+
+    return trace->count;
+}
+
+/**
+ * @brief  Formats one checkpoint as a CSV row (see BOOT_TRACE_CSV_HEADER).
+ * @param  index: [in] Checkpoint index.
+ * @param  buffer: [out] Output buffer.
+ * @param  size: [in] Output buffer size.
+ * @return Row length, 0 if index is past the last checkpoint.
+ * @note   Each interval is converted with the clock of the checkpoint that starts it,
+ *         so a checkpoint is placed right after every clock switch.
+ */
+size_t boot_trace_format_row(uint32_t index, char* buffer, size_t size) {
+    BootTrace_t* trace = boot_trace_get();
+
+    if (index >= boot_trace_count()) {
+        return 0;
+    }
+
+    uint32_t total_us = 0;
+    uint32_t delta_us = 0;
+    for (uint32_t i = 0; i <= index; i++) {
+        const BootTraceEntry_t* entry = &trace->entries[i];
+
+        if (i == 0) {
+            // From reset, the boot stage runs on HSI
+            delta_us = entry->cycles / (HSI_VALUE / 1000000U);
+        } else {
+            const BootTraceEntry_t* prev = &trace->entries[i - 1];
+            delta_us = (entry->cycles - prev->cycles) / (prev->clock_mhz ? prev->clock_mhz : 1);
+        }
+        total_us += delta_us;
+    }
+
+    const BootTraceEntry_t* entry = &trace->entries[index];
+    const char* name = entry->point < BOOT_TRACE_POINT_COUNT ? BOOT_TRACE_NAMES[entry->point] : "unknown";
+
+    int len = snprintf(buffer, size, "%s,%lu,%u,%lu,%lu\r\n", name, (unsigned long)entry->cycles,
+                       (unsigned)entry->clock_mhz, (unsigned long)delta_us, (unsigned long)total_us);
+    if (len < 0) {
+        return 0;
+    }
+
+    return (size_t)len < size ? (size_t)len : size - 1;
+}
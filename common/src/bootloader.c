@@ -1,4 +1,5 @@
 #include "bootloader.h"
+#include "boot_trace.h"
 
 
 /**
@@ -7,6 +8,7 @@
  * @param  config: [in] Pointer to BootConfig_t structure containing valid image base addresses.
  * @return 1 if the image has a valid magic number for the corresponding type, 0 otherwise.
  * @note   This function checks the image magic field against predefined values for app, updater, or loader.
+ * @note   Both application slots take the application magic.
  * @note   Returns 0 if the address does not match any known image base addresses.
  */
 int is_firmware_valid(uint32_t addr, const BootConfig_t* config) {
@@ -15,7 +17,7 @@ int is_firmware_valid(uint32_t addr, const BootConfig_t* config) {
     memcpy(&header, (void*)addr, sizeof(ImageHeader_t));
     
     // Check if the magic number matches
-    if (addr == config->app_addr) {
+    if (addr == config->app_addr || (config->app_b_addr != 0 && addr == config->app_b_addr)) {
         return header.image_magic == IMAGE_MAGIC_APP;
     } else if (addr == config->updater_addr) {
         return header.image_magic == IMAGE_MAGIC_UPDATER;
@@ -27,6 +29,68 @@ int is_firmware_valid(uint32_t addr, const BootConfig_t* config) {
 }
 
 
+/**
+ * @brief  Validates the header and the integrity of a firmware image.
+ * @param  addr: [in] Start address of the firmware image in flash memory.
+ * @param  config: [in] Pointer to BootConfig_t structure containing valid image base addresses.
+ * @return 1 if the magic is valid and the image CRC matches, 0 otherwise.
+ * @note   The full CRC is only calculated when no proof for the current header is cached.
+ */
+int is_firmware_verified(uint32_t addr, const BootConfig_t* config) {
+    if (!is_firmware_valid(addr, config)) {
+        return 0;
+    }
+
+    return verify_image_cached(addr, config->image_hdr_size);
+}
+
+
+/**
+ * @brief  Checks that an application slot holds an image that can run from it.
+ * @param  addr: [in] Start address of the application slot.
+ * @param  config: [in] Pointer to BootConfig_t structure containing valid image base addresses.
+ * @return 1 if the image is verified and linked for this slot, 0 otherwise.
+ */
+static int is_app_slot_bootable(uint32_t addr, const BootConfig_t* config) {
+    if (!is_firmware_verified(addr, config)) {
+        return 0;
+    }
+
+    // An image linked for the other slot would jump into it
+    const ImageHeader_t* header = (const ImageHeader_t*)addr;
+    return header->vector_addr == addr + config->image_hdr_size;
+}
+
+
+/**
+ * @brief  Selects the application slot to boot.
+ * @param  config: [in] Pointer to BootConfig_t structure containing valid image base addresses.
+ * @return Address of the slot to boot, 0 if no slot holds a bootable image.
+ * @note   With two slots the verified image with the higher version wins, a slot that
+ *         fails its CRC is skipped, so an update only takes over once it is complete.
+ *         On equal versions the first slot is used.
+ */
+uint32_t select_app_slot(const BootConfig_t* config) {
+    if (config->app_b_addr == 0) {
+        return is_firmware_verified(config->app_addr, config) ? config->app_addr : 0;
+    }
+
+    int a_ok = is_app_slot_bootable(config->app_addr, config);
+    int b_ok = is_app_slot_bootable(config->app_b_addr, config);
+
+    if (a_ok && b_ok) {
+        return is_newer_version((const ImageHeader_t*)config->app_b_addr,
+                                (const ImageHeader_t*)config->app_addr) ? config->app_b_addr : config->app_addr;
+    } else if (a_ok) {
+        return config->app_addr;
+    } else if (b_ok) {
+        return config->app_b_addr;
+    }
+
+    return 0;
+}
+
+
 /**
  * @brief  Resets all peripheral buses to their default state.
  * @note   This function deinitializes peripherals by writing to the reset registers of APB1, APB2, AHB1, AHB2, and AHB3.
@@ -101,9 +165,13 @@ static void reset_system_clock(void) {
  *         remaps memory, clears pending exceptions, and sets the vector table to the new image.
  */
 void prepare_for_boot(uint32_t addr, uint32_t header_size) {
+    boot_trace_mark(BOOT_TRACE_PREPARE_START);
+
     // Reset clock and peripherals
     reset_system_clock();
     deinit_peripherals();
+
+    boot_trace_mark(BOOT_TRACE_PREPARE_DONE);
     
     // Memory remap
     RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
@@ -127,18 +195,20 @@ void prepare_for_boot(uint32_t addr, uint32_t header_size) {
 /**
  * @brief  Boots the application firmware image.
  * @param  config: [in] Pointer to BootConfig_t containing image addresses and header size.
- * @note   Validates image, prepares system state, sets MSP, and jumps to the application's reset handler.
+ * @note   Verifies image, prepares system state, sets MSP, and jumps to the application's reset handler.
  * @note   Interrupts are disabled before jumping; no return from this function is expected.
+ * @note   With two application slots the one picked by select_app_slot() is booted.
  */
 void boot_application(const BootConfig_t* config) {
-    if (!is_firmware_valid(config->app_addr, config)) {
+    uint32_t app_addr = select_app_slot(config);
+    if (app_addr == 0) {
         return; // don't boot
     }
     
-    prepare_for_boot(config->app_addr, config->image_hdr_size);
+    prepare_for_boot(app_addr, config->image_hdr_size);
     
     // Read SP and reset vector from vector table
-    uint32_t app_vector_table = config->app_addr + config->image_hdr_size;
+    uint32_t app_vector_table = app_addr + config->image_hdr_size;
     uint32_t sp = *((uint32_t*)app_vector_table);
     uint32_t reset_handler = *((uint32_t*)(app_vector_table + 4));
     
@@ -158,10 +228,10 @@ void boot_application(const BootConfig_t* config) {
 /**
  * @brief  Boots the firmware updater image.
  * @param  config: [in] Pointer to BootConfig_t containing image addresses and header size.
- * @note   Validates updater image, prepares system, disables interrupts, sets MSP, and jumps to the updater.
+ * @note   Verifies updater image, prepares system, disables interrupts, sets MSP, and jumps to the updater.
  */
 void boot_updater(const BootConfig_t* config) {
-    if (!is_firmware_valid(config->updater_addr, config)) {
+    if (!is_firmware_verified(config->updater_addr, config)) {
         return; // Invalid updater - don't boot
     }
     
@@ -187,10 +257,10 @@ void boot_updater(const BootConfig_t* config) {
 /**
  * @brief  Boots the bootloader image.
  * @param  config: [in] Pointer to BootConfig_t containing image addresses and header size.
- * @note   Validates loader image, resets system, disables interrupts, sets MSP, and jumps to loader code.
+ * @note   Verifies loader image, resets system, disables interrupts, sets MSP, and jumps to loader code.
  */
 void boot_loader(const BootConfig_t* config) {
-    if (!is_firmware_valid(config->loader_addr, config)) {
+    if (!is_firmware_verified(config->loader_addr, config)) {
         return; // don't boot
     }
     
@@ -230,6 +300,8 @@ int get_firmware_header(uint32_t addr, const BootConfig_t* config, ImageHeader_t
     // Validate
     if (addr == config->app_addr && header->image_magic == IMAGE_MAGIC_APP) {
         return 1;
+    } else if (config->app_b_addr != 0 && addr == config->app_b_addr && header->image_magic == IMAGE_MAGIC_APP) {
+        return 1;
     } else if (addr == config->updater_addr && header->image_magic == IMAGE_MAGIC_UPDATER) {
         return 1;
     } else if (addr == config->loader_addr && header->image_magic == IMAGE_MAGIC_LOADER) {
@@ -0,0 +1,340 @@
+#include "command.h"
+#include "main.h"
+#include "image.h"
+#include "crc.h"
+#include <string.h>
+
+/* Private typedef -----------------------------------------------------------*/
+typedef enum {
+    COMMAND_STATE_SOF,
+    COMMAND_STATE_HEADER,       // Command and length
+    COMMAND_STATE_BODY          // Payload and CRC
+} CommandState_t;
+
+/* Private functions ---------------------------------------------------------*/
+static uint16_t command_crc16(uint16_t crc, const uint8_t* data, size_t len);
+static volatile uint32_t* command_session_reg(void);
+
+
+/**
+ * @brief  Updates a CRC-16/XMODEM, the CRC of the XMODEM packets.
+ * @param  crc: [in] CRC so far, 0 to start.
+ * @param  data: [in] Pointer to the data.
+ * @param  len: [in] Number of bytes.
+ * @return Updated CRC.
+ */
+static uint16_t command_crc16(uint16_t crc, const uint8_t* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (uint8_t j = 0; j < 8; j++) {
+            if (crc & 0x8000) {
+                crc = (crc << 1) ^ 0x1021;
+            } else {
+                crc <<= 1;
+            }
+        }
+    }
+
+    return crc;
+}
+
+/**
+ * @brief  Returns the hand-off backup register with write access enabled.
+ * @return Pointer to the register.
+ * @note   Access is re-enabled on every call, prepare_for_boot() resets the PWR block.
+ */
+static volatile uint32_t* command_session_reg(void) {
+    __HAL_RCC_PWR_CLK_ENABLE();
+    HAL_PWR_EnableBkUpAccess();
+
+    return &(&RTC->BKP0R)[COMMAND_SESSION_BKP_REG];
+}
+
+/**
+ * @brief  Resets the parser to wait for a start of frame.
+ * @param  parser: [out] Parser state.
+ */
+void command_parser_init(CommandParser_t* parser) {
+    parser->state = COMMAND_STATE_SOF;
+    parser->fill = 0;
+    parser->length = 0;
+    parser->last_byte_time = 0;
+}
+
+/**
+ * @brief  Feeds one received byte to the frame parser.
+ * @param  parser: [in,out] Parser state.
+ * @param  byte: [in] Received byte.
+ * @param  now: [in] Current time in ms.
+ * @param  frame: [out] Command, length and payload once a frame is complete.
+ * @return COMMAND_PARSE_IDLE if the byte is not part of a frame (a menu key),
+ *         COMMAND_PARSE_BUSY, COMMAND_PARSE_FRAME or COMMAND_PARSE_ERROR.
+ * @note   A frame that stalls for COMMAND_BYTE_TIMEOUT_MS is dropped, so a lost byte
+ *         never leaves the menu keys swallowed.
+ */
+CommandParse_t command_parse_byte(CommandParser_t* parser, uint8_t byte, uint32_t now, CommandFrame_t* frame) {
+    if (parser->state != COMMAND_STATE_SOF && now - parser->last_byte_time > COMMAND_BYTE_TIMEOUT_MS) {
+        command_parser_init(parser);
+    }
+    parser->last_byte_time = now;
+
+    if (parser->state == COMMAND_STATE_SOF) {
+        if (byte != COMMAND_SOF) {
+            return COMMAND_PARSE_IDLE;
+        }
+        parser->state = COMMAND_STATE_HEADER;
+        parser->fill = 0;
+        return COMMAND_PARSE_BUSY;
+    }
+
+    parser->frame[parser->fill++] = byte;
+
+    if (parser->state == COMMAND_STATE_HEADER) {
+        if (parser->fill < 3) {
+            return COMMAND_PARSE_BUSY;
+        }
+        parser->length = (uint16_t)(parser->frame[1] | (parser->frame[2] << 8));
+        if (parser->length > COMMAND_MAX_PAYLOAD) {
+            command_parser_init(parser);
+            return COMMAND_PARSE_ERROR;
+        }
+        parser->state = COMMAND_STATE_BODY;
+        return COMMAND_PARSE_BUSY;
+    }
+
+    // Command, length, payload and CRC
+    if (parser->fill < 3 + parser->length + 2) {
+        return COMMAND_PARSE_BUSY;
+    }
+
+    uint16_t received_crc = (uint16_t)(parser->frame[parser->fill - 2] | (parser->frame[parser->fill - 1] << 8));
+    uint16_t calculated_crc = command_crc16(0, parser->frame, 3 + parser->length);
+    parser->state = COMMAND_STATE_SOF;
+    if (received_crc != calculated_crc) {
+        return COMMAND_PARSE_ERROR;
+    }
+
+    frame->id = parser->frame[0];
+    frame->length = parser->length;
+    frame->payload = &parser->frame[3];
+    return COMMAND_PARSE_FRAME;
+}
+
+/**
+ * @brief  Builds a frame.
+ * @param  out: [out] Frame buffer of COMMAND_MAX_FRAME bytes.
+ * @param  id: [in] Command byte.
+ * @param  payload: [in] Payload, may be NULL when len is 0.
+ * @param  len: [in] Payload length, at most COMMAND_MAX_PAYLOAD.
+ * @return Frame size in bytes, 0 if the payload is too long.
+ */
+size_t command_encode(uint8_t* out, uint8_t id, const void* payload, uint16_t len) {
+    if (len > COMMAND_MAX_PAYLOAD) {
+        return 0;
+    }
+
+    out[0] = COMMAND_SOF;
+    out[1] = id;
+    out[2] = (uint8_t)len;
+    out[3] = (uint8_t)(len >> 8);
+    if (len > 0) {
+        memcpy(&out[4], payload, len);
+    }
+
+    uint16_t crc = command_crc16(0, &out[1], 3 + len);
+    out[4 + len] = (uint8_t)crc;
+    out[5 + len] = (uint8_t)(crc >> 8);
+
+    return COMMAND_FRAME_OVERHEAD + len;
+}
+
+/**
+ * @brief  Builds the reply to a command.
+ * @param  out: [out] Frame buffer of COMMAND_MAX_FRAME bytes.
+ * @param  id: [in] Command being answered.
+ * @param  status: [in] CommandStatus_t, first payload byte.
+ * @param  data: [in] Reply data after the status, may be NULL when len is 0.
+ * @param  len: [in] Data length, at most COMMAND_MAX_PAYLOAD - 1.
+ * @return Frame size in bytes, 0 if the data is too long.
+ */
+size_t command_build_reply(uint8_t* out, uint8_t id, uint8_t status, const void* data, uint16_t len) {
+    uint8_t payload[COMMAND_MAX_PAYLOAD];
+
+    if (len >= COMMAND_MAX_PAYLOAD) {
+        return 0;
+    }
+
+    payload[0] = status;
+    if (len > 0) {
+        memcpy(&payload[1], data, len);
+    }
+
+    return command_encode(out, id | COMMAND_REPLY, payload, len + 1);
+}
+
+/**
+ * @brief  Resolves a target to the slot it names.
+ * @param  target: [in] CommandTarget_t.
+ * @param  config: [in] Boot configuration.
+ * @return Slot address, the slot the loader boots for COMMAND_TARGET_APP
+ *         (the first one if none is bootable), 0 for any other target.
+ */
+uint32_t command_target_addr(uint8_t target, const BootConfig_t* config) {
+    switch (target) {
+        case COMMAND_TARGET_LOADER:
+            return config->loader_addr;
+        case COMMAND_TARGET_UPDATER:
+            return config->updater_addr;
+        case COMMAND_TARGET_APP: {
+            uint32_t app_slot = select_app_slot(config);
+            return app_slot != 0 ? app_slot : config->app_addr;
+        }
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief  Describes the image in a slot.
+ * @param  addr: [in] Slot address.
+ * @param  config: [in] Boot configuration.
+ * @param  info: [out] Image entry, only address and type are set without a valid header.
+ * @return 1 if the slot has a valid header, 0 otherwise.
+ */
+int command_image_info(uint32_t addr, const BootConfig_t* config, CommandImageInfo_t* info) {
+    ImageHeader_t header;
+
+    memset(info, 0, sizeof(*info));
+    info->addr = addr;
+    if (addr == config->loader_addr) {
+        info->image_type = IMAGE_TYPE_LOADER;
+    } else if (addr == config->updater_addr) {
+        info->image_type = IMAGE_TYPE_UPDATER;
+    } else {
+        info->image_type = IMAGE_TYPE_APP;
+    }
+
+    if (!get_firmware_header(addr, config, &header)) {
+        return 0;
+    }
+
+    info->flags = COMMAND_INFO_VALID;
+    info->version_major = header.version_major;
+    info->version_minor = header.version_minor;
+    info->version_patch = header.version_patch;
+    info->data_size = header.data_size;
+    info->crc = header.crc;
+    return 1;
+}
+
+/**
+ * @brief  Fills the GET_INFO reply data.
+ * @param  out: [out] Buffer for up to four CommandImageInfo_t entries.
+ * @param  config: [in] Boot configuration.
+ * @return Data length, one entry each for the loader, the updater and every application slot.
+ */
+uint16_t command_build_info(uint8_t* out, const BootConfig_t* config) {
+    uint32_t slots[4] = { config->loader_addr, config->updater_addr, config->app_addr, config->app_b_addr };
+    uint32_t boot_slot = select_app_slot(config);
+    uint16_t len = 0;
+
+    for (uint32_t i = 0; i < 4 && slots[i] != 0; i++) {
+        CommandImageInfo_t info;
+        command_image_info(slots[i], config, &info);
+        if (boot_slot != 0 && slots[i] == boot_slot) {
+            info.flags |= COMMAND_INFO_BOOT;
+        }
+        memcpy(&out[len], &info, sizeof(info));
+        len += sizeof(info);
+    }
+
+    return len;
+}
+
+/**
+ * @brief  Answers the commands every image handles the same way.
+ * @param  frame: [in] Received frame.
+ * @param  config: [in] Boot configuration.
+ * @param  self: [in] Header of the running image, for the HELLO reply.
+ * @param  out: [out] Reply frame buffer of COMMAND_MAX_FRAME bytes.
+ * @return Reply size for HELLO, GET_INFO, VERIFY and ECHO, 0 for any other command.
+ * @note   VERIFY reads the whole image, it is not answered from the verified-image cache.
+ */
+size_t command_answer_common(const CommandFrame_t* frame, const BootConfig_t* config,
+                             const ImageHeader_t* self, uint8_t* out) {
+    uint8_t data[COMMAND_MAX_PAYLOAD - 1];
+
+    switch (frame->id) {
+        case COMMAND_HELLO: {
+            CommandHello_t hello = {
+                .protocol_version = COMMAND_PROTOCOL_VERSION,
+                .image_type = self->image_type,
+                .version_major = self->version_major,
+                .version_minor = self->version_minor,
+                .version_patch = self->version_patch,
+                .max_payload = COMMAND_MAX_PAYLOAD
+            };
+            return command_build_reply(out, frame->id, COMMAND_STATUS_OK, &hello, sizeof(hello));
+        }
+
+        case COMMAND_GET_INFO: {
+            uint16_t len = command_build_info(data, config);
+            return command_build_reply(out, frame->id, COMMAND_STATUS_OK, data, len);
+        }
+
+        case COMMAND_VERIFY: {
+            if (frame->length != 1) {
+                return command_build_reply(out, frame->id, COMMAND_STATUS_BAD_LENGTH, NULL, 0);
+            }
+
+            uint32_t addr = command_target_addr(frame->payload[0], config);
+            if (addr == 0) {
+                return command_build_reply(out, frame->id, COMMAND_STATUS_BAD_TARGET, NULL, 0);
+            }
+
+            CommandImageInfo_t info;
+            uint8_t status = COMMAND_STATUS_OK;
+            if (!command_image_info(addr, config, &info) || !verify_firmware_crc(addr, config->image_hdr_size)) {
+                status = COMMAND_STATUS_FAILED;
+            }
+            return command_build_reply(out, frame->id, status, &info, sizeof(info));
+        }
+
+        case COMMAND_ECHO: {
+            if (frame->length >= COMMAND_MAX_PAYLOAD) {
+                return command_build_reply(out, frame->id, COMMAND_STATUS_BAD_LENGTH, NULL, 0);
+            }
+            return command_build_reply(out, frame->id, COMMAND_STATUS_OK, frame->payload, frame->length);
+        }
+
+        default:
+            return 0;
+    }
+}
+
+/**
+ * @brief  Leaves a station session for the image about to be started.
+ * @param  boot_target: [in] CommandTarget_t the loader boots on arrival, COMMAND_TARGET_NONE to stay.
+ */
+void command_session_handoff(uint8_t boot_target) {
+    *command_session_reg() = COMMAND_SESSION_MAGIC | boot_target;
+}
+
+/**
+ * @brief  Takes the session left by the previous image.
+ * @param  boot_target: [out] Boot target of the hand-off.
+ * @return 1 if a station session was handed over, 0 otherwise.
+ * @note   The register is cleared, a later reset starts with the menus again.
+ */
+int command_session_take(uint8_t* boot_target) {
+    volatile uint32_t* reg = command_session_reg();
+    uint32_t value = *reg;
+
+    if ((value & 0xFFFFFF00U) != COMMAND_SESSION_MAGIC) {
+        return 0;
+    }
+
+    *reg = 0;
+    *boot_target = (uint8_t)value;
+    return 1;
+}
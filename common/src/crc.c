@@ -1,5 +1,6 @@
 #include "image.h"
 #include "flash.h"
+#include "verify_cache.h"
 
 
 /**
@@ -109,6 +110,8 @@ int verify_firmware_crc(uint32_t addr, uint32_t header_size) {
 }
 
 int invalidate_firmware(uint32_t addr) {
+    verify_cache_invalidate(addr);
+
     // Simply erase the sector containing the header
     return flash_erase_sector(addr);
 }
\ No newline at end of file
@@ -1,9 +1,66 @@
 #include "delta_update.h"
 #include "uart_transport.h"
+#include "verify_cache.h"
 
-static unsigned char source_buf[DELTA_BUFFER_SIZE];
-static unsigned char target_buf[DELTA_BUFFER_SIZE];
-static unsigned char patch_buf[DELTA_BUFFER_SIZE];
+// Page caches are only touched by the CPU, so they go to CCMRAM
+static unsigned char source_buf[DELTA_SOURCE_PAGES * DELTA_BUFFER_SIZE] DELTA_CCMRAM;
+static unsigned char target_buf[DELTA_TARGET_PAGES * DELTA_BUFFER_SIZE] DELTA_CCMRAM;
+static unsigned char patch_buf[DELTA_PATCH_PAGES * DELTA_BUFFER_SIZE] DELTA_CCMRAM;
+
+static janpatch_stats patch_stats;
+
+// Patch stream fed by a live XMODEM transfer
+typedef struct {
+    XmodemManager_t* xmodem;
+    uint8_t  window[DELTA_STREAM_WINDOW_SIZE];  // Ring with the most recent patch bytes
+    uint32_t head;           // Number of bytes received so far (decompressed)
+    uint32_t base;           // Stream offset of the patch data (after the image header)
+    uint32_t header_size;    // Image header size, the header is never compressed
+    uint32_t last_activity;  // Tick of the last received byte
+    int      complete;       // EOT received
+    int      error;          // 0 or error code
+    int      compressed;     // -1 until the header is in, then IMAGE_FLAG_COMPRESSED state
+    LzssHeader_t lz_header;  // Container header of a compressed patch
+    uint32_t lz_fill;        // Container header bytes received
+    uint32_t lz_consumed;    // Compressed payload bytes fed to the decoder
+} DeltaStream_t;
+
+// Compressed patch in flash, decoded on demand
+typedef struct {
+    const LzssHeader_t* header;
+    const uint8_t* payload;
+    uint32_t in_pos;         // Compressed bytes consumed
+    uint32_t out_pos;        // Decoded bytes produced
+} DeltaLzssStream_t;
+
+// Target slot written by a streamed patch
+typedef struct {
+    uint32_t addr;           // Address of the patched data
+    uint32_t erased_end;     // First address that is not erased yet
+} DeltaTarget_t;
+
+// In-place patch of a slot
+typedef struct {
+    const InplaceAnnotation_t* annotation;
+    uint32_t slot_addr;         // Slot being patched (header address)
+    uint32_t scratch_addr;      // Scratch sectors for old contents still needed
+    uint32_t header_size;
+    uint32_t sector_size;
+    uint8_t  current;           // Slot sector being written, INPLACE_NONE before the first
+    uint8_t  done;              // Sectors below this one are finished
+    uint8_t  saved_slot[INPLACE_MAX_SECTORS];       // Scratch slot holding old sector i
+    uint8_t  slot_owner[INPLACE_SCRATCH_SLOTS];     // Old sector held by scratch slot s
+    int      error;             // 0 or error code
+} InplacePatch_t;
+
+static DeltaStream_t patch_stream;
+static DeltaLzssStream_t patch_lzss;
+static LzssDecoder_t patch_decoder DELTA_CCMRAM;
+static InplacePatch_t inplace_patch;
+
+static void delta_init_ctx(janpatch_ctx* ctx, uint32_t max_file_size);
+static void delta_report_stats(void);
+static int delta_open_patch(sfio_stream_t* stream, uint32_t addr, uint32_t size, uint8_t flags);
 
 /**
  * @brief  Callback function to report the progress of the patching operation.
@@ -28,39 +85,18 @@ static void delta_progress_callback(uint8_t percentage) {
  * @param  patch_addr: [in] Address of the patch.
  * @param  target_addr: [in] Address where the patched firmware will be stored.
  * @param  source_size: [in] Size of the source firmware in bytes.
- * @param  patch_size: [in] Size of the patch in bytes.
+ * @param  patch_size: [in] Size of the patch in bytes (space available for a compressed patch).
+ * @param  patch_flags: [in] IMAGE_FLAG_* bits of the patch header.
  * @return 1 on success, 0 on failure.
  * @note   This function uses the `JANPATCH` library to apply the delta patch.
  */
 int apply_delta_patch(uint32_t source_addr, uint32_t patch_addr, uint32_t target_addr,
-                     uint32_t source_size, uint32_t patch_size) {
+                     uint32_t source_size, uint32_t patch_size, uint8_t patch_flags) {
     char debug[120];
     sprintf(debug, "Source size=%lu bytes, Patch size=%lu bytes\r\n", 
-            source_size, patch_size);
+            (unsigned long)source_size, (unsigned long)patch_size);
     uart_transport_send((const uint8_t*)debug, strlen(debug));
     
-    // Initialize janpatch context
-    janpatch_ctx ctx;
-    
-    ctx.source_buffer.buffer = source_buf;
-    ctx.source_buffer.size = DELTA_BUFFER_SIZE;
-    ctx.source_buffer.current_page = 0xFFFFFFFF;
-    
-    ctx.patch_buffer.buffer = patch_buf;
-    ctx.patch_buffer.size = DELTA_BUFFER_SIZE;
-    ctx.patch_buffer.current_page = 0xFFFFFFFF;
-    
-    ctx.target_buffer.buffer = target_buf;
-    ctx.target_buffer.size = DELTA_BUFFER_SIZE;
-    ctx.target_buffer.current_page = 0xFFFFFFFF;
-    
-    ctx.fread = &sfio_fread;
-    ctx.fwrite = &sfio_fwrite;
-    ctx.fseek = &sfio_fseek;
-    ctx.ftell = NULL;
-    ctx.progress = delta_progress_callback;
-    ctx.max_file_size = source_size + patch_size;
-    
     // Setup source
     sfio_stream_t source;
     source.type = SFIO_STREAM_SLOT;
@@ -70,10 +106,14 @@ int apply_delta_patch(uint32_t source_addr, uint32_t patch_addr, uint32_t target
     
     // Setup patch stream
     sfio_stream_t patch;
-    patch.type = SFIO_STREAM_RAM;
-    patch.offset = 0;
-    patch.size = patch_size;
-    patch.ptr = (uint8_t*)patch_addr;
+    if (!delta_open_patch(&patch, patch_addr, patch_size, patch_flags)) {
+        uart_transport_send((const uint8_t*)"ERROR: Invalid compressed patch\r\n", 33);
+        return 0;
+    }
+    
+    // Initialize janpatch context
+    janpatch_ctx ctx;
+    delta_init_ctx(&ctx, source_size + patch.size);
     
     // Setup target
     sfio_stream_t target;
@@ -84,11 +124,12 @@ int apply_delta_patch(uint32_t source_addr, uint32_t patch_addr, uint32_t target
     
     // Apply patch
     uart_transport_send((const uint8_t*)"Starting janpatch operation...\r\n", 31);
-    int result = janpatch(ctx, &source, &patch, &target);
+    int result = janpatch(&ctx, &source, &patch, &target);
     
     if (result == 0) {
         // Success
         uart_transport_send((const uint8_t*)"Patch operation completed successfully\r\n", 41);
+        delta_report_stats();
         return 1;
     } else {
         // Error
@@ -98,6 +139,148 @@ int apply_delta_patch(uint32_t source_addr, uint32_t patch_addr, uint32_t target
     }
 }
 
+/**
+ * @brief  Prepares a janpatch context with the static page buffers.
+ * @param  ctx: [out] Context to initialize.
+ * @param  max_file_size: [in] Upper bound of source + patch size, used for progress.
+ */
+static void delta_init_ctx(janpatch_ctx* ctx, uint32_t max_file_size) {
+    ctx->source_buffer.buffer = source_buf;
+    ctx->source_buffer.size = DELTA_BUFFER_SIZE;
+    ctx->source_buffer.pages = DELTA_SOURCE_PAGES;
+    
+    ctx->patch_buffer.buffer = patch_buf;
+    ctx->patch_buffer.size = DELTA_BUFFER_SIZE;
+    ctx->patch_buffer.pages = DELTA_PATCH_PAGES;
+    
+    ctx->target_buffer.buffer = target_buf;
+    ctx->target_buffer.size = DELTA_BUFFER_SIZE;
+    ctx->target_buffer.pages = DELTA_TARGET_PAGES;
+    
+    ctx->fread = &sfio_fread;
+    ctx->fwrite = &sfio_fwrite;
+    ctx->fseek = &sfio_fseek;
+    ctx->ftell = NULL;
+    ctx->progress = delta_progress_callback;
+    ctx->max_file_size = max_file_size;
+
+    memset(&patch_stats, 0, sizeof(patch_stats));
+    ctx->stats = &patch_stats;
+}
+
+/**
+ * @brief  Prints the janpatch page cache statistics of the last patch operation.
+ */
+static void delta_report_stats(void) {
+    char debug[120];
+    sprintf(debug, "Page faults: source=%lu, patch=%lu, target=%lu; target flushes=%lu\r\n",
+            (unsigned long)patch_stats.source_faults, (unsigned long)patch_stats.patch_faults,
+            (unsigned long)patch_stats.target_faults, (unsigned long)patch_stats.target_flushes);
+    uart_transport_send((const uint8_t*)debug, strlen(debug));
+}
+
+/**
+ * @brief  Decodes the next bytes of a compressed patch in flash.
+ * @param  lz: [in] Compressed patch stream.
+ * @param  ptr: [out] Destination buffer.
+ * @param  count: [in] Number of bytes requested.
+ * @return Number of bytes decoded, less than count at the end of the patch.
+ */
+static size_t delta_lzss_decode(DeltaLzssStream_t* lz, uint8_t* ptr, size_t count) {
+    size_t produced = 0;
+
+    if (count > lz->header->raw_size - lz->out_pos) {
+        count = lz->header->raw_size - lz->out_pos;
+    }
+
+    while (produced < count) {
+        size_t used;
+        size_t n = lzss_decode(&patch_decoder, lz->payload + lz->in_pos, lz->header->payload_size - lz->in_pos,
+                               &used, ptr + produced, count - produced);
+        lz->in_pos += used;
+        produced += n;
+
+        if (n == 0) {
+            break; // Payload exhausted
+        }
+    }
+
+    lz->out_pos += produced;
+    return produced;
+}
+
+/**
+ * @brief  janpatch read callback for a compressed patch in flash.
+ * @param  ctx: [in] Compressed patch stream.
+ * @param  offset: [in] Offset in the decompressed patch.
+ * @param  ptr: [out] Destination buffer.
+ * @param  count: [in] Number of bytes requested.
+ * @return Number of bytes copied.
+ * @note   janpatch reads the patch page by page and serves its rewinds from the page
+ *         cache, so requests are sequential. Anything else restarts the decoder.
+ */
+static size_t delta_lzss_read(void* ctx, size_t offset, uint8_t* ptr, size_t count) {
+    DeltaLzssStream_t* lz = (DeltaLzssStream_t*)ctx;
+
+    if (offset < lz->out_pos) {
+        lzss_decoder_init(&patch_decoder, lz->header->window_bits, lz->header->lookahead_bits);
+        lz->in_pos = 0;
+        lz->out_pos = 0;
+    }
+
+    while (lz->out_pos < offset) {
+        uint8_t skip[64];
+        size_t n = offset - lz->out_pos;
+        if (n > sizeof(skip)) {
+            n = sizeof(skip);
+        }
+        if (delta_lzss_decode(lz, skip, n) == 0) {
+            return 0;
+        }
+    }
+
+    return delta_lzss_decode(lz, ptr, count);
+}
+
+/**
+ * @brief  Sets up the janpatch patch stream for a patch stored in flash.
+ * @param  stream: [out] Stream to initialize.
+ * @param  addr: [in] Address of the patch data (after the image header).
+ * @param  size: [in] Patch size, or the space available for a compressed patch.
+ * @param  flags: [in] IMAGE_FLAG_* bits of the patch header.
+ * @return 1 on success, 0 if the compressed container is invalid.
+ */
+static int delta_open_patch(sfio_stream_t* stream, uint32_t addr, uint32_t size, uint8_t flags) {
+    stream->offset = 0;
+
+    if (!(flags & IMAGE_FLAG_COMPRESSED)) {
+        stream->type = SFIO_STREAM_RAM;
+        stream->size = size;
+        stream->ptr = (uint8_t*)addr;
+        return 1;
+    }
+
+    const LzssHeader_t* header = (const LzssHeader_t*)addr;
+    if (size < sizeof(LzssHeader_t) || !lzss_header_valid(header) ||
+        header->payload_size > size - sizeof(LzssHeader_t)) {
+        return 0;
+    }
+
+    lzss_decoder_init(&patch_decoder, header->window_bits, header->lookahead_bits);
+    patch_lzss.header = header;
+    patch_lzss.payload = (const uint8_t*)(addr + sizeof(LzssHeader_t));
+    patch_lzss.in_pos = 0;
+    patch_lzss.out_pos = 0;
+
+    stream->type = SFIO_STREAM_CALLBACK;
+    stream->size = header->raw_size;
+    stream->cb.read = delta_lzss_read;
+    stream->cb.write = NULL;
+    stream->cb.ctx = &patch_lzss;
+
+    return 1;
+}
+
 /**
  * @brief  Calculates the CRC of the firmware image.
  * @param  addr: [in] Address of the firmware to calculate CRC for.
@@ -134,7 +317,7 @@ int verify_patched_firmware(uint32_t target_addr, uint32_t header_size) {
     // Compare with header CRC
     char debug[100];
     sprintf(debug, "CRC Verification - Calculated: 0x%08lX, Expected: 0x%08lX\r\n", 
-            calculated_crc, header.crc);
+            (unsigned long)calculated_crc, (unsigned long)header.crc);
     uart_transport_send((const uint8_t*)debug, strlen(debug));
     
     return (calculated_crc == header.crc);
@@ -182,7 +365,7 @@ static int safe_flash_write(uint32_t addr, const uint8_t* data, uint32_t size, c
  */
 static int erase_memory_sectors(uint32_t addr, uint32_t size, const char* description) {
     char debug[120];
-    sprintf(debug, "Erasing %s sectors at 0x%08lX...\r\n", description, addr);
+    sprintf(debug, "Erasing %s sectors at 0x%08lX...\r\n", description, (unsigned long)addr);
     uart_transport_send((const uint8_t*)debug, strlen(debug));
     
     // Erase first sector
@@ -197,7 +380,7 @@ static int erase_memory_sectors(uint32_t addr, uint32_t size, const char* descri
     uint32_t sectors_needed = (size + 0x1FFFF) / 0x20000;
     for (uint32_t i = 1; i < sectors_needed; i++) {
         sprintf(debug, "Erasing additional %s sector at 0x%08lX\r\n", 
-                description, addr + (i * 0x20000));
+                description, (unsigned long)(addr + (i * 0x20000)));
         uart_transport_send((const uint8_t*)debug, strlen(debug));
         
         if (!flash_erase_sector(addr + (i * 0x20000))) {
@@ -235,6 +418,25 @@ static int restore_from_backup(uint32_t target_addr, uint32_t backup_addr, uint3
     return 1;
 }
 
+/**
+ * @brief  Undoes a failed patch.
+ * @param  target_addr: [in] Address of the patched firmware.
+ * @param  backup_addr: [in] Address of the backup.
+ * @param  size: [in] Size of the backup including header.
+ * @param  use_backup: [in] 1 if the target was patched over the source and must be restored.
+ * @note   A target in another slot is only invalidated, the source slot was never touched.
+ */
+static void recover_target(uint32_t target_addr, uint32_t backup_addr, uint32_t size, int use_backup) {
+    if (!use_backup) {
+        invalidate_firmware(target_addr);
+        return;
+    }
+
+    if (!restore_from_backup(target_addr, backup_addr, size)) {
+        uart_transport_send((const uint8_t*)"ERROR: Failed to restore from backup\r\n", 38);
+    }
+}
+
 /**
  * @brief  Handles the full firmware patching, including backup, patch application and verification.
  * @param  source_addr: [in] Address of the source firmware.
@@ -244,6 +446,8 @@ static int restore_from_backup(uint32_t target_addr, uint32_t backup_addr, uint3
  * @param  header_size: [in] Size of the header for the firmware images.
  * @return 0 on success, error code on failure.
  * @note   This function handles the entire firmware patching flow including error handling and restoration.
+ * @note   When the target is another slot (A/B layout) the source is read in place and no
+ *         backup is made, a failed patch only invalidates the target.
  */
 int handle_firmware_patch(uint32_t source_addr, uint32_t patch_addr, uint32_t target_addr, 
     uint32_t backup_addr, uint32_t header_size) {
@@ -264,7 +468,7 @@ int handle_firmware_patch(uint32_t source_addr, uint32_t patch_addr, uint32_t ta
     
     // Verify patch is valid
     if (!is_image_valid(&patch_header) || !patch_header.is_patch) {
-        uart_transport_send((const uint8_t*)"ERROR: Patch is not valid or not marked as a patch\r\n", 51);
+        uart_transport_send((const uint8_t*)"ERROR: Patch is not valid or not marked as a patch\r\n", 52);
         return 2;
     }
     
@@ -273,65 +477,77 @@ int handle_firmware_patch(uint32_t source_addr, uint32_t patch_addr, uint32_t ta
     uint32_t patch_data_size = patch_header.data_size;
     uint32_t source_total_size = source_data_size + header_size;
 
-    uart_transport_send((const uint8_t*)"Step 1: Backing up current firmware...\r\n", 40);
-    
-    // Erase backup area
-    if (!erase_memory_sectors(backup_addr, source_total_size, "backup")) {
-        return 4; // Failed to erase backup
-    }
-    
-    // Copy current firmware to backup
-    uart_transport_send((const uint8_t*)"Copying firmware to backup...\r\n", 31);
-    if (!safe_flash_write(backup_addr, (const uint8_t*)source_addr, source_total_size, "Backup")) {
-        uart_transport_send((const uint8_t*)"ERROR: Failed to backup firmware\r\n", 34);
-        return 5; // Failed to backup
+    // Patching over the source needs a copy of it to read from
+    int use_backup = (target_addr == source_addr);
+    uint32_t base_addr = use_backup ? backup_addr : source_addr;
+
+    if (use_backup) {
+        uart_transport_send((const uint8_t*)"Step 1: Backing up current firmware...\r\n", 40);
+        
+        // Erase backup area
+        if (!erase_memory_sectors(backup_addr, source_total_size, "backup")) {
+            return 4; // Failed to erase backup
+        }
+        
+        // Copy current firmware to backup
+        uart_transport_send((const uint8_t*)"Copying firmware to backup...\r\n", 31);
+        if (!safe_flash_write(backup_addr, (const uint8_t*)source_addr, source_total_size, "Backup")) {
+            uart_transport_send((const uint8_t*)"ERROR: Failed to backup firmware\r\n", 34);
+            return 5; // Failed to backup
+        }
+        
+        uart_transport_send((const uint8_t*)"Backup completed successfully\r\n", 31);
     }
     
-    uart_transport_send((const uint8_t*)"Backup completed successfully\r\n", 31);
-    
     // Calculate sectors needed for target
     uint32_t target_expected_size = patch_header.data_size + header_size;
 
+    // Target is about to change, drop its cached verification proof
+    verify_cache_invalidate(target_addr);
+
     // Erase target sectors
     if (!erase_memory_sectors(target_addr, target_expected_size, "target")) {
-        // Restore from backup
-        if (!restore_from_backup(target_addr, backup_addr, source_total_size)) {
-            uart_transport_send((const uint8_t*)"ERROR: Failed to restore from backup\r\n", 38);
-        }
+        recover_target(target_addr, backup_addr, source_total_size, use_backup);
             
         return 6; // Failed to erase target
     }
     
-    // Copy header from patch to target
-    if (!safe_flash_write(target_addr, (const uint8_t*)patch_addr, header_size, "Header copy")) {
+    // Copy header from patch to target, the patched image is a full image and not compressed.
+    // The struct is shorter than header_size, the tail of the header area stays erased
+    ImageHeader_t target_header = patch_header;
+    target_header.is_patch = IMAGE_PATCH_NONE;
+    target_header.flags &= ~IMAGE_FLAG_COMPRESSED;
+    if (!safe_flash_write(target_addr, (const uint8_t*)&target_header, sizeof(target_header), "Header copy")) {
         uart_transport_send((const uint8_t*)"ERROR: Failed to write header\r\n", 31);
         
-        // Restore from backup
-        if (!restore_from_backup(target_addr, backup_addr, source_total_size)) {
-            uart_transport_send((const uint8_t*)"ERROR: Failed to restore from backup\r\n", 38);
-        }
+        recover_target(target_addr, backup_addr, source_total_size, use_backup);
         
         return 7; // Failed to write header
     }
     
-    uart_transport_send((const uint8_t*)"Applying delta patch to content...\r\n", 44);
+    uart_transport_send((const uint8_t*)"Applying delta patch to content...\r\n", 36);
     
+    // data_size is the size of the new image and can exceed the staging area (with
+    // AB_SLOTS it is 128 KB at the end of flash), reads stop at the area's end.
+    // A compressed patch carries its own size, bounded by the staging area
+    uint32_t patch_room = PATCH_JOURNAL_ADDR - (patch_addr + header_size);
+    uint32_t patch_staged = (patch_data_size < patch_room) ? patch_data_size : patch_room;
+    uint32_t patch_space = (patch_header.flags & IMAGE_FLAG_COMPRESSED) ? patch_room : patch_staged;
+
     // Apply patch to content
     int result = apply_delta_patch(
-        backup_addr + header_size,
+        base_addr + header_size,
         patch_addr + header_size,
         target_addr + header_size,
         source_data_size,
-        patch_data_size
+        patch_space,
+        patch_header.flags
     );
     
     if (!result) {
         uart_transport_send((const uint8_t*)"ERROR: Failed to apply patch\r\n", 30);
         
-        // Restore from backup
-        if (!restore_from_backup(target_addr, backup_addr, source_total_size)) {
-            uart_transport_send((const uint8_t*)"ERROR: Failed to restore from backup\r\n", 38);
-        }
+        recover_target(target_addr, backup_addr, source_total_size, use_backup);
         
         return 8; // Failed to apply patch
     }
@@ -342,27 +558,846 @@ int handle_firmware_patch(uint32_t source_addr, uint32_t patch_addr, uint32_t ta
     if (!crc_verified) {
         uart_transport_send((const uint8_t*)"ERROR: CRC verification failed!\r\n", 33);
         
-        // Restore from backup
-        if (!restore_from_backup(target_addr, backup_addr, source_total_size)) {
-            uart_transport_send((const uint8_t*)"ERROR: Failed to restore from backup\r\n", 38);
-        }
+        recover_target(target_addr, backup_addr, source_total_size, use_backup);
         
         return 9; // CRC verification failed
     }
     
     uart_transport_send((const uint8_t*)"CRC verification successful\r\n", 29);
+    verify_cache_store(target_addr);
 
-    uart_transport_send((const uint8_t*)"Cleaning up temporary storage...\r\n", 42);
-    if (!erase_memory_sectors(patch_addr, patch_data_size + header_size, "patch")) {
+    uart_transport_send((const uint8_t*)"Cleaning up temporary storage...\r\n", 34);
+    if (!erase_memory_sectors(patch_addr, patch_staged + header_size, "patch")) {
         uart_transport_send((const uint8_t*)"Warning: Failed to clean up patch area\r\n", 39);
     }
     
     // Clean up backup area
-    if (!erase_memory_sectors(backup_addr, source_total_size, "backup")) {
+    if (use_backup && !erase_memory_sectors(backup_addr, source_total_size, "backup")) {
         uart_transport_send((const uint8_t*)"Warning: Failed to clean up backup area\r\n", 40);
     }
     
     uart_transport_send((const uint8_t*)"Temporary storage cleaned successfully\r\n", 40);
     uart_transport_send((const uint8_t*)"Patch process completed successfully\r\n", 38);
     return 0; // Success
-}
\ No newline at end of file
+}
+/**
+ * @brief  XMODEM data sink that appends received patch bytes to the stream window.
+ * @param  ctx: [in] Pointer to the patch stream.
+ * @param  data: [in] Pointer to the received data.
+ * @param  len: [in] Number of bytes received.
+ * @return 1 (the window never rejects data).
+ */
+static int delta_stream_sink(void* ctx, const uint8_t* data, size_t len) {
+    DeltaStream_t* stream = (DeltaStream_t*)ctx;
+    size_t used = 0;
+
+    // Image header (always plain)
+    while (used < len && stream->head < stream->header_size) {
+        stream->window[stream->head % DELTA_STREAM_WINDOW_SIZE] = data[used++];
+        stream->head++;
+    }
+
+    if (used == len || stream->error != 0) {
+        return 1;
+    }
+
+    if (stream->compressed < 0) {
+        const ImageHeader_Packet_t* header = (const ImageHeader_Packet_t*)stream->window;
+        stream->compressed = (header->flags & IMAGE_FLAG_COMPRESSED) ? 1 : 0;
+    }
+
+    if (!stream->compressed) {
+        for (; used < len; used++) {
+            stream->window[stream->head % DELTA_STREAM_WINDOW_SIZE] = data[used];
+            stream->head++;
+        }
+        return 1;
+    }
+
+    // Container header, then the payload through the decoder
+    uint8_t* lz_header = (uint8_t*)&stream->lz_header;
+    while (used < len && stream->lz_fill < sizeof(LzssHeader_t)) {
+        lz_header[stream->lz_fill++] = data[used++];
+        if (stream->lz_fill == sizeof(LzssHeader_t) &&
+            (!lzss_header_valid(&stream->lz_header) ||
+             !lzss_decoder_init(&patch_decoder, stream->lz_header.window_bits, stream->lz_header.lookahead_bits))) {
+            stream->error = DELTA_ERR_COMPRESSION;
+            return 1;
+        }
+    }
+
+    if (stream->lz_fill < sizeof(LzssHeader_t)) {
+        return 1;
+    }
+
+    // Bytes past the payload are XMODEM padding
+    size_t available = len - used;
+    if (available > stream->lz_header.payload_size - stream->lz_consumed) {
+        available = stream->lz_header.payload_size - stream->lz_consumed;
+    }
+
+    // Decode until the input and the decoder's buffered bits are used up
+    while (stream->head - stream->header_size < stream->lz_header.raw_size) {
+        uint32_t pos = stream->head % DELTA_STREAM_WINDOW_SIZE;
+        size_t space = DELTA_STREAM_WINDOW_SIZE - pos;
+        size_t in_used;
+
+        if (space > stream->lz_header.raw_size - (stream->head - stream->header_size)) {
+            space = stream->lz_header.raw_size - (stream->head - stream->header_size);
+        }
+
+        size_t n = lzss_decode(&patch_decoder, data + used, available, &in_used, stream->window + pos, space);
+        stream->head += n;
+        stream->lz_consumed += in_used;
+        used += in_used;
+        available -= in_used;
+
+        if (n == 0) {
+            break;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief  Services the UART once for a streamed patch transfer.
+ * @param  stream: [in] Pointer to the patch stream.
+ * @note   Feeds received bytes to XMODEM, sends its responses and flags timeouts.
+ */
+static void delta_stream_pump(DeltaStream_t* stream) {
+    XmodemManager_t* xmodem = stream->xmodem;
+    uint32_t now = HAL_GetTick();
+    uint8_t byte;
+
+    uart_transport_process();
+
+    if (uart_transport_receive(&byte, 1) > 0) {
+        stream->last_activity = now;
+
+        switch (xmodem_process_byte(xmodem, byte)) {
+            case XMODEM_ERROR_NONE:
+            case XMODEM_ERROR_CRC_ERROR:
+            case XMODEM_ERROR_SEQUENCE_ERROR:
+                // NAK is queued, sender retransmits
+                break;
+            case XMODEM_ERROR_TRANSFER_COMPLETE:
+                stream->complete = 1;
+                break;
+            case XMODEM_ERROR_INVALID_MAGIC:
+                stream->error = 2;
+                break;
+            case XMODEM_ERROR_AUTHENTICATION_FAILED:
+                stream->error = DELTA_ERR_AUTHENTICATION;
+                break;
+            default:
+                stream->error = DELTA_ERR_TRANSFER;
+                break;
+        }
+    } else if (xmodem_get_state(xmodem) != XMODEM_STATE_SENDING_INITIAL_C &&
+               now - stream->last_activity >= DELTA_STREAM_TIMEOUT_MS) {
+        stream->error = DELTA_ERR_TRANSFER;
+    }
+
+    // Initial 'C', ACK or NAK
+    if (xmodem_should_send_byte(xmodem)) {
+        uint8_t response = xmodem_get_response(xmodem);
+        uart_transport_send(&response, 1);
+    }
+
+    if (xmodem_get_state(xmodem) == XMODEM_STATE_ERROR && stream->error == 0) {
+        stream->error = DELTA_ERR_TRANSFER;
+    }
+}
+
+/**
+ * @brief  Aborts a streamed patch transfer and tells the sender to stop.
+ * @param  stream: [in] Pointer to the patch stream.
+ */
+static void delta_stream_cancel(DeltaStream_t* stream) {
+    const uint8_t cancel[] = {XMODEM_CAN, XMODEM_CAN, XMODEM_CAN};
+
+    xmodem_cancel_transfer(stream->xmodem);
+    uart_transport_send(cancel, sizeof(cancel));
+    HAL_Delay(100);
+}
+
+/**
+ * @brief  janpatch read callback for the patch stream.
+ * @param  ctx: [in] Pointer to the patch stream.
+ * @param  offset: [in] Offset relative to the start of the patch data.
+ * @param  ptr: [out] Destination buffer.
+ * @param  count: [in] Number of bytes requested.
+ * @return Number of bytes copied, 0 at end of transfer or on error.
+ * @note   Blocks and pumps XMODEM until the range has arrived. Data older than the
+ *         window is gone, which janpatch never needs (it only steps back a few bytes).
+ */
+static size_t delta_stream_read(void* ctx, size_t offset, uint8_t* ptr, size_t count) {
+    DeltaStream_t* stream = (DeltaStream_t*)ctx;
+    uint32_t start = stream->base + offset;
+
+    while (stream->head < start + count && !stream->complete && stream->error == 0) {
+        delta_stream_pump(stream);
+    }
+
+    if (stream->error != 0 || start >= stream->head ||
+        start + DELTA_STREAM_WINDOW_SIZE < stream->head) {
+        return 0;
+    }
+
+    if (count > stream->head - start) {
+        count = stream->head - start;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        ptr[i] = stream->window[(start + i) % DELTA_STREAM_WINDOW_SIZE];
+    }
+
+    return count;
+}
+
+/**
+ * @brief  janpatch write callback for the target slot.
+ * @param  ctx: [in] Pointer to the target descriptor.
+ * @param  offset: [in] Offset relative to the start of the patched data.
+ * @param  ptr: [in] Data to write.
+ * @param  count: [in] Number of bytes to write.
+ * @return Number of bytes written, 0 on failure.
+ * @note   Sectors are erased when the output first reaches them, so the target is
+ *         left untouched if the transfer fails before the first page is flushed.
+ */
+static size_t delta_target_write(void* ctx, size_t offset, const uint8_t* ptr, size_t count) {
+    DeltaTarget_t* target = (DeltaTarget_t*)ctx;
+    uint32_t addr = target->addr + offset;
+
+    while (addr + count > target->erased_end) {
+        uint8_t sector = flash_get_sector(target->erased_end);
+        if (sector == 0xFF || !flash_erase_sector(target->erased_end)) {
+            return 0;
+        }
+        target->erased_end = flash_get_sector_end(sector) + 1;
+    }
+
+    if (!flash_write(addr, ptr, count)) {
+        return 0;
+    }
+
+    return count;
+}
+
+/**
+ * @brief  Applies a delta patch while it is being received over XMODEM.
+ * @param  xmodem: [in] XMODEM manager used for the transfer.
+ * @param  source_addr: [in] Address of the current firmware.
+ * @param  target_addr: [in] Address for the patched firmware.
+ * @param  backup_addr: [in] Address for storing a backup.
+ * @param  header_size: [in] Size of the header for the firmware images.
+ * @return 0 on success, error code on failure.
+ * @note   The patch never touches the staging area: blocks go straight into a small
+ *         RAM window that janpatch consumes. The old image is copied to the backup
+ *         area first and used as the patch source, since the target is rewritten
+ *         in place. The header is written last, so an interrupted update never
+ *         leaves a valid-looking image behind. When the target is another slot
+ *         (A/B layout) the source is read in place and no backup is made.
+ * @note   No debug output is sent while the transfer is running.
+ */
+int handle_firmware_patch_stream(XmodemManager_t* xmodem, uint32_t source_addr, uint32_t target_addr,
+    uint32_t backup_addr, uint32_t header_size) {
+
+    // Read source header
+    ImageHeader_t source_header;
+    memcpy(&source_header, (void*)source_addr, sizeof(ImageHeader_t));
+
+    // Verify source firmware is valid
+    if (!is_image_valid(&source_header) || !verify_image_cached(source_addr, header_size)) {
+        uart_transport_send((const uint8_t*)"ERROR: Source firmware is not valid\r\n", 37);
+        return 1;
+    }
+
+    uint32_t source_total_size = source_header.data_size + header_size;
+
+    // Patching over the source needs a copy of it to read from
+    int use_backup = (target_addr == source_addr);
+
+    if (use_backup) {
+        uart_transport_send((const uint8_t*)"Step 1: Backing up current firmware...\r\n", 40);
+
+        // Erase backup area
+        if (!erase_memory_sectors(backup_addr, source_total_size, "backup")) {
+            return 4; // Failed to erase backup
+        }
+
+        // Copy current firmware to backup
+        if (!safe_flash_write(backup_addr, (const uint8_t*)source_addr, source_total_size, "Backup")) {
+            uart_transport_send((const uint8_t*)"ERROR: Failed to backup firmware\r\n", 34);
+            return 5; // Failed to backup
+        }
+
+        uart_transport_send((const uint8_t*)"Backup completed successfully\r\n", 31);
+    }
+    uart_transport_send((const uint8_t*)"Step 2: Send the patch file using XMODEM protocol\r\n", 51);
+
+    // Target is about to change, drop its cached verification proof
+    verify_cache_invalidate(target_addr);
+
+    // Route received blocks into the patch window instead of the staging area
+    memset(&patch_stream, 0, sizeof(patch_stream));
+    patch_stream.xmodem = xmodem;
+    patch_stream.header_size = header_size;
+    patch_stream.compressed = -1;
+    patch_stream.last_activity = HAL_GetTick();
+    xmodem_set_sink(xmodem, delta_stream_sink, &patch_stream);
+    xmodem_start(xmodem, target_addr);
+
+    DeltaTarget_t target_slot = {
+        .addr = target_addr + header_size,
+        .erased_end = target_addr
+    };
+
+    int result = 0;
+
+    // The patch header arrives first
+    ImageHeader_t patch_header;
+    if (delta_stream_read(&patch_stream, 0, (uint8_t*)&patch_header, sizeof(ImageHeader_t)) != sizeof(ImageHeader_t)) {
+        result = patch_stream.error ? patch_stream.error : DELTA_ERR_TRANSFER;
+    } else if (!is_image_valid(&patch_header) || !patch_header.is_patch ||
+               patch_header.image_type != source_header.image_type || patch_header.data_size == 0 ||
+               (target_addr < backup_addr && patch_header.data_size + header_size > backup_addr - target_addr)) {
+        result = 2; // Not a patch for this slot
+    } else {
+        patch_stream.base = header_size;
+
+        janpatch_ctx ctx;
+        delta_init_ctx(&ctx, source_total_size);
+
+        sfio_stream_t source;
+        source.type = SFIO_STREAM_SLOT;
+        source.offset = 0;
+        source.size = source_header.data_size;
+        source.slot = (use_backup ? backup_addr : source_addr) + header_size;
+
+        sfio_stream_t patch;
+        patch.type = SFIO_STREAM_CALLBACK;
+        patch.offset = 0;
+        patch.size = SIZE_MAX;
+        patch.cb.read = delta_stream_read;
+        patch.cb.write = NULL;
+        patch.cb.ctx = &patch_stream;
+
+        // Sized to the new image, which also drops the XMODEM padding of the last block
+        sfio_stream_t target;
+        target.type = SFIO_STREAM_CALLBACK;
+        target.offset = 0;
+        target.size = patch_header.data_size;
+        target.cb.read = NULL;
+        target.cb.write = delta_target_write;
+        target.cb.ctx = &target_slot;
+
+        if (janpatch(&ctx, &source, &patch, &target) != 0) {
+            result = patch_stream.error ? patch_stream.error : 8;
+        } else if (patch_stream.error != 0 || !patch_stream.complete) {
+            result = patch_stream.error ? patch_stream.error : DELTA_ERR_TRANSFER;
+        }
+    }
+
+    if (result != 0 && !patch_stream.complete) {
+        delta_stream_cancel(&patch_stream);
+    }
+    xmodem_set_sink(xmodem, NULL, NULL);
+
+    if (result == 0) {
+        uart_transport_send((const uint8_t*)"\r\nPatch stream applied, verifying...\r\n", 38);
+        delta_report_stats();
+
+        uint32_t calculated_crc = calculate_firmware_crc(target_addr + header_size, patch_header.data_size);
+        if (calculated_crc != patch_header.crc) {
+            uart_transport_send((const uint8_t*)"ERROR: CRC verification failed!\r\n", 33);
+            result = 9; // CRC verification failed
+        } else {
+            // Header goes in last, as a regular image
+            patch_header.is_patch = 0;
+            patch_header.flags &= ~IMAGE_FLAG_COMPRESSED;
+            if (!safe_flash_write(target_addr, (const uint8_t*)&patch_header, sizeof(ImageHeader_t), "Header write")) {
+                result = 7; // Failed to write header
+            }
+        }
+    }
+
+    if (result != 0) {
+        // Only recover if the target has been touched
+        if (target_slot.erased_end != target_addr) {
+            recover_target(target_addr, backup_addr, source_total_size, use_backup);
+        }
+        return result;
+    }
+
+    uart_transport_send((const uint8_t*)"CRC verification successful\r\n", 29);
+    verify_cache_store(target_addr);
+
+    // Clean up backup area
+    if (use_backup && !erase_memory_sectors(backup_addr, source_total_size, "backup")) {
+        uart_transport_send((const uint8_t*)"Warning: Failed to clean up backup area\r\n", 41);
+    }
+
+    uart_transport_send((const uint8_t*)"Patch process completed successfully\r\n", 38);
+    return 0; // Success
+}
+
+/**
+ * @brief  Checks that a slot range matches the flash sector layout.
+ * @param  addr: [in] Start address of the range.
+ * @param  sector_size: [in] Expected size of each sector.
+ * @param  count: [in] Number of sectors.
+ * @return 1 if every sector starts where expected and has the expected size, 0 otherwise.
+ */
+static int inplace_check_sectors(uint32_t addr, uint32_t sector_size, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t start = addr + i * sector_size;
+        uint8_t sector = flash_get_sector(start);
+
+        if (sector == 0xFF || flash_get_sector_start(sector) != start ||
+            flash_get_sector_end(sector) - start + 1 != sector_size) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief  Validates a staged in-place patch and its annotation.
+ * @param  slot_addr: [in] Slot the patch is applied to.
+ * @param  patch_addr: [in] Address of the staged patch (header).
+ * @param  scratch_addr: [in] Address of the scratch sectors.
+ * @param  header_size: [in] Size of the image header.
+ * @return 1 if the patch can be applied to this slot, 0 otherwise.
+ */
+static int inplace_check_patch(uint32_t slot_addr, uint32_t patch_addr, uint32_t scratch_addr, uint32_t header_size) {
+    const ImageHeader_t* patch_header = (const ImageHeader_t*)patch_addr;
+    const InplaceAnnotation_t* annotation = (const InplaceAnnotation_t*)(patch_addr + header_size);
+    uint32_t patch_data = patch_addr + header_size + sizeof(InplaceAnnotation_t);
+
+    if (!is_image_valid(patch_header) || patch_header->is_patch != IMAGE_PATCH_INPLACE) {
+        return 0;
+    }
+
+    if (annotation->magic != INPLACE_ANNOTATION_MAGIC ||
+        annotation->crc != crc_calculate_memory((uint32_t)annotation, offsetof(InplaceAnnotation_t, crc))) {
+        uart_transport_send((const uint8_t*)"ERROR: In-place annotation is corrupted\r\n", 41);
+        return 0;
+    }
+
+    // The patch must not reach into the journal
+    if (annotation->patch_size > PATCH_JOURNAL_ADDR - patch_data) {
+        return 0;
+    }
+
+    if (annotation->sector_count == 0 || annotation->sector_count > INPLACE_MAX_SECTORS ||
+        header_size + patch_header->data_size > annotation->sector_count * annotation->sector_size) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < annotation->sector_count; i++) {
+        if (annotation->last_use[i] != INPLACE_NONE && annotation->last_use[i] >= annotation->sector_count) {
+            return 0;
+        }
+    }
+
+    if (!inplace_check_sectors(slot_addr, annotation->sector_size, annotation->sector_count) ||
+        !inplace_check_sectors(scratch_addr, annotation->sector_size, INPLACE_SCRATCH_SLOTS)) {
+        uart_transport_send((const uint8_t*)"ERROR: Patch sector layout does not match flash\r\n", 49);
+        return 0;
+    }
+
+    if (annotation->patch_crc != crc_calculate_memory(patch_data, annotation->patch_size)) {
+        uart_transport_send((const uint8_t*)"ERROR: Patch data CRC mismatch\r\n", 32);
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief  Checks that the scratch slots are enough for the sectors that must be kept.
+ * @param  annotation: [in] Patch annotation.
+ * @return 1 if the patch can be applied with INPLACE_SCRATCH_SLOTS slots, 0 otherwise.
+ * @note   Runs the same allocation as inplace_enter_sector(), before anything is erased.
+ */
+static int inplace_plan_fits(const InplaceAnnotation_t* annotation) {
+    uint8_t owner[INPLACE_SCRATCH_SLOTS];
+    memset(owner, INPLACE_NONE, sizeof(owner));
+
+    for (uint8_t sector = 0; sector < annotation->sector_count; sector++) {
+        if (annotation->unchanged[sector]) {
+            continue;
+        }
+
+        for (uint32_t s = 0; s < INPLACE_SCRATCH_SLOTS; s++) {
+            if (owner[s] != INPLACE_NONE && annotation->last_use[owner[s]] < sector) {
+                owner[s] = INPLACE_NONE;
+            }
+        }
+
+        uint8_t last_use = annotation->last_use[sector];
+        if (last_use != INPLACE_NONE && last_use >= sector) {
+            uint32_t s = 0;
+            while (s < INPLACE_SCRATCH_SLOTS && owner[s] != INPLACE_NONE) {
+                s++;
+            }
+            if (s == INPLACE_SCRATCH_SLOTS) {
+                return 0;
+            }
+            owner[s] = sector;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief  Prepares a slot sector for the patched data.
+ * @param  patch: [in] In-place patch state.
+ * @param  sector: [in] Slot sector the output has reached.
+ * @return 1 on success, 0 on failure (patch->error is set).
+ * @note   Journal order: DONE, scratch copy + SAVED, erase. A reset at any point
+ *         resumes at this sector with the old contents still readable.
+ */
+static int inplace_enter_sector(InplacePatch_t* patch, uint8_t sector) {
+    const InplaceAnnotation_t* annotation = patch->annotation;
+
+    // Every sector below this one is written
+    if (!patch_journal_append(PATCH_JOURNAL_DONE, sector, 0, 0)) {
+        patch->error = DELTA_ERR_JOURNAL;
+        return 0;
+    }
+    patch->done = sector;
+
+    // Release copies no remaining sector reads from
+    for (uint32_t s = 0; s < INPLACE_SCRATCH_SLOTS; s++) {
+        uint8_t owner = patch->slot_owner[s];
+        if (owner != INPLACE_NONE && annotation->last_use[owner] < sector) {
+            patch->saved_slot[owner] = INPLACE_NONE;
+            patch->slot_owner[s] = INPLACE_NONE;
+        }
+    }
+
+    // Keep the old contents if this or a later sector still copies from them
+    uint8_t last_use = annotation->last_use[sector];
+    if (last_use != INPLACE_NONE && last_use >= sector && patch->saved_slot[sector] == INPLACE_NONE) {
+        uint32_t s = 0;
+        while (s < INPLACE_SCRATCH_SLOTS && patch->slot_owner[s] != INPLACE_NONE) {
+            s++;
+        }
+
+        uint32_t scratch = patch->scratch_addr + s * patch->sector_size;
+        if (s == INPLACE_SCRATCH_SLOTS || !flash_erase_sector(scratch) ||
+            !flash_write(scratch, (const uint8_t*)(patch->slot_addr + sector * patch->sector_size), patch->sector_size)) {
+            patch->error = DELTA_ERR_SCRATCH;
+            return 0;
+        }
+
+        if (!patch_journal_append(PATCH_JOURNAL_SAVED, sector, (uint8_t)s, 0)) {
+            patch->error = DELTA_ERR_JOURNAL;
+            return 0;
+        }
+
+        patch->saved_slot[sector] = (uint8_t)s;
+        patch->slot_owner[s] = sector;
+    }
+
+    if (!flash_erase_sector(patch->slot_addr + sector * patch->sector_size)) {
+        patch->error = 6;
+        return 0;
+    }
+
+    patch->current = sector;
+    return 1;
+}
+
+/**
+ * @brief  janpatch read callback for the old image during an in-place patch.
+ * @param  ctx: [in] In-place patch state.
+ * @param  offset: [in] Offset in the old image data.
+ * @param  ptr: [out] Destination buffer.
+ * @param  count: [in] Number of bytes requested.
+ * @return Number of bytes copied.
+ * @note   Sectors with a scratch copy are read from the scratch area. Reads from
+ *         other overwritten sectors return new data, which by construction of the
+ *         annotation only feeds output that is discarded during a resume.
+ */
+static size_t inplace_source_read(void* ctx, size_t offset, uint8_t* ptr, size_t count) {
+    InplacePatch_t* patch = (InplacePatch_t*)ctx;
+    size_t copied = 0;
+
+    while (copied < count) {
+        uint32_t image_offset = patch->header_size + offset + copied;
+        uint32_t sector = image_offset / patch->sector_size;
+        uint32_t in_sector = image_offset % patch->sector_size;
+        size_t chunk = patch->sector_size - in_sector;
+        if (chunk > count - copied) {
+            chunk = count - copied;
+        }
+
+        uint32_t addr = patch->slot_addr + image_offset;
+        if (sector < INPLACE_MAX_SECTORS && patch->saved_slot[sector] != INPLACE_NONE) {
+            addr = patch->scratch_addr + patch->saved_slot[sector] * patch->sector_size + in_sector;
+        }
+
+        memcpy(ptr + copied, (const void*)addr, chunk);
+        copied += chunk;
+    }
+
+    return count;
+}
+
+/**
+ * @brief  janpatch write callback for the slot during an in-place patch.
+ * @param  ctx: [in] In-place patch state.
+ * @param  offset: [in] Offset in the new image data.
+ * @param  ptr: [in] Data to write.
+ * @param  count: [in] Number of bytes to write.
+ * @return Number of bytes consumed, 0 on failure.
+ * @note   Output for finished sectors (when resuming) and for unchanged sectors is dropped.
+ */
+static size_t inplace_target_write(void* ctx, size_t offset, const uint8_t* ptr, size_t count) {
+    InplacePatch_t* patch = (InplacePatch_t*)ctx;
+    size_t written = 0;
+
+    if (patch->error != 0) {
+        return 0;
+    }
+
+    while (written < count) {
+        uint32_t image_offset = patch->header_size + offset + written;
+        uint32_t sector = image_offset / patch->sector_size;
+        size_t chunk = patch->sector_size - image_offset % patch->sector_size;
+        if (chunk > count - written) {
+            chunk = count - written;
+        }
+
+        if (sector >= patch->annotation->sector_count) {
+            patch->error = 8;
+            return 0;
+        }
+
+        if (sector >= patch->done && !patch->annotation->unchanged[sector]) {
+            if (sector != patch->current && !inplace_enter_sector(patch, (uint8_t)sector)) {
+                return 0;
+            }
+
+            if (!flash_write(patch->slot_addr + image_offset, ptr + written, chunk)) {
+                patch->error = 8;
+                return 0;
+            }
+        }
+
+        written += chunk;
+    }
+
+    return count;
+}
+
+/**
+ * @brief  Writes the final image header, magic word last.
+ * @param  slot_addr: [in] Slot address.
+ * @param  header: [in] Header to write.
+ * @return 1 on success, 0 on failure.
+ * @note   A header torn by a reset has no magic and is rewritten with the same
+ *         bytes on resume, which flash allows.
+ */
+static int inplace_write_header(uint32_t slot_addr, const ImageHeader_t* header) {
+    const uint8_t* bytes = (const uint8_t*)header;
+    uint32_t magic_size = sizeof(header->image_magic);
+
+    return flash_write(slot_addr + magic_size, bytes + magic_size, sizeof(ImageHeader_t) - magic_size) &&
+           flash_write(slot_addr, bytes, magic_size);
+}
+
+/**
+ * @brief  Runs or resumes an in-place patch from the given journal state.
+ * @param  slot_addr: [in] Slot being patched.
+ * @param  patch_addr: [in] Address of the staged patch.
+ * @param  scratch_addr: [in] Address of the scratch sectors.
+ * @param  header_size: [in] Size of the image header.
+ * @param  journal: [in] Journal state to start from.
+ * @return 0 on success, error code on failure.
+ */
+static int inplace_apply(uint32_t slot_addr, uint32_t patch_addr, uint32_t scratch_addr, uint32_t header_size,
+                         const PatchJournalState_t* journal) {
+    const InplaceAnnotation_t* annotation = (const InplaceAnnotation_t*)(patch_addr + header_size);
+    InplacePatch_t* patch = &inplace_patch;
+    ImageHeader_t header;
+    memcpy(&header, (void*)patch_addr, sizeof(ImageHeader_t));
+
+    memset(patch, 0, sizeof(InplacePatch_t));
+    patch->annotation = annotation;
+    patch->slot_addr = slot_addr;
+    patch->scratch_addr = scratch_addr;
+    patch->header_size = header_size;
+    patch->sector_size = annotation->sector_size;
+    patch->current = INPLACE_NONE;
+    patch->done = journal->done;
+    memcpy(patch->saved_slot, journal->saved_slot, sizeof(patch->saved_slot));
+    memset(patch->slot_owner, INPLACE_NONE, sizeof(patch->slot_owner));
+    for (uint8_t i = 0; i < INPLACE_MAX_SECTORS; i++) {
+        if (patch->saved_slot[i] < INPLACE_SCRATCH_SLOTS) {
+            patch->slot_owner[patch->saved_slot[i]] = i;
+        }
+    }
+
+    int result = 0;
+
+    if (patch->done < annotation->sector_count) {
+        sfio_stream_t source;
+        source.type = SFIO_STREAM_CALLBACK;
+        source.offset = 0;
+        source.size = annotation->old_size;
+        source.cb.read = inplace_source_read;
+        source.cb.write = NULL;
+        source.cb.ctx = patch;
+
+        sfio_stream_t patch_data;
+        if (!delta_open_patch(&patch_data, patch_addr + header_size + sizeof(InplaceAnnotation_t),
+                              annotation->patch_size, header.flags)) {
+            patch_journal_append(PATCH_JOURNAL_END, 0, 0, DELTA_ERR_COMPRESSION);
+            return DELTA_ERR_COMPRESSION;
+        }
+
+        janpatch_ctx ctx;
+        delta_init_ctx(&ctx, annotation->old_size + patch_data.size);
+
+        sfio_stream_t target;
+        target.type = SFIO_STREAM_CALLBACK;
+        target.offset = 0;
+        target.size = header.data_size;
+        target.cb.read = NULL;
+        target.cb.write = inplace_target_write;
+        target.cb.ctx = patch;
+
+        uart_transport_send((const uint8_t*)"Applying patch in place...\r\n", 28);
+        if (janpatch(&ctx, &source, &patch_data, &target) != 0 || patch->error != 0) {
+            result = patch->error ? patch->error : 8;
+        } else if (!patch_journal_append(PATCH_JOURNAL_DONE, annotation->sector_count, 0, 0)) {
+            result = DELTA_ERR_JOURNAL;
+        } else {
+            delta_report_stats();
+        }
+    }
+
+    if (result == 0 && calculate_firmware_crc(slot_addr + header_size, header.data_size) != header.crc) {
+        uart_transport_send((const uint8_t*)"ERROR: CRC verification failed!\r\n", 33);
+        result = 9;
+    }
+
+    if (result == 0) {
+        header.is_patch = IMAGE_PATCH_NONE;
+        header.flags &= ~IMAGE_FLAG_COMPRESSED;
+        if (!inplace_write_header(slot_addr, &header)) {
+            result = 7;
+        }
+    }
+
+    if (result != 0 && result != DELTA_ERR_JOURNAL && result != 6 && result != DELTA_ERR_SCRATCH) {
+        // Deterministic failure, resuming would fail the same way
+        patch_journal_append(PATCH_JOURNAL_END, 0, 0, (uint32_t)result);
+        return result;
+    }
+
+    if (result != 0) {
+        // Flash failure, the journal stays active so the next start retries
+        return result;
+    }
+
+    verify_cache_store(slot_addr);
+    patch_journal_append(PATCH_JOURNAL_END, 0, 0, 0);
+
+    uart_transport_send((const uint8_t*)"In-place patch completed successfully\r\n", 39);
+    return 0;
+}
+
+/**
+ * @brief  Applies an annotated delta patch in place, without a full backup.
+ * @param  slot_addr: [in] Slot to patch (current firmware).
+ * @param  patch_addr: [in] Address of the staged patch.
+ * @param  scratch_addr: [in] Address of the scratch sectors (backup area).
+ * @param  header_size: [in] Size of the image header.
+ * @return 0 on success, error code on failure.
+ * @note   The host generator records, per sector, the last new sector that copies
+ *         from it. Only sectors still needed after they are overwritten are copied
+ *         to scratch, and unchanged sectors are not touched, so erase and program
+ *         work follows the size of the change. Progress is journaled in the staging
+ *         area and resume_firmware_patch_inplace() continues after a power loss.
+ * @note   Once started there is no old image to go back to. Everything that can be
+ *         checked up front (base image, patch CRC, scratch plan) is checked first.
+ */
+int handle_firmware_patch_inplace(uint32_t slot_addr, uint32_t patch_addr, uint32_t scratch_addr,
+    uint32_t header_size) {
+
+    // Read source header
+    ImageHeader_t source_header;
+    memcpy(&source_header, (void*)slot_addr, sizeof(ImageHeader_t));
+
+    if (!is_image_valid(&source_header) || !verify_image_cached(slot_addr, header_size)) {
+        uart_transport_send((const uint8_t*)"ERROR: Source firmware is not valid\r\n", 37);
+        return 1;
+    }
+
+    if (!inplace_check_patch(slot_addr, patch_addr, scratch_addr, header_size)) {
+        uart_transport_send((const uint8_t*)"ERROR: Patch is not valid or not marked as a patch\r\n", 52);
+        return 2;
+    }
+
+    const InplaceAnnotation_t* annotation = (const InplaceAnnotation_t*)(patch_addr + header_size);
+    if (annotation->old_size != source_header.data_size || annotation->old_crc != source_header.crc) {
+        uart_transport_send((const uint8_t*)"ERROR: Patch was made for a different firmware\r\n", 48);
+        return 2;
+    }
+
+    if (!inplace_plan_fits(annotation)) {
+        uart_transport_send((const uint8_t*)"ERROR: Patch needs more scratch sectors\r\n", 41);
+        return DELTA_ERR_SCRATCH;
+    }
+
+    // Point of no return
+    if (!patch_journal_append(PATCH_JOURNAL_BEGIN, 0, 0, annotation->crc)) {
+        return DELTA_ERR_JOURNAL;
+    }
+    verify_cache_invalidate(slot_addr);
+
+    PatchJournalState_t journal;
+    patch_journal_load(&journal);
+
+    return inplace_apply(slot_addr, patch_addr, scratch_addr, header_size, &journal);
+}
+
+/**
+ * @brief  Continues an in-place patch after a reset or power loss.
+ * @param  slot_addr: [in] Slot being patched.
+ * @param  patch_addr: [in] Address of the staged patch.
+ * @param  scratch_addr: [in] Address of the scratch sectors.
+ * @param  header_size: [in] Size of the image header.
+ * @return 0 on success, error code on failure.
+ * @note   janpatch is replayed from the start of the patch; output for sectors the
+ *         journal marks as finished is dropped.
+ */
+int resume_firmware_patch_inplace(uint32_t slot_addr, uint32_t patch_addr, uint32_t scratch_addr,
+    uint32_t header_size) {
+
+    PatchJournalState_t journal;
+    if (!patch_journal_load(&journal)) {
+        return 0; // Nothing to resume
+    }
+
+    const InplaceAnnotation_t* annotation = (const InplaceAnnotation_t*)(patch_addr + header_size);
+    if (!inplace_check_patch(slot_addr, patch_addr, scratch_addr, header_size) ||
+        annotation->crc != journal.patch_id) {
+        // The staged patch is gone, the slot cannot be completed
+        uart_transport_send((const uint8_t*)"ERROR: Staged patch no longer matches the journal\r\n", 51);
+        patch_journal_append(PATCH_JOURNAL_END, 0, 0, 2);
+        return 2;
+    }
+
+    verify_cache_invalidate(slot_addr);
+
+    return inplace_apply(slot_addr, patch_addr, scratch_addr, header_size, &journal);
+}
@@ -1,4 +1,5 @@
 #include "flash.h"
+#include "profile.h"
 #include <string.h>
 
 static const uint32_t FLASH_SECTORS_KB[] = {
@@ -18,6 +19,9 @@ static const uint32_t FLASH_SECTORS_KB[] = {
 
 static const uint8_t FLASH_SECTOR_COUNT = sizeof(FLASH_SECTORS_KB) / sizeof(FLASH_SECTORS_KB[0]);
 
+/* Private functions ---------------------------------------------------------*/
+static int flash_program(uint32_t addr, const uint8_t* data, size_t len);
+
 /**
  * @brief Unlocks the Flash memory for write/erase operations.
  * @return int Returns 1 if the Flash is successfully unlocked or already unlocked, 0 otherwise.
@@ -165,7 +169,9 @@ int flash_erase_sector(uint32_t sector_addr) {
     }
     
     // Erase the sector
+    PROFILE_BEGIN(PROFILE_FLASH_ERASE);
     HAL_StatusTypeDef status = HAL_FLASHEx_Erase(&EraseInitStruct, &SectorError);
+    PROFILE_END(PROFILE_FLASH_ERASE);
     
     // Lock flash again
     flash_lock();
@@ -228,35 +234,15 @@ int flash_erase(uint32_t destination) {
  * @param data Pointer to data buffer.
  * @param len Number of bytes to write.
  * @retval 1 if successful, 0 otherwise.
+ * @note  Any address and length are accepted. The unaligned head and tail are
+ *        programmed byte by byte and the aligned middle word by word, all under a
+ *        single unlock. The result is verified once at the end.
  */
-int flash_write(uint32_t addr, const uint8_t* data, size_t len) {
+static int flash_program(uint32_t addr, const uint8_t* data, size_t len) {
     if (len == 0) {
         return 1; // Nothing to do
     }
     
-    // Check alignment
-    if (len % 4 != 0) {
-        // Use static buffer for alignment
-        static uint8_t aligned_buffer[256]; // Static buffer for alignment
-        
-        // Check if buffer is large enough
-        size_t aligned_len = ((len + 3) / 4) * 4;
-        if (aligned_len > sizeof(aligned_buffer)) {
-            return 0; // Buffer too small
-        }
-        
-        // Copy data to aligned buffer
-        memcpy(aligned_buffer, data, len);
-        
-        // Pad with 0xFF (erased flash state)
-        for (size_t i = len; i < aligned_len; i++) {
-            aligned_buffer[i] = 0xFF;
-        }
-        
-        // Call ourselves with the aligned data
-        return flash_write(addr, aligned_buffer, aligned_len);
-    }
-    
     // Wait for any previous operations
     if (!flash_wait_for_last_operation()) {
         return 0;
@@ -267,25 +253,31 @@ int flash_write(uint32_t addr, const uint8_t* data, size_t len) {
         return 0;
     }
     
-    // Program flash
-    for (size_t offset = 0; offset < len; offset += 4) {
-        uint32_t data_word = 0;
-        memcpy(&data_word, data + offset, 4);
-        
-        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr + offset, data_word) != HAL_OK) {
+    size_t offset = 0;
+    
+    // Unaligned head
+    while (offset < len && ((addr + offset) & 0x3U) != 0) {
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, addr + offset, data[offset]) != HAL_OK) {
             flash_lock();
             return 0;
         }
+        offset++;
+    }
+    
+    // Aligned words, HAL_FLASH_Program waits for each one to complete
+    for (; offset + 4 <= len; offset += 4) {
+        uint32_t data_word;
+        memcpy(&data_word, data + offset, 4);
         
-        // Wait with timeout
-        if (!flash_wait_for_last_operation()) {
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, addr + offset, data_word) != HAL_OK) {
             flash_lock();
             return 0;
         }
-        
-        // Verify written data
-        uint32_t read_data = *(__IO uint32_t*)(addr + offset);
-        if (read_data != data_word) {
+    }
+    
+    // Unaligned tail
+    for (; offset < len; offset++) {
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_BYTE, addr + offset, data[offset]) != HAL_OK) {
             flash_lock();
             return 0;
         }
@@ -294,7 +286,23 @@ int flash_write(uint32_t addr, const uint8_t* data, size_t len) {
     // Lock flash
     flash_lock();
     
-    return 1;
+    // Verify written data
+    return memcmp((const void*)addr, data, len) == 0;
+}
+
+/**
+ * @brief Writes data to flash memory, timed when profiling is enabled (see flash_program()).
+ * @param addr Destination flash address.
+ * @param data Pointer to source data.
+ * @param len Number of bytes to write.
+ * @retval 1 if successful, 0 otherwise.
+ */
+int flash_write(uint32_t addr, const uint8_t* data, size_t len) {
+    PROFILE_BEGIN(PROFILE_FLASH_WRITE);
+    int result = flash_program(addr, data, len);
+    PROFILE_END(PROFILE_FLASH_WRITE);
+
+    return result;
 }
 
 /**
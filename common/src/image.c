@@ -131,7 +131,7 @@ void header_to_packet(const ImageHeader_t* header, ImageHeader_Packet_t* packet)
     packet->version_major = header->version_major;
     packet->version_minor = header->version_minor;
     packet->version_patch = header->version_patch;
-    packet->_padding = header->_padding;
+    packet->flags = header->flags;
     packet->vector_addr = header->vector_addr;
     packet->crc = header->crc;
     packet->data_size = header->data_size;
@@ -150,7 +150,7 @@ void packet_to_header(const ImageHeader_Packet_t* packet, ImageHeader_t* header)
     header->version_major = packet->version_major;
     header->version_minor = packet->version_minor;
     header->version_patch = packet->version_patch;
-    header->_padding = packet->_padding;
+    header->flags = packet->flags;
     header->vector_addr = packet->vector_addr;
     header->crc = packet->crc;
     header->data_size = packet->data_size;
@@ -0,0 +1,134 @@
+#include "lzss.h"
+#include <string.h>
+
+// Decoder states
+enum {
+    LZSS_STATE_TAG = 0,
+    LZSS_STATE_LITERAL,
+    LZSS_STATE_INDEX,
+    LZSS_STATE_COUNT
+};
+
+/* Private functions ---------------------------------------------------------*/
+static int lzss_get_bits(LzssDecoder_t* decoder, uint8_t count, const uint8_t* in, size_t in_len,
+                         size_t* pos, uint16_t* value);
+
+
+/**
+ * @brief  Takes bits from the accumulator, refilling it from the input.
+ * @param  decoder: [in] Decoder state.
+ * @param  count: [in] Number of bits (up to 16).
+ * @param  in: [in] Input buffer.
+ * @param  in_len: [in] Input length.
+ * @param  pos: [in,out] Read position in the input.
+ * @param  value: [out] The bits, MSB first.
+ * @return 1 if enough bits were available, 0 otherwise (partial bits are kept).
+ */
+static int lzss_get_bits(LzssDecoder_t* decoder, uint8_t count, const uint8_t* in, size_t in_len,
+                         size_t* pos, uint16_t* value) {
+    while (decoder->bit_count < count) {
+        if (*pos >= in_len) {
+            return 0;
+        }
+        decoder->bits = (decoder->bits << 8) | in[(*pos)++];
+        decoder->bit_count += 8;
+    }
+
+    decoder->bit_count -= count;
+    *value = (uint16_t)((decoder->bits >> decoder->bit_count) & ((1u << count) - 1));
+    return 1;
+}
+
+/**
+ * @brief  Checks the container header fields against the decoder limits.
+ * @param  header: [in] Container header.
+ * @return 1 if the stream can be decoded, 0 otherwise.
+ */
+int lzss_header_valid(const LzssHeader_t* header) {
+    return header->magic == LZSS_MAGIC &&
+           header->window_bits >= LZSS_MIN_WINDOW_BITS && header->window_bits <= LZSS_MAX_WINDOW_BITS &&
+           header->lookahead_bits >= LZSS_MIN_LOOKAHEAD_BITS && header->lookahead_bits <= LZSS_MAX_LOOKAHEAD_BITS;
+}
+
+/**
+ * @brief  Resets the decoder for a new stream.
+ * @param  decoder: [out] Decoder state.
+ * @param  window_bits: [in] log2 of the window size.
+ * @param  lookahead_bits: [in] log2 of the longest copy.
+ * @return 1 on success, 0 if the parameters exceed the decoder limits.
+ */
+int lzss_decoder_init(LzssDecoder_t* decoder, uint8_t window_bits, uint8_t lookahead_bits) {
+    if (window_bits < LZSS_MIN_WINDOW_BITS || window_bits > LZSS_MAX_WINDOW_BITS ||
+        lookahead_bits < LZSS_MIN_LOOKAHEAD_BITS || lookahead_bits > LZSS_MAX_LOOKAHEAD_BITS) {
+        return 0;
+    }
+
+    memset(decoder, 0, sizeof(LzssDecoder_t));
+    decoder->window_bits = window_bits;
+    decoder->lookahead_bits = lookahead_bits;
+    decoder->state = LZSS_STATE_TAG;
+
+    return 1;
+}
+
+/**
+ * @brief  Decodes until the input is used up or the output is full.
+ * @param  decoder: [in] Decoder state.
+ * @param  in: [in] Compressed input.
+ * @param  in_len: [in] Number of input bytes.
+ * @param  in_used: [out] Number of input bytes consumed.
+ * @param  out: [out] Output buffer.
+ * @param  out_len: [in] Output buffer size.
+ * @return Number of bytes written to out.
+ * @note   Input can be split anywhere, state (including partial bits and an
+ *         unfinished copy) is kept between calls. RAM use is the 2KB window.
+ */
+size_t lzss_decode(LzssDecoder_t* decoder, const uint8_t* in, size_t in_len, size_t* in_used,
+                   uint8_t* out, size_t out_len) {
+    uint16_t mask = (uint16_t)((1u << decoder->window_bits) - 1);
+    size_t pos = 0;
+    size_t produced = 0;
+    uint16_t value;
+
+    while (produced < out_len) {
+        // Finish the pending copy first
+        if (decoder->remaining > 0) {
+            uint8_t c = decoder->window[(decoder->head - decoder->distance) & mask];
+            decoder->window[decoder->head] = c;
+            decoder->head = (decoder->head + 1) & mask;
+            decoder->remaining--;
+            out[produced++] = c;
+            continue;
+        }
+
+        if (decoder->state == LZSS_STATE_TAG) {
+            if (!lzss_get_bits(decoder, 1, in, in_len, &pos, &value)) {
+                break;
+            }
+            decoder->state = value ? LZSS_STATE_LITERAL : LZSS_STATE_INDEX;
+        } else if (decoder->state == LZSS_STATE_LITERAL) {
+            if (!lzss_get_bits(decoder, 8, in, in_len, &pos, &value)) {
+                break;
+            }
+            decoder->window[decoder->head] = (uint8_t)value;
+            decoder->head = (decoder->head + 1) & mask;
+            out[produced++] = (uint8_t)value;
+            decoder->state = LZSS_STATE_TAG;
+        } else if (decoder->state == LZSS_STATE_INDEX) {
+            if (!lzss_get_bits(decoder, decoder->window_bits, in, in_len, &pos, &value)) {
+                break;
+            }
+            decoder->distance = value + 1;
+            decoder->state = LZSS_STATE_COUNT;
+        } else {
+            if (!lzss_get_bits(decoder, decoder->lookahead_bits, in, in_len, &pos, &value)) {
+                break;
+            }
+            decoder->remaining = value + 1;
+            decoder->state = LZSS_STATE_TAG;
+        }
+    }
+
+    *in_used = pos;
+    return produced;
+}
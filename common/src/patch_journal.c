@@ -0,0 +1,141 @@
+#include "patch_journal.h"
+#include <string.h>
+
+/* Private functions ---------------------------------------------------------*/
+static uint32_t patch_journal_check(const PatchJournalRecord_t* record);
+static int patch_journal_is_erased(const PatchJournalRecord_t* record);
+
+
+/**
+ * @brief  Computes the integrity word of a journal record.
+ * @param  record: [in] Pointer to the record.
+ * @return Integrity word for the record contents.
+ */
+static uint32_t patch_journal_check(const PatchJournalRecord_t* record) {
+    uint32_t fields = ((uint32_t)record->type << 24) | ((uint32_t)record->sector << 16) |
+                      ((uint32_t)record->slot << 8) | record->reserved;
+
+    return ~(record->magic ^ fields ^ record->value);
+}
+
+/**
+ * @brief  Checks whether a record slot is still erased.
+ * @param  record: [in] Pointer to the record in flash.
+ * @return 1 if all bytes are 0xFF, 0 otherwise.
+ */
+static int patch_journal_is_erased(const PatchJournalRecord_t* record) {
+    const uint32_t* words = (const uint32_t*)record;
+
+    for (size_t i = 0; i < sizeof(PatchJournalRecord_t) / 4; i++) {
+        if (words[i] != 0xFFFFFFFF) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief  Rebuilds the in-place patch state from the journal.
+ * @param  state: [out] Journal state of the last session.
+ * @return 1 if an in-place patch is in progress, 0 otherwise.
+ * @note   Torn records (power lost while programming) fail the integrity check and
+ *         are skipped. Each BEGIN starts a new session.
+ */
+int patch_journal_load(PatchJournalState_t* state) {
+    memset(state, 0, sizeof(PatchJournalState_t));
+    memset(state->saved_slot, PATCH_JOURNAL_NONE, sizeof(state->saved_slot));
+
+    const PatchJournalRecord_t* records = (const PatchJournalRecord_t*)PATCH_JOURNAL_ADDR;
+    size_t count = PATCH_JOURNAL_SIZE / sizeof(PatchJournalRecord_t);
+
+    for (size_t i = 0; i < count; i++) {
+        const PatchJournalRecord_t* record = &records[i];
+
+        if (record->magic != PATCH_JOURNAL_MAGIC || record->check != patch_journal_check(record)) {
+            continue;
+        }
+
+        switch (record->type) {
+            case PATCH_JOURNAL_BEGIN:
+                memset(state, 0, sizeof(PatchJournalState_t));
+                memset(state->saved_slot, PATCH_JOURNAL_NONE, sizeof(state->saved_slot));
+                state->active = 1;
+                state->patch_id = record->value;
+                break;
+
+            case PATCH_JOURNAL_SAVED:
+                if (record->sector < PATCH_JOURNAL_MAX_SECTORS) {
+                    // A scratch slot holds one sector, drop the previous owner
+                    for (size_t j = 0; j < PATCH_JOURNAL_MAX_SECTORS; j++) {
+                        if (state->saved_slot[j] == record->slot) {
+                            state->saved_slot[j] = PATCH_JOURNAL_NONE;
+                        }
+                    }
+                    state->saved_slot[record->sector] = record->slot;
+                }
+                break;
+
+            case PATCH_JOURNAL_DONE:
+                if (record->sector > state->done) {
+                    state->done = record->sector;
+                }
+                break;
+
+            case PATCH_JOURNAL_END:
+                state->active = 0;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return state->active;
+}
+
+/**
+ * @brief  Checks whether an in-place patch was interrupted.
+ * @return 1 if the journal has an unfinished session, 0 otherwise.
+ */
+int patch_journal_is_active(void) {
+    PatchJournalState_t state;
+    return patch_journal_load(&state);
+}
+
+/**
+ * @brief  Appends a record to the journal.
+ * @param  type: [in] Record type.
+ * @param  sector: [in] Slot sector the record refers to.
+ * @param  slot: [in] Scratch slot the record refers to.
+ * @param  value: [in] Record value.
+ * @return 1 on success, 0 if the journal is full or the write failed.
+ * @note   The record goes after the last programmed slot, so a torn record is never
+ *         programmed over.
+ */
+int patch_journal_append(PatchJournalType_t type, uint8_t sector, uint8_t slot, uint32_t value) {
+    const PatchJournalRecord_t* records = (const PatchJournalRecord_t*)PATCH_JOURNAL_ADDR;
+    size_t count = PATCH_JOURNAL_SIZE / sizeof(PatchJournalRecord_t);
+
+    // Find the end of the programmed records
+    size_t next = count;
+    while (next > 0 && patch_journal_is_erased(&records[next - 1])) {
+        next--;
+    }
+
+    if (next >= count) {
+        return 0;
+    }
+
+    PatchJournalRecord_t record = {
+        .magic = PATCH_JOURNAL_MAGIC,
+        .type = (uint8_t)type,
+        .sector = sector,
+        .slot = slot,
+        .reserved = 0xFF,
+        .value = value
+    };
+    record.check = patch_journal_check(&record);
+
+    return flash_write((uint32_t)&records[next], (const uint8_t*)&record, sizeof(record));
+}
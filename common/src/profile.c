@@ -0,0 +1,94 @@
+#include "profile.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ENABLE_PROFILING
+
+static const char* const PROFILE_NAMES[PROFILE_COUNTER_COUNT] = {
+    "xmodem_byte",
+    "crc16",
+    "gcm_update",
+    "flash_write",
+    "flash_erase",
+    "rx_overflow",
+    "tx_full"
+};
+
+static volatile ProfileStats_t profile_stats[PROFILE_COUNTER_COUNT];
+
+
+/**
+ * @brief  Clears all counters and makes sure the cycle counter runs.
+ * @note   The boot stage normally starts DWT, this covers a debugger-loaded image.
+ */
+void profile_reset(void) {
+    if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+
+    memset((void*)profile_stats, 0, sizeof(profile_stats));
+}
+
+/**
+ * @brief  Adds one call of the given duration to a counter.
+ * @param  id: [in] Counter.
+ * @param  cycles: [in] Duration in DWT cycles, 0 for events.
+ * @note   RX overflows are recorded from the USART interrupt. Each counter is only
+ *         written from one context, so no locking is needed.
+ */
+void profile_record(ProfileCounter_t id, uint32_t cycles) {
+    if (id >= PROFILE_COUNTER_COUNT) {
+        return;
+    }
+
+    volatile ProfileStats_t* stats = &profile_stats[id];
+    stats->calls++;
+    stats->cycles += cycles;
+    if (cycles > stats->max_cycles) {
+        stats->max_cycles = cycles;
+    }
+}
+
+/**
+ * @brief  Reads a counter.
+ * @param  id: [in] Counter.
+ * @return Pointer to the counter, NULL if id is out of range.
+ */
+const ProfileStats_t* profile_get(ProfileCounter_t id) {
+    if (id >= PROFILE_COUNTER_COUNT) {
+        return NULL;
+    }
+
+    return (const ProfileStats_t*)&profile_stats[id];
+}
+
+/**
+ * @brief  Formats one counter as a report row (see PROFILE_REPORT_HEADER).
+ * @param  index: [in] Counter index.
+ * @param  buffer: [out] Output buffer.
+ * @param  size: [in] Output buffer size.
+ * @return Row length, 0 if index is past the last counter.
+ * @note   Time is converted with the current core clock.
+ */
+size_t profile_format_row(uint32_t index, char* buffer, size_t size) {
+    if (index >= PROFILE_COUNTER_COUNT) {
+        return 0;
+    }
+
+    const ProfileStats_t* stats = profile_get((ProfileCounter_t)index);
+    uint32_t mhz = SystemCoreClock / 1000000U;
+    uint32_t total_us = (uint32_t)(stats->cycles / (mhz ? mhz : 1));
+    uint32_t avg_cycles = stats->calls ? (uint32_t)(stats->cycles / stats->calls) : 0;
+
+    int len = snprintf(buffer, size, "%-14s %7lu %12lu %8lu %8lu\r\n", PROFILE_NAMES[index],
+                       (unsigned long)stats->calls, (unsigned long)total_us,
+                       (unsigned long)avg_cycles, (unsigned long)stats->max_cycles);
+    if (len < 0) {
+        return 0;
+    }
+
+    return (size_t)len < size ? (size_t)len : size - 1;
+}
+
+#endif /* ENABLE_PROFILING */
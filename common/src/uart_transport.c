@@ -3,52 +3,175 @@
 #include "stm32f4xx_ll_system.h"
 #include "stm32f4xx_ll_cortex.h"
 #include "stm32f4xx_ll_utils.h"
+#include "stm32f4xx_ll_rcc.h"
 #include "stm32f4xx_ll_usart.h"
 #include "uart_transport.h"
+#include "profile.h"
+
+// Fixed wiring of a USART instance
+typedef struct {
+    USART_TypeDef* usart;
+    IRQn_Type irqn;
+    uint8_t apb2;               // Clocked from APB2, APB1 otherwise
+    uint32_t clock;             // Peripheral clock enable bit on its bus
+    GPIO_TypeDef* gpio;         // Default TX and RX pins
+    uint32_t gpio_clock;
+    uint32_t tx_pin;
+    uint32_t rx_pin;
+    uint32_t alternate;
+    uint32_t rts_pin;           // Flow control pins on the same port, 0 if not bonded out
+    uint32_t cts_pin;
+} UARTTransport_Port_t;
 
 // UART transport state
 typedef struct {
     UARTTransport_Config_t* config;
+    const UARTTransport_Port_t* port;
     XmodemManager_t xmodem;
     RingBuffer_t tx_buffer;
     RingBuffer_t rx_buffer;
     uint8_t receive_mode;
+    uint32_t baudrate;          // Line rate set now, config->baudrate until changed
+    volatile uint8_t rts_held;  // RTS deasserted, the RX ring buffer is above high water
+    UARTTransport_Errors_t errors;
 } UARTTransport_State_t;
 
-static UARTTransport_State_t uart_state;
+// USART1 and USART6 sit on APB2 at twice the APB1 clock of USART2. The RTS and CTS
+// pins of USART6 are on port G, which the 100-pin STM32F407VG does not have.
+static const UARTTransport_Port_t uart_ports[] = {
+    { USART1, USART1_IRQn, 1, LL_APB2_GRP1_PERIPH_USART1, GPIOA, LL_AHB1_GRP1_PERIPH_GPIOA, LL_GPIO_PIN_9, LL_GPIO_PIN_10, LL_GPIO_AF_7,
+      LL_GPIO_PIN_12, LL_GPIO_PIN_11 },
+    { USART2, USART2_IRQn, 0, LL_APB1_GRP1_PERIPH_USART2, GPIOA, LL_AHB1_GRP1_PERIPH_GPIOA, LL_GPIO_PIN_2, LL_GPIO_PIN_3, LL_GPIO_AF_7,
+      LL_GPIO_PIN_1, LL_GPIO_PIN_0 },
+    { USART6, USART6_IRQn, 1, LL_APB2_GRP1_PERIPH_USART6, GPIOC, LL_AHB1_GRP1_PERIPH_GPIOC, LL_GPIO_PIN_6, LL_GPIO_PIN_7, LL_GPIO_AF_8,
+      0, 0 }
+};
+
+#define UART_PORT_COUNT (sizeof(uart_ports) / sizeof(uart_ports[0]))
+
+// Buffers only for the ports in use, each port takes a state on its first init
+static UARTTransport_State_t uart_states[UART_TRANSPORT_MAX_PORTS];
+static UARTTransport_State_t* uart_port_state[UART_PORT_COUNT];
+
+// Port the uart_transport_* calls act on, the one initialized or selected last
+static UARTTransport_State_t* uart_active = &uart_states[0];
+
+static const UARTTransport_Port_t* uart_transport_find_port(const USART_TypeDef* usart);
+static void uart_transport_service(UARTTransport_State_t* state);
+static void uart_transport_rx_taken(UARTTransport_State_t* state);
+static uint32_t uart_transport_clock(const UARTTransport_State_t* state);
+static uint32_t uart_transport_divider(const UARTTransport_State_t* state, uint32_t baudrate);
+
+/**
+  * @brief This function handles USART1 global interrupt.
+  */
+void USART1_IRQHandler(void) {
+    uart_transport_service(uart_port_state[0]);
+}
 
 /**
   * @brief This function handles USART2 global interrupt.
   */
 void USART2_IRQHandler(void) {
-    uart_transport_irq_handler();
+    uart_transport_service(uart_port_state[1]);
+}
+
+/**
+  * @brief This function handles USART6 global interrupt.
+  */
+void USART6_IRQHandler(void) {
+    uart_transport_service(uart_port_state[2]);
+}
+
+/**
+ * @brief Look up the wiring of a USART instance.
+ * @param usart USART instance.
+ * @return Port entry, NULL if the transport does not drive this instance.
+ */
+static const UARTTransport_Port_t* uart_transport_find_port(const USART_TypeDef* usart) {
+    for (uint32_t i = 0; i < UART_PORT_COUNT; i++) {
+        if (uart_ports[i].usart == usart) {
+            return &uart_ports[i];
+        }
+    }
+    
+    return NULL;
 }
 
 /**
  * @brief Initialize UART transport with the given configuration.
  * @param config Pointer to UARTTransport_Config_t.
  * @return 0 on success, -1 on failure.
+ * @note The port becomes the one the uart_transport_* calls act on. Without pins in the
+ *       configuration the instance's default ones are used: PA9/PA10 for USART1,
+ *       PA2/PA3 for USART2 and PC6/PC7 for USART6. With flow control CTS is PA11 on
+ *       USART1 and PA0 on USART2, RTS is PA12 and PA1.
  */
 int uart_transport_init(void* config) {
     UARTTransport_Config_t* uart_config = (UARTTransport_Config_t*)config;
-    uart_state.config = uart_config;
+    const UARTTransport_Port_t* port = uart_transport_find_port(uart_config->usart);
+    if (port == NULL || (uart_config->flow_control && port->rts_pin == 0)) {
+        return -1;
+    }
+    
+    // Take a state, or keep the one of an earlier init
+    uint32_t index = (uint32_t)(port - uart_ports);
+    UARTTransport_State_t* state = uart_port_state[index];
+    for (uint32_t i = 0; state == NULL && i < UART_TRANSPORT_MAX_PORTS; i++) {
+        if (uart_states[i].port == NULL) {
+            state = &uart_states[i];
+        }
+    }
+    if (state == NULL) {
+        return -1;
+    }
+    
+    NVIC_DisableIRQ(port->irqn);
+    state->config = uart_config;
+    state->port = port;
+    uart_port_state[index] = state;
     
     // Initialize ring buffers
-    ring_buffer_init(&uart_state.tx_buffer);
-    ring_buffer_init(&uart_state.rx_buffer);
+    ring_buffer_init(&state->tx_buffer);
+    ring_buffer_init(&state->rx_buffer);
     
-    // Enable USART2 peripheral clock
-    LL_APB1_GRP1_EnableClock(LL_APB1_GRP1_PERIPH_USART2);
+    // Enable the USART and GPIO clocks
+    if (port->apb2) {
+        LL_APB2_GRP1_EnableClock(port->clock);
+    } else {
+        LL_APB1_GRP1_EnableClock(port->clock);
+    }
     
-    // PA2=TX, PA3=RX
+    // TX and RX pins, custom pins have their GPIO clock enabled by the caller
     LL_GPIO_InitTypeDef GPIO_InitStruct = {0};
-    GPIO_InitStruct.Pin = LL_GPIO_PIN_2 | LL_GPIO_PIN_3;
+    GPIO_TypeDef* gpio = port->gpio;
+    GPIO_InitStruct.Pin = port->tx_pin | port->rx_pin;
+    GPIO_InitStruct.Alternate = port->alternate;
+    if (uart_config->gpio != NULL) {
+        gpio = uart_config->gpio;
+        GPIO_InitStruct.Pin = uart_config->tx_pin | uart_config->rx_pin;
+        GPIO_InitStruct.Alternate = uart_config->alternate;
+    } else {
+        LL_AHB1_GRP1_EnableClock(port->gpio_clock);
+    }
     GPIO_InitStruct.Mode = LL_GPIO_MODE_ALTERNATE;
     GPIO_InitStruct.Speed = LL_GPIO_SPEED_FREQ_VERY_HIGH;
     GPIO_InitStruct.OutputType = LL_GPIO_OUTPUT_PUSHPULL;
     GPIO_InitStruct.Pull = LL_GPIO_PULL_NO;
-    GPIO_InitStruct.Alternate = LL_GPIO_AF_7;
-    LL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+    LL_GPIO_Init(gpio, &GPIO_InitStruct);
+    
+    // CTS holds the transmitter in hardware, RTS follows the RX ring buffer fill
+    state->rts_held = 0;
+    if (uart_config->flow_control) {
+        GPIO_InitStruct.Pin = port->cts_pin;
+        GPIO_InitStruct.Alternate = port->alternate;
+        LL_GPIO_Init(port->gpio, &GPIO_InitStruct);
+        
+        LL_GPIO_ResetOutputPin(port->gpio, port->rts_pin);
+        GPIO_InitStruct.Pin = port->rts_pin;
+        GPIO_InitStruct.Mode = LL_GPIO_MODE_OUTPUT;
+        LL_GPIO_Init(port->gpio, &GPIO_InitStruct);
+    }
     
     // Initialize USART using LL functions
     LL_USART_InitTypeDef USART_InitStruct = {0};
@@ -59,8 +182,9 @@ int uart_transport_init(void* config) {
     USART_InitStruct.StopBits = LL_USART_STOPBITS_1;
     USART_InitStruct.Parity = LL_USART_PARITY_NONE;
     USART_InitStruct.TransferDirection = LL_USART_DIRECTION_TX_RX;
-    USART_InitStruct.HardwareFlowControl = LL_USART_HWCONTROL_NONE;
-    USART_InitStruct.OverSampling = LL_USART_OVERSAMPLING_16;
+    USART_InitStruct.HardwareFlowControl = uart_config->flow_control ? LL_USART_HWCONTROL_CTS : LL_USART_HWCONTROL_NONE;
+    USART_InitStruct.OverSampling = uart_transport_divider(state, uart_config->baudrate) < 16 ?
+                                    LL_USART_OVERSAMPLING_8 : LL_USART_OVERSAMPLING_16;
     
     // Initialize USART
     if (LL_USART_Init(uart_config->usart, &USART_InitStruct) != SUCCESS) {
@@ -73,8 +197,8 @@ int uart_transport_init(void* config) {
     // Enable UART receive interrupt
     LL_USART_EnableIT_RXNE(uart_config->usart);
     
-    NVIC_SetPriority(USART2_IRQn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 0, 0));
-    NVIC_EnableIRQ(USART2_IRQn);
+    NVIC_SetPriority(port->irqn, NVIC_EncodePriority(NVIC_GetPriorityGrouping(), 0, 0));
+    NVIC_EnableIRQ(port->irqn);
     
     // Initialize XMODEM if needed
     if (uart_config->use_xmodem) {
@@ -85,14 +209,113 @@ int uart_transport_init(void* config) {
             .image_hdr_size = uart_config->image_hdr_size
         };
         
-        xmodem_init(&uart_state.xmodem, &xmodem_config);
+        xmodem_init(&state->xmodem, &xmodem_config);
+    }
+    
+    state->receive_mode = 0;
+    state->baudrate = uart_config->baudrate;
+    memset(&state->errors, 0, sizeof(state->errors));
+    uart_active = state;
+    
+    return 0;
+}
+
+/**
+ * @brief Make an initialized port the one the uart_transport_* calls act on.
+ * @param usart USART instance.
+ * @return 0 on success, -1 if the port was not initialized.
+ */
+int uart_transport_select(USART_TypeDef* usart) {
+    const UARTTransport_Port_t* port = uart_transport_find_port(usart);
+    if (port == NULL || uart_port_state[port - uart_ports] == NULL) {
+        return -1;
+    }
+    
+    uart_active = uart_port_state[port - uart_ports];
+    return 0;
+}
+
+/**
+ * @brief Get the clock of a port's USART, the bus it sits on.
+ * @param state Port state.
+ * @return Peripheral clock in Hz.
+ */
+static uint32_t uart_transport_clock(const UARTTransport_State_t* state) {
+    LL_RCC_ClocksTypeDef clocks;
+    LL_RCC_GetSystemClocksFreq(&clocks);
+    
+    return (state->port != NULL && state->port->apb2) ? clocks.PCLK2_Frequency : clocks.PCLK1_Frequency;
+}
+
+/**
+ * @brief Work out the nearest divider for a line rate.
+ * @param state Port state.
+ * @param baudrate Requested rate.
+ * @return Peripheral clock over the rate, rounded. 16 and up is set at 16x oversampling,
+ *         8 to 15 at 8x, anything lower is out of reach.
+ */
+static uint32_t uart_transport_divider(const UARTTransport_State_t* state, uint32_t baudrate) {
+    if (baudrate == 0) {
+        return 0;
+    }
+    
+    return (uart_transport_clock(state) + baudrate / 2) / baudrate;
+}
+
+/**
+ * @brief Work out the line rate the USART generates for a requested one.
+ * @param baudrate Requested rate.
+ * @return Rate from the nearest divider, 0 if it is out of range.
+ * @note 8x oversampling doubles the top rate (PCLK2 / 8, 5.6 Mbaud on USART1 and USART6)
+ *       but leaves the receiver less margin for clock error.
+ */
+uint32_t uart_transport_actual_baudrate(uint32_t baudrate) {
+    uint32_t divider = uart_transport_divider(uart_active, baudrate);
+    if (divider < 8 || divider > 0xFFFF) {
+        return 0;
+    }
+    
+    return uart_transport_clock(uart_active) / divider;
+}
+
+/**
+ * @brief Change the line rate.
+ * @param baudrate New rate.
+ * @return 0 on success, -1 if the USART cannot generate it.
+ * @note Waits for pending transmission to finish, and drops what was received
+ *       at the old rate.
+ */
+int uart_transport_set_baudrate(uint32_t baudrate) {
+    if (uart_transport_actual_baudrate(baudrate) == 0) {
+        return -1;
     }
     
-    uart_state.receive_mode = 0;
+    USART_TypeDef* usart = uart_active->config->usart;
+    uint32_t oversampling = uart_transport_divider(uart_active, baudrate) < 16 ?
+                            LL_USART_OVERSAMPLING_8 : LL_USART_OVERSAMPLING_16;
+    
+    while (!uart_transport_is_tx_complete()) {}
+    
+    LL_USART_Disable(usart);
+    LL_USART_SetOverSampling(usart, oversampling);
+    LL_USART_SetBaudRate(usart, uart_transport_clock(uart_active), oversampling, baudrate);
+    LL_USART_Enable(usart);
+    
+    uart_active->baudrate = baudrate;
+    ring_buffer_clear(&uart_active->rx_buffer);
+    uart_transport_rx_taken(uart_active);
     
     return 0;
 }
 
+/**
+ * @brief Get the line rate set now.
+ * @return Rate in baud.
+ */
+uint32_t uart_transport_get_baudrate(void) {
+    return uart_active->baudrate;
+}
+
 
 /**
  * @brief Send a data buffer over UART.
@@ -107,16 +330,17 @@ int uart_transport_send(const uint8_t* data, size_t len) {
     
     size_t sent = 0;
     for (size_t i = 0; i < len; i++) {
-        if (ring_buffer_write(&uart_state.tx_buffer, data[i])) {
+        if (ring_buffer_write(&uart_active->tx_buffer, data[i])) {
             sent++;
         } else {
+            PROFILE_EVENT(PROFILE_TX_FULL);
             break; // Buffer full
         }
     }
     
     // Start transmission if not already in progress
-    if (!ring_buffer_is_empty(&uart_state.tx_buffer)) {
-        LL_USART_EnableIT_TXE(uart_state.config->usart);
+    if (!ring_buffer_is_empty(&uart_active->tx_buffer)) {
+        LL_USART_EnableIT_TXE(uart_active->config->usart);
     }
     
     return sent;
@@ -129,10 +353,10 @@ int uart_transport_send(const uint8_t* data, size_t len) {
  */
 void uart_transport_send_byte(uint8_t byte) {
     // Wait until transmit buffer is empty
-    while (!LL_USART_IsActiveFlag_TXE(uart_state.config->usart)) {}
+    while (!LL_USART_IsActiveFlag_TXE(uart_active->config->usart)) {}
     
     // Write data to transmit register
-    LL_USART_TransmitData8(uart_state.config->usart, byte);
+    LL_USART_TransmitData8(uart_active->config->usart, byte);
 }
 
 /**
@@ -148,13 +372,15 @@ int uart_transport_receive(uint8_t* data, size_t len) {
     
     size_t received = 0;
     for (size_t i = 0; i < len; i++) {
-        if (ring_buffer_read(&uart_state.rx_buffer, &data[i])) {
+        if (ring_buffer_read(&uart_active->rx_buffer, &data[i])) {
             received++;
         } else {
             break; // No more data
         }
     }
     
+    uart_transport_rx_taken(uart_active);
+    
     return received;
 }
 
@@ -164,8 +390,8 @@ int uart_transport_receive(uint8_t* data, size_t len) {
  * @return 1 if complete, 0 otherwise.
  */
 int uart_transport_is_tx_complete(void) {
-    return ring_buffer_is_empty(&uart_state.tx_buffer) && 
-           LL_USART_IsActiveFlag_TC(uart_state.config->usart);
+    return ring_buffer_is_empty(&uart_active->tx_buffer) && 
+           LL_USART_IsActiveFlag_TC(uart_active->config->usart);
 }
 
 /**
@@ -174,36 +400,37 @@ int uart_transport_is_tx_complete(void) {
  */
 int uart_transport_process(void) {
     // Process XMODEM if in receive mode
-    if (uart_state.receive_mode && uart_state.config->use_xmodem) {
+    if (uart_active->receive_mode && uart_active->config->use_xmodem) {
         uint8_t byte;
         
         // Process any bytes in the RX buffer
-        while (ring_buffer_read(&uart_state.rx_buffer, &byte)) {
-            XmodemError_t result = xmodem_process_byte(&uart_state.xmodem, byte);
+        while (ring_buffer_read(&uart_active->rx_buffer, &byte)) {
+            uart_transport_rx_taken(uart_active);
+            XmodemError_t result = xmodem_process_byte(&uart_active->xmodem, byte);
             
             // Handle XMODEM response
-            if (xmodem_should_send_byte(&uart_state.xmodem)) {
-                uint8_t response = xmodem_get_response(&uart_state.xmodem);
+            if (xmodem_should_send_byte(&uart_active->xmodem)) {
+                uint8_t response = xmodem_get_response(&uart_active->xmodem);
                 uart_transport_send(&response, 1);
             }
             
             // Check transfer status
             if (result == XMODEM_ERROR_TRANSFER_COMPLETE) {
-                uart_state.receive_mode = 0;
+                uart_active->receive_mode = 0;
                 return 1; // Success
             } else if (result != XMODEM_ERROR_NONE) {
                 // Any error other than NONE indicates transfer issues
                 if (result != XMODEM_ERROR_CRC_ERROR && 
                     result != XMODEM_ERROR_SEQUENCE_ERROR) {
-                    uart_state.receive_mode = 0;
+                    uart_active->receive_mode = 0;
                     return -1; // Error
                 }
             }
             
             // Check state
-            XmodemState_t state = xmodem_get_state(&uart_state.xmodem);
+            XmodemState_t state = xmodem_get_state(&uart_active->xmodem);
             if (state == XMODEM_STATE_COMPLETE || state == XMODEM_STATE_ERROR) {
-                uart_state.receive_mode = 0;
+                uart_active->receive_mode = 0;
                 return (state == XMODEM_STATE_COMPLETE) ? 1 : -1;
             }
         }
@@ -216,7 +443,27 @@ int uart_transport_process(void) {
  * @brief Clear the UART RX buffer.
  */
 void uart_transport_clear_rx(void) {
-    ring_buffer_clear(&uart_state.rx_buffer);
+    ring_buffer_clear(&uart_active->rx_buffer);
+    uart_transport_rx_taken(uart_active);
+}
+
+/**
+ * @brief Copy the receive error counters.
+ * @param errors Counters of the active port since its init.
+ */
+void uart_transport_get_errors(UARTTransport_Errors_t* errors) {
+    *errors = uart_active->errors;
+}
+
+/**
+ * @brief Assert RTS again once the RX ring buffer is down to low water.
+ * @param state Port state.
+ */
+static void uart_transport_rx_taken(UARTTransport_State_t* state) {
+    if (state->rts_held && ring_buffer_len(&state->rx_buffer) <= UART_TRANSPORT_RTS_LOW_WATER) {
+        state->rts_held = 0;
+        LL_GPIO_ResetOutputPin(state->port->gpio, state->port->rts_pin);
+    }
 }
 
 
@@ -226,11 +473,11 @@ void uart_transport_clear_rx(void) {
  */
 int uart_transport_deinit(void) {
     // Disable UART interrupts
-    LL_USART_DisableIT_RXNE(uart_state.config->usart);
-    LL_USART_DisableIT_TXE(uart_state.config->usart);
+    LL_USART_DisableIT_RXNE(uart_active->config->usart);
+    LL_USART_DisableIT_TXE(uart_active->config->usart);
     
     // Disable UART
-    LL_USART_Disable(uart_state.config->usart);
+    LL_USART_Disable(uart_active->config->usart);
     
     return 0;
 }
@@ -241,15 +488,16 @@ int uart_transport_deinit(void) {
  * @return 0 on success, -1 if XMODEM is not enabled.
  */
 int uart_transport_xmodem_receive(uint32_t target_addr) {
-    if (!uart_state.config->use_xmodem) {
+    if (!uart_active->config->use_xmodem) {
         return -1;
     }
     
     // Clear RX buffer
-    ring_buffer_clear(&uart_state.rx_buffer);
+    ring_buffer_clear(&uart_active->rx_buffer);
+    uart_transport_rx_taken(uart_active);
     
-    xmodem_start(&uart_state.xmodem, target_addr);
-    uart_state.receive_mode = 1;
+    xmodem_start(&uart_active->xmodem, target_addr);
+    uart_active->receive_mode = 1;
     
     return 0;
 }
@@ -259,7 +507,7 @@ int uart_transport_xmodem_receive(uint32_t target_addr) {
  * @return Current XmodemState_t value.
  */
 XmodemState_t uart_transport_xmodem_state(void) {
-    return xmodem_get_state(&uart_state.xmodem);
+    return xmodem_get_state(&uart_active->xmodem);
 }
 
 
@@ -267,21 +515,63 @@ XmodemState_t uart_transport_xmodem_state(void) {
  * @brief Handle UART interrupt events like TXE, RXNE and errors.
  */
 void uart_transport_irq_handler(void) {
-    USART_TypeDef* usart = uart_state.config->usart;
+    uart_transport_service(uart_active);
+}
+
+/**
+ * @brief Serve the interrupt of one port.
+ * @param state Port state, NULL if the port was never initialized.
+ */
+static void uart_transport_service(UARTTransport_State_t* state) {
+    if (state == NULL) {
+        return;
+    }
+    
+    USART_TypeDef* usart = state->config->usart;
+    
+    // Latch SR once, the DR read below clears ORE, NE, FE and PE along with RXNE
+    uint32_t sr = LL_USART_ReadReg(usart, SR);
+    
+    // Count error flags
+    if (sr & USART_SR_ORE) {
+        state->errors.overrun++;
+    }
+    if (sr & USART_SR_NE) {
+        state->errors.noise++;
+    }
+    if (sr & USART_SR_FE) {
+        state->errors.framing++;
+    }
+    if (sr & USART_SR_PE) {
+        state->errors.parity++;
+    }
     
     // Check for RXNE
-    if(LL_USART_IsActiveFlag_RXNE(usart) && 
+    if((sr & USART_SR_RXNE) && 
        LL_USART_IsEnabledIT_RXNE(usart)) {
         // Read byte from USART and store in RX buffer
         uint8_t byte = LL_USART_ReceiveData8(usart);
-        ring_buffer_write(&uart_state.rx_buffer, byte);
+        if (!ring_buffer_write(&state->rx_buffer, byte)) {
+            state->errors.dropped++;
+            PROFILE_EVENT(PROFILE_RX_OVERFLOW);
+        }
+        
+        // Ask the sender to pause before the buffer runs out
+        if (state->config->flow_control && !state->rts_held &&
+            ring_buffer_len(&state->rx_buffer) >= UART_TRANSPORT_RTS_HIGH_WATER) {
+            state->rts_held = 1;
+            LL_GPIO_SetOutputPin(state->port->gpio, state->port->rts_pin);
+        }
+    } else if (sr & (USART_SR_ORE | USART_SR_NE | USART_SR_FE | USART_SR_PE)) {
+        // No byte was taken, the SR read above and this DR read clear the flags
+        (void)LL_USART_ReceiveData8(usart);
     }
     
     // Check for TXE
-    if(LL_USART_IsActiveFlag_TXE(usart) && 
+    if((sr & USART_SR_TXE) && 
        LL_USART_IsEnabledIT_TXE(usart)) {
         uint8_t byte;
-        if(ring_buffer_read(&uart_state.tx_buffer, &byte)) {
+        if(ring_buffer_read(&state->tx_buffer, &byte)) {
             // Send byte
             LL_USART_TransmitData8(usart, byte);
         } else {
@@ -289,18 +579,6 @@ void uart_transport_irq_handler(void) {
             LL_USART_DisableIT_TXE(usart);
         }
     }
-    
-    // Check for error flags
-    if(LL_USART_IsActiveFlag_ORE(usart) || 
-       LL_USART_IsActiveFlag_NE(usart) || 
-       LL_USART_IsActiveFlag_FE(usart) || 
-       LL_USART_IsActiveFlag_PE(usart)) {
-        // Clear error flags
-        LL_USART_ClearFlag_ORE(usart);
-        LL_USART_ClearFlag_NE(usart);
-        LL_USART_ClearFlag_FE(usart);
-        LL_USART_ClearFlag_PE(usart);
-    }
 }
 
 /**
@@ -308,7 +586,7 @@ void uart_transport_irq_handler(void) {
  * @return Pointer to RX RingBuffer_t.
  */
 RingBuffer_t* get_uart_rx_buffer(void) {
-    return &uart_state.rx_buffer;
+    return &uart_active->rx_buffer;
 }
 
 
@@ -317,5 +595,5 @@ RingBuffer_t* get_uart_rx_buffer(void) {
  * @return Pointer to TX RingBuffer_t.
  */
 RingBuffer_t* get_uart_tx_buffer(void) {
-    return &uart_state.tx_buffer;
+    return &uart_active->tx_buffer;
 }
\ No newline at end of file
@@ -0,0 +1,160 @@
+#include "verify_cache.h"
+#include "crc.h"
+
+/* Private functions ---------------------------------------------------------*/
+static VerifyCache_t* verify_cache_get(void);
+static uint32_t verify_cache_entry_check(const VerifyCacheEntry_t* entry);
+static uint32_t verify_cache_header_crc(uint32_t addr);
+static VerifyCacheEntry_t* verify_cache_find(VerifyCache_t* cache, uint32_t addr);
+
+
+/**
+ * @brief  Returns the cache record in backup SRAM with bus access enabled.
+ * @return Pointer to the cache record.
+ * @note   Access is re-enabled on every call because prepare_for_boot() resets the
+ *         PWR block (clearing DBP) before each hand-off.
+ */
+static VerifyCache_t* verify_cache_get(void) {
+    __HAL_RCC_PWR_CLK_ENABLE();
+    HAL_PWR_EnableBkUpAccess();
+    __HAL_RCC_BKPSRAM_CLK_ENABLE();
+
+    return (VerifyCache_t*)VERIFY_CACHE_ADDR;
+}
+
+/**
+ * @brief  Computes the integrity word of a cache entry.
+ * @param  entry: [in] Pointer to the cache entry.
+ * @return Integrity word for the entry contents.
+ * @note   Guards against random backup SRAM contents after VBAT loss being taken as a proof.
+ */
+static uint32_t verify_cache_entry_check(const VerifyCacheEntry_t* entry) {
+    return ~(entry->image_addr ^ entry->header_crc ^ entry->image_crc ^ entry->data_size ^ VERIFY_CACHE_MAGIC);
+}
+
+/**
+ * @brief  Calculates the CRC of the compact header fields at a given address.
+ * @param  addr: [in] Address of the image header.
+ * @return CRC of the first sizeof(ImageHeader_Packet_t) bytes.
+ * @note   Binds the cached proof to the exact header (magic, version, size and CRC).
+ */
+static uint32_t verify_cache_header_crc(uint32_t addr) {
+    return crc_calculate_memory(addr, sizeof(ImageHeader_Packet_t));
+}
+
+/**
+ * @brief  Finds the cache entry that belongs to a slot address.
+ * @param  cache: [in] Pointer to the cache record.
+ * @param  addr: [in] Slot address.
+ * @return Pointer to the matching entry or NULL.
+ */
+static VerifyCacheEntry_t* verify_cache_find(VerifyCache_t* cache, uint32_t addr) {
+    for (uint32_t i = 0; i < VERIFY_CACHE_ENTRIES; i++) {
+        if (cache->entries[i].image_addr == addr) {
+            return &cache->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief  Enables the backup SRAM and formats the cache record if needed.
+ * @note   The record survives system resets and image hand-offs. It is lost on power
+ *         cycle unless VBAT is present, which only costs one full verification.
+ */
+void verify_cache_init(void) {
+    VerifyCache_t* cache = verify_cache_get();
+
+    if (cache->magic != VERIFY_CACHE_MAGIC) {
+        memset(cache, 0, sizeof(VerifyCache_t));
+        cache->magic = VERIFY_CACHE_MAGIC;
+    }
+}
+
+/**
+ * @brief  Looks up a verification proof for the image at a given address.
+ * @param  addr: [in] Start address of the image header in flash.
+ * @return 1 if the cached proof matches the current header, 0 otherwise.
+ * @note   A hit means the image was fully CRC-verified with this exact header and
+ *         the slot has not been written by the updater since.
+ */
+int verify_cache_lookup(uint32_t addr) {
+    verify_cache_init();
+    VerifyCache_t* cache = verify_cache_get();
+
+    VerifyCacheEntry_t* entry = verify_cache_find(cache, addr);
+    if (entry == NULL || entry->check != verify_cache_entry_check(entry)) {
+        return 0;
+    }
+
+    const ImageHeader_Packet_t* header = (const ImageHeader_Packet_t*)addr;
+    if (entry->image_crc != header->crc || entry->data_size != header->data_size) {
+        return 0;
+    }
+
+    return entry->header_crc == verify_cache_header_crc(addr);
+}
+
+/**
+ * @brief  Stores a verification proof for the image at a given address.
+ * @param  addr: [in] Start address of the image header in flash.
+ * @note   Caller must have verified the image CRC against the current header.
+ * @note   Reuses the slot's entry, or the first free one; the oldest entry 0 is replaced otherwise.
+ */
+void verify_cache_store(uint32_t addr) {
+    verify_cache_init();
+    VerifyCache_t* cache = verify_cache_get();
+
+    VerifyCacheEntry_t* entry = verify_cache_find(cache, addr);
+    if (entry == NULL) {
+        entry = verify_cache_find(cache, 0);
+    }
+    if (entry == NULL) {
+        entry = &cache->entries[0];
+    }
+
+    const ImageHeader_Packet_t* header = (const ImageHeader_Packet_t*)addr;
+
+    entry->image_addr = addr;
+    entry->header_crc = verify_cache_header_crc(addr);
+    entry->image_crc = header->crc;
+    entry->data_size = header->data_size;
+    entry->check = verify_cache_entry_check(entry);
+}
+
+/**
+ * @brief  Invalidates the verification proof for a slot.
+ * @param  addr: [in] Start address of the image header in flash.
+ * @note   Must be called before the updater erases or writes the slot.
+ */
+void verify_cache_invalidate(uint32_t addr) {
+    verify_cache_init();
+    VerifyCache_t* cache = verify_cache_get();
+
+    VerifyCacheEntry_t* entry = verify_cache_find(cache, addr);
+    if (entry != NULL) {
+        memset(entry, 0, sizeof(VerifyCacheEntry_t));
+    }
+}
+
+/**
+ * @brief  Verifies the image at a given address, using the cached proof when possible.
+ * @param  addr: [in] Start address of the image header in flash.
+ * @param  header_size: [in] Size of the image header in bytes.
+ * @return 1 if the image is verified, 0 otherwise.
+ * @note   On a cache miss the full CRC is calculated and the result is cached.
+ */
+int verify_image_cached(uint32_t addr, uint32_t header_size) {
+    if (verify_cache_lookup(addr)) {
+        return 1;
+    }
+
+    if (!verify_firmware_crc(addr, header_size)) {
+        verify_cache_invalidate(addr);
+        return 0;
+    }
+
+    verify_cache_store(addr);
+    return 1;
+}
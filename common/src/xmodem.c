@@ -1,4 +1,6 @@
 #include <xmodem.h>
+#include "patch_journal.h"
+#include "profile.h"
 
 // Default AES-128 key
 #ifdef FIRMWARE_ENCRYPTED
@@ -21,6 +23,17 @@ static const uint8_t HeaderAES[16] = {
 
 #define DATA_SIZE 128
 
+// Decoder for compressed full images, one transfer runs at a time
+static LzssDecoder_t unpack_decoder;
+static uint8_t unpack_buffer[XMODEM_UNPACK_SIZE];
+
+// Image header of a direct transfer, written last. The header area is larger than
+// ImageHeader_t (0x1F8 bytes), the rest is kept so the slot gets it as sent
+static union {
+    ImageHeader_t header;
+    uint8_t bytes[XMODEM_HELD_HEADER_SIZE];
+} held_header;
+
 /**
  * @brief Calculates CRC-16 bit for the given data buffer.
  * @param data Pointer to the data buffer.
@@ -28,6 +41,7 @@ static const uint8_t HeaderAES[16] = {
  * @return uint16_t Computed CRC-16 value.
  */
 static uint16_t calculate_crc16(const uint8_t* data, size_t len) {
+    PROFILE_BEGIN(PROFILE_CRC16);
     uint16_t crc = 0;
     
     for (size_t i = 0; i < len; i++) {
@@ -41,9 +55,28 @@ static uint16_t calculate_crc16(const uint8_t* data, size_t len) {
         }
     }
     
+    PROFILE_END(PROFILE_CRC16);
     return crc;
 }
 
+#ifdef FIRMWARE_ENCRYPTED
+/**
+ * @brief Decrypts packet data with the transfer's GCM context.
+ * @param manager Pointer to the XmodemManager_t instance.
+ * @param len Number of bytes to decrypt.
+ * @param input Ciphertext.
+ * @param output Plaintext buffer.
+ * @return int Result of mbedtls_gcm_update(), 0 on success.
+ */
+static int xmodem_gcm_update(XmodemManager_t* manager, size_t len, const uint8_t* input, uint8_t* output) {
+    PROFILE_BEGIN(PROFILE_GCM_UPDATE);
+    int result = mbedtls_gcm_update(&manager->aes, len, input, output);
+    PROFILE_END(PROFILE_GCM_UPDATE);
+
+    return result;
+}
+#endif
+
 /**
  * @brief Initializes the XMODEM manager with the specified configuration.
  * @note This function sets up the internal state and prepares for an XMODEM transfer.
@@ -74,20 +107,345 @@ void xmodem_init(XmodemManager_t* manager, const XmodemConfig_t* config) {
 }
 
 
+/**
+ * @brief Routes received image data to a sink instead of the flash staging area.
+ * @note Must be called before xmodem_start(). The sink receives plaintext image data
+ * @note (header included) in transfer order; pass NULL to restore staging.
+ * @param manager Pointer to the XmodemManager_t structure.
+ * @param sink Data consumer callback or NULL.
+ * @param ctx Context pointer passed to the sink.
+ */
+void xmodem_set_sink(XmodemManager_t* manager, XmodemDataSink_t sink, void* ctx) {
+    manager->data_sink = sink;
+    manager->sink_ctx = ctx;
+}
+
+/**
+ * @brief Receives full images at another address than the staging area.
+ * @note Must be called before xmodem_start(). Used to write an application straight into
+ * @note its inactive A/B slot; patches are still received in the staging area.
+ * @param manager Pointer to the XmodemManager_t structure.
+ * @param addr Start address of the receive area or 0 for PATCH_ADDR.
+ */
+void xmodem_set_staging(XmodemManager_t* manager, uint32_t addr) {
+    manager->staging_addr = addr;
+    manager->hold_header = 0;
+}
+
+/**
+ * @brief Receives a full image straight into its destination slot.
+ * @note Must be called before xmodem_start(). The slot's first sector is erased when the
+ * @note transfer starts, which invalidates the old image; the new header is kept in RAM
+ * @note and only written by xmodem_commit_header(), so a cut transfer never leaves a
+ * @note valid-looking image. Patches are still received in the staging area.
+ * @param manager Pointer to the XmodemManager_t structure.
+ * @param addr Start address of the destination slot or 0 to restore staging.
+ */
+void xmodem_set_direct(XmodemManager_t* manager, uint32_t addr) {
+    xmodem_set_staging(manager, addr);
+    manager->hold_header = (addr != 0);
+}
+
+/**
+ * @brief Returns the image header held back by a direct transfer.
+ * @param manager Pointer to the XmodemManager_t structure.
+ * @return const ImageHeader_t* The header, or NULL if none is held or it is incomplete.
+ */
+const ImageHeader_t* xmodem_get_held_header(XmodemManager_t* manager) {
+    if (!manager->hold_header || manager->held_fill < manager->header_size) {
+        return NULL;
+    }
+
+    return &held_header.header;
+}
+
+/**
+ * @brief Writes the held header of a direct transfer to the destination slot.
+ * @note Call only after the image data has been verified against the held header.
+ * @param manager Pointer to the XmodemManager_t structure.
+ * @return int 1 on success, 0 if no header is held or the flash write fails.
+ */
+int xmodem_commit_header(XmodemManager_t* manager) {
+    if (xmodem_get_held_header(manager) == NULL) {
+        return 0;
+    }
+
+    if (!flash_write(manager->target_addr, held_header.bytes, manager->header_size)) {
+        return 0;
+    }
+
+    manager->hold_header = 0;
+    return 1;
+}
+
+/**
+ * @brief Points reception at a flash area and erases its first sector.
+ * @param manager Pointer to the XmodemManager_t structure.
+ * @param addr Start address of the area.
+ * @return int 1 on success, 0 if the address is not in flash.
+ */
+static int xmodem_prepare_area(XmodemManager_t* manager, uint32_t addr) {
+    uint8_t sector = flash_get_sector(addr);
+    if (sector == 0xFF) {
+        return 0;
+    }
+
+    manager->target_addr = addr;
+    manager->current_addr = addr;
+    // The staging area stops at the patch journal, any other area is an application slot
+    manager->area_end = (addr >= PATCH_ADDR) ? PATCH_JOURNAL_ADDR : addr + APP_SLOT_SIZE;
+    manager->current_sector = sector;
+    manager->current_sector_base = flash_get_sector_start(sector);
+
+    // Erase the area before we start receiving
+    flash_erase_sector(addr);
+    // Erase the next sector too while it is still part of the area
+    if (addr + 0x20000 < manager->area_end) {
+        flash_erase_sector(addr + 0x20000);
+    }
+    manager->first_sector_erased = 1;
+
+    return 1;
+}
+
+/**
+ * @brief Writes image data to the staging area.
+ * @note Erases the next sector when the write crosses a sector boundary. Data that
+ * @note would not fit in the receive area fails the write.
+ * @param manager Pointer to the XmodemManager_t structure.
+ * @param data Pointer to the data to write.
+ * @param len Number of bytes to write.
+ * @return int 1 on success, 0 on flash failure or if the data runs past the area.
+ */
+static int xmodem_write_data(XmodemManager_t* manager, const uint8_t* data, size_t len) {
+    // An empty write would take the sector before current_addr for the next one
+    if (len == 0) {
+        return 1;
+    }
+
+    // Direct transfer: the header stays in RAM, its flash area is left erased
+    if (manager->hold_header && manager->held_fill < manager->header_size) {
+        size_t held = manager->header_size - manager->held_fill;
+        if (held > len) {
+            held = len;
+        }
+
+        memcpy(held_header.bytes + manager->held_fill, data, held);
+        manager->held_fill += held;
+        manager->current_addr += held;
+        data += held;
+        len -= held;
+
+        if (len == 0) {
+            return 1;
+        }
+    }
+
+    // An image larger than its area would run into the next one
+    if (len > manager->area_end - manager->current_addr) {
+        return 0;
+    }
+
+    // Handle sector boundary if needed
+    uint32_t next_addr = manager->current_addr + len;
+    uint8_t current_sector = manager->current_sector;
+    uint8_t target_sector = flash_get_sector(next_addr - 1);
+    
+    if (target_sector != current_sector && target_sector != 0xFF) {
+        // Crossing sector boundary
+        uint32_t next_sector_base = flash_get_sector_start(target_sector);
+        
+        // Erase the next sector
+        if (!flash_erase_sector(next_sector_base)) {
+            return 0;
+        }
+        
+        // Calculate data split
+        uint32_t current_sector_end = flash_get_sector_end(current_sector);
+        uint32_t bytes_in_current = current_sector_end - manager->current_addr + 1;
+        // Align to 4 bytes
+        bytes_in_current = (bytes_in_current / 4) * 4;
+        
+        if (bytes_in_current > len) {
+            bytes_in_current = len;
+        }
+        
+        // Write to current sector
+        if (bytes_in_current > 0) {
+            if (!flash_write(manager->current_addr, data, bytes_in_current)) {
+                return 0;
+            }
+        }
+        
+        // Write to next sector
+        uint32_t bytes_in_next = len - bytes_in_current;
+        if (bytes_in_next > 0) {
+            if (!flash_write(next_sector_base, data + bytes_in_current, bytes_in_next)) {
+                return 0;
+            }
+        }
+        
+        // Update tracking info
+        manager->current_addr = next_sector_base + bytes_in_next;
+        manager->current_sector = target_sector;
+        manager->current_sector_base = next_sector_base;
+    } else {
+        // Standard write in the same sector
+        if (!flash_write(manager->current_addr, data, len)) {
+            return 0;
+        }
+        
+        manager->current_addr += len;
+    }
+    
+    return 1;
+}
+
+/**
+ * @brief Decompresses the data of a compressed image into the staging area.
+ * @note Output is collected in a fixed buffer and written in XMODEM_UNPACK_SIZE chunks,
+ * @note so flash writes stay aligned. Bytes past the compressed payload are padding.
+ * @param manager Pointer to the XmodemManager_t structure.
+ * @param data Pointer to the compressed data (container header first).
+ * @param len Number of bytes.
+ * @return int 1 on success, 0 on an invalid container or flash failure.
+ */
+static int xmodem_unpack_data(XmodemManager_t* manager, const uint8_t* data, size_t len) {
+    uint8_t* lz_header = (uint8_t*)&manager->lz_header;
+    size_t used = 0;
+
+    // Container header
+    while (used < len && manager->lz_fill < sizeof(LzssHeader_t)) {
+        lz_header[manager->lz_fill++] = data[used++];
+        if (manager->lz_fill == sizeof(LzssHeader_t) &&
+            (!lzss_header_valid(&manager->lz_header) || manager->lz_header.raw_size != manager->unpack_size ||
+             !lzss_decoder_init(&unpack_decoder, manager->lz_header.window_bits, manager->lz_header.lookahead_bits))) {
+            return 0;
+        }
+    }
+
+    if (manager->lz_fill < sizeof(LzssHeader_t)) {
+        return 1;
+    }
+
+    size_t available = len - used;
+    if (available > manager->lz_header.payload_size - manager->lz_consumed) {
+        available = manager->lz_header.payload_size - manager->lz_consumed;
+    }
+
+    // Decode until the input and the decoder's buffered bits are used up
+    while (manager->lz_produced < manager->lz_header.raw_size) {
+        size_t space = XMODEM_UNPACK_SIZE - manager->unpack_fill;
+        if (space > manager->lz_header.raw_size - manager->lz_produced) {
+            space = manager->lz_header.raw_size - manager->lz_produced;
+        }
+
+        size_t in_used;
+        size_t n = lzss_decode(&unpack_decoder, data + used, available, &in_used,
+                               unpack_buffer + manager->unpack_fill, space);
+        used += in_used;
+        available -= in_used;
+        manager->lz_consumed += in_used;
+        manager->unpack_fill += n;
+        manager->lz_produced += n;
+
+        // Write full chunks and the tail of the image
+        if (manager->unpack_fill == XMODEM_UNPACK_SIZE || manager->lz_produced == manager->lz_header.raw_size) {
+            if (manager->unpack_fill > 0 && !xmodem_write_data(manager, unpack_buffer, manager->unpack_fill)) {
+                return 0;
+            }
+            manager->unpack_fill = 0;
+        }
+
+        if (n == 0) {
+            break;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Stores received image data in the staging area or hands it to the sink.
+ * @note A full image with IMAGE_FLAG_COMPRESSED is decompressed on the way to flash and
+ * @note staged with the flag cleared. Patches and sink data are passed through as received.
+ * @param manager Pointer to the XmodemManager_t structure.
+ * @param data Pointer to the data to store.
+ * @param len Number of bytes to store.
+ * @return int 1 on success, 0 on flash, decompression or sink failure.
+ */
+static int xmodem_store_data(XmodemManager_t* manager, const uint8_t* data, size_t len) {
+    if (manager->data_sink != NULL) {
+        return manager->data_sink(manager->sink_ctx, data, len);
+    }
+
+    // The first block holds the packet header
+    if (manager->compressed < 0 && manager->stored_size == 0 && len >= sizeof(ImageHeader_Packet_t)) {
+        const ImageHeader_Packet_t* header = (const ImageHeader_Packet_t*)data;
+        manager->compressed = (!header->is_patch && (header->flags & IMAGE_FLAG_COMPRESSED)) ? 1 : 0;
+        manager->unpack_size = header->data_size;
+
+        // A patch received for a slot still goes to the staging area
+        if (header->is_patch && manager->target_addr != PATCH_ADDR) {
+            manager->hold_header = 0;
+            if (!xmodem_prepare_area(manager, PATCH_ADDR)) {
+                return 0;
+            }
+        }
+    }
+
+    if (manager->compressed != 1) {
+        manager->stored_size += len;
+        return xmodem_write_data(manager, data, len);
+    }
+
+    size_t used = 0;
+
+    // Image header is stored as received, apart from the compressed flag
+    if (manager->stored_size < manager->header_size) {
+        used = manager->header_size - manager->stored_size;
+        if (used > len) {
+            used = len;
+        }
+
+        memcpy(unpack_buffer, data, used);
+        size_t flags_offset = offsetof(ImageHeader_Packet_t, flags);
+        if (manager->stored_size <= flags_offset && flags_offset < manager->stored_size + used) {
+            unpack_buffer[flags_offset - manager->stored_size] &= ~IMAGE_FLAG_COMPRESSED;
+        }
+
+        if (!xmodem_write_data(manager, unpack_buffer, used)) {
+            return 0;
+        }
+        manager->stored_size += used;
+    }
+
+    if (used == len) {
+        return 1;
+    }
+
+    manager->stored_size += len - used;
+    return xmodem_unpack_data(manager, data + used, len - used);
+}
+
+
 /**
  * @brief Starts the XMODEM reception process at the specified address.
  * @note Initializes internal variables, prepares flash sectors for writing, and validates
  * @note the intended target address against known application areas. If encryption is enabled,
- * @note related buffers and flags are initialized.
+ * @note the GCM context is keyed again and related buffers and flags are initialized.
  * @param manager Pointer to the XmodemManager_t structure.
  * @param intended_addr The destination memory address for the incoming firmware.
  */
 void xmodem_start(XmodemManager_t* manager, uint32_t intended_addr) {
+    // Profiling counters cover one transfer
+    PROFILE_RESET();
+
     manager->state = XMODEM_STATE_SENDING_INITIAL_C;
     manager->intended_addr = intended_addr;
     
-    // using PATCH_ADDR as staging area for reception
-    uint32_t staging_addr = PATCH_ADDR;
+    // using PATCH_ADDR as staging area for reception unless overridden
+    uint32_t staging_addr = manager->staging_addr ? manager->staging_addr : PATCH_ADDR;
     manager->target_addr = staging_addr;
     manager->current_addr = staging_addr;
     manager->expected_packet_num = 1;
@@ -104,20 +462,47 @@ void xmodem_start(XmodemManager_t* manager, uint32_t intended_addr) {
     manager->expected_total_packets = 0;
     manager->last_packet_useful_bytes = 0;
     manager->is_patch = 0;
+    manager->stored_size = 0;
+    manager->compressed = -1;
+    manager->lz_fill = 0;
+    manager->lz_consumed = 0;
+    manager->lz_produced = 0;
+    manager->unpack_size = 0;
+    manager->unpack_fill = 0;
+    manager->held_fill = 0;
+    
+    // The held header must fit its RAM copy
+    if (manager->hold_header && manager->header_size > sizeof(held_header)) {
+        manager->state = XMODEM_STATE_ERROR;
+        return;
+    }
     
 #ifdef FIRMWARE_ENCRYPTED
     if (manager->use_encryption) {
+        // A cancelled or finished transfer freed the context, key it again
+        mbedtls_gcm_free(&manager->aes);
+        mbedtls_gcm_init(&manager->aes);
+        if (mbedtls_gcm_setkey(&manager->aes, MBEDTLS_CIPHER_ID_AES, pKeyAES, 128) != 0) {
+            manager->state = XMODEM_STATE_ERROR;
+            return;
+        }
+
         memset(manager->nonce_counter, 0, sizeof(manager->nonce_counter));
         memset(manager->tag, 0, sizeof(manager->tag));
         memset(manager->decrypted_buffer, 0, sizeof(manager->decrypted_buffer));
         manager->gcm_initialized = 0;
         manager->remaining_size = 0;
         manager->tag_received = 0;
+        manager->tag_fill = 0;
     }
 #endif
     
-    // Set magic based on destination
+    // Set magic based on destination, either application slot takes an application
+#ifdef AB_SLOTS
+    if (intended_addr == manager->config.app_addr || intended_addr == APP_B_ADDR) {
+#else
     if (intended_addr == manager->config.app_addr) {
+#endif
         manager->expected_magic = IMAGE_MAGIC_APP;
         manager->expected_img_type = IMAGE_TYPE_APP;
     } else if (intended_addr == manager->config.updater_addr) {
@@ -131,18 +516,16 @@ void xmodem_start(XmodemManager_t* manager, uint32_t intended_addr) {
         return;
     }
     
-    // Determine sector for staging
-    uint8_t sector = flash_get_sector(staging_addr);
-    if (sector != 0xFF) {
-        manager->current_sector = sector;
-        manager->current_sector_base = flash_get_sector_start(sector);
-        
-        // Erase staging area before we start receiving
-        flash_erase_sector(staging_addr);
-        // Erase additional sector to ensure we have enough space
-        flash_erase_sector(staging_addr + 0x20000);
+    // Data goes to the sink, no staging area to prepare
+    if (manager->data_sink != NULL) {
+        manager->target_addr = 0xFFFFFFFF;
+        manager->current_addr = 0xFFFFFFFF;
         manager->first_sector_erased = 1;
-    } else {
+        return;
+    }
+    
+    // Prepare the staging area
+    if (!xmodem_prepare_area(manager, staging_addr)) {
         manager->state = XMODEM_STATE_ERROR;
         return;
     }
@@ -200,7 +583,7 @@ static int process_first_packet(XmodemManager_t* manager, const uint8_t* data) {
             }
             
             // Decrypt the data
-            if (mbedtls_gcm_update(&manager->aes, data_to_decrypt, data + 16, manager->decrypted_buffer) != 0) {
+            if (xmodem_gcm_update(manager, data_to_decrypt, data + 16, manager->decrypted_buffer) != 0) {
                 return 0;
             }
             
@@ -259,12 +642,11 @@ static int process_first_packet(XmodemManager_t* manager, const uint8_t* data) {
                 manager->first_sector_erased = 1;
             }
             
-            // Write decrypted data to flash
-            if (!flash_write(manager->current_addr, manager->decrypted_buffer, data_to_decrypt)) {
+            // Store decrypted data
+            if (!xmodem_store_data(manager, manager->decrypted_buffer, data_to_decrypt)) {
                 return 0;
             }
             
-            manager->current_addr += data_to_decrypt;
             manager->total_data_received += data_to_decrypt;
             manager->remaining_size -= data_to_decrypt;
             manager->first_packet_processed = 1;
@@ -354,13 +736,12 @@ static int process_first_packet(XmodemManager_t* manager, const uint8_t* data) {
             manager->first_sector_erased = 1;
         }
         
-        // Write first packet data to flash - the entire packet
-        if (!flash_write(manager->current_addr, data, DATA_SIZE)) {
+        // Store first packet data - the entire packet
+        if (!xmodem_store_data(manager, data, DATA_SIZE)) {
             return 0;
         }
         
         manager->total_data_received = DATA_SIZE;
-        manager->current_addr += DATA_SIZE;
         manager->first_packet_processed = 1;
         
         return 1;
@@ -391,68 +772,26 @@ static int process_data_packet(XmodemManager_t* manager, const uint8_t* data, ui
             // If there's data to decrypt
             if (useful_data > 0) {
                 // Decrypt the data
-                if (mbedtls_gcm_update(&manager->aes, useful_data, data, manager->decrypted_buffer) != 0) {
+                if (xmodem_gcm_update(manager, useful_data, data, manager->decrypted_buffer) != 0) {
                     return 0;
                 }
                 
-                // Handle sector boundary if needed
-                uint32_t next_addr = manager->current_addr + useful_data;
-                uint8_t current_sector = manager->current_sector;
-                uint8_t target_sector = flash_get_sector(next_addr - 1);
-                
-                if (target_sector != current_sector && target_sector != 0xFF) {
-                    // Crossing sector boundary - handle appropriately
-                    uint32_t next_sector_base = flash_get_sector_start(target_sector);
-                    
-                    // Erase the next sector
-                    if (!flash_erase_sector(next_sector_base)) {
-                        return 0;
-                    }
-                    
-                    // Calculate data split
-                    uint32_t current_sector_end = flash_get_sector_end(current_sector);
-                    uint32_t bytes_in_current = current_sector_end - manager->current_addr + 1;
-                    // Align to 4 bytes
-                    bytes_in_current = (bytes_in_current / 4) * 4;
-                    
-                    if (bytes_in_current > useful_data) {
-                        bytes_in_current = useful_data;
-                    }
-                    
-                    // Write to current sector
-                    if (bytes_in_current > 0) {
-                        if (!flash_write(manager->current_addr, manager->decrypted_buffer, bytes_in_current)) {
-                            return 0;
-                        }
-                    }
-                    
-                    // Write to next sector
-                    uint32_t bytes_in_next = useful_data - bytes_in_current;
-                    if (bytes_in_next > 0) {
-                        if (!flash_write(next_sector_base, manager->decrypted_buffer + bytes_in_current, bytes_in_next)) {
-                            return 0;
-                        }
-                    }
-                    
-                    // Update tracking info
-                    manager->current_addr = next_sector_base + bytes_in_next;
-                    manager->current_sector = target_sector;
-                    manager->current_sector_base = next_sector_base;
-                } else {
-                    // Standard write in the same sector
-                    if (!flash_write(manager->current_addr, manager->decrypted_buffer, useful_data)) {
-                        return 0;
-                    }
-                    
-                    manager->current_addr += useful_data;
+                if (!xmodem_store_data(manager, manager->decrypted_buffer, useful_data)) {
+                    return 0;
                 }
                 
                 manager->total_data_received += useful_data;
             }
             
-            // Extract the tag
-            if (useful_data + 16 <= DATA_SIZE) {
-                memcpy(manager->tag, data + useful_data, 16);
+            // Collect the tag, it may straddle this packet and the next one
+            size_t tag_bytes = sizeof(manager->tag) - manager->tag_fill;
+            if (tag_bytes > DATA_SIZE - useful_data) {
+                tag_bytes = DATA_SIZE - useful_data;
+            }
+            memcpy(manager->tag + manager->tag_fill, data + useful_data, tag_bytes);
+            manager->tag_fill += tag_bytes;
+
+            if (manager->tag_fill == sizeof(manager->tag)) {
                 manager->tag_received = 1;
                 
                 // Finalize GCM
@@ -472,56 +811,12 @@ static int process_data_packet(XmodemManager_t* manager, const uint8_t* data, ui
         }
         else {
             // Decrypt the full regular data packet
-            if (mbedtls_gcm_update(&manager->aes, DATA_SIZE, data, manager->decrypted_buffer) != 0) {
+            if (xmodem_gcm_update(manager, DATA_SIZE, data, manager->decrypted_buffer) != 0) {
                 return 0;
             }
             
-            // Handle sector boundary if needed
-            uint32_t next_addr = manager->current_addr + DATA_SIZE;
-            uint8_t current_sector = manager->current_sector;
-            uint8_t target_sector = flash_get_sector(next_addr - 1);
-            
-            if (target_sector != current_sector && target_sector != 0xFF) {
-                // Crossing sector boundary
-                uint32_t next_sector_base = flash_get_sector_start(target_sector);
-                
-                // Erase the next sector
-                if (!flash_erase_sector(next_sector_base)) {
-                    return 0;
-                }
-                
-                // Calculate data split
-                uint32_t current_sector_end = flash_get_sector_end(current_sector);
-                uint32_t bytes_in_current = current_sector_end - manager->current_addr + 1;
-                // Align to 4 bytes
-                bytes_in_current = (bytes_in_current / 4) * 4;
-                
-                // Write to current sector
-                if (bytes_in_current > 0) {
-                    if (!flash_write(manager->current_addr, manager->decrypted_buffer, bytes_in_current)) {
-                        return 0;
-                    }
-                }
-                
-                // Write to next sector
-                uint32_t bytes_in_next = DATA_SIZE - bytes_in_current;
-                if (bytes_in_next > 0) {
-                    if (!flash_write(next_sector_base, manager->decrypted_buffer + bytes_in_current, bytes_in_next)) {
-                        return 0;
-                    }
-                }
-                
-                // Update tracking info
-                manager->current_addr = next_sector_base + bytes_in_next;
-                manager->current_sector = target_sector;
-                manager->current_sector_base = next_sector_base;
-            } else {
-                // Standard write in the same sector
-                if (!flash_write(manager->current_addr, manager->decrypted_buffer, DATA_SIZE)) {
-                    return 0;
-                }
-                
-                manager->current_addr += DATA_SIZE;
+            if (!xmodem_store_data(manager, manager->decrypted_buffer, DATA_SIZE)) {
+                return 0;
             }
             
             manager->total_data_received += DATA_SIZE;
@@ -562,53 +857,8 @@ static int process_data_packet(XmodemManager_t* manager, const uint8_t* data, ui
     
     // If we have useful data to write
     if (useful_bytes > 0) {
-        // Check if we need to cross a sector boundary
-        uint32_t next_addr = manager->current_addr + useful_bytes;
-        uint8_t current_sector = manager->current_sector;
-        uint8_t target_sector = flash_get_sector(next_addr - 1);
-        
-        if (target_sector != current_sector && target_sector != 0xFF) {
-            // Crossing a sector boundary
-            uint32_t next_sector_base = flash_get_sector_start(target_sector);
-            
-            // Erase the next sector
-            if (!flash_erase_sector(next_sector_base)) {
-                return 0;
-            }
-            
-            // Calculate how much data goes in current sector
-            uint32_t current_sector_end = flash_get_sector_end(current_sector);
-            uint32_t bytes_in_current = current_sector_end - manager->current_addr + 1;
-            
-            // Align to 4
-            bytes_in_current = (bytes_in_current / 4) * 4;
-            
-            // Write to current sector if needed
-            if (bytes_in_current > 0) {
-                if (!flash_write(manager->current_addr, data, bytes_in_current)) {
-                    return 0;
-                }
-            }
-            
-            // Write to next sector
-            uint32_t bytes_in_next = useful_bytes - bytes_in_current;
-            if (bytes_in_next > 0) {
-                if (!flash_write(next_sector_base, data + bytes_in_current, bytes_in_next)) {
-                    return 0;
-                }
-            }
-            
-            // Update current address and sector tracking
-            manager->current_addr = next_sector_base + bytes_in_next;
-            manager->current_sector = target_sector;
-            manager->current_sector_base = next_sector_base;
-        } else {
-            // Standard write in the same sector
-            if (!flash_write(manager->current_addr, data, useful_bytes)) {
-                return 0;
-            }
-            
-            manager->current_addr += useful_bytes;
+        if (!xmodem_store_data(manager, data, useful_bytes)) {
+            return 0;
         }
     }
     
@@ -616,14 +866,14 @@ static int process_data_packet(XmodemManager_t* manager, const uint8_t* data, ui
 }
 
 /**
- * @brief Processes a single byte received during the XMODEM transfer.
+ * @brief Handles a single byte received during the XMODEM transfer.
  * @note Handles state transitions based on protocol, including SOH, EOT, CAN detection,
  * @note timeouts, CRC validation, packet sequence, and flash or encrypted data handling.
  * @param manager Pointer to the XmodemManager_t instance.
  * @param byte The received byte to process.
  * @return XmodemError_t Error or success status indicating how the byte was processed.
  */
-XmodemError_t xmodem_process_byte(XmodemManager_t* manager, uint8_t byte) {
+static XmodemError_t xmodem_handle_byte(XmodemManager_t* manager, uint8_t byte) {
     uint32_t current_time = HAL_GetTick();
     
     switch (manager->state) {
@@ -739,34 +989,7 @@ XmodemError_t xmodem_process_byte(XmodemManager_t* manager, uint8_t byte) {
                 
                 // Process data based on packet number
                 if (packet_num == 1 && !manager->first_packet_processed) {
-                    // Check if it's a patch by examining the header
-                    uint8_t* data = &manager->buffer[3];
-                    
-                    // Only check if we're targeting the application
-                    if (manager->target_addr == APP_ADDR) {
-                        // Check the is_patch flag in the header
-                        if (data[7] == 1) {
-                            // Set flag and switch target to PATCH_ADDR
-                            manager->is_patch = 1;
-                            
-                            // Erase patch sectors
-                            uint8_t sector = flash_get_sector(PATCH_ADDR);
-                            if (sector != 0xFF) {
-                                flash_erase_sector(PATCH_ADDR);
-                                // Erase additional sectors to ensure enough space
-                                flash_erase_sector(PATCH_ADDR + 0x20000);
-                            }
-                            
-                            // Update target address
-                            manager->target_addr = PATCH_ADDR;
-                            manager->current_addr = PATCH_ADDR;
-                            
-                            // Update current sector information
-                            manager->current_sector = flash_get_sector(PATCH_ADDR);
-                            manager->current_sector_base = flash_get_sector_start(manager->current_sector);
-                        }
-                    }
-                    
+                    // Patches are moved to the staging area once the header is decoded
                     // Process first packet as usual
                     if (!process_first_packet(manager, &manager->buffer[3])) {
                         manager->state = XMODEM_STATE_ERROR;
@@ -808,6 +1031,21 @@ XmodemError_t xmodem_process_byte(XmodemManager_t* manager, uint8_t byte) {
     }
 }
 
+/**
+ * @brief Processes a single byte received during the XMODEM transfer.
+ * @note Timed when profiling is enabled, see xmodem_handle_byte().
+ * @param manager Pointer to the XmodemManager_t instance.
+ * @param byte The received byte to process.
+ * @return XmodemError_t Error or success status indicating how the byte was processed.
+ */
+XmodemError_t xmodem_process_byte(XmodemManager_t* manager, uint8_t byte) {
+    PROFILE_BEGIN(PROFILE_XMODEM_BYTE);
+    XmodemError_t result = xmodem_handle_byte(manager, byte);
+    PROFILE_END(PROFILE_XMODEM_BYTE);
+
+    return result;
+}
+
 /**
  * @brief Determines whether a byte should be sent by the receiver.
  * @param manager Pointer to the XmodemManager_t instance.
@@ -889,7 +1127,8 @@ void xmodem_cancel_transfer(XmodemManager_t* manager) {
  */
 void xmodem_cleanup(XmodemManager_t* manager) {
 #ifdef FIRMWARE_ENCRYPTED
-    if (manager->use_encryption && manager->gcm_initialized) {
+    // The key context exists from xmodem_init() on, decryption started or not
+    if (manager->use_encryption) {
         mbedtls_gcm_free(&manager->aes);
         manager->gcm_initialized = 0;
     }
@@ -49,6 +49,91 @@ static int jp_fseek(janpatch_buffer *buffer, long int offset, int origin)
 }
 
 
+/**
+ * Reset the page cache of a stream
+ */
+static void jp_cache_init(janpatch_buffer *buffer)
+{
+    if (buffer->pages == 0) buffer->pages = 1;
+    if (buffer->pages > JANPATCH_MAX_PAGES) buffer->pages = JANPATCH_MAX_PAGES;
+
+    for (size_t ix = 0; ix < buffer->pages; ix++) {
+        buffer->slots[ix].page = 0xffffffff;
+        buffer->slots[ix].size = 0;
+        buffer->slots[ix].dirty_end = 0;
+        buffer->slots[ix].last_used = 0;
+    }
+
+    buffer->current_slot = 0;
+    buffer->clock = 0;
+    buffer->page_faults = 0;
+    buffer->page_flushes = 0;
+}
+
+/**
+ * Write the modified part of a cached page back to the stream
+ */
+static void jp_flush_page(janpatch_ctx *ctx, janpatch_buffer *buffer, janpatch_page *slot)
+{
+    if (slot->dirty_end == 0) return;
+
+    unsigned char *data = buffer->buffer + (size_t)(slot - buffer->slots) * buffer->size;
+
+    jp_fseek(buffer, slot->page * buffer->size, SEEK_SET);
+    jp_fwrite(ctx, data, 1, slot->dirty_end, buffer);
+    buffer->page_flushes++;
+
+    if (ctx->progress)
+    {
+        ctx->progress(buffer->position * 100 / ctx->max_file_size);
+    }
+
+    slot->dirty_end = 0;
+}
+
+/**
+ * Look up a page in the cache, on a miss the least recently used page is evicted
+ * (and written back if it was modified) and the page is read from the stream
+ */
+static janpatch_page* jp_get_page(janpatch_ctx *ctx, janpatch_buffer *buffer, uint32_t page)
+{
+    janpatch_page *slot = &buffer->slots[buffer->current_slot];
+
+    if (slot->page != page)
+    {
+        janpatch_page *victim = &buffer->slots[0];
+        slot = NULL;
+
+        for (size_t ix = 0; ix < buffer->pages; ix++) {
+            if (buffer->slots[ix].page == page) {
+                slot = &buffer->slots[ix];
+                break;
+            }
+            if (buffer->slots[ix].last_used < victim->last_used) {
+                victim = &buffer->slots[ix];
+            }
+        }
+
+        if (slot == NULL)
+        {
+            slot = victim;
+            jp_flush_page(ctx, buffer, slot);
+
+            unsigned char *data = buffer->buffer + (size_t)(slot - buffer->slots) * buffer->size;
+
+            jp_fseek(buffer, page * buffer->size, SEEK_SET);
+            slot->size = jp_fread(ctx, data, 1, buffer->size, buffer);
+            slot->page = page;
+            buffer->page_faults++;
+        }
+
+        buffer->current_slot = slot - buffer->slots;
+    }
+
+    slot->last_used = ++buffer->clock;
+    return slot;
+}
+
 /**
  * Get a character from the stream
  */
@@ -59,22 +144,17 @@ static int jp_getc(janpatch_ctx* ctx, janpatch_buffer* buffer)
 
     // calculate the current page...
     uint32_t page = ((unsigned long)position) / buffer->size;
+    janpatch_page *slot = jp_get_page(ctx, buffer, page);
 
-    if (page != buffer->current_page)
-    {
-        jp_fseek(buffer, page * buffer->size, SEEK_SET);
-        buffer->current_page_size = jp_fread(ctx, buffer->buffer, 1, buffer->size, buffer);
-        buffer->current_page = page;
-    }
+    size_t position_in_page = position % buffer->size;
 
-    int position_in_page = position % buffer->size;
-
-    if ((size_t)position_in_page >= buffer->current_page_size)
+    if (position_in_page >= slot->size)
     {
+        jp_fseek(buffer, position, SEEK_SET);
         return EOF;
     }
 
-    unsigned char b = buffer->buffer[position_in_page];
+    unsigned char b = buffer->buffer[buffer->current_slot * buffer->size + position_in_page];
     jp_fseek(buffer, position + 1, SEEK_SET);
     return b;
 }
@@ -91,31 +171,15 @@ static int jp_putc(int c, janpatch_ctx* ctx, janpatch_buffer* buffer)
 
     // calculate the current page...
     uint32_t page = ((unsigned long)position) / buffer->size;
+    janpatch_page *slot = jp_get_page(ctx, buffer, page);
 
-    if (page != buffer->current_page)
-    {
-        // flush the page buffer...
-        if (buffer->current_page != 0xFFFFFFFF)
-        {
-            jp_fseek(buffer, buffer->current_page * buffer->size, SEEK_SET);
-            jp_fwrite(ctx, buffer->buffer, 1, buffer->current_page_size, buffer);
+    size_t position_in_page = position % buffer->size;
 
-            if (ctx->progress)
-            {
-                ctx->progress(position * 100 / ctx->max_file_size);
-            }
-        }
-
-        // and read the next page...
-        jp_fseek(buffer, page * buffer->size, SEEK_SET);
-        jp_fread(ctx, buffer->buffer, 1, buffer->size, buffer);
-        buffer->current_page_size = buffer->size;
-        buffer->current_page = page;
+    buffer->buffer[buffer->current_slot * buffer->size + position_in_page] = (unsigned char)c;
+    if (position_in_page + 1 > slot->dirty_end) {
+        slot->dirty_end = position_in_page + 1;
     }
 
-    int position_in_page = position % buffer->size;
-
-    buffer->buffer[position_in_page] = (unsigned char)c;
     jp_fseek(buffer, position + 1, SEEK_SET);
 
     return 0;
@@ -123,24 +187,21 @@ static int jp_putc(int c, janpatch_ctx* ctx, janpatch_buffer* buffer)
 
 static void jp_final_flush(janpatch_ctx* ctx, janpatch_buffer* buffer)
 {
-    long position = buffer->position;
-    int position_in_page = position % buffer->size;
-
-    uint32_t page = ((unsigned long)position) / buffer->size;
+    // write back the modified pages in stream order
+    while (1) {
+        janpatch_page *first = NULL;
 
-    // if the page has changed we also need to flush the previous page
-    // this can happen when the last operation (e.g. jp_putc) has just crossed page boundary
-    if (page != buffer->current_page) {
-        // flush the page buffer...
-        if (buffer->current_page != 0xFFFFFFFF) {
-            jp_fseek(buffer, buffer->current_page * buffer->size, SEEK_SET);
-            jp_fwrite(ctx, buffer->buffer, 1, buffer->current_page_size, buffer);
+        for (size_t ix = 0; ix < buffer->pages; ix++) {
+            janpatch_page *slot = &buffer->slots[ix];
+            if (slot->dirty_end > 0 && (first == NULL || slot->page < first->page)) {
+                first = slot;
+            }
         }
-    }
 
-    // flush the new page buffer
-    jp_fseek(buffer, page * buffer->size, SEEK_SET);
-    jp_fwrite(ctx, buffer->buffer, 1, position_in_page, buffer);
+        if (first == NULL) break;
+
+        jp_flush_page(ctx, buffer, first);
+    }
 
     if (ctx->progress) {
         ctx->progress(100);
@@ -208,6 +269,7 @@ static int find_length(janpatch_ctx *ctx, janpatch_buffer *buffer)
     * If byte[0] is 253 => use (byte[1] << 8) + byte[2]
     * If byte[0] is 254 => use (byte[1] << 16) + (byte[2] << 8) + byte[3] (NOT VERIFIED)
     */
+    // bytes are read one statement at a time, the evaluation order of operands is unspecified
     uint8_t l = jp_getc(ctx, buffer);
     if (l <= 251)
     {
@@ -215,15 +277,22 @@ static int find_length(janpatch_ctx *ctx, janpatch_buffer *buffer)
     }
     else if (l == 252)
     {
-        return l + jp_getc(ctx, buffer) + 1;
+        uint8_t b0 = jp_getc(ctx, buffer);
+        return l + b0 + 1;
     }
     else if (l == 253)
     {
-        return (jp_getc(ctx, buffer) << 8) + jp_getc(ctx, buffer);
+        uint8_t b0 = jp_getc(ctx, buffer);
+        uint8_t b1 = jp_getc(ctx, buffer);
+        return (b0 << 8) + b1;
     }
     else if (l == 254)
     {
-        return (jp_getc(ctx, buffer) << 24) + (jp_getc(ctx, buffer) << 16) + (jp_getc(ctx, buffer) << 8) + (jp_getc(ctx, buffer));
+        uint8_t b0 = jp_getc(ctx, buffer);
+        uint8_t b1 = jp_getc(ctx, buffer);
+        uint8_t b2 = jp_getc(ctx, buffer);
+        uint8_t b3 = jp_getc(ctx, buffer);
+        return ((uint32_t)b0 << 24) + (b1 << 16) + (b2 << 8) + b3;
     }
     else
     {
@@ -233,55 +302,55 @@ static int find_length(janpatch_ctx *ctx, janpatch_buffer *buffer)
     // it's fine if we get over the end of the stream here, will be caught by the next function
 }
 
-int janpatch(janpatch_ctx ctx, JANPATCH_STREAM *source, JANPATCH_STREAM *patch, JANPATCH_STREAM *target)
+int janpatch(janpatch_ctx *ctx, JANPATCH_STREAM *source, JANPATCH_STREAM *patch, JANPATCH_STREAM *target)
 {
-    ctx.source_buffer.current_page = 0xffffffff;
-    ctx.patch_buffer.current_page = 0xffffffff;
-    ctx.target_buffer.current_page = 0xffffffff;
+    jp_cache_init(&ctx->source_buffer);
+    jp_cache_init(&ctx->patch_buffer);
+    jp_cache_init(&ctx->target_buffer);
 
-    ctx.source_buffer.position = 0;
-    ctx.patch_buffer.position = 0;
-    ctx.target_buffer.position = 0;
+    ctx->source_buffer.position = 0;
+    ctx->patch_buffer.position = 0;
+    ctx->target_buffer.position = 0;
 
-    ctx.source_buffer.stream = source;
-    ctx.patch_buffer.stream = patch;
-    ctx.target_buffer.stream = target;
+    ctx->source_buffer.stream = source;
+    ctx->patch_buffer.stream = patch;
+    ctx->target_buffer.stream = target;
 
     // look at the size of the source file...
-    if (ctx.progress != NULL && ctx.ftell != NULL)
+    if (ctx->progress != NULL && ctx->ftell != NULL)
     {
-        ctx.fseek(source, 0, SEEK_END);
-        ctx.max_file_size = ctx.ftell(source);
-        ctx.fseek(source, 0, SEEK_SET);
+        ctx->fseek(source, 0, SEEK_END);
+        ctx->max_file_size = ctx->ftell(source);
+        ctx->fseek(source, 0, SEEK_SET);
 
         // and at the size of the patch file
-        ctx.fseek(patch, 0, SEEK_END);
-        ctx.max_file_size += ctx.ftell(patch);
-        ctx.fseek(patch, 0, SEEK_SET);
+        ctx->fseek(patch, 0, SEEK_END);
+        ctx->max_file_size += ctx->ftell(patch);
+        ctx->fseek(patch, 0, SEEK_SET);
     }
     else
     {
-        ctx.progress = NULL;
+        ctx->progress = NULL;
     }
 
     int c;
-    while ((c = jp_getc(&ctx, &ctx.patch_buffer)) != EOF)
+    while ((c = jp_getc(ctx, &ctx->patch_buffer)) != EOF)
     {
         if (c == JANPATCH_OPERATION_ESC)
         {
-            c = jp_getc(&ctx, &ctx.patch_buffer);
+            c = jp_getc(ctx, &ctx->patch_buffer);
         }
         else if (c != -1)
         {
             // Rewind 1 character, for the one we just consummed, and set a default operation of MOD
-            jp_fseek(&ctx.patch_buffer, -1, SEEK_CUR);
+            jp_fseek(&ctx->patch_buffer, -1, SEEK_CUR);
             c = JANPATCH_OPERATION_MOD;
         }
         switch (c)
         {
             case JANPATCH_OPERATION_EQL:
             {
-                int length = find_length(&ctx, &ctx.patch_buffer);
+                int length = find_length(ctx, &ctx->patch_buffer);
                 if (length == -1)
                 {
                     return 1;
@@ -289,13 +358,13 @@ int janpatch(janpatch_ctx ctx, JANPATCH_STREAM *source, JANPATCH_STREAM *patch,
 
                 for (int ix = 0; ix < length; ix++)
                 {
-                    int r = jp_getc(&ctx, &ctx.source_buffer);
+                    int r = jp_getc(ctx, &ctx->source_buffer);
                     if (r < -1)
                     {
                         return 1;
                     }
 
-                    jp_putc(r, &ctx, &ctx.target_buffer);
+                    jp_putc(r, ctx, &ctx->target_buffer);
                 }
 
                 break;
@@ -305,7 +374,7 @@ int janpatch(janpatch_ctx ctx, JANPATCH_STREAM *source, JANPATCH_STREAM *patch,
                 // MOD means to modify the next series of bytes
                 // so just write everything (until the next ESC sequence) to the target JANPATCH_STREAM
                 // but also up the position in the source JANPATCH_STREAM every time
-                process_mod(&ctx, &ctx.source_buffer, &ctx.patch_buffer, &ctx.target_buffer, true);
+                process_mod(ctx, &ctx->source_buffer, &ctx->patch_buffer, &ctx->target_buffer, true);
                 break;
             }
             case JANPATCH_OPERATION_INS:
@@ -313,37 +382,37 @@ int janpatch(janpatch_ctx ctx, JANPATCH_STREAM *source, JANPATCH_STREAM *patch,
                 // INS inserts the sequence in the new JANPATCH_STREAM, but does not up the position of the source JANPATCH_STREAM
                 // so just write everything (until the next ESC sequence) to the target JANPATCH_STREAM
 
-                process_mod(&ctx, &ctx.source_buffer, &ctx.patch_buffer, &ctx.target_buffer, false);
+                process_mod(ctx, &ctx->source_buffer, &ctx->patch_buffer, &ctx->target_buffer, false);
                 break;
             }
             case JANPATCH_OPERATION_BKT:
             {
                 // BKT = backtrace, seek back in source JANPATCH_STREAM with X bytes...
-                int length = find_length(&ctx, &ctx.patch_buffer);
+                int length = find_length(ctx, &ctx->patch_buffer);
                 if (length == -1)
                 {
                     return 1;
                 }
 
-                jp_fseek(&ctx.source_buffer, -length, SEEK_CUR);
+                jp_fseek(&ctx->source_buffer, -length, SEEK_CUR);
 
                 break;
             }
             case JANPATCH_OPERATION_DEL:
             {
                 // DEL deletes bytes, so up the source stream with X bytes
-                int length = find_length(&ctx, &ctx.patch_buffer);
+                int length = find_length(ctx, &ctx->patch_buffer);
                 if (length == -1)
                 {
                     return 1;
                 }
 
-                jp_fseek(&ctx.source_buffer, length, SEEK_CUR);
+                jp_fseek(&ctx->source_buffer, length, SEEK_CUR);
                 break;
             }
             case -1: {
                 // End of file stream... rewind 1 character and break, this will yield back to main loop
-                jp_fseek(&ctx.source_buffer, -1, SEEK_CUR);
+                jp_fseek(&ctx->source_buffer, -1, SEEK_CUR);
                 break;
             }
             default:
@@ -353,7 +422,15 @@ int janpatch(janpatch_ctx ctx, JANPATCH_STREAM *source, JANPATCH_STREAM *patch,
         }
     }
 
-    jp_final_flush(&ctx, &ctx.target_buffer);
+    jp_final_flush(ctx, &ctx->target_buffer);
+
+    if (ctx->stats != NULL)
+    {
+        ctx->stats->source_faults = ctx->source_buffer.page_faults;
+        ctx->stats->patch_faults = ctx->patch_buffer.page_faults;
+        ctx->stats->target_faults = ctx->target_buffer.page_faults;
+        ctx->stats->target_flushes = ctx->target_buffer.page_flushes;
+    }
 
     return 0;
 }
\ No newline at end of file
@@ -5,7 +5,6 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <simple_fileio.h>
-#include <ring_buffer.h>
 
 #define JANPATCH_STREAM sfio_stream_t
 
@@ -17,15 +16,40 @@
 #error "JANPATCH_STREAM not defined, and not on POSIX system. Please specify the JANPATCH_STREAM macro"
 #endif
 
+// maximum number of cached pages per stream
+#ifndef JANPATCH_MAX_PAGES
+#define JANPATCH_MAX_PAGES 16
+#endif
+
+typedef struct {
+    uint32_t         page;          // page held by this slot, 0xFFFFFFFF if empty
+    size_t           size;          // number of valid bytes read from the stream
+    size_t           dirty_end;     // bytes [0, dirty_end) need to be written back
+    uint32_t         last_used;     // LRU stamp
+} janpatch_page;
+
 typedef struct {
-    unsigned char*   buffer;
-    size_t           size;
-    uint32_t         current_page;
-    size_t           current_page_size;
+    unsigned char*   buffer;        // pages * size bytes
+    size_t           size;          // page size
+    size_t           pages;         // number of pages in buffer (0 is treated as 1)
     JANPATCH_STREAM* stream;
     long int         position;
+
+    // page cache state, managed by janpatch
+    janpatch_page    slots[JANPATCH_MAX_PAGES];
+    size_t           current_slot;
+    uint32_t         clock;
+    uint32_t         page_faults;
+    uint32_t         page_flushes;
 } janpatch_buffer;
 
+typedef struct {
+    uint32_t source_faults;
+    uint32_t patch_faults;
+    uint32_t target_faults;
+    uint32_t target_flushes;
+} janpatch_stats;
+
 typedef struct {
     // fread/fwrite buffers
     janpatch_buffer source_buffer;
@@ -43,6 +67,9 @@ typedef struct {
 
     // the combination of the size of both the source + patch files (that's the max. the target file can be)
     long   max_file_size;
+
+    // optional, receives the page cache statistics when janpatch() returns
+    janpatch_stats* stats;
 }janpatch_ctx;
 
 enum {
@@ -63,6 +90,6 @@ enum {
  * @param target Target file stream
  * @return 0 if successful, non-zero on failure
  */
-int janpatch(janpatch_ctx ctx, JANPATCH_STREAM *source, JANPATCH_STREAM *patch, JANPATCH_STREAM *target);
+int janpatch(janpatch_ctx *ctx, JANPATCH_STREAM *source, JANPATCH_STREAM *patch, JANPATCH_STREAM *target);
 
 #endif /* _JANPATCH_H */
\ No newline at end of file
@@ -17,6 +17,9 @@ size_t sfio_fread(void *ptr, size_t size, size_t count, sfio_stream_t *stream)
         // Reading from flash memory
         uint32_t addr = stream->slot + stream->offset;
         memcpy(ptr, (void*)addr, count);
+    } else if (stream->type == SFIO_STREAM_CALLBACK) {
+        // Reading from a producer (e.g. a live transfer), which may deliver less
+        count = stream->cb.read ? stream->cb.read(stream->cb.ctx, stream->offset, (uint8_t*)ptr, count) : 0;
     } else {
         // Reading from RAM
         memcpy(ptr, stream->ptr + stream->offset, count);
@@ -47,6 +50,11 @@ size_t sfio_fwrite(const void *ptr, size_t size, size_t count, sfio_stream_t *st
         if (!flash_write(addr, (const uint8_t*)ptr, count)) {
             return 0; // Write failed
         }
+    } else if (stream->type == SFIO_STREAM_CALLBACK) {
+        // Writing to a consumer
+        if (!stream->cb.write || stream->cb.write(stream->cb.ctx, stream->offset, (const uint8_t*)ptr, count) != count) {
+            return 0; // Write failed
+        }
     } else {
         // Writing to RAM
         memcpy(stream->ptr + stream->offset, ptr, count);
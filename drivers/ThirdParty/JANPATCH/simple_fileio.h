@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <assert.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
@@ -8,8 +9,13 @@ typedef enum
 {
     SFIO_STREAM_SLOT,
     SFIO_STREAM_RAM,
+    SFIO_STREAM_CALLBACK,
 }sfio_stream_type_t;
 
+// Stream callbacks for SFIO_STREAM_CALLBACK, return the number of bytes transferred
+typedef size_t (*sfio_read_cb_t)(void *ctx, size_t offset, uint8_t *ptr, size_t count);
+typedef size_t (*sfio_write_cb_t)(void *ctx, size_t offset, const uint8_t *ptr, size_t count);
+
 typedef struct {
     sfio_stream_type_t type;
     size_t offset;
@@ -18,6 +24,11 @@ typedef struct {
 	{
         uint8_t *ptr;	// RAM pointer for SFIO_STREAM_RAM
         uint32_t slot;   // Image slot for SFIO_STREAM_SLOT
+        struct {
+            sfio_read_cb_t read;    // May be NULL for write-only streams
+            sfio_write_cb_t write;  // May be NULL for read-only streams
+            void *ctx;
+        } cb;            // Callbacks for SFIO_STREAM_CALLBACK
     };
 } sfio_stream_t;
 
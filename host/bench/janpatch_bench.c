@@ -0,0 +1,245 @@
+/**
+ * @file   janpatch_bench.c
+ * @brief  Replays a jdiff patch through janpatch with different page cache sizes.
+ *
+ * Reports page faults per stream and the number/size of target writes, which on the
+ * device map to flash page reads and flash program calls.
+ *
+ * Usage: janpatch_bench [-H] [-p page_size] [-s source_pages] [-t target_pages]
+ *                       old.bin patch.bin [new.bin]
+ *   -H  inputs carry the 512-byte image header (as produced by create_patch.py)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "janpatch.h"
+
+#define IMAGE_HDR_SIZE      0x200
+#define DEFAULT_PAGE_SIZE   2048
+#define PATCH_PAGES         2
+
+typedef struct {
+    uint8_t* data;
+    size_t   capacity;
+    size_t   length;        // Highest offset written
+    uint32_t writes;        // Number of write calls
+    size_t   bytes;         // Total bytes written
+} BenchTarget_t;
+
+typedef struct {
+    size_t   source_pages;
+    janpatch_stats stats;
+    uint32_t writes;
+    size_t   bytes;
+    double   ms;
+    int      result;
+    int      match;
+} BenchResult_t;
+
+// SLOT streams are not used on the host
+int flash_write(uint32_t addr, const uint8_t* data, size_t len) {
+    return 0;
+}
+
+/**
+ * @brief  Reads a whole file into memory.
+ * @param  path: [in] File name.
+ * @param  skip: [in] Number of leading bytes to drop.
+ * @param  size: [out] Number of bytes returned.
+ * @return Allocated buffer, or NULL on failure.
+ */
+static uint8_t* read_file(const char* path, size_t skip, size_t* size) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    if (length < (long)skip) {
+        fprintf(stderr, "%s is smaller than its header\n", path);
+        fclose(f);
+        return NULL;
+    }
+
+    fseek(f, (long)skip, SEEK_SET);
+    *size = (size_t)length - skip;
+
+    uint8_t* data = malloc(*size ? *size : 1);
+    if (data == NULL || fread(data, 1, *size, f) != *size) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+
+    fclose(f);
+    return data;
+}
+
+/**
+ * @brief  Target write callback, stands in for the flash programming of one page.
+ */
+static size_t bench_target_write(void* ctx, size_t offset, const uint8_t* ptr, size_t count) {
+    BenchTarget_t* target = (BenchTarget_t*)ctx;
+
+    if (offset + count > target->capacity) {
+        return 0;
+    }
+
+    memcpy(target->data + offset, ptr, count);
+    if (offset + count > target->length) {
+        target->length = offset + count;
+    }
+    target->writes++;
+    target->bytes += count;
+
+    return count;
+}
+
+/**
+ * @brief  Applies the patch once with the given cache configuration.
+ */
+static BenchResult_t bench_run(const uint8_t* old_data, size_t old_size, const uint8_t* patch_data, size_t patch_size,
+                               const uint8_t* new_data, size_t new_size, size_t page_size,
+                               size_t source_pages, size_t target_pages) {
+    BenchResult_t result;
+    memset(&result, 0, sizeof(result));
+    result.source_pages = source_pages;
+
+    unsigned char* source_buf = malloc(source_pages * page_size);
+    unsigned char* patch_buf = malloc(PATCH_PAGES * page_size);
+    unsigned char* target_buf = malloc(target_pages * page_size);
+
+    BenchTarget_t target_out;
+    memset(&target_out, 0, sizeof(target_out));
+    target_out.capacity = new_data ? new_size : old_size + patch_size;
+    target_out.data = calloc(target_out.capacity ? target_out.capacity : 1, 1);
+
+    janpatch_ctx ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.source_buffer.buffer = source_buf;
+    ctx.source_buffer.size = page_size;
+    ctx.source_buffer.pages = source_pages;
+    ctx.patch_buffer.buffer = patch_buf;
+    ctx.patch_buffer.size = page_size;
+    ctx.patch_buffer.pages = PATCH_PAGES;
+    ctx.target_buffer.buffer = target_buf;
+    ctx.target_buffer.size = page_size;
+    ctx.target_buffer.pages = target_pages;
+    ctx.fread = &sfio_fread;
+    ctx.fwrite = &sfio_fwrite;
+    ctx.fseek = &sfio_fseek;
+    ctx.ftell = NULL;
+    ctx.progress = NULL;
+    ctx.stats = &result.stats;
+
+    sfio_stream_t source;
+    source.type = SFIO_STREAM_RAM;
+    source.offset = 0;
+    source.size = old_size;
+    source.ptr = (uint8_t*)old_data;
+
+    sfio_stream_t patch;
+    patch.type = SFIO_STREAM_RAM;
+    patch.offset = 0;
+    patch.size = patch_size;
+    patch.ptr = (uint8_t*)patch_data;
+
+    sfio_stream_t target;
+    target.type = SFIO_STREAM_CALLBACK;
+    target.offset = 0;
+    target.size = target_out.capacity;
+    target.cb.read = NULL;
+    target.cb.write = bench_target_write;
+    target.cb.ctx = &target_out;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    result.result = janpatch(&ctx, &source, &patch, &target);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    result.ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    result.writes = target_out.writes;
+    result.bytes = target_out.bytes;
+    result.match = new_data == NULL ? -1 :
+                   (target_out.length >= new_size && memcmp(target_out.data, new_data, new_size) == 0);
+
+    free(target_out.data);
+    free(target_buf);
+    free(patch_buf);
+    free(source_buf);
+
+    return result;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-H] [-p page_size] [-s source_pages] [-t target_pages] old.bin patch.bin [new.bin]\n", name);
+}
+
+int main(int argc, char** argv) {
+    size_t header = 0;
+    size_t page_size = DEFAULT_PAGE_SIZE;
+    size_t source_pages = 0;    // 0 = sweep
+    size_t target_pages = 4;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "Hp:s:t:")) != -1) {
+        switch (opt) {
+            case 'H': header = IMAGE_HDR_SIZE; break;
+            case 'p': page_size = strtoul(optarg, NULL, 0); break;
+            case 's': source_pages = strtoul(optarg, NULL, 0); break;
+            case 't': target_pages = strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    if (argc - optind < 2 || page_size == 0 || target_pages == 0 ||
+        source_pages > JANPATCH_MAX_PAGES || target_pages > JANPATCH_MAX_PAGES) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    size_t old_size, patch_size, new_size = 0;
+    uint8_t* old_data = read_file(argv[optind], header, &old_size);
+    uint8_t* patch_data = read_file(argv[optind + 1], header, &patch_size);
+    uint8_t* new_data = NULL;
+    if (argc - optind > 2) {
+        new_data = read_file(argv[optind + 2], header, &new_size);
+    }
+    if (old_data == NULL || patch_data == NULL || (argc - optind > 2 && new_data == NULL)) {
+        return 1;
+    }
+
+    printf("source %zu bytes, patch %zu bytes, page %zu bytes, target cache %zu pages\n\n",
+           old_size, patch_size, page_size, target_pages);
+    printf("src pages  src faults  patch faults  tgt faults  tgt writes  bytes written  time ms  output\n");
+
+    int failed = 0;
+    for (size_t pages = 1; pages <= JANPATCH_MAX_PAGES; pages *= 2) {
+        size_t run_pages = source_pages ? source_pages : pages;
+
+        BenchResult_t r = bench_run(old_data, old_size, patch_data, patch_size, new_data, new_size,
+                                    page_size, run_pages, target_pages);
+
+        const char* output = r.result != 0 ? "error" : r.match < 0 ? "-" : r.match ? "ok" : "MISMATCH";
+        failed |= r.result != 0 || r.match == 0;
+
+        printf("%9zu  %10u  %12u  %10u  %10u  %13zu  %7.2f  %s\n",
+               r.source_pages, r.stats.source_faults, r.stats.patch_faults, r.stats.target_faults,
+               r.writes, r.bytes, r.ms, output);
+
+        if (source_pages) {
+            break;
+        }
+    }
+
+    free(new_data);
+    free(patch_data);
+    free(old_data);
+
+    return failed;
+}
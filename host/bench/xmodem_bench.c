@@ -0,0 +1,841 @@
+/**
+ * @file   xmodem_bench.c
+ * @brief  Measures how fast an image moves through the updater's XMODEM path.
+ *
+ * The common/ sources run unchanged against the host HAL shims, fed by a modelled
+ * XMODEM-CRC sender over a modelled serial link. Time is virtual: the line moves
+ * bytes at the configured baud rate and latency, flash program/erase operations
+ * cost their STM32F407 datasheet times and AES-GCM costs a number of core cycles
+ * per byte, so the figures are those of the board and do not depend on the host.
+ *
+ * Modes:
+ *   plain  full image, XMODEM into the staging area without encryption
+ *   enc    the same image AES-128-GCM encrypted, as the updater receives it
+ *   patch  encrypted patch streamed into janpatch (handle_firmware_patch_stream)
+ *
+ * plain and enc use a generated application image of -s bytes (or -i file). patch
+ * needs the installed image and the patch file from create_patch.py -e.
+ *
+ * Usage: xmodem_bench [-m plain|enc|patch|all] [-s size] [-i image.bin]
+ *                     [-o old.bin -p patch.bin [-n new.bin]] [-b baud[,baud...]]
+ *                     [-l latency_us] [-e bit_error_rate] [-k gcm_cycles_per_byte]
+ *                     [-r seed] [-W]
+ *   -l  added to every byte in both directions (USB-serial adapters: 1 to 16 ms)
+ *   -e  probability of each bit on the line being flipped
+ *   -k  defaults to an estimate, use avg_cyc / 128 of the GCM row of an
+ *       ENABLE_PROFILING build to match a given board
+ *   -W  use the datasheet maximum flash times instead of the typical ones
+ */
+#include "main.h"
+#include "transport.h"
+#include "uart_transport.h"
+#include "xmodem.h"
+#include "delta_update.h"
+#include "image.h"
+#include "host_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BENCH_CORE_CLOCK        90000000U   // Updater SYSCLK (HSE 8 MHz, PLL N=90 M=4 P=2)
+#define BENCH_BITS_PER_BYTE     10U
+#define BENCH_DEFAULT_SIZE      (64U * 1024U)
+#define BENCH_DEFAULT_BAUD      115200U
+#define BENCH_DEFAULT_GCM_CPB   120U        // mbedTLS AES-128-GCM, 4-bit GHASH tables, Cortex-M4
+#define BENCH_LOOP_NS           1000U       // Firmware time between two tick reads while busy
+#define BENCH_IDLE_POLLS        16U         // Tick reads without progress that mean the firmware waits
+#define BENCH_SENDER_TIMEOUT_MS 10000U      // sx waits 10 s for a response
+#define BENCH_SENDER_RETRIES    10U
+#define BENCH_TIME_LIMIT_MS     (30U * 60U * 1000U)
+#define BENCH_LINE_SIZE         4096U
+#define BENCH_MAX_BAUDS         16
+
+// STM32F407 datasheet (DS8626), VDD 2.7 V to 3.6 V, x32 parallelism
+#define FLASH_PROG_TYP_NS       16000U
+#define FLASH_PROG_MAX_NS       100000U
+#define FLASH_ERASE16_TYP_MS    250U
+#define FLASH_ERASE16_MAX_MS    500U
+#define FLASH_ERASE64_TYP_MS    550U
+#define FLASH_ERASE64_MAX_MS    1100U
+#define FLASH_ERASE128_TYP_MS   1000U
+#define FLASH_ERASE128_MAX_MS   2000U
+
+typedef enum {
+    BENCH_MODE_PLAIN = 0,
+    BENCH_MODE_ENC,
+    BENCH_MODE_PATCH,
+    BENCH_MODE_COUNT
+} BenchMode_t;
+
+static const char* const BENCH_MODE_NAMES[BENCH_MODE_COUNT] = { "plain", "enc", "patch" };
+
+// Bytes in flight on one direction of the line
+typedef struct {
+    uint64_t at[BENCH_LINE_SIZE];   // Arrival time at the far end
+    uint8_t data[BENCH_LINE_SIZE];
+    uint32_t head;
+    uint32_t count;
+    uint64_t free_ns;               // When the transmitter is done with the last byte
+} BenchLine_t;
+
+typedef enum {
+    SENDER_WAIT_C = 0,
+    SENDER_WAIT_ACK,
+    SENDER_WAIT_EOT_ACK,
+    SENDER_DONE,
+    SENDER_FAILED
+} SenderState_t;
+
+typedef struct {
+    const uint8_t* file;
+    size_t size;
+    SenderState_t state;
+    uint32_t block;                 // 1-based block being sent
+    uint32_t blocks;
+    uint32_t retries;               // Consecutive retries of the current block
+    uint32_t retransmits;           // All blocks sent again
+    uint64_t deadline_ns;           // Response timeout, 0 = none
+} BenchSender_t;
+
+typedef struct {
+    // Settings
+    uint32_t baud;
+    uint64_t latency_ns;
+    double ber;
+    uint32_t gcm_cpb;
+    int worst_case;
+    // State
+    uint64_t now_ns;
+    uint64_t byte_ns;
+    int charging;                   // Costs count only while a run is active
+    uint32_t idle_polls;            // Tick reads since the firmware last did something observable
+    BenchLine_t down;               // Sender -> updater
+    BenchLine_t up;                 // Updater -> sender
+    BenchSender_t sender;
+    uint64_t rng;
+    // Results
+    uint64_t flash_ns;
+    uint64_t crypto_ns;
+    uint32_t bit_errors;
+    uint32_t lost;                  // Bytes overrun in the USART
+} Bench_t;
+
+typedef struct {
+    BenchMode_t mode;
+    const uint8_t* file;            // Bytes on the line
+    size_t file_size;
+    const uint8_t* expect;          // Plaintext the flash should hold afterwards
+    size_t expect_size;
+    const uint8_t* old_image;       // Patch mode: installed application
+    size_t old_size;
+} BenchCase_t;
+
+static Bench_t bench;
+static Transport_t uart_transport;
+static UARTTransport_Config_t uart_config;
+static XmodemManager_t xmodem_manager;
+
+/* Private functions ---------------------------------------------------------*/
+static void bench_advance(uint64_t ns, int stall);
+static void bench_service(void);
+
+// Originals of the wrapped mbedTLS calls (-Wl,--wrap)
+int __real_mbedtls_gcm_starts(mbedtls_gcm_context* ctx, int mode, const unsigned char* iv, size_t iv_len,
+                              const unsigned char* add, size_t add_len);
+int __real_mbedtls_gcm_update(mbedtls_gcm_context* ctx, size_t length, const unsigned char* input,
+                              unsigned char* output);
+int __real_mbedtls_gcm_finish(mbedtls_gcm_context* ctx, unsigned char* tag, size_t tag_len);
+
+
+/**
+ * @brief  xorshift64*, deterministic for a given seed.
+ */
+static uint64_t bench_random(void) {
+    bench.rng ^= bench.rng >> 12;
+    bench.rng ^= bench.rng << 25;
+    bench.rng ^= bench.rng >> 27;
+
+    return bench.rng * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * @brief  Applies the bit error rate to one byte.
+ */
+static uint8_t bench_corrupt(uint8_t byte) {
+    if (bench.ber <= 0.0) {
+        return byte;
+    }
+
+    for (int bit = 0; bit < 8; bit++) {
+        if ((double)(bench_random() >> 11) / (double)(1ULL << 53) < bench.ber) {
+            byte ^= (uint8_t)(1U << bit);
+            bench.bit_errors++;
+        }
+    }
+
+    return byte;
+}
+
+/**
+ * @brief  Starts a byte on the line after whatever is already being transmitted.
+ * @return 1 if queued, 0 if the model's buffer is full.
+ */
+static int line_send(BenchLine_t* line, uint8_t byte) {
+    if (line->count >= BENCH_LINE_SIZE) {
+        return 0;
+    }
+
+    if (line->free_ns < bench.now_ns) {
+        line->free_ns = bench.now_ns;
+    }
+    line->free_ns += bench.byte_ns;
+
+    uint32_t slot = (line->head + line->count) % BENCH_LINE_SIZE;
+    line->at[slot] = line->free_ns + bench.latency_ns;
+    line->data[slot] = bench_corrupt(byte);
+    line->count++;
+
+    return 1;
+}
+
+/**
+ * @brief  Takes the oldest byte off the line if it has arrived by the given time.
+ * @return 1 with the byte in *byte, 0 if nothing has arrived.
+ */
+static int line_receive(BenchLine_t* line, uint64_t by_ns, uint8_t* byte) {
+    if (line->count == 0 || line->at[line->head] > by_ns) {
+        return 0;
+    }
+
+    *byte = line->data[line->head];
+    line->head = (line->head + 1) % BENCH_LINE_SIZE;
+    line->count--;
+
+    return 1;
+}
+
+/* Sender --------------------------------------------------------------------*/
+
+/**
+ * @brief  Puts the current block (or EOT) on the line and arms the response timeout.
+ */
+static void sender_transmit(BenchSender_t* sender) {
+    if (sender->state == SENDER_WAIT_EOT_ACK) {
+        line_send(&bench.down, XMODEM_EOT);
+    } else {
+        uint8_t block[XMODEM_UNPACK_SIZE];
+        size_t offset = (size_t)(sender->block - 1) * XMODEM_UNPACK_SIZE;
+        size_t len = sender->size - offset < XMODEM_UNPACK_SIZE ? sender->size - offset : XMODEM_UNPACK_SIZE;
+
+        memcpy(block, sender->file + offset, len);
+        memset(block + len, 0x1A, XMODEM_UNPACK_SIZE - len);    // CPMEOF padding, as sx does
+
+        uint16_t crc = host_image_crc16(block, sizeof(block));
+        line_send(&bench.down, XMODEM_SOH);
+        line_send(&bench.down, (uint8_t)sender->block);
+        line_send(&bench.down, (uint8_t)(0xFF - (uint8_t)sender->block));
+        for (size_t i = 0; i < sizeof(block); i++) {
+            line_send(&bench.down, block[i]);
+        }
+        line_send(&bench.down, (uint8_t)(crc >> 8));
+        line_send(&bench.down, (uint8_t)crc);
+    }
+
+    // The timeout runs from when the last byte has left
+    sender->deadline_ns = bench.down.free_ns + (uint64_t)BENCH_SENDER_TIMEOUT_MS * 1000000U;
+}
+
+/**
+ * @brief  Sends the current block again after a NAK or a timeout.
+ */
+static void sender_retry(BenchSender_t* sender) {
+    if (++sender->retries > BENCH_SENDER_RETRIES) {
+        sender->state = SENDER_FAILED;
+        sender->deadline_ns = 0;
+        return;
+    }
+
+    sender->retransmits++;
+    sender_transmit(sender);
+}
+
+/**
+ * @brief  Reacts to one byte from the updater.
+ * @note   Anything other than C, ACK, NAK and CAN (menu text, a corrupted
+ *         response) is ignored, and the timeout recovers from a lost response.
+ */
+static void sender_receive(BenchSender_t* sender, uint8_t byte) {
+    switch (sender->state) {
+        case SENDER_WAIT_C:
+            if (byte == XMODEM_C || byte == XMODEM_NAK) {
+                sender->state = SENDER_WAIT_ACK;
+                sender->block = 1;
+                sender->retries = 0;
+                sender_transmit(sender);
+            }
+            break;
+
+        case SENDER_WAIT_ACK:
+            if (byte == XMODEM_ACK) {
+                sender->retries = 0;
+                if (sender->block == sender->blocks) {
+                    sender->state = SENDER_WAIT_EOT_ACK;
+                } else {
+                    sender->block++;
+                }
+                sender_transmit(sender);
+            } else if (byte == XMODEM_NAK || (byte == XMODEM_C && sender->block == 1)) {
+                sender_retry(sender);
+            } else if (byte == XMODEM_CAN) {
+                sender->state = SENDER_FAILED;
+                sender->deadline_ns = 0;
+            }
+            break;
+
+        case SENDER_WAIT_EOT_ACK:
+            if (byte == XMODEM_ACK) {
+                sender->state = SENDER_DONE;
+                sender->deadline_ns = 0;
+            } else if (byte == XMODEM_NAK) {
+                sender_retry(sender);
+            } else if (byte == XMODEM_CAN) {
+                sender->state = SENDER_FAILED;
+                sender->deadline_ns = 0;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/* Virtual time --------------------------------------------------------------*/
+
+/**
+ * @brief  Moves time forward, feeding the HAL tick and the line.
+ * @param  ns: [in] Nanoseconds to advance.
+ * @param  stall: [in] 1 while the CPU is stalled by a flash operation. Only the
+ *         first byte arriving meanwhile reaches the data register, the USART
+ *         overruns on the rest as the interrupt cannot run.
+ */
+static void bench_advance(uint64_t ns, int stall) {
+    uint64_t end = bench.now_ns + ns;
+
+    if (stall) {
+        uint8_t byte;
+        int latched = 0;
+        while (line_receive(&bench.down, end, &byte)) {
+            if (!latched) {
+                latched = 1;
+                if (!host_usart_rx_push(byte)) {
+                    bench.lost++;
+                }
+            } else {
+                USART2->SR |= USART_SR_ORE;
+                bench.lost++;
+            }
+        }
+    }
+
+    uint32_t old_ms = (uint32_t)(bench.now_ns / 1000000U);
+    bench.now_ns = end;
+    uint32_t new_ms = (uint32_t)(bench.now_ns / 1000000U);
+    if (new_ms != old_ms) {
+        host_tick_advance(new_ms - old_ms);
+    }
+
+    bench_service();
+}
+
+/**
+ * @brief  Delivers everything that has arrived by now in both directions.
+ */
+static void bench_service(void) {
+    uint8_t byte;
+
+    for (;;) {
+        if (line_receive(&bench.up, bench.now_ns, &byte)) {
+            sender_receive(&bench.sender, byte);
+        } else if (line_receive(&bench.down, bench.now_ns, &byte)) {
+            if (!host_usart_rx_push(byte)) {
+                bench.lost++;
+            }
+            bench.idle_polls = 0;
+        } else {
+            break;
+        }
+    }
+
+    if (bench.sender.deadline_ns != 0 && bench.now_ns >= bench.sender.deadline_ns) {
+        sender_retry(&bench.sender);
+    }
+}
+
+/**
+ * @brief  Poll hook, runs whenever the firmware reads the tick.
+ * @note   The firmware counts as busy while received bytes wait in the RX ring
+ *         buffer or it has just touched flash, crypto or the transmitter, and each
+ *         tick read then costs BENCH_LOOP_NS. After BENCH_IDLE_POLLS reads without
+ *         any of that it is waiting, and time skips to the next arrival, sender
+ *         timeout or tick, whichever comes first.
+ */
+static void bench_poll(void* ctx) {
+    if (!ring_buffer_is_empty(get_uart_rx_buffer())) {
+        bench.idle_polls = 0;
+    }
+    if (bench.idle_polls++ < BENCH_IDLE_POLLS) {
+        bench_advance(BENCH_LOOP_NS, 0);
+        return;
+    }
+
+    uint64_t next = (bench.now_ns / 1000000U + 1U) * 1000000U;
+    if (bench.up.count > 0 && bench.up.at[bench.up.head] < next) {
+        next = bench.up.at[bench.up.head];
+    }
+    if (bench.down.count > 0 && bench.down.at[bench.down.head] < next) {
+        next = bench.down.at[bench.down.head];
+    }
+    if (bench.sender.deadline_ns != 0 && bench.sender.deadline_ns < next) {
+        next = bench.sender.deadline_ns;
+    }
+
+    bench_advance(next > bench.now_ns ? next - bench.now_ns : 0, 0);
+}
+
+/**
+ * @brief  USART2 transmit sink, the updater's output goes onto the line.
+ * @note   Text beyond what the line model buffers is dropped, the sender only
+ *         looks at single protocol bytes.
+ */
+static void bench_tx(uint8_t byte, void* ctx) {
+    bench.idle_polls = 0;
+    line_send(&bench.up, byte);
+}
+
+/**
+ * @brief  Charges datasheet program/erase times, called before each NOR operation.
+ */
+static int bench_flash_hook(HostNorOp_t op, uint32_t addr, uint32_t len, void* ctx) {
+    uint64_t ns;
+
+    if (!bench.charging) {
+        return 0;
+    }
+
+    if (op == HOST_NOR_OP_PROGRAM) {
+        ns = bench.worst_case ? FLASH_PROG_MAX_NS : FLASH_PROG_TYP_NS;
+    } else if (len <= 16U * 1024U) {
+        ns = (uint64_t)(bench.worst_case ? FLASH_ERASE16_MAX_MS : FLASH_ERASE16_TYP_MS) * 1000000U;
+    } else if (len <= 64U * 1024U) {
+        ns = (uint64_t)(bench.worst_case ? FLASH_ERASE64_MAX_MS : FLASH_ERASE64_TYP_MS) * 1000000U;
+    } else {
+        ns = (uint64_t)(bench.worst_case ? FLASH_ERASE128_MAX_MS : FLASH_ERASE128_TYP_MS) * 1000000U;
+    }
+
+    bench.flash_ns += ns;
+    bench.idle_polls = 0;
+    bench_advance(ns, 1);
+
+    return 0;
+}
+
+/**
+ * @brief  Charges the modelled core time of a GCM step, interrupts keep running.
+ */
+static void bench_charge_crypto(size_t bytes) {
+    if (!bench.charging) {
+        return;
+    }
+
+    uint64_t ns = (uint64_t)bytes * bench.gcm_cpb * 1000000000ULL / BENCH_CORE_CLOCK;
+    bench.crypto_ns += ns;
+    bench.idle_polls = 0;
+    bench_advance(ns, 0);
+}
+
+int __wrap_mbedtls_gcm_starts(mbedtls_gcm_context* ctx, int mode, const unsigned char* iv, size_t iv_len,
+                              const unsigned char* add, size_t add_len) {
+    // J0, the AAD and the first counter block, about three blocks of work
+    bench_charge_crypto(48);
+
+    return __real_mbedtls_gcm_starts(ctx, mode, iv, iv_len, add, add_len);
+}
+
+int __wrap_mbedtls_gcm_update(mbedtls_gcm_context* ctx, size_t length, const unsigned char* input,
+                              unsigned char* output) {
+    bench_charge_crypto(length);
+
+    return __real_mbedtls_gcm_update(ctx, length, input, output);
+}
+
+int __wrap_mbedtls_gcm_finish(mbedtls_gcm_context* ctx, unsigned char* tag, size_t tag_len) {
+    bench_charge_crypto(32);
+
+    return __real_mbedtls_gcm_finish(ctx, tag, tag_len);
+}
+
+/* Inputs --------------------------------------------------------------------*/
+
+/**
+ * @brief  Reads a whole file into memory.
+ * @return Allocated buffer, or NULL on failure.
+ */
+static uint8_t* read_file(const char* path, size_t* size) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t* data = malloc(length > 0 ? (size_t)length : 1);
+    if (data == NULL || length < 0 || fread(data, 1, (size_t)length, f) != (size_t)length) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+
+    fclose(f);
+    *size = (size_t)length;
+    return data;
+}
+
+/**
+ * @brief  Builds an application image with a valid header around size bytes of data.
+ * @note   The data mixes runs and noise, roughly like code and constants.
+ */
+static uint8_t* make_image(size_t size, size_t* image_size) {
+    uint8_t* image = malloc(IMAGE_HDR_SIZE + size);
+    if (image == NULL) {
+        return NULL;
+    }
+
+    uint8_t* data = image + IMAGE_HDR_SIZE;
+    for (size_t i = 0; i < size; i++) {
+        data[i] = (i % 64U < 16U) ? (uint8_t)(i >> 6) : (uint8_t)bench_random();
+    }
+
+    host_image_header((ImageHeader_t*)image, APP_ADDR, IMAGE_MAGIC_APP, IMAGE_TYPE_APP, data, (uint32_t)size);
+
+    *image_size = IMAGE_HDR_SIZE + size;
+    return image;
+}
+
+/* Runs ----------------------------------------------------------------------*/
+
+/**
+ * @brief  Brings the models and the updater's transport to their reset state.
+ */
+static void bench_reset(const BenchCase_t* test) {
+    host_system_reset();
+    host_nor_erase_all();
+    host_nor_reset_stats();
+    memset(host_bkpsram, 0, sizeof(host_bkpsram));
+
+    if (test->old_image != NULL) {
+        memcpy(host_nor_raw() + (APP_ADDR - FLASH_BASE), test->old_image, test->old_size);
+    }
+
+    SystemCoreClock = BENCH_CORE_CLOCK;
+
+    memset(&bench.down, 0, sizeof(bench.down));
+    memset(&bench.up, 0, sizeof(bench.up));
+    memset(&bench.sender, 0, sizeof(bench.sender));
+    bench.now_ns = 0;
+    bench.idle_polls = 0;
+    bench.byte_ns = (BENCH_BITS_PER_BYTE * 1000000000ULL + bench.baud - 1) / bench.baud;
+    bench.flash_ns = 0;
+    bench.crypto_ns = 0;
+    bench.bit_errors = 0;
+    bench.lost = 0;
+
+    bench.sender.file = test->file;
+    bench.sender.size = test->file_size;
+    bench.sender.blocks = (uint32_t)((test->file_size + XMODEM_UNPACK_SIZE - 1) / XMODEM_UNPACK_SIZE);
+
+    uart_config.usart = USART2;
+    uart_config.baudrate = bench.baud;
+    uart_config.timeout = 1000;
+    uart_config.use_xmodem = 1;
+    uart_config.app_addr = APP_ADDR;
+    uart_config.updater_addr = UPDATER_ADDR;
+    uart_config.loader_addr = LOADER_ADDR;
+    uart_config.image_hdr_size = IMAGE_HDR_SIZE;
+    transport_init(&uart_transport, TRANSPORT_UART, &uart_config);
+
+    XmodemConfig_t xmodem_config = {
+        .app_addr = APP_ADDR,
+        .updater_addr = UPDATER_ADDR,
+        .loader_addr = LOADER_ADDR,
+        .image_hdr_size = IMAGE_HDR_SIZE,
+        .use_encryption = (test->mode != BENCH_MODE_PLAIN)
+    };
+    xmodem_init(&xmodem_manager, &xmodem_config);
+}
+
+/**
+ * @brief  Receives a full image the way the updater's main loop does.
+ * @return 1 if the transfer completed, 0 otherwise.
+ */
+static int bench_receive_image(void) {
+    xmodem_set_staging(&xmodem_manager, 0);
+    xmodem_start(&xmodem_manager, APP_ADDR);
+
+    while (bench.now_ns < (uint64_t)BENCH_TIME_LIMIT_MS * 1000000U) {
+        transport_process(&uart_transport);
+
+        uint8_t byte;
+        if (transport_receive(&uart_transport, &byte, 1) > 0) {
+            XmodemError_t result = xmodem_process_byte(&xmodem_manager, byte);
+
+            if (xmodem_should_send_byte(&xmodem_manager)) {
+                uint8_t response = xmodem_get_response(&xmodem_manager);
+                transport_send(&uart_transport, &response, 1);
+            }
+
+            if (result == XMODEM_ERROR_TRANSFER_COMPLETE) {
+                return 1;
+            }
+            if (result != XMODEM_ERROR_NONE && result != XMODEM_ERROR_CRC_ERROR &&
+                result != XMODEM_ERROR_SEQUENCE_ERROR && result != XMODEM_ERROR_INVALID_PACKET) {
+                return 0;
+            }
+        }
+
+        if (xmodem_should_send_byte(&xmodem_manager)) {
+            uint8_t response = xmodem_get_response(&xmodem_manager);
+            transport_send(&uart_transport, &response, 1);
+        }
+
+        if (xmodem_get_state(&xmodem_manager) == XMODEM_STATE_ERROR) {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  Runs one transfer and prints its row.
+ * @return 1 if the transfer succeeded and flash holds the expected image.
+ */
+static int bench_run(const BenchCase_t* test) {
+    int ok;
+    uint32_t check_addr;
+
+    bench_reset(test);
+    bench.charging = 1;
+
+    if (test->mode == BENCH_MODE_PATCH) {
+#ifdef AB_SLOTS
+        check_addr = APP_B_ADDR;
+        ok = handle_firmware_patch_stream(&xmodem_manager, APP_ADDR, APP_B_ADDR,
+                                          APP_B_ADDR + APP_SLOT_SIZE, IMAGE_HDR_SIZE) == 0;
+#else
+        check_addr = APP_ADDR;
+        ok = handle_firmware_patch_stream(&xmodem_manager, APP_ADDR, APP_ADDR,
+                                          BACKUP_ADDR, IMAGE_HDR_SIZE) == 0;
+#endif
+    } else {
+        ok = bench_receive_image();
+        check_addr = xmodem_manager.target_addr;
+    }
+
+    // Let the final ACK reach the sender
+    while (ok && bench.sender.state != SENDER_DONE && bench.up.count > 0) {
+        bench_poll(NULL);
+    }
+
+    bench.charging = 0;
+    uint64_t end_ns = bench.now_ns;
+    xmodem_cleanup(&xmodem_manager);
+
+    // The patched image carries its own header, compare the data after it
+    if (ok && test->expect != NULL) {
+        size_t skip = (test->mode == BENCH_MODE_PATCH) ? IMAGE_HDR_SIZE : 0;
+        ok = memcmp(host_nor_raw() + (check_addr - FLASH_BASE) + skip, test->expect + skip,
+                    test->expect_size - skip) == 0;
+    }
+
+    double seconds = end_ns / 1e9;
+    double line_bps = (double)bench.baud / BENCH_BITS_PER_BYTE;
+    double bps = seconds > 0 ? test->file_size / seconds : 0;
+
+    printf("%-6s %8u %7.2f %8.1e %8zu %9.2f ",
+           BENCH_MODE_NAMES[test->mode], bench.baud, bench.latency_ns / 1e6, bench.ber, test->file_size,
+           seconds);
+    // A failed run moved no image, it has no throughput to report
+    if (ok) {
+        printf("%9.0f %5.1f%% ", bps, 100.0 * bps / line_bps);
+    } else {
+        printf("%9s %6s ", "-", "-");
+    }
+    printf("%9.1f %5.1f%% %9.1f %5.1f%% %6u %6u %5u  %s\n",
+           bench.flash_ns / 1e6, seconds > 0 ? 100.0 * bench.flash_ns / 1e9 / seconds : 0,
+           bench.crypto_ns / 1e6, seconds > 0 ? 100.0 * bench.crypto_ns / 1e9 / seconds : 0,
+           bench.sender.retransmits, bench.bit_errors, bench.lost, ok ? "ok" : "FAIL");
+
+    return ok;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-m plain|enc|patch|all] [-s size] [-i image.bin] [-o old.bin -p patch.bin [-n new.bin]]\n"
+                    "       [-b baud[,baud...]] [-l latency_us] [-e bit_error_rate] [-k gcm_cycles_per_byte] [-r seed] [-W]\n",
+            name);
+}
+
+int main(int argc, char** argv) {
+    const char* mode_name = "all";
+    const char* image_path = NULL;
+    const char* old_path = NULL;
+    const char* patch_path = NULL;
+    const char* new_path = NULL;
+    size_t size = BENCH_DEFAULT_SIZE;
+    uint32_t bauds[BENCH_MAX_BAUDS] = { BENCH_DEFAULT_BAUD };
+    int baud_count = 1;
+    uint64_t seed = 1;
+    int opt;
+
+    bench.gcm_cpb = BENCH_DEFAULT_GCM_CPB;
+
+    while ((opt = getopt(argc, argv, "m:s:i:o:p:n:b:l:e:k:r:W")) != -1) {
+        switch (opt) {
+            case 'm': mode_name = optarg; break;
+            case 's': size = strtoul(optarg, NULL, 0); break;
+            case 'i': image_path = optarg; break;
+            case 'o': old_path = optarg; break;
+            case 'p': patch_path = optarg; break;
+            case 'n': new_path = optarg; break;
+            case 'b': {
+                char* cursor = optarg;
+                baud_count = 0;
+                while (*cursor != '\0' && baud_count < BENCH_MAX_BAUDS) {
+                    bauds[baud_count++] = (uint32_t)strtoul(cursor, &cursor, 0);
+                    if (*cursor == ',') {
+                        cursor++;
+                    }
+                }
+                break;
+            }
+            case 'l': bench.latency_ns = (uint64_t)(strtod(optarg, NULL) * 1000.0); break;
+            case 'e': bench.ber = strtod(optarg, NULL); break;
+            case 'k': bench.gcm_cpb = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'r': seed = strtoull(optarg, NULL, 0); break;
+            case 'W': bench.worst_case = 1; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    int run_mode[BENCH_MODE_COUNT] = { 0 };
+    if (strcmp(mode_name, "all") == 0) {
+        run_mode[BENCH_MODE_PLAIN] = 1;
+        run_mode[BENCH_MODE_ENC] = 1;
+        run_mode[BENCH_MODE_PATCH] = (patch_path != NULL);
+    } else {
+        int found = 0;
+        for (int m = 0; m < BENCH_MODE_COUNT; m++) {
+            if (strcmp(mode_name, BENCH_MODE_NAMES[m]) == 0) {
+                run_mode[m] = 1;
+                found = 1;
+            }
+        }
+        if (!found) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (run_mode[BENCH_MODE_PATCH] && (old_path == NULL || patch_path == NULL)) {
+        fprintf(stderr, "patch mode needs -o old.bin and -p patch.bin\n");
+        return 2;
+    }
+
+    for (int i = 0; i < baud_count; i++) {
+        if (bauds[i] == 0) {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (!host_nor_init(NULL)) {
+        return 1;
+    }
+    host_nor_set_hook(bench_flash_hook, NULL);
+    host_set_poll_hook(bench_poll, NULL);
+    host_usart_set_tx_sink(bench_tx, NULL);
+    crc_init();
+    bench.rng = seed ? seed : 1;
+
+    // Inputs
+    BenchCase_t cases[BENCH_MODE_COUNT];
+    memset(cases, 0, sizeof(cases));
+    uint8_t* image = NULL;
+    size_t image_size = 0;
+    uint8_t* encrypted = NULL;
+    uint8_t* old_image = NULL;
+    uint8_t* patch = NULL;
+    uint8_t* new_image = NULL;
+
+    if (run_mode[BENCH_MODE_PLAIN] || run_mode[BENCH_MODE_ENC]) {
+        image = image_path ? read_file(image_path, &image_size) : make_image(size, &image_size);
+        if (image == NULL) {
+            return 1;
+        }
+
+        cases[BENCH_MODE_PLAIN] = (BenchCase_t){ BENCH_MODE_PLAIN, image, image_size, image, image_size, NULL, 0 };
+
+        uint8_t nonce[12];
+        for (size_t i = 0; i < sizeof(nonce); i++) {
+            nonce[i] = (uint8_t)bench_random();
+        }
+        size_t encrypted_size = 0;
+        encrypted = host_image_encrypt(image, image_size, (uint32_t)image_size, nonce, &encrypted_size);
+        if (encrypted == NULL) {
+            fprintf(stderr, "Encryption failed\n");
+            return 1;
+        }
+        cases[BENCH_MODE_ENC] = (BenchCase_t){ BENCH_MODE_ENC, encrypted, encrypted_size, image, image_size, NULL, 0 };
+    }
+
+    if (run_mode[BENCH_MODE_PATCH]) {
+        size_t old_size = 0, patch_size = 0, new_size = 0;
+        old_image = read_file(old_path, &old_size);
+        patch = read_file(patch_path, &patch_size);
+        new_image = new_path ? read_file(new_path, &new_size) : NULL;
+        if (old_image == NULL || patch == NULL || (new_path != NULL && new_image == NULL)) {
+            return 1;
+        }
+        cases[BENCH_MODE_PATCH] = (BenchCase_t){ BENCH_MODE_PATCH, patch, patch_size, new_image, new_size,
+                                                 old_image, old_size };
+    }
+
+    printf("Flash times: %s (DS8626), GCM: %u cycles/byte at %u MHz\n",
+           bench.worst_case ? "maximum" : "typical", bench.gcm_cpb, BENCH_CORE_CLOCK / 1000000U);
+    printf("%-6s %8s %7s %8s %8s %9s %9s %6s %9s %6s %9s %6s %6s %6s %5s  %s\n",
+           "mode", "baud", "lat_ms", "ber", "bytes", "time_s", "bytes/s", "line",
+           "flash_ms", "flash", "crypto_ms", "crypto", "retx", "biterr", "lost", "result");
+
+    int failures = 0;
+    for (int i = 0; i < baud_count; i++) {
+        bench.baud = bauds[i];
+        for (int m = 0; m < BENCH_MODE_COUNT; m++) {
+            if (run_mode[m] && !bench_run(&cases[m])) {
+                failures++;
+            }
+        }
+    }
+
+    free(new_image);
+    free(patch);
+    free(old_image);
+    free(encrypted);
+    free(image);
+    host_nor_deinit();
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,326 @@
+#include "delta.h"
+#include "suffix_array.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+namespace {
+
+// One step of the edit script: diff_len bytes of new at new_pos against old at old_pos
+// (equal bytes copied, the rest replaced), followed by extra_len inserted bytes
+struct Block {
+    size_t new_pos;
+    size_t old_pos;
+    size_t diff_len;
+    size_t extra_len;
+};
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief  Finds the edit script for one chunk of the new image.
+ * @param  sa: [in] Suffix array of the old image.
+ * @param  old_data: [in] Old image.
+ * @param  old_size: [in] Size of the old image.
+ * @param  new_data: [in] New image.
+ * @param  start: [in] First new-image byte of the chunk.
+ * @param  end: [in] End of the chunk.
+ * @param  min_match: [in] Gain needed to leave the current alignment.
+ * @param  blocks: [out] Blocks covering [start, end) without gaps.
+ * @note   Same scan as bsdiff: a match is only taken when it beats the current
+ *         alignment, then both neighbouring blocks are extended with approximate
+ *         matches (more than half the bytes equal), which suits firmware where code
+ *         moves a little and references in it change.
+ */
+void scan_chunk(const SuffixArray& sa, const uint8_t* old_data, size_t old_size, const uint8_t* new_data,
+                size_t start, size_t end, size_t min_match, std::vector<Block>& blocks) {
+    auto old_at = [&](int64_t pos) -> int { return pos >= 0 && (size_t)pos < old_size ? old_data[pos] : -1; };
+
+    size_t scan = start;
+    size_t len = 0;
+    size_t pos = 0;
+    size_t last_scan = start;
+    size_t last_pos = std::min(start, old_size);    // Start on the identity alignment
+    int64_t last_offset = (int64_t)last_pos - (int64_t)last_scan;
+
+    while (scan < end) {
+        size_t old_score = 0;
+        size_t scsc = scan += len;
+
+        for (; scan < end; scan++) {
+            Match m = sa.search(new_data + scan, end - scan);
+            len = m.len;
+            pos = m.pos;
+
+            for (; scsc < scan + len; scsc++) {
+                if (old_at((int64_t)scsc + last_offset) == new_data[scsc]) {
+                    old_score++;
+                }
+            }
+
+            if ((len == old_score && len != 0) || len > old_score + min_match) {
+                break;
+            }
+
+            if (old_at((int64_t)scan + last_offset) == new_data[scan]) {
+                old_score--;
+            }
+        }
+
+        if (len == old_score && scan != end) {
+            continue;
+        }
+
+        // Extend the previous block forward
+        size_t len_f = 0;
+        int64_t score = 0, best = 0;
+        for (size_t i = 0; last_scan + i < scan && last_pos + i < old_size;) {
+            if (old_data[last_pos + i] == new_data[last_scan + i]) {
+                score++;
+            }
+            i++;
+            if (score * 2 - (int64_t)i > best * 2 - (int64_t)len_f) {
+                best = score;
+                len_f = i;
+            }
+        }
+
+        // Extend the new match backward
+        size_t len_b = 0;
+        if (scan < end) {
+            score = 0;
+            best = 0;
+            for (size_t i = 1; scan >= last_scan + i && pos >= i; i++) {
+                if (old_data[pos - i] == new_data[scan - i]) {
+                    score++;
+                }
+                if (score * 2 - (int64_t)i > best * 2 - (int64_t)len_b) {
+                    best = score;
+                    len_b = i;
+                }
+            }
+        }
+
+        // Split an overlap where it scores best
+        if (last_scan + len_f > scan - len_b) {
+            size_t overlap = (last_scan + len_f) - (scan - len_b);
+            size_t len_s = 0;
+            score = 0;
+            best = 0;
+            for (size_t i = 0; i < overlap; i++) {
+                if (new_data[last_scan + len_f - overlap + i] == old_data[last_pos + len_f - overlap + i]) {
+                    score++;
+                }
+                if (new_data[scan - len_b + i] == old_data[pos - len_b + i]) {
+                    score--;
+                }
+                if (score > best) {
+                    best = score;
+                    len_s = i + 1;
+                }
+            }
+            len_f += len_s - overlap;
+            len_b -= len_s;
+        }
+
+        blocks.push_back({last_scan, last_pos, len_f, (scan - len_b) - (last_scan + len_f)});
+
+        last_scan = scan - len_b;
+        last_pos = pos - len_b;
+        last_offset = (int64_t)pos - (int64_t)scan;
+    }
+}
+
+class PatchWriter {
+public:
+    PatchWriter(std::vector<uint8_t>& out, DeltaStats& stats) : out_(out), stats_(stats) {}
+
+    // Moves the source cursor with DEL or BKT
+    void seek(size_t target) {
+        if (target == source_) {
+            return;
+        }
+        op(target > source_ ? JDIFF_DEL : JDIFF_BKT);
+        length(target > source_ ? target - source_ : source_ - target);
+        stats_.seek_ops++;
+        source_ = target;
+    }
+
+    void copy(size_t len) {
+        while (len > 0) {
+            // find_length() returns an int
+            size_t chunk = std::min<size_t>(len, INT32_MAX);
+            op(JDIFF_EQL);
+            length(chunk);
+            stats_.eql_ops++;
+            stats_.eql_bytes += chunk;
+            source_ += chunk;
+            len -= chunk;
+        }
+    }
+
+    // MOD replaces source bytes, INS adds bytes without moving the source
+    void data(const uint8_t* bytes, size_t len, bool modify) {
+        uint8_t kind = modify ? JDIFF_MOD : JDIFF_INS;
+        if (len == 0) {
+            return;
+        }
+
+        // A MOD run after anything but a data run needs no operator, janpatch defaults to MOD,
+        // unless it starts with ESC: janpatch reads ESC ESC there as an unknown operator
+        bool implicit = run_ != JDIFF_INS && (run_ == JDIFF_MOD || bytes[0] != JDIFF_ESC);
+        if (modify ? !implicit : (run_ != JDIFF_INS)) {
+            op(kind);
+        }
+        run_ = kind;
+
+        for (size_t i = 0; i < len; i++) {
+            if (bytes[i] == JDIFF_ESC) {
+                out_.push_back(JDIFF_ESC);
+            }
+            out_.push_back(bytes[i]);
+        }
+
+        if (modify) {
+            stats_.mod_ops++;
+            stats_.mod_bytes += len;
+            source_ += len;
+        } else {
+            stats_.ins_ops++;
+            stats_.ins_bytes += len;
+        }
+    }
+
+private:
+    void op(uint8_t code) {
+        out_.push_back(JDIFF_ESC);
+        out_.push_back(code);
+        run_ = code;
+    }
+
+    // Length encoding read by janpatch find_length()
+    void length(size_t len) {
+        if (len <= 252) {
+            out_.push_back((uint8_t)(len - 1));
+        } else if (len <= 252 + 256) {
+            out_.push_back(252);
+            out_.push_back((uint8_t)(len - 253));
+        } else if (len <= 0xFFFF) {
+            out_.push_back(253);
+            out_.push_back((uint8_t)(len >> 8));
+            out_.push_back((uint8_t)len);
+        } else {
+            out_.push_back(254);
+            out_.push_back((uint8_t)(len >> 24));
+            out_.push_back((uint8_t)(len >> 16));
+            out_.push_back((uint8_t)(len >> 8));
+            out_.push_back((uint8_t)len);
+        }
+    }
+
+    std::vector<uint8_t>& out_;
+    DeltaStats& stats_;
+    size_t source_ = 0;         // janpatch source position
+    uint8_t run_ = 0;           // Last operator written
+};
+
+/**
+ * @brief  Encodes the aligned part of a block as EQL and MOD runs.
+ */
+void encode_diff(PatchWriter& writer, const uint8_t* old_data, const uint8_t* new_data, const Block& block,
+                 size_t min_copy) {
+    const uint8_t* a = old_data + block.old_pos;
+    const uint8_t* b = new_data + block.new_pos;
+    size_t i = 0;
+    size_t mod_start = 0;
+
+    writer.seek(block.old_pos);
+
+    while (i < block.diff_len) {
+        size_t run = 0;
+        while (i + run < block.diff_len && a[i + run] == b[i + run]) {
+            run++;
+        }
+
+        // Short equal runs are cheaper inside the MOD run than as an EQL
+        if (run >= min_copy) {
+            writer.data(b + mod_start, i - mod_start, true);
+            writer.copy(run);
+            i += run;
+            mod_start = i;
+        } else {
+            i += run ? run : 1;
+        }
+    }
+
+    writer.data(b + mod_start, block.diff_len - mod_start, true);
+}
+
+} // namespace
+
+/**
+ * @brief  Generates a patch that turns old into new when applied by janpatch.
+ * @note   The new image is split into fixed chunks that are scanned in parallel;
+ *         fixed chunks keep the patch identical on every machine.
+ */
+std::vector<uint8_t> delta_generate(const uint8_t* old_data, size_t old_size,
+                                    const uint8_t* new_data, size_t new_size,
+                                    const DeltaOptions& options, DeltaStats* stats) {
+    DeltaStats local = {};
+    auto start = std::chrono::steady_clock::now();
+
+    SuffixArray sa(old_data, old_size);
+    local.sort_ms = elapsed_ms(start);
+
+    // Match finding, one job per chunk
+    start = std::chrono::steady_clock::now();
+    size_t chunk_size = options.chunk_size ? options.chunk_size : new_size;
+    size_t chunks = new_size ? (new_size + chunk_size - 1) / chunk_size : 0;
+    std::vector<std::vector<Block>> chunk_blocks(chunks);
+    std::atomic<size_t> next(0);
+
+    auto worker = [&]() {
+        for (size_t c; (c = next.fetch_add(1)) < chunks;) {
+            size_t begin = c * chunk_size;
+            size_t end = std::min(begin + chunk_size, new_size);
+            scan_chunk(sa, old_data, old_size, new_data, begin, end, options.min_match, chunk_blocks[c]);
+        }
+    };
+
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = (unsigned)std::min<size_t>(threads, std::max<size_t>(chunks, 1));
+    std::vector<std::thread> pool;
+    for (unsigned t = 1; t < threads; t++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : pool) {
+        t.join();
+    }
+    local.match_ms = elapsed_ms(start);
+
+    // Encoding
+    start = std::chrono::steady_clock::now();
+    std::vector<uint8_t> patch;
+    PatchWriter writer(patch, local);
+
+    for (const auto& blocks : chunk_blocks) {
+        for (const Block& block : blocks) {
+            if (block.diff_len > 0) {
+                encode_diff(writer, old_data, new_data, block, options.min_copy);
+            }
+            writer.data(new_data + block.new_pos + block.diff_len, block.extra_len, false);
+        }
+    }
+    local.encode_ms = elapsed_ms(start);
+
+    if (stats != nullptr) {
+        *stats = local;
+    }
+
+    return patch;
+}
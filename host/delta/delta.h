@@ -0,0 +1,50 @@
+/**
+ * @file   delta.h
+ * @brief  janpatch-compatible delta generator (jdiff patch format).
+ */
+#ifndef _DELTA_H
+#define _DELTA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// jdiff operators, see janpatch.h
+#define JDIFF_ESC   0xA7
+#define JDIFF_MOD   0xA6
+#define JDIFF_INS   0xA5
+#define JDIFF_DEL   0xA4
+#define JDIFF_EQL   0xA3
+#define JDIFF_BKT   0xA2
+
+struct DeltaOptions {
+    size_t min_match = 8;           // A new match must beat the current alignment by this many bytes
+    size_t min_copy = 4;            // Shortest equal run inside a MOD run that becomes an EQL
+    size_t chunk_size = 0x10000;    // New-image bytes per match-finding job
+    unsigned threads = 0;           // Worker threads, 0 = one per core
+};
+
+struct DeltaStats {
+    size_t eql_ops, eql_bytes;
+    size_t mod_ops, mod_bytes;
+    size_t ins_ops, ins_bytes;
+    size_t seek_ops;                // DEL + BKT
+    double sort_ms, match_ms, encode_ms;
+};
+
+/**
+ * @brief  Generates a patch that turns old into new when applied by janpatch.
+ * @param  old_data: [in] Old image.
+ * @param  old_size: [in] Size of the old image.
+ * @param  new_data: [in] New image.
+ * @param  new_size: [in] Size of the new image.
+ * @param  options: [in] Generator settings.
+ * @param  stats: [out] Operation counts and timings, may be NULL.
+ * @return Patch data.
+ * @note   Output does not depend on the thread count.
+ */
+std::vector<uint8_t> delta_generate(const uint8_t* old_data, size_t old_size,
+                                    const uint8_t* new_data, size_t new_size,
+                                    const DeltaOptions& options, DeltaStats* stats);
+
+#endif /* _DELTA_H */
@@ -0,0 +1,94 @@
+/**
+ * @file   delta_gen.cpp
+ * @brief  Creates a janpatch-compatible patch between two firmware images.
+ *
+ * Usage: delta_gen [-v] [-t threads] [-m min_match] [-c min_copy] old.bin new.bin patch.bin
+ *   -t  worker threads for match finding (default: one per core)
+ *   -m  bytes a new match must gain over the current alignment (default: 8)
+ *   -c  shortest equal run encoded as a copy inside modified data (default: 4)
+ *   -v  print operation counts and timings
+ *
+ * The output uses the jdiff format read by janpatch on the device. The images are
+ * taken as-is, create_patch.py strips the image header before calling this.
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "delta.h"
+
+static bool read_file(const char* path, std::vector<uint8_t>& data) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+
+    data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    return true;
+}
+
+static bool write_file(const char* path, const std::vector<uint8_t>& data) {
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if (!f || !f.write((const char*)data.data(), (std::streamsize)data.size())) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-v] [-t threads] [-m min_match] [-c min_copy] old.bin new.bin patch.bin\n", name);
+}
+
+int main(int argc, char** argv) {
+    DeltaOptions options;
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vt:m:c:")) != -1) {
+        switch (opt) {
+            case 'v': verbose = true; break;
+            case 't': options.threads = (unsigned)strtoul(optarg, nullptr, 0); break;
+            case 'm': options.min_match = strtoul(optarg, nullptr, 0); break;
+            case 'c': options.min_copy = strtoul(optarg, nullptr, 0); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    if (argc - optind != 3 || options.min_copy == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<uint8_t> old_data, new_data;
+    if (!read_file(argv[optind], old_data) || !read_file(argv[optind + 1], new_data)) {
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    DeltaStats stats;
+    std::vector<uint8_t> patch = delta_generate(old_data.data(), old_data.size(), new_data.data(), new_data.size(),
+                                                options, &stats);
+    double total_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (!write_file(argv[optind + 2], patch)) {
+        return 1;
+    }
+
+    printf("%s: %zu -> %zu bytes, patch %zu bytes\n", argv[optind + 2], old_data.size(), new_data.size(), patch.size());
+    if (verbose) {
+        printf("  EQL %zu ops / %zu bytes, MOD %zu ops / %zu bytes, INS %zu ops / %zu bytes, seeks %zu\n",
+               stats.eql_ops, stats.eql_bytes, stats.mod_ops, stats.mod_bytes, stats.ins_ops, stats.ins_bytes,
+               stats.seek_ops);
+        printf("  suffix sort %.1f ms, match %.1f ms, encode %.1f ms, total %.1f ms\n",
+               stats.sort_ms, stats.match_ms, stats.encode_ms, total_ms);
+    }
+
+    return 0;
+}
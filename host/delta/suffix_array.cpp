@@ -0,0 +1,142 @@
+#include "suffix_array.h"
+#include <algorithm>
+#include <cstring>
+
+/**
+ * @brief  Builds the suffix array with prefix doubling and radix sorting.
+ * @note   O(n log n). Rounds stop as soon as all ranks are distinct, so images
+ *         without long repeats finish after a few passes.
+ */
+SuffixArray::SuffixArray(const uint8_t* data, size_t size)
+    : data_(data), size_(size), sa_(size) {
+    if (size == 0) {
+        return;
+    }
+
+    // Ranks start at 1, rank 0 stands for "past the end"
+    std::vector<uint32_t> rank(size), next_rank(size), tmp(size);
+    std::vector<uint32_t> count(std::max<size_t>(size, 256) + 1);
+
+    for (size_t i = 0; i < size; i++) {
+        rank[i] = data[i] + 1u;
+    }
+    uint32_t classes = 256;
+
+    for (size_t k = 1;; k *= 2) {
+        auto second = [&](size_t i) -> uint32_t { return i + k < size ? rank[i + k] : 0; };
+
+        // Counting sort by the second key, then stable by the first
+        std::fill(count.begin(), count.begin() + classes + 1, 0);
+        for (size_t i = 0; i < size; i++) {
+            count[second(i)]++;
+        }
+        for (uint32_t c = 1; c <= classes; c++) {
+            count[c] += count[c - 1];
+        }
+        for (size_t i = size; i-- > 0;) {
+            tmp[--count[second(i)]] = (uint32_t)i;
+        }
+
+        std::fill(count.begin(), count.begin() + classes + 1, 0);
+        for (size_t i = 0; i < size; i++) {
+            count[rank[i]]++;
+        }
+        for (uint32_t c = 1; c <= classes; c++) {
+            count[c] += count[c - 1];
+        }
+        for (size_t i = size; i-- > 0;) {
+            sa_[--count[rank[tmp[i]]]] = tmp[i];
+        }
+
+        // Re-rank
+        uint32_t r = 1;
+        next_rank[sa_[0]] = r;
+        for (size_t i = 1; i < size; i++) {
+            size_t a = sa_[i - 1];
+            size_t b = sa_[i];
+            if (rank[a] != rank[b] || second(a) != second(b)) {
+                r++;
+            }
+            next_rank[b] = r;
+        }
+
+        rank.swap(next_rank);
+        classes = r;
+        if (classes == size) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief  Returns the common prefix length of an old-image suffix and a string.
+ */
+size_t SuffixArray::match_length(size_t pos, const uint8_t* str, size_t len) const {
+    size_t max = std::min(size_ - pos, len);
+    size_t i = 0;
+
+    // Word compare first, images are mostly long runs of equal bytes
+    while (i + sizeof(uint64_t) <= max) {
+        uint64_t a, b;
+        memcpy(&a, data_ + pos + i, sizeof(a));
+        memcpy(&b, str + i, sizeof(b));
+        if (a != b) {
+            break;
+        }
+        i += sizeof(uint64_t);
+    }
+    while (i < max && data_[pos + i] == str[i]) {
+        i++;
+    }
+
+    return i;
+}
+
+/**
+ * @brief  Finds the longest prefix of a string that occurs in the old image.
+ * @note   Binary search that keeps the common prefix with both bounds, so each step
+ *         only compares bytes past min(lcp_lo, lcp_hi).
+ */
+Match SuffixArray::search(const uint8_t* str, size_t len) const {
+    Match best = {0, 0};
+    if (size_ == 0 || len == 0) {
+        return best;
+    }
+
+    size_t lo = 0;
+    size_t hi = size_ - 1;
+    size_t lcp_lo = match_length(sa_[lo], str, len);
+    size_t lcp_hi = match_length(sa_[hi], str, len);
+
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        size_t skip = std::min(lcp_lo, lcp_hi);
+        size_t pos = sa_[mid];
+        size_t l = skip + match_length(pos + skip, str + skip, len - skip);
+
+        if (l == len) {
+            lo = mid;
+            lcp_lo = l;
+            break;
+        }
+
+        // Suffix at mid sorts before str if it is a proper prefix of it or differs with a smaller byte
+        if (pos + l == size_ || data_[pos + l] < str[l]) {
+            lo = mid;
+            lcp_lo = l;
+        } else {
+            hi = mid;
+            lcp_hi = l;
+        }
+    }
+
+    if (lcp_lo >= lcp_hi) {
+        best.pos = sa_[lo];
+        best.len = lcp_lo;
+    } else {
+        best.pos = sa_[hi];
+        best.len = lcp_hi;
+    }
+
+    return best;
+}
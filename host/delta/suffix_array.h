@@ -0,0 +1,44 @@
+/**
+ * @file   suffix_array.h
+ * @brief  Suffix array over the old image and longest-match search.
+ */
+#ifndef _SUFFIX_ARRAY_H
+#define _SUFFIX_ARRAY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Longest match of a new-image position in the old image
+struct Match {
+    size_t pos;     // Offset in the old image
+    size_t len;     // Match length, 0 if no byte matches
+};
+
+class SuffixArray {
+public:
+    /**
+     * @brief  Builds the suffix array with prefix doubling and radix sorting.
+     * @param  data: [in] Old image, must outlive the suffix array.
+     * @param  size: [in] Size of the old image.
+     */
+    SuffixArray(const uint8_t* data, size_t size);
+
+    /**
+     * @brief  Finds the longest prefix of a string that occurs in the old image.
+     * @param  str: [in] String to look up (a position in the new image).
+     * @param  len: [in] Number of bytes available at str.
+     * @return Position and length of the longest match.
+     * @note   Read-only, safe to call from several threads.
+     */
+    Match search(const uint8_t* str, size_t len) const;
+
+private:
+    size_t match_length(size_t pos, const uint8_t* str, size_t len) const;
+
+    const uint8_t* data_;
+    size_t size_;
+    std::vector<uint32_t> sa_;
+};
+
+#endif /* _SUFFIX_ARRAY_H */
@@ -0,0 +1,695 @@
+/**
+ * @file   xmodem_fuzz.c
+ * @brief  Fuzz target for the updater's XMODEM receiver and image header parsing.
+ *
+ * Every input is one transfer fed to xmodem_process_byte() as the updater's main
+ * loop does, with the responses drained after each byte. The receive path runs
+ * unchanged on the host HAL shims: process_first_packet(), is_image_valid_packet(),
+ * decryption, decompression and the staging writes all see the fuzzer's bytes.
+ *
+ * Input layout:
+ *   byte 0  setup
+ *           bit 0    AES-GCM transfer (use_encryption)
+ *           bit 1    framed: the harness builds valid packets, see below
+ *           bit 2-3  target: 0 loader, 1 application, 2 application direct to
+ *                    its slot, 3 updater
+ *           bit 4    data goes to a sink instead of flash
+ *           bit 5-6  virtual time between two bytes: 0, 1, 100 or 1000 ms
+ *   raw     the remaining bytes are the line
+ *   framed  byte 1   bit 0-4 control byte count, bit 7 size field from the body
+ *           control bytes, one per packet (repeating), then the body
+ *           The body is the image; an encrypted transfer sends nonce, size,
+ *           ciphertext and tag made with the updater's key, so the header parser
+ *           behind GCM is reachable. Each packet's control byte:
+ *           bit 0-1  0 sent once, 1 sent twice, 2 sent first with a bad CRC,
+ *                    3 sent first with the wrong block number
+ *           bit 4-7  the packet is sent again 2^n - 1 times under new block
+ *                    numbers, so short inputs reach the end of a flash area
+ *           EOT follows the last packet.
+ *
+ * Checks, on top of the sanitizers:
+ *   - program and erase only inside the area the transfer was started for
+ *   - the manager's buffer indexes stay within their arrays (ASan does not see
+ *     an overflow into the next struct member)
+ *   - the receiver reaches COMPLETE or ERROR once the line goes quiet: idle bytes
+ *     one virtual second apart must end the transfer through its timeouts
+ *
+ * State is restored in place between inputs (flash sectors touched, HAL registers,
+ * tick and manager), so libFuzzer runs persistently in one process.
+ *
+ * Built with Clang and -DFUZZ=ON this is a libFuzzer target:
+ *   build-fuzz/xmodem_fuzz -max_len=4096 corpus/
+ * Otherwise a standalone driver replaces libFuzzer, it also writes the seed corpus:
+ *   xmodem_fuzz [-g dir] [-n runs] [-r seed] [-l max_len] [file|dir ...]
+ *   -g  write seed inputs (complete plain and encrypted transfers) to dir
+ *   -n  after replaying the files, run this many random mutations of them
+ */
+#include "main.h"
+#include "xmodem.h"
+#include "image.h"
+#include "host_hal.h"
+#include "host_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FUZZ_CORE_CLOCK     90000000U   // Updater SYSCLK
+#define FUZZ_DRAIN_BYTES    64U         // Idle bytes allowed to end the transfer
+#define FUZZ_DRAIN_MS       1000U
+#define FUZZ_MAX_CONTROL    31U
+#define FUZZ_FLASH_END      (FLASH_END + 1U)
+
+static const uint32_t FUZZ_BYTE_MS[4] = { 0, 1, 100, 1000 };
+
+// Flash window a transfer may program or erase
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+} FuzzArea_t;
+
+typedef struct {
+    int ready;
+    uint8_t* pristine;              // Flash contents every input starts from
+    uint16_t dirty;                 // Sectors touched by the current input
+    FuzzArea_t areas[2];            // Receive area and the patch staging area
+    uint32_t area_count;
+    uint32_t byte_ms;
+    uint8_t sink_sum;
+} Fuzz_t;
+
+static Fuzz_t fuzz;
+static XmodemManager_t xmodem_manager;
+
+/* Private functions ---------------------------------------------------------*/
+static void fuzz_fail(const char* what);
+static int fuzz_nor_hook(HostNorOp_t op, uint32_t addr, uint32_t len, void* ctx);
+static void fuzz_idle(void* ctx);
+static int fuzz_sink(void* ctx, const uint8_t* data, size_t len);
+static void fuzz_setup(void);
+static void fuzz_reset(void);
+static void fuzz_check(void);
+static void fuzz_send(uint8_t byte);
+static void fuzz_send_packet(const uint8_t* data, uint8_t block, int bad_crc);
+static void fuzz_send_framed(const uint8_t* control, size_t control_count, const uint8_t* stream, size_t size);
+
+
+/**
+ * @brief  Reports a failed check the way the sanitizers do, the input is kept by the driver.
+ */
+static void fuzz_fail(const char* what) {
+    fprintf(stderr, "xmodem_fuzz: %s (state %d, packet %u, addr 0x%08lX)\n", what,
+            (int)xmodem_manager.state, xmodem_manager.packet_count,
+            (unsigned long)xmodem_manager.current_addr);
+    abort();
+}
+
+/**
+ * @brief  Confines flash operations to the transfer's areas and records touched sectors.
+ */
+static int fuzz_nor_hook(HostNorOp_t op, uint32_t addr, uint32_t len, void* ctx) {
+    int inside = 0;
+
+    for (uint32_t i = 0; i < fuzz.area_count; i++) {
+        if (addr >= fuzz.areas[i].start && addr + len <= fuzz.areas[i].end) {
+            inside = 1;
+        }
+    }
+
+    if (!inside) {
+        fprintf(stderr, "xmodem_fuzz: %s of %lu bytes at 0x%08lX\n", op == HOST_NOR_OP_ERASE ? "erase" : "program",
+                (unsigned long)len, (unsigned long)addr);
+        fuzz_fail("flash operation outside the receive area");
+    }
+
+    uint32_t start;
+    uint32_t size;
+    int sector = host_nor_sector(addr, &start, &size);
+    if (sector >= 0) {
+        fuzz.dirty |= (uint16_t)(1U << sector);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  Keeps the tick still while firmware reads it, the harness moves time itself.
+ */
+static void fuzz_idle(void* ctx) {
+}
+
+/**
+ * @brief  Data sink standing in for the streamed patch path.
+ */
+static int fuzz_sink(void* ctx, const uint8_t* data, size_t len) {
+    // Read every byte so ASan sees a length past the data
+    for (size_t i = 0; i < len; i++) {
+        fuzz.sink_sum += data[i];
+    }
+
+    return 1;
+}
+
+/**
+ * @brief  Maps the flash and lays out a device with installed images, once per process.
+ */
+static void fuzz_setup(void) {
+    if (!host_nor_init(NULL)) {
+        abort();
+    }
+
+    host_system_reset();
+    host_nor_erase_all();
+
+    // Installed images give the version check something to compare against
+    static const struct {
+        uint32_t addr;
+        uint32_t magic;
+        uint8_t type;
+    } images[] = {
+        { LOADER_ADDR, IMAGE_MAGIC_LOADER, IMAGE_TYPE_LOADER },
+        { UPDATER_ADDR, IMAGE_MAGIC_UPDATER, IMAGE_TYPE_UPDATER },
+        { APP_ADDR, IMAGE_MAGIC_APP, IMAGE_TYPE_APP },
+    };
+
+    for (size_t i = 0; i < sizeof(images) / sizeof(images[0]); i++) {
+        ImageHeader_t header;
+        host_image_header(&header, images[i].addr, images[i].magic, images[i].type, NULL, 0x1000);
+        header.version_minor = 2;
+        header.version_patch = 3;
+        memcpy(host_nor_raw() + (images[i].addr - FLASH_BASE), &header, sizeof(header));
+    }
+
+    fuzz.pristine = malloc(HOST_FLASH_SIZE);
+    if (fuzz.pristine == NULL) {
+        abort();
+    }
+    memcpy(fuzz.pristine, host_nor_raw(), HOST_FLASH_SIZE);
+
+    host_nor_set_hook(fuzz_nor_hook, NULL);
+    host_set_poll_hook(fuzz_idle, NULL);
+    fuzz.ready = 1;
+}
+
+/**
+ * @brief  Puts the model back to the state after fuzz_setup(), only sectors an input touched are copied.
+ */
+static void fuzz_reset(void) {
+    uint32_t addr = FLASH_BASE;
+    uint32_t start;
+    uint32_t size;
+    int sector;
+
+    while (fuzz.dirty != 0 && (sector = host_nor_sector(addr, &start, &size)) >= 0) {
+        if (fuzz.dirty & (1U << sector)) {
+            memcpy(host_nor_raw() + (start - FLASH_BASE), fuzz.pristine + (start - FLASH_BASE), size);
+        }
+        addr = start + size;
+    }
+    fuzz.dirty = 0;
+
+    host_system_reset();
+    host_nor_reset_stats();
+    SystemCoreClock = FUZZ_CORE_CLOCK;
+}
+
+/**
+ * @brief  Checks the manager's fill levels against the arrays they index.
+ */
+static void fuzz_check(void) {
+    if (xmodem_manager.buffer_index > sizeof(xmodem_manager.buffer)) {
+        fuzz_fail("packet buffer overflow");
+    }
+    if (xmodem_manager.held_fill > XMODEM_HELD_HEADER_SIZE) {
+        fuzz_fail("held header overflow");
+    }
+    if (xmodem_manager.lz_fill > sizeof(LzssHeader_t)) {
+        fuzz_fail("LZSS container header overflow");
+    }
+    if (xmodem_manager.unpack_fill > XMODEM_UNPACK_SIZE) {
+        fuzz_fail("unpack buffer overflow");
+    }
+#ifdef FIRMWARE_ENCRYPTED
+    if (xmodem_manager.tag_fill > sizeof(xmodem_manager.tag)) {
+        fuzz_fail("GCM tag overflow");
+    }
+#endif
+}
+
+/**
+ * @brief  Delivers one byte and drains the response, as the updater's main loop does.
+ */
+static void fuzz_send(uint8_t byte) {
+    host_tick_advance(fuzz.byte_ms);
+
+    xmodem_process_byte(&xmodem_manager, byte);
+    if (xmodem_should_send_byte(&xmodem_manager)) {
+        xmodem_get_response(&xmodem_manager);
+    }
+
+    fuzz_check();
+}
+
+/**
+ * @brief  Sends one 128-byte packet.
+ */
+static void fuzz_send_packet(const uint8_t* data, uint8_t block, int bad_crc) {
+    uint16_t crc = host_image_crc16(data, XMODEM_UNPACK_SIZE) ^ (bad_crc ? 0x0001 : 0x0000);
+
+    fuzz_send(XMODEM_SOH);
+    fuzz_send(block);
+    fuzz_send((uint8_t)~block);
+    for (size_t i = 0; i < XMODEM_UNPACK_SIZE; i++) {
+        fuzz_send(data[i]);
+    }
+    fuzz_send((uint8_t)(crc >> 8));
+    fuzz_send((uint8_t)crc);
+}
+
+/**
+ * @brief  Sends a stream as packets shaped by the control bytes, then EOT.
+ */
+static void fuzz_send_framed(const uint8_t* control, size_t control_count, const uint8_t* stream, size_t size) {
+    uint8_t block = 1;
+    size_t packets = (size + XMODEM_UNPACK_SIZE - 1) / XMODEM_UNPACK_SIZE;
+
+    for (size_t i = 0; i < packets; i++) {
+        uint8_t data[XMODEM_UNPACK_SIZE];
+        size_t len = size - i * XMODEM_UNPACK_SIZE;
+        if (len > XMODEM_UNPACK_SIZE) {
+            len = XMODEM_UNPACK_SIZE;
+        }
+        memcpy(data, stream + i * XMODEM_UNPACK_SIZE, len);
+        memset(data + len, 0x1A, XMODEM_UNPACK_SIZE - len);
+
+        uint8_t ctl = control_count ? control[i % control_count] : 0;
+        uint32_t copies = 1U << (ctl >> 4);
+
+        for (uint32_t copy = 0; copy < copies; copy++) {
+            switch (ctl & 0x03) {
+                case 1: fuzz_send_packet(data, block, 0); break;
+                case 2: fuzz_send_packet(data, block, 1); break;
+                case 3: fuzz_send_packet(data, (uint8_t)(block + 1), 0); break;
+                default: break;
+            }
+            fuzz_send_packet(data, block, 0);
+            block++;
+
+            // Nothing more reaches a receiver that gave up
+            XmodemState_t state = xmodem_get_state(&xmodem_manager);
+            if (state == XMODEM_STATE_ERROR || state == XMODEM_STATE_COMPLETE) {
+                return;
+            }
+        }
+    }
+
+    fuzz_send(XMODEM_EOT);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (!fuzz.ready) {
+        fuzz_setup();
+    }
+    if (size < 1) {
+        return 0;
+    }
+
+    uint8_t setup = data[0];
+    int encrypted = setup & 0x01;
+    int framed = (setup & 0x02) != 0;
+    int target = (setup >> 2) & 0x03;
+    int sink = (setup & 0x10) != 0;
+    data++;
+    size--;
+
+    fuzz_reset();
+    fuzz.byte_ms = FUZZ_BYTE_MS[(setup >> 5) & 0x03];
+
+    XmodemConfig_t xmodem_config = {
+        .app_addr = APP_ADDR,
+        .updater_addr = UPDATER_ADDR,
+        .loader_addr = LOADER_ADDR,
+        .image_hdr_size = IMAGE_HDR_SIZE,
+        .use_encryption = (uint8_t)encrypted
+    };
+    xmodem_init(&xmodem_manager, &xmodem_config);
+
+    // Receive areas as the updater's menu sets them up
+    uint32_t intended = (target == 0) ? LOADER_ADDR : (target == 3) ? UPDATER_ADDR : APP_ADDR;
+    fuzz.areas[0].start = PATCH_ADDR;
+    fuzz.areas[0].end = FUZZ_FLASH_END;
+    fuzz.area_count = 1;
+
+#ifdef AB_SLOTS
+    if (target == 1 || target == 2) {
+        fuzz.areas[1].start = APP_B_ADDR;
+        fuzz.areas[1].end = APP_B_ADDR + APP_SLOT_SIZE;
+        fuzz.area_count = 2;
+    }
+    if (target == 2) {
+        xmodem_set_direct(&xmodem_manager, APP_B_ADDR);
+    } else {
+        xmodem_set_staging(&xmodem_manager, (target == 1) ? APP_B_ADDR : 0);
+    }
+#else
+    if (target == 2) {
+        fuzz.areas[1].start = APP_ADDR;
+        fuzz.areas[1].end = BACKUP_ADDR;
+        fuzz.area_count = 2;
+        xmodem_set_direct(&xmodem_manager, APP_ADDR);
+    } else {
+        xmodem_set_staging(&xmodem_manager, 0);
+    }
+#endif
+
+    if (sink) {
+        fuzz.area_count = 0;
+        xmodem_set_sink(&xmodem_manager, fuzz_sink, NULL);
+    }
+
+    xmodem_start(&xmodem_manager, intended);
+    if (xmodem_should_send_byte(&xmodem_manager)) {
+        xmodem_get_response(&xmodem_manager);
+    }
+
+    if (!framed) {
+        for (size_t i = 0; i < size; i++) {
+            fuzz_send(data[i]);
+        }
+    } else if (size >= 1) {
+        size_t control_count = data[0] & FUZZ_MAX_CONTROL;
+        int size_from_body = (data[0] & 0x80) != 0;
+        data++;
+        size--;
+
+        if (control_count > size) {
+            control_count = size;
+        }
+        const uint8_t* control = data;
+        data += control_count;
+        size -= control_count;
+
+        if (!encrypted) {
+            fuzz_send_framed(control, control_count, data, size);
+        } else {
+            uint32_t size_field = (uint32_t)size;
+            if (size_from_body && size >= 4) {
+                size_field = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) |
+                             ((uint32_t)data[2] << 8) | data[3];
+                data += 4;
+                size -= 4;
+            }
+
+            static const uint8_t nonce[12] = {
+                0xA5, 0xA5, 0xA5, 0xA5, 0xA5, 0xA5, 0xA5, 0xA5, 0xA5, 0xA5, 0xA5, 0xA5
+            };
+            size_t stream_size = 0;
+            uint8_t* stream = host_image_encrypt(data, size, size_field, nonce, &stream_size);
+            if (stream != NULL) {
+                fuzz_send_framed(control, control_count, stream, stream_size);
+                free(stream);
+            }
+        }
+    }
+
+    // A quiet line has to end the transfer through the receiver's timeouts
+    fuzz.byte_ms = FUZZ_DRAIN_MS;
+    for (uint32_t i = 0; i < FUZZ_DRAIN_BYTES; i++) {
+        XmodemState_t state = xmodem_get_state(&xmodem_manager);
+        if (state == XMODEM_STATE_ERROR || state == XMODEM_STATE_COMPLETE) {
+            break;
+        }
+        fuzz_send(0x00);
+    }
+
+    XmodemState_t state = xmodem_get_state(&xmodem_manager);
+    if (state != XMODEM_STATE_ERROR && state != XMODEM_STATE_COMPLETE) {
+        fuzz_fail("receiver still waiting after the line went quiet");
+    }
+
+    xmodem_cleanup(&xmodem_manager);
+    return 0;
+}
+
+#ifdef XMODEM_FUZZ_STANDALONE
+/*
+ * Replays inputs and runs blind mutations of them for builds without libFuzzer
+ * (GCC). A failing input is written to crash-<run>.bin before the process dies.
+ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DRIVER_MAX_INPUTS   4096U
+#define DRIVER_DEFAULT_LEN  4096U
+
+typedef struct {
+    uint8_t* data;
+    size_t size;
+} DriverInput_t;
+
+static DriverInput_t driver_inputs[DRIVER_MAX_INPUTS];
+static uint32_t driver_input_count;
+static const uint8_t* driver_current;
+static size_t driver_current_size;
+static uint64_t driver_run;
+static uint64_t driver_rng;
+
+static void driver_on_crash(int sig) {
+    char name[48];
+    int len = snprintf(name, sizeof(name), "crash-%llu.bin", (unsigned long long)driver_run);
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd >= 0 && len > 0) {
+        ssize_t written = write(fd, driver_current, driver_current_size);
+        (void)written;
+        close(fd);
+        static const char msg[] = "xmodem_fuzz: input written to ";
+        written = write(2, msg, sizeof(msg) - 1);
+        written = write(2, name, (size_t)len);
+        written = write(2, "\n", 1);
+    }
+
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static uint32_t driver_random(void) {
+    driver_rng ^= driver_rng >> 12;
+    driver_rng ^= driver_rng << 25;
+    driver_rng ^= driver_rng >> 27;
+    return (uint32_t)((driver_rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static void driver_run_input(const uint8_t* data, size_t size) {
+    driver_current = data;
+    driver_current_size = size;
+    LLVMFuzzerTestOneInput(data, size);
+    driver_run++;
+}
+
+static int driver_load(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL || driver_input_count >= DRIVER_MAX_INPUTS) {
+        if (file != NULL) {
+            fclose(file);
+        }
+        return 0;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t* data = malloc(size > 0 ? (size_t)size : 1);
+    if (data == NULL || fread(data, 1, (size_t)size, file) != (size_t)size) {
+        free(data);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+
+    driver_inputs[driver_input_count].data = data;
+    driver_inputs[driver_input_count].size = (size_t)size;
+    driver_input_count++;
+    return 1;
+}
+
+static void driver_load_path(const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        perror(path);
+        exit(1);
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        driver_load(path);
+        return;
+    }
+
+    DIR* dir = opendir(path);
+    struct dirent* entry;
+    while (dir != NULL && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char file[4096];
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+        driver_load(file);
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+}
+
+/**
+ * @brief  Mutates a copy of a loaded input (or an empty one) into buf.
+ */
+static size_t driver_mutate(uint8_t* buf, size_t max_len) {
+    size_t size = 0;
+
+    if (driver_input_count > 0) {
+        const DriverInput_t* input = &driver_inputs[driver_random() % driver_input_count];
+        size = input->size < max_len ? input->size : max_len;
+        memcpy(buf, input->data, size);
+    }
+
+    uint32_t steps = 1 + driver_random() % 8;
+    for (uint32_t step = 0; step < steps; step++) {
+        uint32_t pos = size ? driver_random() % size : 0;
+
+        switch (driver_random() % 6) {
+            case 0:
+                if (size) buf[pos] ^= (uint8_t)(1U << (driver_random() % 8));
+                break;
+            case 1:
+                if (size) buf[pos] = (uint8_t)driver_random();
+                break;
+            case 2:
+                if (size < max_len) {
+                    memmove(buf + pos + 1, buf + pos, size - pos);
+                    buf[pos] = (uint8_t)driver_random();
+                    size++;
+                }
+                break;
+            case 3:
+                if (size) {
+                    memmove(buf + pos, buf + pos + 1, size - pos - 1);
+                    size--;
+                }
+                break;
+            case 4: {
+                // Interesting values where the parsers keep sizes and magics
+                static const uint32_t values[] = { 0, 1, 0x7F, 0x80, 0xFF, 0x200, 0xFFFF, 0x80000,
+                                                   0x80001, 0xFFFFFFFF, IMAGE_MAGIC_APP, IMAGE_MAGIC_LOADER };
+                uint32_t value = values[driver_random() % (sizeof(values) / sizeof(values[0]))];
+                for (uint32_t i = 0; i < 4 && pos + i < size; i++) {
+                    buf[pos + i] = (uint8_t)(value >> (8 * i));
+                }
+                break;
+            }
+            default: {
+                // Copy a block over another place
+                if (size > 1) {
+                    uint32_t from = driver_random() % size;
+                    uint32_t len = 1 + driver_random() % (size - (from > pos ? from : pos));
+                    memmove(buf + pos, buf + from, len);
+                }
+                break;
+            }
+        }
+    }
+
+    return size;
+}
+
+/**
+ * @brief  Writes complete transfers in the framed format as a starting corpus.
+ */
+static void driver_write_seeds(const char* dir) {
+    static const uint32_t sizes[] = { 256, 1000, 4000 };
+    mkdir(dir, 0755);
+
+    for (int encrypted = 0; encrypted < 2; encrypted++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            size_t image_size = IMAGE_HDR_SIZE + sizes[s];
+            uint8_t* seed = calloc(1, 2 + image_size);
+            if (seed == NULL) {
+                exit(1);
+            }
+
+            seed[0] = (uint8_t)(0x02 | (1 << 2) | encrypted);
+            seed[1] = 0;
+
+            ImageHeader_t header;
+            host_image_header(&header, APP_ADDR, IMAGE_MAGIC_APP, IMAGE_TYPE_APP, NULL, sizes[s]);
+            header.version_major = 2;
+            memcpy(seed + 2, &header, sizeof(header));
+            for (size_t i = 0; i < sizes[s]; i++) {
+                seed[2 + IMAGE_HDR_SIZE + i] = (uint8_t)(i * 7);
+            }
+
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s-%u.bin", dir, encrypted ? "enc" : "plain", (unsigned)sizes[s]);
+            FILE* file = fopen(path, "wb");
+            if (file == NULL || fwrite(seed, 1, 2 + image_size, file) != 2 + image_size) {
+                perror(path);
+                exit(1);
+            }
+            fclose(file);
+            free(seed);
+        }
+    }
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-g dir] [-n runs] [-r seed] [-l max_len] [file|dir ...]\n", name);
+}
+
+int main(int argc, char** argv) {
+    uint64_t runs = 0;
+    size_t max_len = DRIVER_DEFAULT_LEN;
+    int opt;
+
+    driver_rng = 1;
+
+    while ((opt = getopt(argc, argv, "g:n:r:l:")) != -1) {
+        switch (opt) {
+            case 'g': driver_write_seeds(optarg); return 0;
+            case 'n': runs = strtoull(optarg, NULL, 0); break;
+            case 'r': driver_rng = strtoull(optarg, NULL, 0) | 1; break;
+            case 'l': max_len = strtoul(optarg, NULL, 0); break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    signal(SIGABRT, driver_on_crash);
+    signal(SIGSEGV, driver_on_crash);
+    signal(SIGBUS, driver_on_crash);
+
+    for (int i = optind; i < argc; i++) {
+        driver_load_path(argv[i]);
+    }
+
+    for (uint32_t i = 0; i < driver_input_count; i++) {
+        driver_run_input(driver_inputs[i].data, driver_inputs[i].size);
+    }
+    printf("xmodem_fuzz: %u inputs replayed\n", driver_input_count);
+
+    if (runs > 0) {
+        uint8_t* buf = malloc(max_len ? max_len : 1);
+        if (buf == NULL) {
+            return 1;
+        }
+        for (uint64_t run = 0; run < runs; run++) {
+            size_t size = driver_mutate(buf, max_len);
+            driver_run_input(buf, size);
+        }
+        free(buf);
+        printf("xmodem_fuzz: %llu mutated inputs run\n", (unsigned long long)runs);
+    }
+
+    return 0;
+}
+#endif /* XMODEM_FUZZ_STANDALONE */
@@ -0,0 +1,88 @@
+#include "crc.h"
+#include "image.h"
+#include "flash.h"
+#include "verify_cache.h"
+
+/*
+ * Host replacement for common/src/crc.c. The CRC unit is fed by plain stores to
+ * CRC->DR, which a host struct cannot observe, so the unit is computed in software
+ * here with the same algorithm: CRC-32 polynomial 0x04C11DB7, MSB first, 32-bit
+ * words, initial value 0xFFFFFFFF, no output XOR. Everything above the unit is
+ * kept identical to crc.c.
+ */
+
+/* Private functions ---------------------------------------------------------*/
+static void crc_write_word(uint32_t word);
+
+
+/**
+ * @brief  Feeds one word to the CRC unit, as a write to CRC->DR does.
+ * @param  word: [in] Data word.
+ */
+static void crc_write_word(uint32_t word) {
+    uint32_t crc = CRC->DR ^ word;
+
+    for (int bit = 0; bit < 32; bit++) {
+        crc = (crc & 0x80000000U) ? (crc << 1) ^ 0x04C11DB7U : (crc << 1);
+    }
+
+    CRC->DR = crc;
+}
+
+void crc_init(void) {
+    __HAL_RCC_CRC_CLK_ENABLE();
+}
+
+void crc_reset(void) {
+    CRC->DR = 0xFFFFFFFFU;
+}
+
+uint32_t crc_calculate(const uint8_t* data, size_t len) {
+    crc_reset();
+
+    for (size_t i = 0; i < len / 4; i++) {
+        uint32_t word;
+        memcpy(&word, data + i * 4, sizeof(word));
+        crc_write_word(word);
+    }
+
+    uint32_t remaining = len % 4;
+    if (remaining > 0) {
+        uint32_t last_word = 0;
+        size_t offset = len - remaining;
+
+        for (size_t i = 0; i < remaining; i++) {
+            last_word |= (uint32_t)data[offset + i] << (i * 8);
+        }
+
+        crc_write_word(last_word);
+    }
+
+    return CRC->DR;
+}
+
+uint32_t crc_calculate_memory(uint32_t addr, uint32_t size) {
+    crc_init();
+
+    return crc_calculate((const uint8_t*)(uintptr_t)addr, size);
+}
+
+int verify_firmware_crc(uint32_t addr, uint32_t header_size) {
+    ImageHeader_t header;
+    memcpy(&header, (void*)(uintptr_t)addr, sizeof(ImageHeader_t));
+
+    if (header.data_size == 0 || header.data_size > 0x100000) {
+        return 0;
+    }
+
+    uint32_t firmware_addr = addr + header_size;
+    uint32_t calculated_crc = crc_calculate_memory(firmware_addr, header.data_size);
+
+    return calculated_crc == header.crc;
+}
+
+int invalidate_firmware(uint32_t addr) {
+    verify_cache_invalidate(addr);
+
+    return flash_erase_sector(addr);
+}
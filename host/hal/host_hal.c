@@ -0,0 +1,387 @@
+#include "stm32f4xx_hal.h"
+#include "host_ll.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * Core, clock and USART2 models. Time only moves when the host says so (or one
+ * tick per HAL_GetTick() call without a poll hook, so firmware timeouts still
+ * expire). Interrupts run synchronously on the caller's stack whenever a model
+ * event or an unmask makes one pending.
+ *
+ * Firmware also waits in loops that only an interrupt can end. A host program can
+ * feed events from a SIGALRM handler for those, after host_irq_set_async(1): the
+ * model then keeps SIGALRM blocked in its own code, while interrupts are disabled
+ * and while a handler runs, the way the NVIC holds off a preempting interrupt.
+ */
+
+// Handlers come from the common/ sources linked with the shims
+extern void USART2_IRQHandler(void);
+
+/* Registers -----------------------------------------------------------------*/
+RCC_TypeDef    host_rcc;
+FLASH_TypeDef  host_flash_regs;
+CRC_TypeDef    host_crc;
+PWR_TypeDef    host_pwr;
+RTC_TypeDef    host_rtc;
+SYSCFG_TypeDef host_syscfg;
+DWT_Type       host_dwt;
+CoreDebug_Type host_core_debug;
+SCB_Type       host_scb;
+SysTick_Type   host_systick;
+USART_TypeDef  host_usart1, host_usart2, host_usart6;
+GPIO_TypeDef   host_gpioa, host_gpioc, host_gpiod;
+
+uint8_t host_bkpsram[4096];
+uint8_t host_ccmram[64 * 1024];
+
+uint32_t SystemCoreClock = HSI_VALUE;
+
+typedef struct {
+    volatile uint32_t tick;
+    uint32_t pll_clock;
+    uint32_t apb1_div;
+    uint32_t apb2_div;
+    HostPollHook_t poll;
+    void* poll_ctx;
+    int irq_masked;
+    int usart2_enabled;
+    int in_handler;
+    int async;
+    HostUsartSink_t tx_sink;
+    void* tx_ctx;
+    HostJumpHook_t jump;
+    void* jump_ctx;
+} HostCore_t;
+
+static HostCore_t core;
+
+/* Private functions ---------------------------------------------------------*/
+static void host_poll(void);
+static void host_irq_block(sigset_t* saved);
+static void host_irq_restore(const sigset_t* saved);
+
+
+/**
+ * @brief  Holds off the asynchronous event source, if there is one.
+ * @param  saved: [out] Signal mask to restore.
+ */
+static void host_irq_block(sigset_t* saved) {
+    if (core.async) {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGALRM);
+        sigprocmask(SIG_BLOCK, &set, saved);
+    }
+}
+
+static void host_irq_restore(const sigset_t* saved) {
+    if (core.async && !core.irq_masked) {
+        sigprocmask(SIG_SETMASK, saved, NULL);
+    }
+}
+
+/**
+ * @brief  Lets the host run while firmware waits on time.
+ */
+static void host_poll(void) {
+    sigset_t saved;
+    host_irq_block(&saved);
+
+    if (core.poll != NULL) {
+        core.poll(core.poll_ctx);
+    } else {
+        host_tick_advance(1);
+    }
+
+    host_irq_restore(&saved);
+    host_irq_service();
+}
+
+void host_irq_set_async(int enable) {
+    core.async = enable;
+}
+
+void host_tick_advance(uint32_t ms) {
+    core.tick += ms;
+
+    if (host_dwt.CTRL & DWT_CTRL_CYCCNTENA_Msk) {
+        host_dwt.CYCCNT += ms * (SystemCoreClock / 1000U);
+    }
+}
+
+void host_set_poll_hook(HostPollHook_t hook, void* ctx) {
+    core.poll = hook;
+    core.poll_ctx = ctx;
+}
+
+/**
+ * @brief  Runs USART2_IRQHandler() while the USART has an enabled event pending.
+ * @note   Handlers do not nest, a handler that unmasks or enables an interrupt
+ *         is picked up by the loop instead.
+ */
+void host_irq_service(void) {
+    if (core.irq_masked || core.in_handler || !core.usart2_enabled) {
+        return;
+    }
+
+    sigset_t saved;
+    host_irq_block(&saved);
+
+    core.in_handler = 1;
+    for (;;) {
+        uint32_t sr = host_usart2.SR;
+        uint32_t cr1 = host_usart2.CR1;
+        int pending = ((sr & USART_SR_RXNE) && (cr1 & USART_CR1_RXNEIE)) ||
+                      ((sr & USART_SR_TXE) && (cr1 & USART_CR1_TXEIE)) ||
+                      ((sr & USART_SR_ORE) && (cr1 & USART_CR1_RXNEIE));
+        if (!pending || !(cr1 & USART_CR1_UE)) {
+            break;
+        }
+        USART2_IRQHandler();
+    }
+    core.in_handler = 0;
+
+    host_irq_restore(&saved);
+}
+
+/* USART2 --------------------------------------------------------------------*/
+
+/**
+ * @brief  Resets a USART to an idle, empty transmitter.
+ * @note   Only USART2 is wired to the host, USART1 and USART6 are registers alone.
+ */
+ErrorStatus LL_USART_Init(USART_TypeDef* USARTx, LL_USART_InitTypeDef* USART_InitStruct) {
+    if (USART_InitStruct->BaudRate == 0) {
+        return ERROR;
+    }
+
+    uint32_t clock = (USARTx == USART1 || USARTx == USART6) ? HAL_RCC_GetPCLK2Freq() : HAL_RCC_GetPCLK1Freq();
+    USARTx->CR1 = (USARTx->CR1 & USART_CR1_UE) | USART_InitStruct->TransferDirection | USART_InitStruct->OverSampling;
+    LL_USART_SetBaudRate(USARTx, clock, USART_InitStruct->OverSampling, USART_InitStruct->BaudRate);
+    USARTx->SR = USART_SR_TXE | USART_SR_TC;
+
+    return SUCCESS;
+}
+
+void host_usart_set_tx_sink(HostUsartSink_t sink, void* ctx) {
+    core.tx_sink = sink;
+    core.tx_ctx = ctx;
+}
+
+/**
+ * @brief  Hands a transmitted byte to the sink.
+ * @note   The line is modelled as infinitely fast, the data register is empty
+ *         again right away. Host programs that need line time pace with the tick.
+ */
+void host_usart_transmit(uint8_t byte) {
+    sigset_t saved;
+    host_irq_block(&saved);
+
+    host_usart2.SR |= USART_SR_TXE | USART_SR_TC;
+
+    if (core.tx_sink != NULL) {
+        core.tx_sink(byte, core.tx_ctx);
+    }
+
+    host_irq_restore(&saved);
+}
+
+/**
+ * @brief  Latches a received byte into the data register.
+ * @param  byte: [in] Received byte.
+ * @return 1 if accepted, 0 if the previous byte was still unread (overrun, byte lost).
+ */
+int host_usart_rx_push(uint8_t byte) {
+    if (host_usart2.SR & USART_SR_RXNE) {
+        host_usart2.SR |= USART_SR_ORE;
+        host_irq_service();
+        return 0;
+    }
+
+    host_usart2.DR = byte;
+    host_usart2.SR |= USART_SR_RXNE;
+    host_irq_service();
+
+    return 1;
+}
+
+int host_usart_rx_ready(void) {
+    return (host_usart2.SR & USART_SR_RXNE) == 0;
+}
+
+/* Clocks --------------------------------------------------------------------*/
+
+/**
+ * @brief  Records the PLL output the oscillator settings would produce.
+ * @note   Ready flags are not latched: RCC->CR is plain memory and could not drop
+ *         them again when prepare_for_boot() turns HSE and the PLL off and waits.
+ */
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef* RCC_OscInitStruct) {
+    const RCC_PLLInitTypeDef* pll = &RCC_OscInitStruct->PLL;
+
+    if (pll->PLLState == RCC_PLL_ON) {
+        if (pll->PLLM == 0 || pll->PLLP == 0) {
+            return HAL_ERROR;
+        }
+        uint32_t source = (pll->PLLSource == RCC_PLLSOURCE_HSE) ? HSE_VALUE : HSI_VALUE;
+        core.pll_clock = (uint32_t)((uint64_t)source / pll->PLLM * pll->PLLN / pll->PLLP);
+        RCC->CR |= RCC_CR_PLLON;
+    }
+
+    if (RCC_OscInitStruct->HSEState == RCC_HSE_ON) {
+        RCC->CR |= RCC_CR_HSEON;
+    }
+
+    return HAL_OK;
+}
+
+/**
+ * @brief  Switches the core to the PLL and updates SystemCoreClock.
+ */
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef* RCC_ClkInitStruct, uint32_t FLatency) {
+    if (RCC_ClkInitStruct->SYSCLKSource == RCC_SYSCLKSOURCE_PLLCLK) {
+        if (core.pll_clock == 0) {
+            return HAL_ERROR;
+        }
+        SystemCoreClock = core.pll_clock;
+        RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SWS) | RCC_CFGR_SWS_PLL;
+    }
+
+    core.apb1_div = (RCC_ClkInitStruct->APB1CLKDivider == RCC_HCLK_DIV4) ? 4 :
+                    (RCC_ClkInitStruct->APB1CLKDivider == RCC_HCLK_DIV2) ? 2 : 1;
+    core.apb2_div = (RCC_ClkInitStruct->APB2CLKDivider == RCC_HCLK_DIV4) ? 4 :
+                    (RCC_ClkInitStruct->APB2CLKDivider == RCC_HCLK_DIV2) ? 2 : 1;
+
+    return HAL_OK;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void) {
+    return SystemCoreClock / (core.apb1_div ? core.apb1_div : 1);
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void) {
+    return SystemCoreClock / (core.apb2_div ? core.apb2_div : 1);
+}
+
+/* Core ----------------------------------------------------------------------*/
+
+HAL_StatusTypeDef HAL_Init(void) {
+    return HAL_OK;
+}
+
+uint32_t HAL_GetTick(void) {
+    host_poll();
+
+    return core.tick;
+}
+
+void HAL_Delay(uint32_t Delay) {
+    uint32_t start = core.tick;
+
+    while (core.tick - start < Delay) {
+        host_poll();
+    }
+}
+
+void HAL_PWR_EnableBkUpAccess(void) {
+    PWR->CR |= PWR_CR_DBP;
+}
+
+void __disable_irq(void) {
+    sigset_t saved;
+    host_irq_block(&saved);
+
+    core.irq_masked = 1;
+}
+
+void __enable_irq(void) {
+    core.irq_masked = 0;
+
+    if (core.async) {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGALRM);
+        sigprocmask(SIG_UNBLOCK, &set, NULL);
+    }
+
+    host_irq_service();
+}
+
+void NVIC_EnableIRQ(IRQn_Type IRQn) {
+    if (IRQn == USART2_IRQn) {
+        core.usart2_enabled = 1;
+        host_irq_service();
+    }
+}
+
+void NVIC_DisableIRQ(IRQn_Type IRQn) {
+    if (IRQn == USART2_IRQn) {
+        core.usart2_enabled = 0;
+    }
+}
+
+/**
+ * @brief  Ends execution of the current image at a jump.
+ * @note   boot_xxx() loads MSP right before branching to the reset handler, which
+ *         cannot run on the host. The jump hook decides what comes next.
+ */
+void __set_MSP(uint32_t topOfMainStack) {
+    if (core.jump != NULL) {
+        core.jump(SCB->VTOR, topOfMainStack, core.jump_ctx);
+    }
+
+    fprintf(stderr, "host: jump to image at 0x%08lx\n", (unsigned long)SCB->VTOR);
+    exit(0);
+}
+
+void __set_PSP(uint32_t topOfProcStack) {
+}
+
+/**
+ * @brief  Software reset, ends the current image like a jump to the boot image.
+ * @note   The jump hook sees the vector table at FLASH_BASE, host_system_reset()
+ *         is left to it.
+ */
+void NVIC_SystemReset(void) {
+    SCB->VTOR = FLASH_BASE;
+    __set_MSP(*(volatile uint32_t*)FLASH_BASE);
+    while (1) {
+    }
+}
+
+void host_set_jump_hook(HostJumpHook_t hook, void* ctx) {
+    core.jump = hook;
+    core.jump_ctx = ctx;
+}
+
+/**
+ * @brief  Puts registers, tick and interrupt state back to their reset values.
+ */
+void host_system_reset(void) {
+    memset(&host_rcc, 0, sizeof(host_rcc));
+    memset(&host_flash_regs, 0, sizeof(host_flash_regs));
+    memset(&host_crc, 0, sizeof(host_crc));
+    memset(&host_pwr, 0, sizeof(host_pwr));
+    memset(&host_syscfg, 0, sizeof(host_syscfg));
+    memset(&host_dwt, 0, sizeof(host_dwt));
+    memset(&host_core_debug, 0, sizeof(host_core_debug));
+    memset(&host_scb, 0, sizeof(host_scb));
+    memset(&host_systick, 0, sizeof(host_systick));
+    memset(&host_usart2, 0, sizeof(host_usart2));
+
+    host_rcc.CR = RCC_CR_HSION | RCC_CR_HSIRDY;
+    host_rcc.PLLCFGR = 0x24003010;
+    host_flash_regs.CR = FLASH_CR_LOCK;
+    host_crc.DR = 0xFFFFFFFFU;
+    SystemCoreClock = HSI_VALUE;
+
+    core.tick = 0;
+    core.pll_clock = 0;
+    core.apb1_div = 1;
+    core.apb2_div = 1;
+    core.irq_masked = 0;
+    core.usart2_enabled = 0;
+    core.in_handler = 0;
+}
@@ -0,0 +1,107 @@
+#ifndef _HOST_HAL_H
+#define _HOST_HAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Controls for the host peripheral models behind the HAL/LL shims. Host programs
+ * (simulator, benchmarks, fuzzers) use these to drive what is a hardware event
+ * on target: flash contents, time, UART traffic and jumps to another image.
+ */
+
+/* NOR flash model -----------------------------------------------------------*/
+typedef enum {
+    HOST_NOR_OP_PROGRAM = 0,    // HAL_FLASH_Program(), len is the access width
+    HOST_NOR_OP_ERASE           // HAL_FLASHEx_Erase(), once per sector
+} HostNorOp_t;
+
+typedef struct {
+    uint32_t programs;          // Successful program operations
+    uint32_t program_bytes;     // Bytes programmed
+    uint32_t erases;            // Sectors erased
+    uint32_t erase_bytes;       // Bytes erased
+    uint32_t violations;        // Programs refused, a 0 bit would have gone back to 1
+    uint32_t locked_writes;     // Operations refused while the flash was locked
+    uint32_t rejected;          // Operations refused by the hook
+} HostNorStats_t;
+
+// Called before every program or erase, returning non-zero fails the operation
+typedef int (*HostNorHook_t)(HostNorOp_t op, uint32_t addr, uint32_t len, void* ctx);
+
+// Map the 1 MB flash at FLASH_BASE, backed by a file or anonymous memory when path is NULL
+int host_nor_init(const char* path);
+
+// Unmap the flash, a file backing keeps its contents
+void host_nor_deinit(void);
+
+// Writable view of the flash for the host, bypasses every NOR rule
+uint8_t* host_nor_raw(void);
+
+// Erase the whole array to 0xFF
+void host_nor_erase_all(void);
+
+// Sector number, start and size of the sector holding addr, -1 outside flash
+int host_nor_sector(uint32_t addr, uint32_t* start, uint32_t* size);
+
+// Operation counters
+const HostNorStats_t* host_nor_stats(void);
+void host_nor_reset_stats(void);
+
+// Install a program/erase hook, NULL removes it
+void host_nor_set_hook(HostNorHook_t hook, void* ctx);
+
+// Value being programmed, for a hook called with HOST_NOR_OP_PROGRAM
+uint64_t host_nor_program_data(void);
+
+/* Virtual tick --------------------------------------------------------------*/
+
+// Called from HAL_GetTick() and HAL_Delay() while firmware waits on time
+typedef void (*HostPollHook_t)(void* ctx);
+
+// Advance the millisecond tick, DWT CYCCNT follows at SystemCoreClock
+void host_tick_advance(uint32_t ms);
+
+// Install the poll hook, NULL restores the default of one tick per HAL_GetTick() call
+void host_set_poll_hook(HostPollHook_t hook, void* ctx);
+
+/* Interrupts ----------------------------------------------------------------*/
+
+// Deliver pending, enabled interrupts unless masked or already in a handler
+void host_irq_service(void);
+
+// Events are also fed from a SIGALRM handler, the model keeps it blocked in its own
+// code, while interrupts are disabled and while a handler runs
+void host_irq_set_async(int enable);
+
+/* USART2 --------------------------------------------------------------------*/
+
+// Receives every byte the firmware writes to the data register
+typedef void (*HostUsartSink_t)(uint8_t byte, void* ctx);
+
+void host_usart_set_tx_sink(HostUsartSink_t sink, void* ctx);
+
+// Present one received byte, returns 0 if it overran an unread one
+int host_usart_rx_push(uint8_t byte);
+
+// 1 once the firmware has read the last pushed byte
+int host_usart_rx_ready(void);
+
+// Data register write, called by LL_USART_TransmitData8()
+void host_usart_transmit(uint8_t byte);
+
+/* Image jumps ---------------------------------------------------------------*/
+
+// Called instead of loading MSP before a jump, must not return
+typedef void (*HostJumpHook_t)(uint32_t vector_table, uint32_t sp, void* ctx);
+
+// Install the jump hook, without one a jump exits the process
+void host_set_jump_hook(HostJumpHook_t hook, void* ctx);
+
+/* Reset ---------------------------------------------------------------------*/
+
+// Reset registers, tick and interrupt state as a system reset would
+// Flash, backup registers, backup SRAM and CCM RAM keep their contents
+void host_system_reset(void);
+
+#endif /* _HOST_HAL_H */
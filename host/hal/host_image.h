@@ -0,0 +1,26 @@
+#ifndef _HOST_IMAGE_H
+#define _HOST_IMAGE_H
+
+#include "image.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Images and transfers as the host tools (benchmark, fuzzer, tests, power-loss
+ * sweep) hand them to the firmware: image headers, the AES-GCM container of
+ * scripts/encrypt_firmware.py made with the updater's default key, and the
+ * XMODEM-CRC packet checksum.
+ */
+
+// Version 1.0.0 header for size bytes linked at addr + IMAGE_HDR_SIZE, a NULL data leaves the CRC 0
+void host_image_header(ImageHeader_t* header, uint32_t addr, uint32_t magic, uint8_t type,
+                       const uint8_t* data, uint32_t size);
+
+// nonce | size_field | ciphertext | tag of size bytes, malloc'ed, NULL on failure
+uint8_t* host_image_encrypt(const uint8_t* body, size_t size, uint32_t size_field, const uint8_t nonce[12],
+                            size_t* out_size);
+
+// CRC-16/XMODEM of a packet's data
+uint16_t host_image_crc16(const uint8_t* data, size_t len);
+
+#endif /* _HOST_IMAGE_H */
@@ -0,0 +1,177 @@
+#ifndef _HOST_LL_H
+#define _HOST_LL_H
+
+/*
+ * Host stand-in for the STM32F4 LL drivers used by common/. Register bits match
+ * the reference manual so flags read by uart_transport.c behave as on target.
+ */
+
+#include "stm32f4xx_hal.h"
+
+/* USART ---------------------------------------------------------------------*/
+#define USART_SR_PE                 (1UL << 0)
+#define USART_SR_FE                 (1UL << 1)
+#define USART_SR_NE                 (1UL << 2)
+#define USART_SR_ORE                (1UL << 3)
+#define USART_SR_RXNE               (1UL << 5)
+#define USART_SR_TC                 (1UL << 6)
+#define USART_SR_TXE                (1UL << 7)
+#define USART_CR1_RE                (1UL << 2)
+#define USART_CR1_TE                (1UL << 3)
+#define USART_CR1_RXNEIE            (1UL << 5)
+#define USART_CR1_TXEIE             (1UL << 7)
+#define USART_CR1_UE                (1UL << 13)
+#define USART_CR1_OVER8             (1UL << 15)
+
+#define LL_USART_DATAWIDTH_8B       0x00000000U
+#define LL_USART_STOPBITS_1         0x00000000U
+#define LL_USART_PARITY_NONE        0x00000000U
+#define LL_USART_DIRECTION_TX_RX    (USART_CR1_TE | USART_CR1_RE)
+#define LL_USART_HWCONTROL_NONE     0x00000000U
+#define LL_USART_HWCONTROL_CTS      (1UL << 9)
+#define LL_USART_OVERSAMPLING_16    0x00000000U
+#define LL_USART_OVERSAMPLING_8     USART_CR1_OVER8
+
+typedef struct {
+    uint32_t BaudRate;
+    uint32_t DataWidth;
+    uint32_t StopBits;
+    uint32_t Parity;
+    uint32_t TransferDirection;
+    uint32_t HardwareFlowControl;
+    uint32_t OverSampling;
+} LL_USART_InitTypeDef;
+
+ErrorStatus LL_USART_Init(USART_TypeDef* USARTx, LL_USART_InitTypeDef* USART_InitStruct);
+
+static inline void LL_USART_Enable(USART_TypeDef* USARTx)   { USARTx->CR1 |= USART_CR1_UE; }
+static inline void LL_USART_Disable(USART_TypeDef* USARTx)  { USARTx->CR1 &= ~USART_CR1_UE; }
+
+static inline void LL_USART_EnableIT_RXNE(USART_TypeDef* USARTx) {
+    USARTx->CR1 |= USART_CR1_RXNEIE;
+    host_irq_service();
+}
+
+static inline void LL_USART_EnableIT_TXE(USART_TypeDef* USARTx) {
+    USARTx->CR1 |= USART_CR1_TXEIE;
+    host_irq_service();
+}
+
+static inline void LL_USART_DisableIT_RXNE(USART_TypeDef* USARTx) { USARTx->CR1 &= ~USART_CR1_RXNEIE; }
+static inline void LL_USART_DisableIT_TXE(USART_TypeDef* USARTx)  { USARTx->CR1 &= ~USART_CR1_TXEIE; }
+
+static inline uint32_t LL_USART_IsEnabledIT_RXNE(USART_TypeDef* USARTx) { return (USARTx->CR1 & USART_CR1_RXNEIE) ? 1U : 0U; }
+static inline uint32_t LL_USART_IsEnabledIT_TXE(USART_TypeDef* USARTx)  { return (USARTx->CR1 & USART_CR1_TXEIE) ? 1U : 0U; }
+
+static inline uint32_t LL_USART_IsActiveFlag_PE(USART_TypeDef* USARTx)   { return (USARTx->SR & USART_SR_PE) ? 1U : 0U; }
+static inline uint32_t LL_USART_IsActiveFlag_FE(USART_TypeDef* USARTx)   { return (USARTx->SR & USART_SR_FE) ? 1U : 0U; }
+static inline uint32_t LL_USART_IsActiveFlag_NE(USART_TypeDef* USARTx)   { return (USARTx->SR & USART_SR_NE) ? 1U : 0U; }
+static inline uint32_t LL_USART_IsActiveFlag_ORE(USART_TypeDef* USARTx)  { return (USARTx->SR & USART_SR_ORE) ? 1U : 0U; }
+static inline uint32_t LL_USART_IsActiveFlag_RXNE(USART_TypeDef* USARTx) { return (USARTx->SR & USART_SR_RXNE) ? 1U : 0U; }
+static inline uint32_t LL_USART_IsActiveFlag_TC(USART_TypeDef* USARTx)   { return (USARTx->SR & USART_SR_TC) ? 1U : 0U; }
+static inline uint32_t LL_USART_IsActiveFlag_TXE(USART_TypeDef* USARTx)  { return (USARTx->SR & USART_SR_TXE) ? 1U : 0U; }
+
+static inline void LL_USART_ClearFlag_PE(USART_TypeDef* USARTx)  { USARTx->SR &= ~USART_SR_PE; }
+static inline void LL_USART_ClearFlag_FE(USART_TypeDef* USARTx)  { USARTx->SR &= ~USART_SR_FE; }
+static inline void LL_USART_ClearFlag_NE(USART_TypeDef* USARTx)  { USARTx->SR &= ~USART_SR_NE; }
+static inline void LL_USART_ClearFlag_ORE(USART_TypeDef* USARTx) { USARTx->SR &= ~USART_SR_ORE; }
+
+#define LL_USART_ReadReg(__INSTANCE__, __REG__) ((__INSTANCE__)->__REG__)
+
+// The DR read that follows an SR read clears the error flags with RXNE
+static inline uint8_t LL_USART_ReceiveData8(USART_TypeDef* USARTx) {
+    USARTx->SR &= ~(USART_SR_RXNE | USART_SR_ORE | USART_SR_NE | USART_SR_FE | USART_SR_PE);
+    return (uint8_t)USARTx->DR;
+}
+
+static inline void LL_USART_TransmitData8(USART_TypeDef* USARTx, uint8_t Value) {
+    host_usart_transmit(Value);
+}
+
+static inline void LL_USART_SetOverSampling(USART_TypeDef* USARTx, uint32_t OverSampling) {
+    USARTx->CR1 = (USARTx->CR1 & ~USART_CR1_OVER8) | OverSampling;
+}
+
+static inline uint32_t LL_USART_GetOverSampling(USART_TypeDef* USARTx) { return USARTx->CR1 & USART_CR1_OVER8; }
+
+// BRR is the divider in 1/16ths, at 8x oversampling in 1/8ths with the fraction
+// kept in the low three bits, as the register layout packs it
+static inline void LL_USART_SetBaudRate(USART_TypeDef* USARTx, uint32_t PeriphClk, uint32_t OverSampling,
+                                        uint32_t BaudRate) {
+    uint32_t divider = (PeriphClk + BaudRate / 2U) / BaudRate;
+    if (OverSampling == LL_USART_OVERSAMPLING_8) {
+        divider = ((divider >> 3) << 4) | (divider & 0x7U);
+    }
+    USARTx->BRR = divider;
+}
+
+/* RCC -----------------------------------------------------------------------*/
+typedef struct {
+    uint32_t SYSCLK_Frequency;
+    uint32_t HCLK_Frequency;
+    uint32_t PCLK1_Frequency;
+    uint32_t PCLK2_Frequency;
+} LL_RCC_ClocksTypeDef;
+
+static inline void LL_RCC_GetSystemClocksFreq(LL_RCC_ClocksTypeDef* RCC_Clocks) {
+    RCC_Clocks->SYSCLK_Frequency = SystemCoreClock;
+    RCC_Clocks->HCLK_Frequency = SystemCoreClock;
+    RCC_Clocks->PCLK1_Frequency = HAL_RCC_GetPCLK1Freq();
+    RCC_Clocks->PCLK2_Frequency = HAL_RCC_GetPCLK2Freq();
+}
+
+/* GPIO ----------------------------------------------------------------------*/
+#define LL_GPIO_PIN_0               GPIO_PIN_0
+#define LL_GPIO_PIN_1               GPIO_PIN_1
+#define LL_GPIO_PIN_2               GPIO_PIN_2
+#define LL_GPIO_PIN_3               GPIO_PIN_3
+#define LL_GPIO_PIN_6               GPIO_PIN_6
+#define LL_GPIO_PIN_7               GPIO_PIN_7
+#define LL_GPIO_PIN_9               GPIO_PIN_9
+#define LL_GPIO_PIN_10              GPIO_PIN_10
+#define LL_GPIO_PIN_11              GPIO_PIN_11
+#define LL_GPIO_PIN_12              GPIO_PIN_12
+#define LL_GPIO_PIN_13              GPIO_PIN_13
+#define LL_GPIO_PIN_14              GPIO_PIN_14
+#define LL_GPIO_PIN_15              GPIO_PIN_15
+#define LL_GPIO_MODE_OUTPUT         0x00000001U
+#define LL_GPIO_MODE_ALTERNATE      0x00000002U
+#define LL_GPIO_SPEED_FREQ_LOW      0x00000000U
+#define LL_GPIO_SPEED_FREQ_VERY_HIGH 0x00000003U
+#define LL_GPIO_OUTPUT_PUSHPULL     0x00000000U
+#define LL_GPIO_PULL_NO             0x00000000U
+#define LL_GPIO_AF_7                0x00000007U
+#define LL_GPIO_AF_8                0x00000008U
+
+typedef struct {
+    uint32_t Pin;
+    uint32_t Mode;
+    uint32_t Speed;
+    uint32_t OutputType;
+    uint32_t Pull;
+    uint32_t Alternate;
+} LL_GPIO_InitTypeDef;
+
+static inline ErrorStatus LL_GPIO_Init(GPIO_TypeDef* GPIOx, LL_GPIO_InitTypeDef* GPIO_InitStruct) {
+    return SUCCESS;
+}
+
+static inline void LL_GPIO_SetOutputPin(GPIO_TypeDef* GPIOx, uint32_t PinMask)    { GPIOx->ODR |= PinMask; }
+static inline void LL_GPIO_ResetOutputPin(GPIO_TypeDef* GPIOx, uint32_t PinMask)  { GPIOx->ODR &= ~PinMask; }
+static inline void LL_GPIO_TogglePin(GPIO_TypeDef* GPIOx, uint32_t PinMask)       { GPIOx->ODR ^= PinMask; }
+static inline uint32_t LL_GPIO_IsOutputPinSet(GPIO_TypeDef* GPIOx, uint32_t PinMask) { return (GPIOx->ODR & PinMask) == PinMask; }
+
+/* Bus -----------------------------------------------------------------------*/
+#define LL_AHB1_GRP1_PERIPH_GPIOA   RCC_AHB1ENR_GPIOAEN
+#define LL_AHB1_GRP1_PERIPH_GPIOC   RCC_AHB1ENR_GPIOCEN
+#define LL_AHB1_GRP1_PERIPH_GPIOD   RCC_AHB1ENR_GPIODEN
+#define LL_AHB1_GRP1_PERIPH_GPIOH   (1UL << 7)
+#define LL_APB1_GRP1_PERIPH_USART2  RCC_APB1ENR_USART2EN
+#define LL_APB2_GRP1_PERIPH_USART1  RCC_APB2ENR_USART1EN
+#define LL_APB2_GRP1_PERIPH_USART6  RCC_APB2ENR_USART6EN
+
+static inline void LL_AHB1_GRP1_EnableClock(uint32_t Periphs) { RCC->AHB1ENR |= Periphs; }
+static inline void LL_APB1_GRP1_EnableClock(uint32_t Periphs) { RCC->APB1ENR |= Periphs; }
+static inline void LL_APB2_GRP1_EnableClock(uint32_t Periphs) { RCC->APB2ENR |= Periphs; }
+
+#endif /* _HOST_LL_H */
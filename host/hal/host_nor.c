@@ -0,0 +1,312 @@
+#define _GNU_SOURCE
+#include "stm32f4xx_hal.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * NOR flash model of the STM32F407 1 MB array. The array is mapped read-only at
+ * FLASH_BASE so firmware reads flash through plain pointers as on target, and any
+ * stray store faults. Program and erase go through a second, writable mapping of
+ * the same memory and follow the NOR rules: erase sets a whole sector to 0xFF,
+ * programming only clears bits, and both need the flash unlocked. As in the HAL,
+ * a failure is reported through HAL_FLASH_GetError() until the next operation
+ * and the status register flags are already cleared.
+ */
+
+static const uint32_t NOR_SECTORS_KB[] = {
+    16, 16, 16, 16, 64, 128, 128, 128, 128, 128, 128, 128
+};
+
+#define NOR_SECTOR_COUNT    (sizeof(NOR_SECTORS_KB) / sizeof(NOR_SECTORS_KB[0]))
+#define NOR_KEY1            0x45670123U
+#define NOR_KEY2            0xCDEF89ABU
+
+typedef struct {
+    int fd;
+    uint8_t* rw;                // Writable alias used by the model
+    uint8_t* ro;                // Firmware view at FLASH_BASE
+    uint32_t error;             // HAL_FLASH_ERROR_xxx of the last operation
+    uint64_t program_data;      // Value of the program operation in progress
+    HostNorStats_t stats;
+    HostNorHook_t hook;
+    void* hook_ctx;
+} HostNor_t;
+
+static HostNor_t nor = { .fd = -1 };
+
+/* Private functions ---------------------------------------------------------*/
+static int nor_check_access(HostNorOp_t op, uint32_t addr, uint32_t len);
+
+
+/**
+ * @brief  Maps the flash array at FLASH_BASE.
+ * @param  path: [in] Backing file, created and sized to 1 MB if needed, or NULL for anonymous memory.
+ * @return 1 on success, 0 on failure.
+ * @note   A new backing starts erased. An existing file keeps its contents, so a
+ *         simulator can be stopped and restarted like a powered-off board.
+ */
+int host_nor_init(const char* path) {
+    int created = 1;
+
+    if (nor.ro != NULL) {
+        host_nor_deinit();
+    }
+
+    if (path != NULL) {
+        nor.fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (nor.fd >= 0) {
+            off_t size = lseek(nor.fd, 0, SEEK_END);
+            created = (size != (off_t)HOST_FLASH_SIZE);
+        }
+    } else {
+        nor.fd = memfd_create("stm32f4_flash", 0);
+    }
+
+    if (nor.fd < 0 || ftruncate(nor.fd, HOST_FLASH_SIZE) != 0) {
+        perror("host_nor_init");
+        host_nor_deinit();
+        return 0;
+    }
+
+    nor.rw = mmap(NULL, HOST_FLASH_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, nor.fd, 0);
+    nor.ro = mmap((void*)(uintptr_t)FLASH_BASE, HOST_FLASH_SIZE, PROT_READ,
+                  MAP_SHARED | MAP_FIXED_NOREPLACE, nor.fd, 0);
+    if (nor.rw == MAP_FAILED || nor.ro != (void*)(uintptr_t)FLASH_BASE) {
+        fprintf(stderr, "host_nor_init: cannot map flash at 0x%08lx\n", (unsigned long)FLASH_BASE);
+        if (nor.ro != MAP_FAILED && nor.ro != NULL) {
+            munmap(nor.ro, HOST_FLASH_SIZE);
+        }
+        nor.ro = NULL;
+        if (nor.rw == MAP_FAILED) {
+            nor.rw = NULL;
+        }
+        host_nor_deinit();
+        return 0;
+    }
+
+    if (created) {
+        host_nor_erase_all();
+    }
+
+    FLASH->CR |= FLASH_CR_LOCK;
+    nor.error = HAL_FLASH_ERROR_NONE;
+    host_nor_reset_stats();
+
+    return 1;
+}
+
+/**
+ * @brief  Unmaps the flash array and closes its backing.
+ */
+void host_nor_deinit(void) {
+    if (nor.ro != NULL) {
+        munmap(nor.ro, HOST_FLASH_SIZE);
+        nor.ro = NULL;
+    }
+    if (nor.rw != NULL) {
+        msync(nor.rw, HOST_FLASH_SIZE, MS_SYNC);
+        munmap(nor.rw, HOST_FLASH_SIZE);
+        nor.rw = NULL;
+    }
+    if (nor.fd >= 0) {
+        close(nor.fd);
+        nor.fd = -1;
+    }
+}
+
+/**
+ * @brief  Returns the writable view of the array.
+ * @return Pointer to offset 0 of the flash, NULL before host_nor_init().
+ * @note   Meant for loading images and inspecting results, no NOR rule is applied.
+ */
+uint8_t* host_nor_raw(void) {
+    return nor.rw;
+}
+
+/**
+ * @brief  Erases the whole array.
+ */
+void host_nor_erase_all(void) {
+    if (nor.rw != NULL) {
+        memset(nor.rw, 0xFF, HOST_FLASH_SIZE);
+    }
+}
+
+/**
+ * @brief  Finds the sector holding an address.
+ * @param  addr: [in] Flash address.
+ * @param  start: [out] Sector start address, may be NULL.
+ * @param  size: [out] Sector size in bytes, may be NULL.
+ * @return Sector number, -1 if addr is outside the flash.
+ */
+int host_nor_sector(uint32_t addr, uint32_t* start, uint32_t* size) {
+    uint32_t sector_start = FLASH_BASE;
+
+    for (uint32_t i = 0; i < NOR_SECTOR_COUNT; i++) {
+        uint32_t sector_size = NOR_SECTORS_KB[i] * 1024U;
+        if (addr >= sector_start && addr - sector_start < sector_size) {
+            if (start != NULL) {
+                *start = sector_start;
+            }
+            if (size != NULL) {
+                *size = sector_size;
+            }
+            return (int)i;
+        }
+        sector_start += sector_size;
+    }
+
+    return -1;
+}
+
+const HostNorStats_t* host_nor_stats(void) {
+    return &nor.stats;
+}
+
+void host_nor_reset_stats(void) {
+    memset(&nor.stats, 0, sizeof(nor.stats));
+}
+
+void host_nor_set_hook(HostNorHook_t hook, void* ctx) {
+    nor.hook = hook;
+    nor.hook_ctx = ctx;
+}
+
+uint64_t host_nor_program_data(void) {
+    return nor.program_data;
+}
+
+/**
+ * @brief  Applies the checks shared by program and erase.
+ * @param  op: [in] Operation.
+ * @param  addr: [in] First address touched.
+ * @param  len: [in] Bytes touched.
+ * @return 1 if the operation may proceed, 0 with the error code set otherwise.
+ */
+static int nor_check_access(HostNorOp_t op, uint32_t addr, uint32_t len) {
+    if (nor.rw == NULL) {
+        nor.error = HAL_FLASH_ERROR_OPERATION;
+        return 0;
+    }
+
+    if (FLASH->CR & FLASH_CR_LOCK) {
+        nor.stats.locked_writes++;
+        nor.error = HAL_FLASH_ERROR_WRP;
+        return 0;
+    }
+
+    if (nor.hook != NULL && nor.hook(op, addr, len, nor.hook_ctx) != 0) {
+        nor.stats.rejected++;
+        nor.error = HAL_FLASH_ERROR_OPERATION;
+        return 0;
+    }
+
+    return 1;
+}
+
+/* HAL flash driver ----------------------------------------------------------*/
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void) {
+    if (FLASH->CR & FLASH_CR_LOCK) {
+        FLASH->KEYR = NOR_KEY1;
+        FLASH->KEYR = NOR_KEY2;
+        FLASH->CR &= ~FLASH_CR_LOCK;
+    }
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void) {
+    FLASH->CR |= FLASH_CR_LOCK;
+
+    return HAL_OK;
+}
+
+uint32_t HAL_FLASH_GetError(void) {
+    return nor.error;
+}
+
+/**
+ * @brief  Programs a byte, half-word, word or double word.
+ * @note   Fails with a programming sequence error if any bit would go from 0 to 1,
+ *         which on silicon silently leaves the cell at the AND of both values.
+ */
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data) {
+    uint32_t width = 1U << TypeProgram;
+
+    nor.error = HAL_FLASH_ERROR_NONE;
+
+    if (TypeProgram > FLASH_TYPEPROGRAM_DOUBLEWORD || (Address & (width - 1U)) != 0 ||
+        Address < FLASH_BASE || Address - FLASH_BASE > HOST_FLASH_SIZE - width) {
+        nor.error = HAL_FLASH_ERROR_PGA;
+        return HAL_ERROR;
+    }
+
+    nor.program_data = Data;
+    if (!nor_check_access(HOST_NOR_OP_PROGRAM, Address, width)) {
+        return HAL_ERROR;
+    }
+
+    uint8_t* cell = nor.rw + (Address - FLASH_BASE);
+    for (uint32_t i = 0; i < width; i++) {
+        uint8_t value = (uint8_t)(Data >> (i * 8));
+        if ((value & ~cell[i]) != 0) {
+            nor.stats.violations++;
+            nor.error = HAL_FLASH_ERROR_PGS;
+            return HAL_ERROR;
+        }
+    }
+
+    for (uint32_t i = 0; i < width; i++) {
+        cell[i] = (uint8_t)(Data >> (i * 8));
+    }
+
+    nor.stats.programs++;
+    nor.stats.program_bytes += width;
+
+    return HAL_OK;
+}
+
+/**
+ * @brief  Erases the sectors described by pEraseInit.
+ * @note   SectorError is 0xFFFFFFFF on success, else the sector that failed.
+ */
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* pEraseInit, uint32_t* SectorError) {
+    uint32_t first = 0;
+    uint32_t count = NOR_SECTOR_COUNT;
+
+    nor.error = HAL_FLASH_ERROR_NONE;
+    *SectorError = 0xFFFFFFFFU;
+
+    if (pEraseInit->TypeErase == FLASH_TYPEERASE_SECTORS) {
+        first = pEraseInit->Sector;
+        count = pEraseInit->NbSectors;
+    }
+
+    for (uint32_t sector = first; sector < first + count; sector++) {
+        if (sector >= NOR_SECTOR_COUNT) {
+            nor.error = HAL_FLASH_ERROR_OPERATION;
+            *SectorError = sector;
+            return HAL_ERROR;
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t i = 0; i < sector; i++) {
+            offset += NOR_SECTORS_KB[i] * 1024U;
+        }
+        uint32_t size = NOR_SECTORS_KB[sector] * 1024U;
+
+        if (!nor_check_access(HOST_NOR_OP_ERASE, FLASH_BASE + offset, size)) {
+            *SectorError = sector;
+            return HAL_ERROR;
+        }
+
+        memset(nor.rw + offset, 0xFF, size);
+        nor.stats.erases++;
+        nor.stats.erase_bytes += size;
+    }
+
+    return HAL_OK;
+}
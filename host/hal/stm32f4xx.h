@@ -0,0 +1,2 @@
+/* Host build: the CMSIS device registers are modelled in stm32f4xx_hal.h */
+#include "stm32f4xx_hal.h"
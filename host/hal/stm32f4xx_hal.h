@@ -0,0 +1,318 @@
+#ifndef _HOST_STM32F4XX_HAL_H
+#define _HOST_STM32F4XX_HAL_H
+
+/*
+ * Host (x86-64) stand-in for the STM32F4 HAL, CMSIS device and core headers.
+ *
+ * Peripherals the common/ sources touch are plain structs in host memory, flash is
+ * a NOR model mapped at FLASH_BASE (host_nor.c), the tick is virtual and interrupts
+ * are delivered synchronously (host_hal.c). Only what common/src uses is defined.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define __IO    volatile
+#define __I     volatile const
+
+/* HAL status ----------------------------------------------------------------*/
+typedef enum {
+    HAL_OK       = 0x00U,
+    HAL_ERROR    = 0x01U,
+    HAL_BUSY     = 0x02U,
+    HAL_TIMEOUT  = 0x03U
+} HAL_StatusTypeDef;
+
+typedef enum { RESET = 0U, SET = !RESET } FlagStatus, ITStatus;
+typedef enum { DISABLE = 0U, ENABLE = !DISABLE } FunctionalState;
+typedef enum { SUCCESS = 0U, ERROR = !SUCCESS } ErrorStatus;
+
+/* Memory map ----------------------------------------------------------------*/
+#define FLASH_BASE              0x08000000UL
+#define FLASH_END               0x080FFFFFUL
+#define HOST_FLASH_SIZE         0x00100000UL
+
+extern uint8_t host_bkpsram[4096];
+extern uint8_t host_ccmram[64 * 1024];
+#define BKPSRAM_BASE            ((uintptr_t)host_bkpsram)
+#define CCMDATARAM_BASE         ((uintptr_t)host_ccmram)
+
+#define HSI_VALUE               16000000U
+#define HSE_VALUE               8000000U
+extern uint32_t SystemCoreClock;
+
+/* Peripheral registers ------------------------------------------------------*/
+typedef struct {
+    __IO uint32_t CR, PLLCFGR, CFGR, CIR;
+    __IO uint32_t AHB1RSTR, AHB2RSTR, AHB3RSTR, APB1RSTR, APB2RSTR;
+    __IO uint32_t AHB1ENR, AHB2ENR, AHB3ENR, APB1ENR, APB2ENR;
+    __IO uint32_t BDCR, CSR;
+} RCC_TypeDef;
+
+typedef struct {
+    __IO uint32_t ACR, KEYR, OPTKEYR, SR, CR, OPTCR;
+} FLASH_TypeDef;
+
+typedef struct {
+    __IO uint32_t DR, IDR, CR;
+} CRC_TypeDef;
+
+typedef struct {
+    __IO uint32_t CR, CSR;
+} PWR_TypeDef;
+
+typedef struct {
+    __IO uint32_t BKP0R, BKP1R, BKP2R, BKP3R, BKP4R, BKP5R, BKP6R, BKP7R, BKP8R, BKP9R;
+    __IO uint32_t BKP10R, BKP11R, BKP12R, BKP13R, BKP14R, BKP15R, BKP16R, BKP17R, BKP18R, BKP19R;
+} RTC_TypeDef;
+
+typedef struct {
+    __IO uint32_t MEMRMP, PMC;
+} SYSCFG_TypeDef;
+
+typedef struct {
+    __IO uint32_t CTRL, CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+typedef struct {
+    __IO uint32_t ICSR, VTOR, AIRCR, SHCSR;
+} SCB_Type;
+
+typedef struct {
+    __IO uint32_t CTRL, LOAD, VAL;
+} SysTick_Type;
+
+typedef struct {
+    __IO uint32_t SR, DR, BRR, CR1, CR2, CR3, GTPR;
+} USART_TypeDef;
+
+typedef struct {
+    __IO uint32_t MODER, OTYPER, OSPEEDR, PUPDR, IDR, ODR, BSRR, LCKR, AFR[2];
+} GPIO_TypeDef;
+
+extern RCC_TypeDef    host_rcc;
+extern FLASH_TypeDef  host_flash_regs;
+extern CRC_TypeDef    host_crc;
+extern PWR_TypeDef    host_pwr;
+extern RTC_TypeDef    host_rtc;
+extern SYSCFG_TypeDef host_syscfg;
+extern DWT_Type       host_dwt;
+extern CoreDebug_Type host_core_debug;
+extern SCB_Type       host_scb;
+extern SysTick_Type   host_systick;
+extern USART_TypeDef  host_usart1, host_usart2, host_usart6;
+extern GPIO_TypeDef   host_gpioa, host_gpioc, host_gpiod;
+
+#define RCC         (&host_rcc)
+#define FLASH       (&host_flash_regs)
+#define CRC         (&host_crc)
+#define PWR         (&host_pwr)
+#define RTC         (&host_rtc)
+#define SYSCFG      (&host_syscfg)
+#define DWT         (&host_dwt)
+#define CoreDebug   (&host_core_debug)
+#define SCB         (&host_scb)
+#define SysTick     (&host_systick)
+#define USART1      (&host_usart1)
+#define USART2      (&host_usart2)
+#define USART6      (&host_usart6)
+#define GPIOA       (&host_gpioa)
+#define GPIOC       (&host_gpioc)
+#define GPIOD       (&host_gpiod)
+
+typedef enum {
+    SysTick_IRQn = -1,
+    USART1_IRQn  = 37,
+    USART2_IRQn  = 38,
+    USART6_IRQn  = 71
+} IRQn_Type;
+
+/* Register bits -------------------------------------------------------------*/
+#define RCC_CR_HSION                (1UL << 0)
+#define RCC_CR_HSIRDY               (1UL << 1)
+#define RCC_CR_HSITRIM_Pos          3U
+#define RCC_CR_HSITRIM              (0x1FUL << RCC_CR_HSITRIM_Pos)
+#define RCC_CR_HSEON                (1UL << 16)
+#define RCC_CR_HSERDY               (1UL << 17)
+#define RCC_CR_HSEBYP               (1UL << 18)
+#define RCC_CR_CSSON                (1UL << 19)
+#define RCC_CR_PLLON                (1UL << 24)
+#define RCC_CR_PLLRDY               (1UL << 25)
+#define RCC_CFGR_SWS                (3UL << 2)
+#define RCC_CFGR_SWS_HSI            0x00000000UL
+#define RCC_AHB1ENR_GPIOAEN         (1UL << 0)
+#define RCC_AHB1ENR_GPIOCEN         (1UL << 2)
+#define RCC_AHB1ENR_GPIODEN         (1UL << 3)
+#define RCC_AHB1ENR_CRCEN           (1UL << 12)
+#define RCC_AHB1ENR_BKPSRAMEN       (1UL << 18)
+#define RCC_AHB1ENR_CCMDATARAMEN    (1UL << 20)
+#define RCC_APB1ENR_USART2EN        (1UL << 17)
+#define RCC_APB1ENR_PWREN           (1UL << 28)
+#define RCC_APB2ENR_USART1EN        (1UL << 4)
+#define RCC_APB2ENR_USART6EN        (1UL << 5)
+#define RCC_APB2ENR_SYSCFGEN        (1UL << 14)
+
+#define PWR_CR_DBP                  (1UL << 8)
+#define CRC_CR_RESET                (1UL << 0)
+
+#define FLASH_CR_LOCK               (1UL << 31)
+#define FLASH_ACR_PRFTEN            (1UL << 8)
+#define FLASH_ACR_ICEN              (1UL << 9)
+#define FLASH_ACR_DCEN              (1UL << 10)
+
+#define DWT_CTRL_CYCCNTENA_Msk      (1UL << 0)
+#define CoreDebug_DEMCR_TRCENA_Msk  (1UL << 24)
+#define SCB_ICSR_PENDSTCLR_Msk      (1UL << 25)
+#define SCB_SHCSR_MEMFAULTENA_Msk   (1UL << 16)
+#define SCB_SHCSR_BUSFAULTENA_Msk   (1UL << 17)
+#define SCB_SHCSR_USGFAULTENA_Msk   (1UL << 18)
+
+/* Clock enables -------------------------------------------------------------*/
+#define __HAL_RCC_CRC_CLK_ENABLE()      (RCC->AHB1ENR |= RCC_AHB1ENR_CRCEN)
+#define __HAL_RCC_BKPSRAM_CLK_ENABLE()  (RCC->AHB1ENR |= RCC_AHB1ENR_BKPSRAMEN)
+#define __HAL_RCC_GPIOA_CLK_ENABLE()    (RCC->AHB1ENR |= RCC_AHB1ENR_GPIOAEN)
+#define __HAL_RCC_GPIOD_CLK_ENABLE()    (RCC->AHB1ENR |= RCC_AHB1ENR_GPIODEN)
+#define __HAL_RCC_PWR_CLK_ENABLE()      (RCC->APB1ENR |= RCC_APB1ENR_PWREN)
+#define __HAL_RCC_USART2_CLK_ENABLE()   (RCC->APB1ENR |= RCC_APB1ENR_USART2EN)
+#define __HAL_RCC_SYSCFG_CLK_ENABLE()   (RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN)
+
+/* RCC -----------------------------------------------------------------------*/
+#define RCC_CFGR_SWS_PLL            0x00000008UL
+
+#define RCC_OSCILLATORTYPE_HSE      0x00000001U
+#define RCC_HSE_ON                  RCC_CR_HSEON
+#define RCC_PLL_ON                  0x00000002U
+#define RCC_PLLSOURCE_HSE           0x00400000U
+#define RCC_PLLP_DIV2               0x00000002U
+#define RCC_PLLP_DIV4               0x00000004U
+#define RCC_CLOCKTYPE_SYSCLK        0x00000001U
+#define RCC_CLOCKTYPE_HCLK          0x00000002U
+#define RCC_CLOCKTYPE_PCLK1         0x00000004U
+#define RCC_CLOCKTYPE_PCLK2         0x00000008U
+#define RCC_SYSCLKSOURCE_PLLCLK     0x00000002U
+#define RCC_SYSCLK_DIV1             0x00000000U
+#define RCC_HCLK_DIV1               0x00000000U
+#define RCC_HCLK_DIV2               0x00001000U
+#define RCC_HCLK_DIV4               0x00001400U
+#define FLASH_LATENCY_2             0x00000002U
+#define PWR_REGULATOR_VOLTAGE_SCALE1 0x0000C000U
+
+#define __HAL_PWR_VOLTAGESCALING_CONFIG(scale)  (PWR->CR |= (scale))
+
+typedef struct {
+    uint32_t PLLState;
+    uint32_t PLLSource;
+    uint32_t PLLM;
+    uint32_t PLLN;
+    uint32_t PLLP;
+    uint32_t PLLQ;
+} RCC_PLLInitTypeDef;
+
+typedef struct {
+    uint32_t OscillatorType;
+    uint32_t HSEState;
+    uint32_t LSEState;
+    uint32_t HSIState;
+    uint32_t HSICalibrationValue;
+    uint32_t LSIState;
+    RCC_PLLInitTypeDef PLL;
+} RCC_OscInitTypeDef;
+
+typedef struct {
+    uint32_t ClockType;
+    uint32_t SYSCLKSource;
+    uint32_t AHBCLKDivider;
+    uint32_t APB1CLKDivider;
+    uint32_t APB2CLKDivider;
+} RCC_ClkInitTypeDef;
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef* RCC_OscInitStruct);
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef* RCC_ClkInitStruct, uint32_t FLatency);
+uint32_t HAL_RCC_GetPCLK1Freq(void);
+uint32_t HAL_RCC_GetPCLK2Freq(void);
+
+/* GPIO ----------------------------------------------------------------------*/
+#define GPIO_PIN_0                  ((uint16_t)0x0001)
+#define GPIO_PIN_1                  ((uint16_t)0x0002)
+#define GPIO_PIN_2                  ((uint16_t)0x0004)
+#define GPIO_PIN_3                  ((uint16_t)0x0008)
+#define GPIO_PIN_6                  ((uint16_t)0x0040)
+#define GPIO_PIN_7                  ((uint16_t)0x0080)
+#define GPIO_PIN_9                  ((uint16_t)0x0200)
+#define GPIO_PIN_10                 ((uint16_t)0x0400)
+#define GPIO_PIN_11                 ((uint16_t)0x0800)
+#define GPIO_PIN_12                 ((uint16_t)0x1000)
+#define GPIO_PIN_13                 ((uint16_t)0x2000)
+#define GPIO_PIN_14                 ((uint16_t)0x4000)
+#define GPIO_PIN_15                 ((uint16_t)0x8000)
+
+/* Flash ---------------------------------------------------------------------*/
+#define FLASH_FLAG_EOP              (1UL << 0)
+#define FLASH_FLAG_OPERR            (1UL << 1)
+#define FLASH_FLAG_WRPERR           (1UL << 4)
+#define FLASH_FLAG_PGAERR           (1UL << 5)
+#define FLASH_FLAG_PGPERR           (1UL << 6)
+#define FLASH_FLAG_PGSERR           (1UL << 7)
+#define FLASH_FLAG_BSY              (1UL << 16)
+
+#define HAL_FLASH_ERROR_NONE        0x00000000U
+#define HAL_FLASH_ERROR_PGS         0x00000002U
+#define HAL_FLASH_ERROR_PGA         0x00000008U
+#define HAL_FLASH_ERROR_WRP         0x00000010U
+#define HAL_FLASH_ERROR_OPERATION   0x00000020U
+
+#define FLASH_TYPEERASE_SECTORS     0x00000000U
+#define FLASH_TYPEERASE_MASSERASE   0x00000001U
+#define FLASH_VOLTAGE_RANGE_3       0x00000002U
+#define FLASH_TYPEPROGRAM_BYTE      0x00000000U
+#define FLASH_TYPEPROGRAM_HALFWORD  0x00000001U
+#define FLASH_TYPEPROGRAM_WORD      0x00000002U
+#define FLASH_TYPEPROGRAM_DOUBLEWORD 0x00000003U
+
+#define __HAL_FLASH_GET_FLAG(flag)      ((FLASH->SR & (flag)) == (flag))
+#define __HAL_FLASH_CLEAR_FLAG(flag)    (FLASH->SR &= ~(uint32_t)(flag))
+
+typedef struct {
+    uint32_t TypeErase;
+    uint32_t Banks;
+    uint32_t Sector;
+    uint32_t NbSectors;
+    uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t TypeProgram, uint32_t Address, uint64_t Data);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef* pEraseInit, uint32_t* SectorError);
+uint32_t HAL_FLASH_GetError(void);
+
+/* Core ----------------------------------------------------------------------*/
+HAL_StatusTypeDef HAL_Init(void);
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t Delay);
+void HAL_PWR_EnableBkUpAccess(void);
+
+void __disable_irq(void);
+void __enable_irq(void);
+void __set_MSP(uint32_t topOfMainStack);
+void __set_PSP(uint32_t topOfProcStack);
+#define __DSB()     __sync_synchronize()
+#define __ISB()     __sync_synchronize()
+#define __NOP()     do { } while (0)
+
+void NVIC_EnableIRQ(IRQn_Type IRQn);
+void NVIC_DisableIRQ(IRQn_Type IRQn);
+void NVIC_SystemReset(void);
+#define NVIC_GetPriorityGrouping()                  0U
+#define NVIC_EncodePriority(group, pre, sub)        0U
+#define NVIC_SetPriority(irq, priority)             ((void)(irq), (void)(priority))
+
+#include "host_hal.h"
+
+#endif /* _HOST_STM32F4XX_HAL_H */
@@ -0,0 +1,2 @@
+/* Host build: the LL drivers used by common/ are all in host_ll.h */
+#include "host_ll.h"
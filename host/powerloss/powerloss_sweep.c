@@ -0,0 +1,716 @@
+/**
+ * @file   powerloss_sweep.c
+ * @brief  Power-loss injection sweep for the patch flows and the boot decision after them.
+ *
+ * The patch flow runs on the host NOR model with an old application installed and
+ * a patch staged, exactly as the updater calls it. The NOR hook counts program and
+ * erase operations and cuts power at the Nth one: the flow is abandoned mid-call,
+ * RAM state is lost, and the device restarts through the real boot
+ * (boot/src/main.c) and loader (loader/src/main.c) images, compiled unchanged
+ * with their entry points renamed. Whatever the loader hands over to is checked:
+ *   - the updater (updater/src/main.c) is run as well, so an interrupted in-place
+ *     patch is resumed by its own code and the device restarts once more
+ *   - a loader left waiting in its menu gets the 'U' key a user would press
+ * Every cut point of the flow is swept and each run ends in one of:
+ *   new      the patched application boots
+ *   old      the original application boots
+ *   updater  no application, the updater is reached and can take a new image
+ *   BRICKED  a jump into an image that fails its CRC, or no way to the updater
+ *
+ * A cut skips the operation in progress. With -t it is torn instead: each bit of
+ * the cells it was changing is left either old or new, at random.
+ *
+ * Flows (-f), the updater's calls with its addresses:
+ *   patch    handle_firmware_patch(), over the running slot with the backup
+ *            area, or into slot B with AB_SLOTS, then the staging area cleanup
+ *   inplace  handle_firmware_patch_inplace() for a patch from create_patch.py -i
+ *   restore  patch with a flash error on the first program into the new image,
+ *            so every cut also lands in recover_target() / restore_from_backup()
+ *
+ * The images come from the repo scripts, unencrypted (the staging area holds the
+ * decrypted patch): -o is the installed application, -p the patch from
+ * create_patch.py. Loader and updater images are generated with valid CRCs.
+ *
+ * Usage: powerloss_sweep -o old.bin -p patch.bin [-f patch|inplace|restore] [-t]
+ *                        [-s stride] [-d depth] [-b] [-v]
+ *   -t  tear the operation power is cut in
+ *   -s  cut only at every stride-th operation (1, every operation, by default)
+ *   -d  2 also cuts power again at every operation of the first restart
+ *   -b  backup registers and backup SRAM are lost with power (no VBAT)
+ *   -v  print every run, not only the bricked ones
+ * The exit status is 1 if any run ended BRICKED.
+ */
+#include "main.h"
+#include "bootloader.h"
+#include "delta_update.h"
+#include "patch_journal.h"
+#include "image.h"
+#include "crc.h"
+#include "host_hal.h"
+#include "host_image.h"
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SWEEP_CORE_CLOCK    90000000U   // Updater SYSCLK
+#define SWEEP_MAX_DEPTH     2U
+#define SWEEP_MAX_BOOTS     4U          // Restarts before a resume loop counts as final
+#define SWEEP_LOADER_KEY_MS 25000U      // 'U' once autoboot had its chance
+#define SWEEP_LOADER_MS     40000U
+#define SWEEP_UPDATER_MS    30000U
+#define SWEEP_BKPSRAM_SIZE  sizeof(host_bkpsram)
+#define SWEEP_SYNTH_SIZE    0x2000U     // Data size of the generated loader and updater
+
+// Slot the patched image is written to
+#ifdef AB_SLOTS
+#define SWEEP_TARGET_ADDR   APP_B_ADDR
+#else
+#define SWEEP_TARGET_ADDR   APP_ADDR
+#endif
+
+// Images under test, entry points renamed in host/CMakeLists.txt
+extern int boot_main(void);
+extern int loader_main(void);
+extern int updater_main(void);
+
+typedef enum {
+    SWEEP_FLOW_PATCH = 0,
+    SWEEP_FLOW_INPLACE,
+    SWEEP_FLOW_RESTORE,
+    SWEEP_FLOW_COUNT
+} SweepFlow_t;
+
+static const char* const SWEEP_FLOW_NAMES[SWEEP_FLOW_COUNT] = { "patch", "inplace", "restore" };
+
+typedef enum {
+    SWEEP_END_NEW = 0,
+    SWEEP_END_OLD,
+    SWEEP_END_UPDATER,
+    SWEEP_END_BRICKED,
+    SWEEP_END_COUNT
+} SweepEnd_t;
+
+static const char* const SWEEP_END_NAMES[SWEEP_END_COUNT] = { "new", "old", "updater", "BRICKED" };
+
+// Where a run stopped and why
+typedef struct {
+    SweepEnd_t end;
+    uint32_t boots;
+    char reason[96];
+} SweepResult_t;
+
+// Operation power was cut in
+typedef struct {
+    HostNorOp_t op;
+    uint32_t addr;
+} SweepCut_t;
+
+typedef struct {
+    SweepFlow_t flow;
+    int torn;
+    int lose_backup_domain;
+    int verbose;
+
+    // Device state every run starts from
+    uint8_t* flash;
+    uint8_t bkpsram[4096];
+    RTC_TypeDef rtc;
+    uint32_t old_crc;
+    uint32_t new_crc;
+
+    // Power session: the flow, then one per restart
+    uint32_t session;
+    uint32_t ops;
+    uint32_t cut_at[SWEEP_MAX_DEPTH];
+    uint32_t session_ops[SWEEP_MAX_DEPTH];
+    SweepCut_t cut[SWEEP_MAX_DEPTH];
+    uint32_t fail_at;
+    uint32_t first_body_op;
+    uint32_t rng;
+    jmp_buf power;
+
+    // Image running on the restarted device
+    uint32_t now;
+    uint32_t budget;
+    uint32_t key_at;
+    uint32_t jump_addr;
+    jmp_buf stage;
+} Sweep_t;
+
+static Sweep_t sweep;
+
+/* Private functions ---------------------------------------------------------*/
+static uint32_t sweep_random(void);
+static void sweep_tear(HostNorOp_t op, uint32_t addr, uint32_t len);
+static int sweep_nor_hook(HostNorOp_t op, uint32_t addr, uint32_t len, void* ctx);
+static void sweep_poll(void* ctx);
+static void sweep_jump(uint32_t vector_table, uint32_t sp, void* ctx);
+static uint32_t sweep_run_image(int (*entry)(void), uint32_t budget_ms, uint32_t key_ms);
+static int sweep_image_ok(uint32_t addr);
+static void sweep_power_on(void);
+static int sweep_run_flow(void);
+static int sweep_boot(SweepResult_t* result);
+static void sweep_trial(const uint32_t* cut_at, uint32_t depth, SweepResult_t* result);
+static int sweep_install_synthetic(uint32_t addr, uint32_t magic, uint8_t type);
+static int sweep_setup(const uint8_t* old_image, size_t old_size, const uint8_t* patch, size_t patch_size);
+static void sweep_print(const uint32_t* cut_at, uint32_t depth, const SweepResult_t* result);
+static uint8_t* read_file(const char* path, size_t* size);
+static void usage(const char* name);
+
+
+/**
+ * @brief  xorshift32, seeded per run so torn cells are reproducible.
+ */
+static uint32_t sweep_random(void) {
+    uint32_t x = sweep.rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sweep.rng = x;
+    return x;
+}
+
+/**
+ * @brief  Leaves an interrupted operation half done, bit by bit.
+ */
+static void sweep_tear(HostNorOp_t op, uint32_t addr, uint32_t len) {
+    uint8_t* cell = host_nor_raw() + (addr - FLASH_BASE);
+    uint64_t data = host_nor_program_data();
+
+    for (uint32_t i = 0; i < len; i++) {
+        uint8_t mask = (uint8_t)sweep_random();
+        if (op == HOST_NOR_OP_ERASE) {
+            cell[i] |= mask;
+        } else {
+            cell[i] &= (uint8_t)(data >> (i * 8)) | mask;
+        }
+    }
+}
+
+/**
+ * @brief  Counts flash operations, fails the injected one and cuts power at the chosen one.
+ */
+static int sweep_nor_hook(HostNorOp_t op, uint32_t addr, uint32_t len, void* ctx) {
+    sweep.ops++;
+
+    if (sweep.session == 0) {
+        if (sweep.first_body_op == 0 && op == HOST_NOR_OP_PROGRAM) {
+            if (addr >= SWEEP_TARGET_ADDR + IMAGE_HDR_SIZE && addr < SWEEP_TARGET_ADDR + APP_SLOT_SIZE) {
+                sweep.first_body_op = sweep.ops;
+            }
+        }
+        if (sweep.ops == sweep.fail_at) {
+            return 1;
+        }
+    }
+
+    if (sweep.session < SWEEP_MAX_DEPTH && sweep.ops == sweep.cut_at[sweep.session]) {
+        sweep.cut[sweep.session] = (SweepCut_t){ op, addr };
+        if (sweep.torn) {
+            sweep_tear(op, addr, len);
+        }
+        longjmp(sweep.power, 1);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief  Moves time one millisecond per tick read, presses 'U' and ends a stage on its budget.
+ */
+static void sweep_poll(void* ctx) {
+    host_tick_advance(1);
+
+    if (sweep.budget == 0) {
+        return;
+    }
+
+    sweep.now++;
+    if (sweep.now == sweep.key_at) {
+        host_usart_rx_push('U');
+    }
+    if (sweep.now >= sweep.budget) {
+        longjmp(sweep.stage, 1);
+    }
+}
+
+/**
+ * @brief  Ends the running image where it hands over to another one.
+ */
+static void sweep_jump(uint32_t vector_table, uint32_t sp, void* ctx) {
+    sweep.jump_addr = vector_table - IMAGE_HDR_SIZE;
+    longjmp(sweep.stage, 1);
+}
+
+/**
+ * @brief  Runs an image until it jumps or its time budget is used up.
+ * @param  entry: [in] Renamed main() of the image.
+ * @param  budget_ms: [in] Virtual time the image may run, 0 for no limit.
+ * @param  key_ms: [in] Time at which 'U' arrives on USART2, 0 for never.
+ * @return Header address of the image jumped to, 0 if the image did not jump.
+ */
+static uint32_t sweep_run_image(int (*entry)(void), uint32_t budget_ms, uint32_t key_ms) {
+    sweep.now = 0;
+    sweep.budget = budget_ms;
+    sweep.key_at = key_ms;
+    sweep.jump_addr = 0;
+
+    if (setjmp(sweep.stage) == 0) {
+        entry();
+    }
+
+    sweep.budget = 0;
+    return sweep.jump_addr;
+}
+
+/**
+ * @brief  Independent check of an image the firmware is about to run.
+ * @return 1 if the slot holds an image of its type whose CRC matches, 0 otherwise.
+ */
+static int sweep_image_ok(uint32_t addr) {
+    const ImageHeader_t* header = (const ImageHeader_t*)addr;
+    uint32_t slot_size;
+    uint8_t type;
+
+    if (addr == LOADER_ADDR) {
+        slot_size = UPDATER_ADDR - LOADER_ADDR;
+        type = IMAGE_TYPE_LOADER;
+    } else if (addr == UPDATER_ADDR) {
+        slot_size = APP_ADDR - UPDATER_ADDR;
+        type = IMAGE_TYPE_UPDATER;
+#ifdef AB_SLOTS
+    } else if (addr == APP_ADDR || addr == APP_B_ADDR) {
+#else
+    } else if (addr == APP_ADDR) {
+#endif
+        slot_size = APP_SLOT_SIZE;
+        type = IMAGE_TYPE_APP;
+    } else {
+        return 0;
+    }
+
+    if (header->image_type != type || !is_image_valid(header) ||
+        header->data_size > slot_size - IMAGE_HDR_SIZE) {
+        return 0;
+    }
+
+    crc_init();
+    crc_reset();
+    return crc_calculate_memory(addr + IMAGE_HDR_SIZE, header->data_size) == header->crc;
+}
+
+/**
+ * @brief  Restarts the device after a reset or a power cut.
+ */
+static void sweep_power_on(void) {
+    host_system_reset();
+
+    if (sweep.lose_backup_domain) {
+        memset(host_bkpsram, 0, SWEEP_BKPSRAM_SIZE);
+        memset(RTC, 0, sizeof(*RTC));
+    }
+}
+
+/**
+ * @brief  Runs the flow as the updater does after receiving the patch.
+ * @return Result code of the patch call.
+ */
+static int sweep_run_flow(void) {
+    int result;
+
+    SystemCoreClock = SWEEP_CORE_CLOCK;
+
+    if (sweep.flow == SWEEP_FLOW_INPLACE) {
+#ifdef AB_SLOTS
+        result = DELTA_ERR_INPLACE_UNSUPPORTED;
+#else
+        result = handle_firmware_patch_inplace(APP_ADDR, PATCH_ADDR, BACKUP_ADDR, IMAGE_HDR_SIZE);
+#endif
+    } else {
+#ifdef AB_SLOTS
+        uint32_t backup_addr = SWEEP_TARGET_ADDR + APP_SLOT_SIZE;
+#else
+        uint32_t backup_addr = BACKUP_ADDR;
+#endif
+        result = handle_firmware_patch(APP_ADDR, PATCH_ADDR, SWEEP_TARGET_ADDR, backup_addr, IMAGE_HDR_SIZE);
+    }
+
+    // Staging cleanup after a successful patch
+    if (result == 0) {
+        for (uint32_t addr = PATCH_ADDR; addr < PATCH_ADDR + PATCH_SIZE; addr += 0x20000) {
+            flash_erase_sector(addr);
+        }
+    }
+
+    return result;
+}
+
+/**
+ * @brief  One restart: boot, loader, and the updater if the loader picks it.
+ * @param  result: [out] Filled in when the restart ends the run.
+ * @return 1 if the run ended, 0 if the device restarts again (resumed patch).
+ */
+static int sweep_boot(SweepResult_t* result) {
+    uint32_t image = sweep_run_image(boot_main, 0, 0);
+
+    if (image != UPDATER_ADDR) {
+        if (image != LOADER_ADDR || !sweep_image_ok(LOADER_ADDR)) {
+            result->end = SWEEP_END_BRICKED;
+            snprintf(result->reason, sizeof(result->reason), "boot jumped to a corrupt image at 0x%08lX",
+                     (unsigned long)image);
+            return 1;
+        }
+
+        image = sweep_run_image(loader_main, SWEEP_LOADER_MS, SWEEP_LOADER_KEY_MS);
+        if (image == 0) {
+            result->end = SWEEP_END_BRICKED;
+            snprintf(result->reason, sizeof(result->reason), "loader cannot reach an application or the updater");
+            return 1;
+        }
+
+        if (image != UPDATER_ADDR) {
+            if (!sweep_image_ok(image)) {
+                result->end = SWEEP_END_BRICKED;
+                snprintf(result->reason, sizeof(result->reason), "loader jumped to a corrupt image at 0x%08lX",
+                         (unsigned long)image);
+                return 1;
+            }
+
+            const ImageHeader_t* header = (const ImageHeader_t*)image;
+            if (header->crc == sweep.new_crc) {
+                result->end = SWEEP_END_NEW;
+            } else if (header->crc == sweep.old_crc) {
+                result->end = SWEEP_END_OLD;
+            } else {
+                result->end = SWEEP_END_BRICKED;
+                snprintf(result->reason, sizeof(result->reason), "unknown application at 0x%08lX boots",
+                         (unsigned long)image);
+            }
+            return 1;
+        }
+    }
+
+    if (!sweep_image_ok(UPDATER_ADDR)) {
+        result->end = SWEEP_END_BRICKED;
+        snprintf(result->reason, sizeof(result->reason), "jumped to a corrupt updater");
+        return 1;
+    }
+
+    // The updater resumes an in-place patch on start, the device is restarted after it
+    int resuming = patch_journal_is_active();
+    sweep_run_image(updater_main, SWEEP_UPDATER_MS, 0);
+    if (resuming) {
+        return 0;
+    }
+
+    result->end = SWEEP_END_UPDATER;
+    snprintf(result->reason, sizeof(result->reason), "waiting for an image");
+    return 1;
+}
+
+/**
+ * @brief  Runs the flow and the restarts after it, cutting power where asked.
+ * @param  cut_at: [in] Operation to cut power at, per session (flow, first restart, ...), 0 for none.
+ * @param  depth: [in] Number of entries in cut_at.
+ * @param  result: [out] Outcome of the run.
+ */
+static void sweep_trial(const uint32_t* cut_at, uint32_t depth, SweepResult_t* result) {
+    memcpy(host_nor_raw(), sweep.flash, HOST_FLASH_SIZE);
+    memcpy(host_bkpsram, sweep.bkpsram, SWEEP_BKPSRAM_SIZE);
+    *RTC = sweep.rtc;
+    host_system_reset();
+
+    memset(sweep.cut_at, 0, sizeof(sweep.cut_at));
+    memset(sweep.session_ops, 0, sizeof(sweep.session_ops));
+    memcpy(sweep.cut_at, cut_at, depth * sizeof(cut_at[0]));
+    sweep.rng = 0x9E3779B9U ^ (cut_at[0] * 2654435761U) ^ (depth > 1 ? cut_at[1] : 0);
+    sweep.first_body_op = 0;
+
+    result->boots = 0;
+    result->reason[0] = '\0';
+
+    // Session 0 is the flow, each later one a restart
+    sweep.session = 0;
+    sweep.ops = 0;
+    if (setjmp(sweep.power) == 0) {
+        sweep_run_flow();
+    }
+    sweep.session_ops[0] = sweep.ops;
+
+    while (1) {
+        sweep.session++;
+        sweep.ops = 0;
+        sweep_power_on();
+
+        if (result->boots == SWEEP_MAX_BOOTS) {
+            result->end = SWEEP_END_UPDATER;
+            snprintf(result->reason, sizeof(result->reason), "still resuming after %u restarts", result->boots);
+            return;
+        }
+        result->boots++;
+
+        if (setjmp(sweep.power) == 0) {
+            int ended = sweep_boot(result);
+            if (sweep.session < SWEEP_MAX_DEPTH) {
+                sweep.session_ops[sweep.session] = sweep.ops;
+            }
+            if (ended) {
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * @brief  Programs a loader or updater image with random data and a valid header.
+ */
+static int sweep_install_synthetic(uint32_t addr, uint32_t magic, uint8_t type) {
+    uint8_t* raw = host_nor_raw() + (addr - FLASH_BASE);
+    for (uint32_t i = 0; i < SWEEP_SYNTH_SIZE; i++) {
+        raw[IMAGE_HDR_SIZE + i] = (uint8_t)sweep_random();
+    }
+
+    ImageHeader_t header;
+    host_image_header(&header, addr, magic, type, raw + IMAGE_HDR_SIZE, SWEEP_SYNTH_SIZE);
+    memcpy(raw, &header, sizeof(header));
+
+    return sweep_image_ok(addr);
+}
+
+/**
+ * @brief  Lays out the device before the flow: images, staged patch, and the state one clean boot leaves.
+ * @return 1 on success, 0 if the inputs do not make a bootable device.
+ */
+static int sweep_setup(const uint8_t* old_image, size_t old_size, const uint8_t* patch, size_t patch_size) {
+    host_system_reset();
+    host_nor_erase_all();
+    memset(host_bkpsram, 0, SWEEP_BKPSRAM_SIZE);
+    memset(RTC, 0, sizeof(*RTC));
+    sweep.rng = 0x2545F491U;
+
+    if (old_size < IMAGE_HDR_SIZE || old_size > APP_SLOT_SIZE ||
+        patch_size < IMAGE_HDR_SIZE || patch_size > PATCH_JOURNAL_ADDR - PATCH_ADDR) {
+        fprintf(stderr, "old image or patch does not fit its area\n");
+        return 0;
+    }
+
+    if (!sweep_install_synthetic(LOADER_ADDR, IMAGE_MAGIC_LOADER, IMAGE_TYPE_LOADER) ||
+        !sweep_install_synthetic(UPDATER_ADDR, IMAGE_MAGIC_UPDATER, IMAGE_TYPE_UPDATER)) {
+        fprintf(stderr, "cannot build loader and updater images\n");
+        return 0;
+    }
+
+    memcpy(host_nor_raw() + (APP_ADDR - FLASH_BASE), old_image, old_size);
+    memcpy(host_nor_raw() + (PATCH_ADDR - FLASH_BASE), patch, patch_size);
+
+    const ImageHeader_t* old_header = (const ImageHeader_t*)APP_ADDR;
+    const ImageHeader_t* patch_header = (const ImageHeader_t*)PATCH_ADDR;
+    if (!sweep_image_ok(APP_ADDR) || old_header->vector_addr != APP_ADDR + IMAGE_HDR_SIZE) {
+        fprintf(stderr, "old image does not verify or is not linked for 0x%08lX\n", (unsigned long)APP_ADDR);
+        return 0;
+    }
+    if (!is_image_valid(patch_header) || !patch_header->is_patch) {
+        fprintf(stderr, "patch is not a plain patch image (create_patch.py without -e)\n");
+        return 0;
+    }
+    if ((sweep.flow == SWEEP_FLOW_INPLACE) != (patch_header->is_patch == IMAGE_PATCH_INPLACE)) {
+        fprintf(stderr, "flow %s needs a %s patch\n", SWEEP_FLOW_NAMES[sweep.flow],
+                sweep.flow == SWEEP_FLOW_INPLACE ? "create_patch.py -i" : "delta");
+        return 0;
+    }
+    sweep.old_crc = old_header->crc;
+    sweep.new_crc = patch_header->crc;
+
+    // A clean boot fills the verification cache and boot counter as on a running device
+    uint32_t addr = 0;
+    sweep.session = SWEEP_MAX_DEPTH;
+    sweep_power_on();
+    if (sweep_run_image(boot_main, 0, 0) == LOADER_ADDR) {
+        addr = sweep_run_image(loader_main, SWEEP_LOADER_MS, 0);
+    }
+    if (addr != APP_ADDR) {
+        fprintf(stderr, "device does not boot the old image before the flow\n");
+        return 0;
+    }
+
+    sweep.flash = malloc(HOST_FLASH_SIZE);
+    if (sweep.flash == NULL) {
+        return 0;
+    }
+    memcpy(sweep.flash, host_nor_raw(), HOST_FLASH_SIZE);
+    memcpy(sweep.bkpsram, host_bkpsram, SWEEP_BKPSRAM_SIZE);
+    sweep.rtc = *RTC;
+
+    return 1;
+}
+
+/**
+ * @brief  Prints one run: where power was cut and how the device came back.
+ */
+static void sweep_print(const uint32_t* cut_at, uint32_t depth, const SweepResult_t* result) {
+    printf("  cut");
+    for (uint32_t i = 0; i < depth; i++) {
+        printf(" %s#%lu %s 0x%08lX", i == 0 ? "flow" : "restart", (unsigned long)cut_at[i],
+               sweep.cut[i].op == HOST_NOR_OP_ERASE ? "erase" : "program", (unsigned long)sweep.cut[i].addr);
+    }
+    printf(" -> %s after %u boot%s%s%s\n", SWEEP_END_NAMES[result->end], result->boots,
+           result->boots == 1 ? "" : "s", result->reason[0] != '\0' ? ": " : "", result->reason);
+}
+
+/**
+ * @brief  Reads a whole file.
+ * @return Allocated contents, NULL on error.
+ */
+static uint8_t* read_file(const char* path, size_t* size) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t* data = malloc(length > 0 ? (size_t)length : 1);
+    if (data == NULL || length < 0 || fread(data, 1, (size_t)length, f) != (size_t)length) {
+        fprintf(stderr, "Cannot read %s\n", path);
+        free(data);
+        fclose(f);
+        return NULL;
+    }
+
+    fclose(f);
+    *size = (size_t)length;
+    return data;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s -o old.bin -p patch.bin [-f patch|inplace|restore] [-t] [-s stride] [-d depth] [-b] [-v]\n",
+            name);
+}
+
+int main(int argc, char** argv) {
+    const char* old_path = NULL;
+    const char* patch_path = NULL;
+    uint32_t stride = 1;
+    uint32_t depth = 1;
+    int opt;
+
+    sweep.flow = SWEEP_FLOW_PATCH;
+
+    while ((opt = getopt(argc, argv, "o:p:f:ts:d:bv")) != -1) {
+        switch (opt) {
+            case 'o': old_path = optarg; break;
+            case 'p': patch_path = optarg; break;
+            case 'f': {
+                sweep.flow = SWEEP_FLOW_COUNT;
+                for (int i = 0; i < SWEEP_FLOW_COUNT; i++) {
+                    if (strcmp(optarg, SWEEP_FLOW_NAMES[i]) == 0) {
+                        sweep.flow = (SweepFlow_t)i;
+                    }
+                }
+                if (sweep.flow == SWEEP_FLOW_COUNT) {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            }
+            case 't': sweep.torn = 1; break;
+            case 's': stride = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'd': depth = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'b': sweep.lose_backup_domain = 1; break;
+            case 'v': sweep.verbose = 1; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    if (old_path == NULL || patch_path == NULL || stride == 0 || depth == 0 || depth > SWEEP_MAX_DEPTH) {
+        usage(argv[0]);
+        return 2;
+    }
+
+#ifdef AB_SLOTS
+    if (sweep.flow == SWEEP_FLOW_INPLACE) {
+        fprintf(stderr, "in-place patches are not used with AB_SLOTS\n");
+        return 2;
+    }
+#endif
+
+    size_t old_size = 0, patch_size = 0;
+    uint8_t* old_image = read_file(old_path, &old_size);
+    uint8_t* patch = read_file(patch_path, &patch_size);
+    if (old_image == NULL || patch == NULL) {
+        return 2;
+    }
+
+    if (!host_nor_init(NULL)) {
+        return 2;
+    }
+    host_nor_set_hook(sweep_nor_hook, NULL);
+    host_set_poll_hook(sweep_poll, NULL);
+    host_set_jump_hook(sweep_jump, NULL);
+
+    // Firmware chatter on USART2 goes nowhere
+    int setup_ok = sweep_setup(old_image, old_size, patch, patch_size);
+    free(old_image);
+    free(patch);
+    if (!setup_ok) {
+        return 2;
+    }
+
+    // Uncut run: operation count, and the failure injected for the restore flow
+    uint32_t none[SWEEP_MAX_DEPTH] = { 0 };
+    SweepResult_t result;
+    sweep_trial(none, 1, &result);
+    if (sweep.flow == SWEEP_FLOW_RESTORE) {
+        sweep.fail_at = sweep.first_body_op;
+        sweep_trial(none, 1, &result);
+    }
+    SweepEnd_t expected = (sweep.flow == SWEEP_FLOW_RESTORE) ? SWEEP_END_OLD : SWEEP_END_NEW;
+    uint32_t flow_ops = sweep.session_ops[0];
+
+    printf("%s flow%s: %lu flash operations, uncut run ends %s\n", SWEEP_FLOW_NAMES[sweep.flow],
+           sweep.torn ? " (torn cuts)" : "", (unsigned long)flow_ops, SWEEP_END_NAMES[result.end]);
+    if (result.end != expected) {
+        fprintf(stderr, "uncut run should end %s: %s\n", SWEEP_END_NAMES[expected], result.reason);
+        return 2;
+    }
+
+    uint32_t counts[SWEEP_END_COUNT] = { 0 };
+    uint32_t runs = 0;
+    uint32_t cut_at[SWEEP_MAX_DEPTH];
+
+    for (uint32_t first = 1; first <= flow_ops; first += stride) {
+        cut_at[0] = first;
+        sweep_trial(cut_at, 1, &result);
+        counts[result.end]++;
+        runs++;
+        if (sweep.verbose || result.end == SWEEP_END_BRICKED) {
+            sweep_print(cut_at, 1, &result);
+        }
+
+        // Cut again while the first restart writes (the in-place resume)
+        uint32_t restart_ops = sweep.session_ops[1];
+        for (uint32_t second = 1; depth > 1 && second <= restart_ops; second += stride) {
+            cut_at[1] = second;
+            sweep_trial(cut_at, 2, &result);
+            counts[result.end]++;
+            runs++;
+            if (sweep.verbose || result.end == SWEEP_END_BRICKED) {
+                sweep_print(cut_at, 2, &result);
+            }
+        }
+    }
+
+    printf("%lu runs:", (unsigned long)runs);
+    for (int i = 0; i < SWEEP_END_COUNT; i++) {
+        printf(" %s %lu", SWEEP_END_NAMES[i], (unsigned long)counts[i]);
+    }
+    printf("\n");
+
+    host_nor_deinit();
+    return counts[SWEEP_END_BRICKED] != 0 ? 1 : 0;
+}
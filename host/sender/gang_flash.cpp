@@ -0,0 +1,425 @@
+/**
+ * @file   gang_flash.cpp
+ * @brief  Updates a gang of boards on many serial ports at once, driven by a manifest.
+ *
+ * Usage: gang_flash [-f] manifest
+ *   -f  update even if a board already runs the version in the manifest
+ *
+ * Manifest, one entry per line, '#' starts a comment:
+ *   baud 115200                     line rate the ports are opened at (default: 115200)
+ *   max_baud 921600                 fastest rate to switch to once the updater answers,
+ *                                   probed on every board (default: no switch)
+ *   window 2                        packets sent ahead of their ACK (default: 2)
+ *   rtscts                          RTS/CTS flow control on every port
+ *   boot                            boot the application once a board is done
+ *   image <name> <file> [target=loader|app|patch|direct] [version=X.Y.Z]
+ *   device <port> <name>[,<name>...]
+ *
+ * Every image file is mapped once and shared by all ports. The boards are driven from
+ * one poll() loop, each one runs its images in the listed order through the station
+ * command protocol (see xmodem_send.cpp), and a board whose slot already holds the
+ * given version is skipped. With a version the image in the slot is checked after the
+ * update as well, which is the only check an encrypted container allows.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "mapped_file.h"
+#include "sender.h"
+
+struct Image {
+    std::string name;
+    std::string path;
+    MappedFile file;
+    SendOptions options;
+};
+
+struct Device {
+    std::string path;
+    std::vector<size_t> images;     // Indices into the image list, in update order
+    size_t current = 0;             // Image being sent
+    std::vector<SendResult> results;
+    std::unique_ptr<SerialPort> port;
+    std::unique_ptr<Sender> sender;
+    SendStage shown = SendStage::Idle;
+};
+
+struct Manifest {
+    unsigned baud = 115200;
+    unsigned max_baud = 0;
+    unsigned window = 2;
+    bool rtscts = false;
+    bool boot = false;
+    std::vector<std::unique_ptr<Image>> images;
+    std::vector<std::unique_ptr<Device>> devices;
+};
+
+static const char* stage_name(SendStage stage) {
+    switch (stage) {
+        case SendStage::Idle: return "idle";
+        case SendStage::Hello: return "hello";
+        case SendStage::BootUpdater: return "boot updater";
+        case SendStage::UpdaterHello: return "wait updater";
+        case SendStage::Baud: return "baud";
+        case SendStage::Probe: return "probe";
+        case SendStage::Rejoin: return "rejoin";
+        case SendStage::Check: return "check";
+        case SendStage::Start: return "start";
+        case SendStage::WaitReceiver: return "wait 'C'";
+        case SendStage::Transfer: return "transfer";
+        case SendStage::Eot: return "eot";
+        case SendStage::Progress: return "applying";
+        case SendStage::Verify: return "verify";
+        case SendStage::Boot: return "boot";
+        case SendStage::Restore: return "restore";
+        case SendStage::Done: return "done";
+        case SendStage::Failed: return "FAILED";
+    }
+    return "?";
+}
+
+static bool parse_target(const std::string& name, uint8_t& target) {
+    static const struct { const char* name; uint8_t target; } targets[] = {
+        { "loader", COMMAND_TARGET_LOADER },
+        { "app", COMMAND_TARGET_APP },
+        { "patch", COMMAND_TARGET_APP_PATCH },
+        { "direct", COMMAND_TARGET_APP_DIRECT },
+    };
+
+    for (const auto& t : targets) {
+        if (name == t.name) {
+            target = t.target;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_version(const std::string& text, uint8_t version[3]) {
+    unsigned major, minor, patch;
+    char end;
+    if (sscanf(text.c_str(), "%u.%u.%u%c", &major, &minor, &patch, &end) != 3 ||
+        major > 255 || minor > 255 || patch > 255) {
+        return false;
+    }
+
+    version[0] = (uint8_t)major;
+    version[1] = (uint8_t)minor;
+    version[2] = (uint8_t)patch;
+    return true;
+}
+
+/**
+ * @brief  Adds an image line: maps the file and settles its target and version.
+ * @param  manifest: [in,out] Manifest being read.
+ * @param  words: [in] Line split at spaces, "image" first.
+ * @param  base_dir: [in] Directory of the manifest, relative file names start there.
+ * @param  error: [out] Reason on failure.
+ * @return true if the image can be sent.
+ */
+static bool add_image(Manifest& manifest, const std::vector<std::string>& words, const std::string& base_dir,
+                      std::string& error) {
+    if (words.size() < 3) {
+        error = "image needs a name and a file";
+        return false;
+    }
+
+    std::unique_ptr<Image> image(new Image());
+    image->name = words[1];
+    image->path = words[2][0] == '/' ? words[2] : base_dir + words[2];
+    if (!image->file.open(image->path)) {
+        error = image->path + ": " + image->file.error();
+        return false;
+    }
+
+    ImageInfo info = image_detect(image->file.data(), image->file.size());
+    if (info.format == ImageFormat::Unknown) {
+        error = image->path + ": neither an image nor an encrypted container";
+        return false;
+    }
+    image->options.target = image_default_target(info);
+
+    for (size_t i = 3; i < words.size(); i++) {
+        const std::string& w = words[i];
+        if (w.compare(0, 7, "target=") == 0) {
+            if (!parse_target(w.substr(7), image->options.target)) {
+                error = "unknown target " + w.substr(7);
+                return false;
+            }
+        } else if (w.compare(0, 8, "version=") == 0) {
+            if (!parse_version(w.substr(8), image->options.version)) {
+                error = "bad version " + w.substr(8);
+                return false;
+            }
+            image->options.check_version = true;
+        } else {
+            error = "unknown image option " + w;
+            return false;
+        }
+    }
+
+    if (image->options.target == COMMAND_TARGET_NONE) {
+        error = image->path + ": the Updater does not take this image";
+        return false;
+    }
+
+    // A plain image names its own version, the manifest has to agree with it
+    if (info.format == ImageFormat::Plain && image->options.check_version &&
+        memcmp(info.version, image->options.version, 3) != 0) {
+        error = image->path + ": header version differs from the manifest";
+        return false;
+    }
+
+    manifest.images.push_back(std::move(image));
+    return true;
+}
+
+static bool add_device(Manifest& manifest, const std::vector<std::string>& words, std::string& error) {
+    if (words.size() != 3) {
+        error = "device needs a port and a list of images";
+        return false;
+    }
+
+    std::unique_ptr<Device> device(new Device());
+    device->path = words[1];
+
+    std::stringstream list(words[2]);
+    std::string name;
+    while (std::getline(list, name, ',')) {
+        size_t i = 0;
+        while (i < manifest.images.size() && manifest.images[i]->name != name) {
+            i++;
+        }
+        if (i == manifest.images.size()) {
+            error = "unknown image " + name + " (images are listed before devices)";
+            return false;
+        }
+        device->images.push_back(i);
+    }
+
+    manifest.devices.push_back(std::move(device));
+    return true;
+}
+
+static bool read_manifest(const char* path, Manifest& manifest) {
+    std::ifstream f(path);
+    if (!f) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+
+    std::string base_dir(path);
+    size_t slash = base_dir.rfind('/');
+    base_dir = slash == std::string::npos ? "" : base_dir.substr(0, slash + 1);
+
+    std::string line;
+    for (int number = 1; std::getline(f, line); number++) {
+        line = line.substr(0, line.find('#'));
+        std::stringstream ss(line);
+        std::vector<std::string> words;
+        std::string w;
+        while (ss >> w) {
+            words.push_back(w);
+        }
+        if (words.empty()) {
+            continue;
+        }
+
+        std::string error;
+        bool ok = true;
+        if (words[0] == "baud" && words.size() == 2) {
+            manifest.baud = (unsigned)strtoul(words[1].c_str(), nullptr, 0);
+        } else if (words[0] == "max_baud" && words.size() == 2) {
+            manifest.max_baud = (unsigned)strtoul(words[1].c_str(), nullptr, 0);
+            ok = SerialPort::supports(manifest.max_baud);
+            error = "unsupported baud rate " + words[1];
+        } else if (words[0] == "window" && words.size() == 2) {
+            manifest.window = (unsigned)strtoul(words[1].c_str(), nullptr, 0);
+            ok = manifest.window > 0;
+            error = "window must be at least 1";
+        } else if (words[0] == "rtscts" && words.size() == 1) {
+            manifest.rtscts = true;
+        } else if (words[0] == "boot" && words.size() == 1) {
+            manifest.boot = true;
+        } else if (words[0] == "image") {
+            ok = add_image(manifest, words, base_dir, error);
+        } else if (words[0] == "device") {
+            ok = add_device(manifest, words, error);
+        } else {
+            ok = false;
+            error = "unknown entry " + words[0];
+        }
+
+        if (!ok) {
+            fprintf(stderr, "%s:%d: %s\n", path, number, error.c_str());
+            return false;
+        }
+    }
+
+    if (manifest.devices.empty()) {
+        fprintf(stderr, "%s: no devices\n", path);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief  Starts the next image of a board.
+ * @param  manifest: [in] Manifest, for the image and the shared settings.
+ * @param  device: [in,out] Board to start.
+ * @param  force: [in] Update even if the slot already holds the version.
+ * @param  now: [in] Current time in ms.
+ * @note   The application is only booted after the last image.
+ */
+static void start_image(const Manifest& manifest, Device& device, bool force, uint32_t now) {
+    const Image& image = *manifest.images[device.images[device.current]];
+    SendOptions options = image.options;
+
+    options.window = manifest.window;
+    options.max_baud = manifest.max_baud;
+    options.force = force;
+    options.boot = manifest.boot && device.current + 1 == device.images.size();
+    device.sender->start(image.file.data(), image.file.size(), options, now);
+}
+
+// One row per board, redrawn in place on a terminal
+static void show_progress(const Manifest& manifest, bool redraw, uint32_t now) {
+    if (redraw) {
+        printf("\x1B[%zuA", manifest.devices.size());
+    }
+
+    for (const auto& d : manifest.devices) {
+        const Sender& s = *d->sender;
+        const Image& image = *manifest.images[d->images[d->current]];
+        size_t total = s.packets_total();
+        unsigned percent = total ? (unsigned)(s.packets_done() * 100 / total) : 0;
+        uint32_t elapsed_ms = s.finished() ? s.result().total_ms : now - s.started_at();
+
+        printf("\x1B[2K%-24s %-10s %-12s %3u%% %6.1f s  image %zu/%zu\n", d->path.c_str(), image.name.c_str(),
+               stage_name(s.stage()), percent, s.started_at() ? elapsed_ms / 1000.0 : 0.0, d->current + 1, d->images.size());
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    bool force = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f")) != -1) {
+        switch (opt) {
+            case 'f': force = true; break;
+            default:
+                fprintf(stderr, "Usage: %s [-f] manifest\n", argv[0]);
+                return 2;
+        }
+    }
+    if (argc - optind != 1) {
+        fprintf(stderr, "Usage: %s [-f] manifest\n", argv[0]);
+        return 2;
+    }
+
+    Manifest manifest;
+    if (!read_manifest(argv[optind], manifest)) {
+        return 1;
+    }
+
+    for (const auto& image : manifest.images) {
+        printf("%s: %s, %zu bytes\n", image->name.c_str(), image->path.c_str(), image->file.size());
+    }
+
+    uint32_t start = send_now_ms();
+    std::vector<Sender*> running;
+    std::vector<Device*> running_devices;
+    for (const auto& d : manifest.devices) {
+        d->port.reset(new SerialPort());
+        d->sender.reset(new Sender(*d->port, nullptr));
+        if (!d->port->open(d->path, manifest.baud, manifest.rtscts)) {
+            SendResult failed;
+            failed.error = d->port->error();
+            d->results.push_back(failed);
+            continue;
+        }
+        start_image(manifest, *d, force, start);
+        running.push_back(d->sender.get());
+        running_devices.push_back(d.get());
+    }
+
+    // On a terminal the table is redrawn, otherwise each stage change is a line
+    bool terminal = isatty(STDOUT_FILENO);
+    uint32_t last_draw = 0;
+    if (terminal) {
+        show_progress(manifest, false, start);
+    }
+
+    send_loop(running, [&](size_t i) {
+        Device& d = *running_devices[i];
+        d.results.push_back(d.sender->result());
+        if (!d.sender->result().ok || ++d.current == d.images.size()) {
+            d.current = d.results.size() - 1;
+            return false;
+        }
+        start_image(manifest, d, force, send_now_ms());
+        return true;
+    }, [&](uint32_t now) {
+        if (terminal) {
+            if (now - last_draw >= 250) {
+                last_draw = now;
+                show_progress(manifest, true, now);
+            }
+            return;
+        }
+        for (Device* d : running_devices) {
+            SendStage stage = d->sender->stage();
+            if (stage != d->shown) {
+                d->shown = stage;
+                printf("%s: %s %s\n", d->path.c_str(), manifest.images[d->images[d->current]]->name.c_str(),
+                       stage_name(stage));
+                fflush(stdout);
+            }
+        }
+    });
+
+    uint32_t wall_ms = send_now_ms() - start;
+    if (terminal) {
+        show_progress(manifest, true, send_now_ms());
+    }
+
+    printf("\n%-24s %-10s %-8s %8s %9s %9s %9s %9s %7s\n", "port", "image", "result", "baud", "connect",
+           "transfer", "finish", "total", "resent");
+    size_t done = 0, skipped = 0, failed = 0, bytes = 0;
+    for (const auto& d : manifest.devices) {
+        bool ok = d->results.size() == d->images.size();
+        for (size_t i = 0; i < d->results.size(); i++) {
+            const SendResult& r = d->results[i];
+            const char* name = i < d->images.size() ? manifest.images[d->images[i]]->name.c_str() : "-";
+            const char* state = r.skipped ? "current" : r.ok ? "ok" : "FAILED";
+            printf("%-24s %-10s %-8s %8u %7.2f s %7.2f s %7.2f s %7.2f s %7zu\n", d->path.c_str(), name, state,
+                   r.baud, r.connect_ms / 1000.0, r.transfer_ms / 1000.0, r.finish_ms / 1000.0, r.total_ms / 1000.0,
+                   r.retransmits);
+            if (!r.ok) {
+                printf("%-24s %s\n", "", r.error.c_str());
+                ok = false;
+            } else if (!r.skipped) {
+                bytes += manifest.images[d->images[i]]->file.size();
+            }
+        }
+        if (!ok) {
+            failed++;
+        } else if (std::all_of(d->results.begin(), d->results.end(), [](const SendResult& r) { return r.skipped; })) {
+            skipped++;
+        } else {
+            done++;
+        }
+    }
+
+    printf("\n%zu updated, %zu already current, %zu failed in %.2f s, %.1f kB/s over all ports\n",
+           done, skipped, failed, wall_ms / 1000.0, wall_ms ? (double)bytes / wall_ms : 0.0);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,38 @@
+/**
+ * @file   mapped_file.h
+ * @brief  Read-only memory mapping of an image file, shared by every port sending it.
+ */
+#ifndef _MAPPED_FILE_H
+#define _MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    ~MappedFile();
+
+    /**
+     * @brief  Maps a whole file read-only.
+     * @param  path: [in] File to map.
+     * @return true on success, error() says why otherwise.
+     * @note   An empty file cannot be mapped and is reported as an error.
+     */
+    bool open(const std::string& path);
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    const std::string& error() const { return error_; }
+
+private:
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+    std::string error_;
+};
+
+#endif /* _MAPPED_FILE_H */
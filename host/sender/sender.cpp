@@ -0,0 +1,825 @@
+#include "sender.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <poll.h>
+
+extern "C" {
+#include "image.h"
+}
+
+// XMODEM control bytes, see xmodem.h
+#define SENDER_SOH  0x01
+#define SENDER_EOT  0x04
+#define SENDER_ACK  0x06
+#define SENDER_NAK  0x15
+#define SENDER_CAN  0x18
+#define SENDER_C    0x43
+
+namespace {
+
+// HELLO attempts before falling back to a receiver started from the menu
+const int hello_attempts = 3;
+// The loader boots the updater after BOOT, a HELLO is answered once it is up
+const int updater_start_ms = 5000;
+// Receiver 'C' interval is 3 s, a menu-started receiver gets a few of them
+const int receiver_timeout_ms = 60000;
+// A patch is applied before the updater looks at commands again
+const int progress_timeout_ms = 120000;
+const int progress_poll_ms = 100;
+// Full CRC of an image
+const int verify_timeout_ms = 5000;
+// Any other command
+const int command_timeout_ms = 300;
+// ECHO frames that must come back intact before a new line rate is kept
+const int baud_probes = 4;
+// A kept rate the station lost track of is dropped after COMMAND_BAUD_IDLE_MS
+const int rejoin_timeout_ms = COMMAND_BAUD_IDLE_MS + 2000;
+
+uint16_t crc16_xmodem(const uint8_t* data, size_t len) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int j = 0; j < 8; j++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+uint32_t read_be32(const uint8_t* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+uint32_t read_le32(const uint8_t* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// ECHO payload, every byte value and long runs of alternating bits across the probes
+void probe_pattern(uint8_t* data, size_t len, int probe) {
+    for (size_t i = 0; i < len; i++) {
+        uint8_t value = (uint8_t)(i * 167 + probe * 59);
+        data[i] = (i & 8) ? (uint8_t)((i & 1) ? 0x55 : 0xAA) : value;
+    }
+}
+
+const char* status_name(uint8_t status) {
+    switch (status) {
+        case COMMAND_STATUS_OK: return "ok";
+        case COMMAND_STATUS_UNSUPPORTED: return "unsupported";
+        case COMMAND_STATUS_BAD_LENGTH: return "bad length";
+        case COMMAND_STATUS_BAD_TARGET: return "bad target";
+        case COMMAND_STATUS_FAILED: return "failed";
+        case COMMAND_STATUS_BAD_RATE: return "bad rate";
+        default: return "unknown status";
+    }
+}
+
+} // namespace
+
+ImageInfo image_detect(const uint8_t* data, size_t size) {
+    ImageInfo info;
+
+    if (size >= sizeof(ImageHeader_Packet_t)) {
+        ImageHeader_Packet_t header;
+        memcpy(&header, data, sizeof(header));
+        if ((header.image_magic == IMAGE_MAGIC_LOADER && header.image_type == IMAGE_TYPE_LOADER) ||
+            (header.image_magic == IMAGE_MAGIC_UPDATER && header.image_type == IMAGE_TYPE_UPDATER) ||
+            (header.image_magic == IMAGE_MAGIC_APP && header.image_type == IMAGE_TYPE_APP)) {
+            info.format = ImageFormat::Plain;
+            info.image_type = header.image_type;
+            info.is_patch = header.is_patch;
+            info.version[0] = header.version_major;
+            info.version[1] = header.version_minor;
+            info.version[2] = header.version_patch;
+            return info;
+        }
+    }
+
+    // Nonce and size in front, tag behind, nothing else tells the container apart
+    if (size > SENDER_NONCE_SIZE + 4 + SENDER_TAG_SIZE &&
+        read_be32(data + SENDER_NONCE_SIZE) == size - (SENDER_NONCE_SIZE + 4 + SENDER_TAG_SIZE)) {
+        info.format = ImageFormat::Encrypted;
+        info.payload_size = read_be32(data + SENDER_NONCE_SIZE);
+    }
+
+    return info;
+}
+
+uint8_t image_default_target(const ImageInfo& info) {
+    if (info.format == ImageFormat::Encrypted) {
+        return COMMAND_TARGET_APP;
+    }
+    if (info.format != ImageFormat::Plain) {
+        return COMMAND_TARGET_NONE;
+    }
+
+    switch (info.image_type) {
+        case IMAGE_TYPE_LOADER:
+            return COMMAND_TARGET_LOADER;
+        case IMAGE_TYPE_APP:
+            return info.is_patch != IMAGE_PATCH_NONE ? COMMAND_TARGET_APP_PATCH : COMMAND_TARGET_APP;
+        default:
+            // The updater cannot replace itself
+            return COMMAND_TARGET_NONE;
+    }
+}
+
+Sender::Sender(SerialPort& port, SendProgress progress)
+    : port_(port), progress_(std::move(progress)) {
+    command_parser_init(&parser_);
+}
+
+void Sender::start(const uint8_t* image, size_t size, const SendOptions& options, uint32_t now) {
+    options_ = options;
+    if (options_.window == 0) {
+        options_.window = 1;
+    }
+
+    result_ = SendResult();
+    image_ = image;
+    size_ = size;
+    total_ = (size + SENDER_PACKET_SIZE - 1) / SENDER_PACKET_SIZE;
+    base_ = next_ = drain_ = 0;
+    retries_ = cancels_ = 0;
+    start_time_ = now;
+    transfer_time_ = eot_time_ = 0;
+    base_baud_ = port_.baud();
+    result_.baud = port_.baud();
+
+    if (!options_.session) {
+        wait_for_receiver(now);
+        return;
+    }
+
+    retries_ = 1;
+    send_command(SendStage::Hello, COMMAND_HELLO, nullptr, 0, command_timeout_ms, now);
+}
+
+/**
+ * @brief  Sends a command, its reply is taken by on_reply().
+ * @param  stage: [in] Stage waiting for the reply.
+ * @param  id: [in] CommandId_t.
+ * @param  payload: [in] Payload, may be NULL when len is 0.
+ * @param  len: [in] Payload length.
+ * @param  timeout_ms: [in] Time to wait for the reply.
+ * @param  now: [in] Current time in ms.
+ */
+void Sender::send_command(SendStage stage, uint8_t id, const void* payload, uint16_t len, int timeout_ms,
+                          uint32_t now) {
+    uint8_t frame[COMMAND_MAX_FRAME];
+    size_t frame_len = command_encode(frame, id, payload, len);
+
+    if (stage != stage_) {
+        stage_time_ = now;
+    }
+    stage_ = stage;
+    pending_ = id;
+    deadline_ = now + (uint32_t)timeout_ms;
+    command_parser_init(&parser_);
+
+    if (!port_.write(frame, frame_len)) {
+        fail(port_.error(), now);
+    }
+}
+
+void Sender::on_byte(uint8_t byte, uint32_t now) {
+    switch (stage_) {
+        case SendStage::WaitReceiver:
+            if (byte == SENDER_C) {
+                result_.connect_ms = now - start_time_;
+                transfer_time_ = now;
+                stage_ = SendStage::Transfer;
+                send_window(now);
+            }
+            return;
+
+        case SendStage::Transfer:
+            break;
+
+        case SendStage::Eot:
+            // The status text after the ACK is left for the session commands to skip
+            if (byte == SENDER_ACK) {
+                transfer_done(now);
+            } else if (byte == SENDER_NAK || byte == SENDER_CAN) {
+                send_eot(now);
+            }
+            return;
+
+        case SendStage::Idle:
+        case SendStage::Done:
+        case SendStage::Failed:
+            return;
+
+        default: {
+            // Text and replies to earlier commands are skipped
+            CommandFrame_t frame;
+            if (command_parse_byte(&parser_, byte, now, &frame) == COMMAND_PARSE_FRAME &&
+                frame.id == (pending_ | COMMAND_REPLY) && frame.length > 0) {
+                on_reply(frame, now);
+            }
+            return;
+        }
+    }
+
+    // Transfer: the packets behind a NAK are NAKed as well, their replies are dropped
+    if (drain_ > 0) {
+        if (--drain_ == 0) {
+            send_window(now);
+        }
+        return;
+    }
+
+    if (byte == SENDER_ACK) {
+        base_++;
+        retries_ = 0;
+        cancels_ = 0;
+        if (progress_) {
+            progress_(base_, total_);
+        }
+        if (base_ == total_) {
+            result_.packets = total_;
+            retries_ = 0;
+            send_eot(now);
+        } else {
+            send_window(now);
+        }
+        return;
+    }
+
+    if (byte == SENDER_CAN) {
+        if (++cancels_ >= 2) {
+            fail("cancelled by the receiver at packet " + std::to_string(base_ + 1), now);
+        }
+        return;
+    }
+    cancels_ = 0;
+
+    // A late 'C' or status text
+    if (byte != SENDER_NAK) {
+        return;
+    }
+
+    if (++retries_ > options_.max_retries) {
+        fail("packet " + std::to_string(base_ + 1) + " rejected", now);
+        return;
+    }
+
+    result_.retransmits += next_ - base_;
+    drain_ = next_ - base_ - 1;
+    next_ = base_;
+    if (drain_ == 0) {
+        send_window(now);
+    } else {
+        deadline_ = now + (uint32_t)options_.ack_timeout_ms;
+    }
+}
+
+/**
+ * @brief  Takes the reply to the pending command.
+ * @param  frame: [in] Reply frame, status byte first.
+ * @param  now: [in] Current time in ms.
+ */
+void Sender::on_reply(const CommandFrame_t& frame, uint32_t now) {
+    uint8_t status = frame.payload[0];
+
+    switch (stage_) {
+        case SendStage::Hello:
+        case SendStage::UpdaterHello: {
+            CommandHello_t hello;
+            if (status != COMMAND_STATUS_OK || frame.length < 1 + sizeof(hello)) {
+                return;
+            }
+            memcpy(&hello, &frame.payload[1], sizeof(hello));
+            if (hello.image_type == IMAGE_TYPE_UPDATER) {
+                session_open(now);
+            } else if (stage_ == SendStage::Hello) {
+                uint8_t target = COMMAND_TARGET_UPDATER;
+                send_command(SendStage::BootUpdater, COMMAND_BOOT, &target, 1, command_timeout_ms, now);
+            }
+            return;
+        }
+
+        case SendStage::BootUpdater:
+            if (status != COMMAND_STATUS_OK) {
+                fail("loader did not boot the updater", now);
+                return;
+            }
+            // The session is carried over, the updater starts without its menu
+            send_command(SendStage::UpdaterHello, COMMAND_HELLO, nullptr, 0, command_timeout_ms, now);
+            return;
+
+        case SendStage::Baud:
+            if (pending_ == COMMAND_GET_BAUD) {
+                // Current rate first, then the ones offered
+                rates_.clear();
+                for (size_t i = 5; status == COMMAND_STATUS_OK && i + 4 <= frame.length; i += 4) {
+                    unsigned rate = read_le32(&frame.payload[i]);
+                    if (rate > port_.baud() && rate <= options_.max_baud && SerialPort::supports(rate)) {
+                        rates_.push_back(rate);
+                    }
+                }
+                std::sort(rates_.rbegin(), rates_.rend());
+                old_baud_ = port_.baud();
+                baud_next(now);
+            } else if (port_.baud() == trial_baud_) {
+                // Heard and kept at the new rate
+                if (status != COMMAND_STATUS_OK) {
+                    baud_rejoin(now);
+                    return;
+                }
+                session_ready(now);
+            } else if (status != COMMAND_STATUS_OK) {
+                baud_next(now);
+            } else {
+                if (!port_.set_baud(trial_baud_)) {
+                    fail(port_.error(), now);
+                    return;
+                }
+                switch_time_ = now;
+                probes_ = 0;
+                baud_probe(now);
+            }
+            return;
+
+        case SendStage::Probe: {
+            uint8_t data[COMMAND_MAX_PAYLOAD - 1];
+            probe_pattern(data, sizeof(data), probes_);
+            if (status != COMMAND_STATUS_OK || frame.length != 1 + sizeof(data) ||
+                memcmp(&frame.payload[1], data, sizeof(data)) != 0) {
+                baud_rejoin(now);
+                return;
+            }
+            if (++probes_ < baud_probes) {
+                baud_probe(now);
+                return;
+            }
+            uint32_t rate = trial_baud_;
+            send_command(SendStage::Baud, COMMAND_SET_BAUD, &rate, sizeof(rate), command_timeout_ms, now);
+            return;
+        }
+
+        case SendStage::Rejoin:
+            if (status == COMMAND_STATUS_OK) {
+                baud_next(now);
+            }
+            return;
+
+        case SendStage::Restore:
+            if (port_.baud() == base_baud_) {
+                finish(now);
+            } else if (status != COMMAND_STATUS_OK || !port_.set_baud(base_baud_)) {
+                restore_lost(now);
+            } else {
+                // Kept once it is named again at that rate
+                uint32_t rate = base_baud_;
+                send_command(SendStage::Restore, COMMAND_SET_BAUD, &rate, sizeof(rate), command_timeout_ms, now);
+            }
+            return;
+
+        case SendStage::Check: {
+            CommandImageInfo_t info;
+            if (status == COMMAND_STATUS_OK && frame.length >= 1 + sizeof(info)) {
+                memcpy(&info, &frame.payload[1], sizeof(info));
+                if (memcmp(&info.version_major, options_.version, 3) == 0) {
+                    result_.skipped = true;
+                    session_done(now);
+                    return;
+                }
+            }
+            uint8_t target = options_.target;
+            send_command(SendStage::Start, COMMAND_START_UPDATE, &target, 1, command_timeout_ms, now);
+            return;
+        }
+
+        case SendStage::Start:
+            if (status != COMMAND_STATUS_OK) {
+                fail(std::string("START_UPDATE ") + status_name(status), now);
+                return;
+            }
+            wait_for_receiver(now);
+            return;
+
+        case SendStage::Progress: {
+            CommandProgressInfo_t progress;
+            if (frame.length < 1 + sizeof(progress)) {
+                return;
+            }
+            memcpy(&progress, &frame.payload[1], sizeof(progress));
+            if (progress.state == COMMAND_PROGRESS_DONE) {
+                verify(SendStage::Verify, now);
+            } else if (progress.state != COMMAND_PROGRESS_RECEIVING) {
+                fail("update failed, transfer result " + std::to_string(progress.transfer) +
+                     ", patch result " + std::to_string(progress.patch_error), now);
+            } else {
+                // Asked again once the deadline passes
+                pending_ = 0;
+                deadline_ = now + progress_poll_ms;
+            }
+            return;
+        }
+
+        case SendStage::Verify: {
+            CommandImageInfo_t info;
+            if (status != COMMAND_STATUS_OK || frame.length < 1 + sizeof(info)) {
+                fail(std::string("verify ") + status_name(status), now);
+                return;
+            }
+            memcpy(&info, &frame.payload[1], sizeof(info));
+            if (options_.check_version && memcmp(&info.version_major, options_.version, 3) != 0) {
+                fail("version " + std::to_string(info.version_major) + "." + std::to_string(info.version_minor) +
+                     "." + std::to_string(info.version_patch) + " after the update", now);
+                return;
+            }
+            if (options_.boot) {
+                uint8_t target = COMMAND_TARGET_APP;
+                send_command(SendStage::Boot, COMMAND_BOOT, &target, 1, command_timeout_ms, now);
+            } else {
+                session_done(now);
+            }
+            return;
+        }
+
+        case SendStage::Boot:
+            if (status != COMMAND_STATUS_OK) {
+                fail("application boot refused", now);
+                return;
+            }
+            // The loader talks at the rate the port was opened at
+            if (port_.baud() != base_baud_ && !port_.set_baud(base_baud_)) {
+                fail(port_.error(), now);
+                return;
+            }
+            finish(now);
+            return;
+
+        default:
+            return;
+    }
+}
+
+void Sender::on_time(uint32_t now) {
+    if ((int32_t)(now - deadline_) < 0) {
+        return;
+    }
+
+    switch (stage_) {
+        case SendStage::Hello:
+            if (retries_++ < hello_attempts) {
+                send_command(SendStage::Hello, COMMAND_HELLO, nullptr, 0, command_timeout_ms, now);
+            } else {
+                // No command protocol, the receiver has to be started from the menu
+                wait_for_receiver(now);
+            }
+            return;
+
+        case SendStage::UpdaterHello:
+            if (now - stage_time_ < (uint32_t)updater_start_ms) {
+                send_command(SendStage::UpdaterHello, COMMAND_HELLO, nullptr, 0, command_timeout_ms, now);
+            } else {
+                fail("updater did not answer after boot", now);
+            }
+            return;
+
+        case SendStage::Baud:
+            if (pending_ == COMMAND_GET_BAUD) {
+                // Stays at the rate it has
+                session_ready(now);
+            } else {
+                // The SET_BAUD may or may not have been taken
+                baud_rejoin(now);
+            }
+            return;
+
+        case SendStage::Probe:
+            baud_rejoin(now);
+            return;
+
+        case SendStage::Rejoin:
+            if (now - stage_time_ >= (uint32_t)rejoin_timeout_ms) {
+                fail("no reply at " + std::to_string(old_baud_) + " baud after trying " +
+                     std::to_string(trial_baud_), now);
+            } else {
+                send_command(SendStage::Rejoin, COMMAND_HELLO, nullptr, 0, command_timeout_ms, now);
+            }
+            return;
+
+        case SendStage::Restore:
+            restore_lost(now);
+            return;
+
+        case SendStage::WaitReceiver:
+            fail("no 'C' from the receiver", now);
+            return;
+
+        case SendStage::Transfer:
+            if (++retries_ > options_.max_retries) {
+                fail("no reply to packet " + std::to_string(base_ + 1), now);
+                return;
+            }
+            result_.retransmits += next_ - base_;
+            drain_ = 0;
+            next_ = base_;
+            send_window(now);
+            return;
+
+        case SendStage::Eot:
+            send_eot(now);
+            return;
+
+        case SendStage::Progress:
+            if (now - stage_time_ >= (uint32_t)progress_timeout_ms) {
+                fail("update did not finish", now);
+            } else {
+                // A patch is being applied, or the reply was lost
+                send_command(SendStage::Progress, COMMAND_QUERY_PROGRESS, nullptr, 0, progress_poll_ms, now);
+            }
+            return;
+
+        case SendStage::BootUpdater:
+        case SendStage::Check:
+        case SendStage::Start:
+        case SendStage::Verify:
+        case SendStage::Boot:
+            fail("no reply to command " + std::to_string(pending_), now);
+            return;
+
+        default:
+            return;
+    }
+}
+
+void Sender::abort(const std::string& error, uint32_t now) {
+    if (!finished()) {
+        fail(error, now);
+    }
+}
+
+/**
+ * @brief  Continues once the updater answered: line rate, then the update.
+ * @param  now: [in] Current time in ms.
+ */
+void Sender::session_open(uint32_t now) {
+    session_ = true;
+
+    if (options_.max_baud > port_.baud()) {
+        send_command(SendStage::Baud, COMMAND_GET_BAUD, nullptr, 0, command_timeout_ms, now);
+        return;
+    }
+
+    session_ready(now);
+}
+
+/**
+ * @brief  Continues at the settled line rate: version check or START_UPDATE.
+ * @param  now: [in] Current time in ms.
+ */
+void Sender::session_ready(uint32_t now) {
+    result_.baud = port_.baud();
+
+    if (options_.check_version && !options_.force) {
+        verify(SendStage::Check, now);
+        return;
+    }
+
+    uint8_t target = options_.target;
+    send_command(SendStage::Start, COMMAND_START_UPDATE, &target, 1, command_timeout_ms, now);
+}
+
+/**
+ * @brief  Asks the updater to switch to the fastest rate not tried yet.
+ * @param  now: [in] Current time in ms.
+ * @note   The updater answers at the old rate and switches, then has to be reached with
+ *         baud_probes intact ECHO frames and a second SET_BAUD within
+ *         COMMAND_BAUD_CONFIRM_MS, or it goes back to the old rate.
+ */
+void Sender::baud_next(uint32_t now) {
+    if (rates_.empty()) {
+        session_ready(now);
+        return;
+    }
+
+    trial_baud_ = rates_.front();
+    rates_.erase(rates_.begin());
+    switch_time_ = now;
+
+    uint32_t rate = trial_baud_;
+    send_command(SendStage::Baud, COMMAND_SET_BAUD, &rate, sizeof(rate), command_timeout_ms, now);
+}
+
+void Sender::baud_probe(uint32_t now) {
+    uint8_t data[COMMAND_MAX_PAYLOAD - 1];
+    probe_pattern(data, sizeof(data), probes_);
+    send_command(SendStage::Probe, COMMAND_ECHO, data, sizeof(data), command_timeout_ms, now);
+}
+
+/**
+ * @brief  Gives up on trial_baud_: back to the old rate once the updater has dropped it.
+ * @param  now: [in] Current time in ms.
+ * @note   HELLO is repeated until the updater answers, then the next slower rate is tried.
+ *         If the second SET_BAUD was taken after all, the updater only goes back once no
+ *         frame reached it for COMMAND_BAUD_IDLE_MS.
+ */
+void Sender::baud_rejoin(uint32_t now) {
+    if (port_.baud() != old_baud_ && !port_.set_baud(old_baud_)) {
+        fail(port_.error(), now);
+        return;
+    }
+
+    stage_ = SendStage::Rejoin;
+    stage_time_ = now;
+    pending_ = 0;
+    deadline_ = switch_time_ + COMMAND_BAUD_CONFIRM_MS + command_timeout_ms;
+}
+
+/**
+ * @brief  Ends a successful session, back at the rate the port was opened at.
+ * @param  now: [in] Current time in ms.
+ * @note   The next session, or another tool, finds the updater where it started.
+ */
+void Sender::session_done(uint32_t now) {
+    if (port_.baud() == base_baud_) {
+        finish(now);
+        return;
+    }
+
+    uint32_t rate = base_baud_;
+    send_command(SendStage::Restore, COMMAND_SET_BAUD, &rate, sizeof(rate), command_timeout_ms, now);
+}
+
+// The update itself is done, the updater drops a rate nobody talks at after COMMAND_BAUD_IDLE_MS
+void Sender::restore_lost(uint32_t now) {
+    port_.set_baud(base_baud_);
+    finish(now);
+}
+
+void Sender::wait_for_receiver(uint32_t now) {
+    if (stage_ != SendStage::WaitReceiver) {
+        stage_time_ = now;
+    }
+    stage_ = SendStage::WaitReceiver;
+    deadline_ = now + receiver_timeout_ms;
+}
+
+/**
+ * @brief  Fills the window with packets up to options_.window ahead of the oldest ACK.
+ * @param  now: [in] Current time in ms.
+ * @note   The receiver has no window of its own: it takes packets in order and NAKs
+ *         anything else, so a NAK of the oldest packet also NAKs the ones sent behind
+ *         it. Their replies are drained and sending resumes at the NAKed packet. A lost
+ *         ACK is not recovered, the receiver NAKs the repeated packet as out of sequence.
+ */
+void Sender::send_window(uint32_t now) {
+    while (next_ < total_ && next_ - base_ < options_.window) {
+        if (!send_packet(next_)) {
+            fail(port_.error(), now);
+            return;
+        }
+        next_++;
+    }
+
+    deadline_ = now + (uint32_t)options_.ack_timeout_ms;
+}
+
+bool Sender::send_packet(size_t index) {
+    uint8_t packet[3 + SENDER_PACKET_SIZE + 2];
+    size_t offset = index * SENDER_PACKET_SIZE;
+    size_t chunk = size_ - offset < SENDER_PACKET_SIZE ? size_ - offset : SENDER_PACKET_SIZE;
+    uint8_t number = (uint8_t)(index + 1);
+
+    packet[0] = SENDER_SOH;
+    packet[1] = number;
+    packet[2] = (uint8_t)(0xFF - number);
+    memcpy(&packet[3], image_ + offset, chunk);
+    memset(&packet[3 + chunk], SENDER_PAD_BYTE, SENDER_PACKET_SIZE - chunk);
+
+    uint16_t crc = crc16_xmodem(&packet[3], SENDER_PACKET_SIZE);
+    packet[3 + SENDER_PACKET_SIZE] = (uint8_t)(crc >> 8);
+    packet[4 + SENDER_PACKET_SIZE] = (uint8_t)crc;
+
+    return port_.write(packet, sizeof(packet));
+}
+
+void Sender::send_eot(uint32_t now) {
+    const uint8_t eot = SENDER_EOT;
+
+    if (retries_++ > options_.max_retries) {
+        fail("EOT not acknowledged", now);
+        return;
+    }
+    if (!port_.write(&eot, 1)) {
+        fail(port_.error(), now);
+        return;
+    }
+
+    stage_ = SendStage::Eot;
+    deadline_ = now + (uint32_t)options_.ack_timeout_ms;
+}
+
+void Sender::transfer_done(uint32_t now) {
+    result_.transfer_ms = now - transfer_time_;
+    eot_time_ = now;
+
+    if (!session_) {
+        finish(now);
+        return;
+    }
+
+    send_command(SendStage::Progress, COMMAND_QUERY_PROGRESS, nullptr, 0, progress_poll_ms, now);
+}
+
+/**
+ * @brief  Asks for a full CRC check of the updated slot.
+ * @param  stage: [in] SendStage::Check before the update, SendStage::Verify after it.
+ * @param  now: [in] Current time in ms.
+ */
+void Sender::verify(SendStage stage, uint32_t now) {
+    uint8_t target = verify_target();
+    send_command(stage, COMMAND_VERIFY, &target, 1, verify_timeout_ms, now);
+}
+
+// Patched and direct images end up in the slot the loader boots
+uint8_t Sender::verify_target() const {
+    return options_.target == COMMAND_TARGET_LOADER ? COMMAND_TARGET_LOADER : COMMAND_TARGET_APP;
+}
+
+void Sender::finish(uint32_t now) {
+    if (eot_time_ != 0 && !result_.skipped) {
+        result_.finish_ms = now - eot_time_;
+    }
+    result_.total_ms = now - start_time_;
+    result_.ok = true;
+    stage_ = SendStage::Done;
+}
+
+void Sender::fail(const std::string& error, uint32_t now) {
+    if (result_.error.empty()) {
+        result_.error = error;
+    }
+    result_.total_ms = now - start_time_;
+    stage_ = SendStage::Failed;
+}
+
+uint32_t send_now_ms() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void send_loop(const std::vector<Sender*>& senders, const std::function<bool(size_t)>& on_finished,
+               const std::function<void(uint32_t)>& on_tick) {
+    std::vector<struct pollfd> fds(senders.size());
+    std::vector<bool> reported(senders.size(), false);
+    uint8_t buffer[512];
+
+    for (;;) {
+        uint32_t now = send_now_ms();
+        int timeout = 100;
+        size_t active = 0;
+
+        for (size_t i = 0; i < senders.size(); i++) {
+            Sender* s = senders[i];
+            if (s->finished() && !reported[i]) {
+                reported[i] = !on_finished(i);
+            }
+            fds[i].fd = s->finished() ? -1 : s->port().fd();
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+            if (!s->finished()) {
+                int32_t wait = (int32_t)(s->deadline() - now);
+                timeout = std::max(0, std::min(timeout, (int)wait));
+                active++;
+            }
+        }
+
+        if (on_tick) {
+            on_tick(now);
+        }
+        if (active == 0) {
+            return;
+        }
+
+        if (poll(fds.data(), fds.size(), timeout) < 0 && errno != EINTR) {
+            return;
+        }
+
+        now = send_now_ms();
+        for (size_t i = 0; i < senders.size(); i++) {
+            Sender* s = senders[i];
+            if (fds[i].fd < 0) {
+                continue;
+            }
+            if (fds[i].revents & POLLIN) {
+                ssize_t n = s->port().read(buffer, sizeof(buffer));
+                for (ssize_t j = 0; j < n && !s->finished(); j++) {
+                    s->on_byte(buffer[j], now);
+                }
+            } else if (fds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
+                s->abort("port closed", now);
+            }
+            if (!s->finished()) {
+                s->on_time(now);
+            }
+        }
+    }
+}
@@ -0,0 +1,212 @@
+/**
+ * @file   sender.h
+ * @brief  Sends an image to one device: command session, pipelined XMODEM-CRC, verify.
+ */
+#ifndef _SENDER_H
+#define _SENDER_H
+
+#include "serial_port.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "command.h"
+}
+
+// XMODEM-CRC as the updater receives it, 128-byte packets only
+#define SENDER_PACKET_SIZE      128
+#define SENDER_PAD_BYTE         0x1A
+
+// Trailer added by encrypt_firmware.py: nonce, big-endian plaintext size, ciphertext, tag
+#define SENDER_NONCE_SIZE       12
+#define SENDER_TAG_SIZE         16
+
+enum class ImageFormat {
+    Unknown,
+    Plain,          // Image header first
+    Encrypted       // encrypt_firmware.py container, the header is inside
+};
+
+struct ImageInfo {
+    ImageFormat format = ImageFormat::Unknown;
+    uint8_t image_type = 0;         // Plain only, IMAGE_TYPE_*
+    uint8_t is_patch = 0;           // Plain only, IMAGE_PATCH_*
+    uint8_t version[3] = {};
+    uint32_t payload_size = 0;      // Plaintext size of an encrypted container
+};
+
+/**
+ * @brief  Tells a plain image from an encrypted container.
+ * @param  data: [in] File contents.
+ * @param  size: [in] File size.
+ * @return What the file holds, ImageFormat::Unknown if it is neither.
+ */
+ImageInfo image_detect(const uint8_t* data, size_t size);
+
+/**
+ * @brief  Picks the START_UPDATE target for an image.
+ * @param  info: [in] Detected image.
+ * @return CommandTarget_t, the application for an encrypted container (its header cannot be read),
+ *         COMMAND_TARGET_NONE for an image the updater does not take.
+ */
+uint8_t image_default_target(const ImageInfo& info);
+
+struct SendOptions {
+    uint8_t target = 0;             // CommandTarget_t given to START_UPDATE
+    unsigned window = 2;            // Packets sent ahead of their ACK, 1 = stop-and-wait
+    unsigned max_baud = 0;          // Highest line rate to negotiate with the updater, 0 = keep the port's
+    bool session = true;            // Drive the device with commands, or wait for a 'C' from a menu
+    bool boot = false;              // Boot the application after a verified update
+    bool check_version = false;     // Compare the image in the slot with version
+    bool force = false;             // Update even if the slot already holds version
+    uint8_t version[3] = {};
+    int ack_timeout_ms = 10000;     // Per response, covers a sector erase
+    int max_retries = 10;
+};
+
+enum class SendStage {
+    Idle,
+    Hello,          // Looking for a command session
+    BootUpdater,    // Loader answered, asked to boot the updater
+    UpdaterHello,   // Waiting for the updater to come up
+    Baud,           // GET_BAUD, or SET_BAUD to switch to a rate or to keep it
+    Probe,          // ECHO frames at the new rate
+    Rejoin,         // Rate not kept, waiting for the updater to go back to the old one
+    Check,          // VERIFY before the update, skipped if the version is already there
+    Start,          // START_UPDATE sent
+    WaitReceiver,   // Waiting for 'C'
+    Transfer,
+    Eot,
+    Progress,       // Polling QUERY_PROGRESS until the updater is done
+    Verify,
+    Boot,
+    Restore,        // SET_BAUD back to the rate the port was opened at
+    Done,
+    Failed
+};
+
+struct SendResult {
+    bool ok = false;
+    bool skipped = false;           // Slot already held the version, nothing sent
+    std::string error;
+    size_t packets = 0;
+    size_t retransmits = 0;
+    unsigned baud = 0;              // Line rate of the transfer
+    uint32_t connect_ms = 0;        // Start to the first 'C'
+    uint32_t transfer_ms = 0;       // First packet to the ACK of EOT
+    uint32_t finish_ms = 0;         // ACK of EOT to done, patching and verify
+    uint32_t total_ms = 0;
+};
+
+// Called after every acknowledged packet
+using SendProgress = std::function<void(size_t done, size_t total)>;
+
+/**
+ * Update of one device as a state machine, fed with received bytes and the time by
+ * send_loop(), so any number of devices run from one thread.
+ */
+class Sender {
+public:
+    /**
+     * @param  port: [in] Open port, must outlive the sender.
+     * @param  progress: [in] Progress callback, may be empty.
+     */
+    Sender(SerialPort& port, SendProgress progress);
+
+    /**
+     * @brief  Starts an update: session, transfer, result and verify, optional boot.
+     * @param  image: [in] File to send as-is, must stay mapped until the sender is finished.
+     * @param  size: [in] File size.
+     * @param  options: [in] Send settings for this image.
+     * @param  now: [in] Current time in ms.
+     * @note   Without a session the receiver must already be started from the menu.
+     *         A sender can be started again once finished, the session stays open.
+     */
+    void start(const uint8_t* image, size_t size, const SendOptions& options, uint32_t now);
+
+    // Feed one received byte
+    void on_byte(uint8_t byte, uint32_t now);
+
+    // Handle timeouts, called whenever deadline() has passed
+    void on_time(uint32_t now);
+
+    // Give up, for a port that went away
+    void abort(const std::string& error, uint32_t now);
+
+    uint32_t deadline() const { return deadline_; }
+    bool finished() const { return stage_ == SendStage::Done || stage_ == SendStage::Failed; }
+    SendStage stage() const { return stage_; }
+    size_t packets_done() const { return base_; }
+    size_t packets_total() const { return total_; }
+    uint32_t started_at() const { return start_time_; }
+    const SendResult& result() const { return result_; }
+    SerialPort& port() { return port_; }
+
+private:
+    void send_command(SendStage stage, uint8_t id, const void* payload, uint16_t len, int timeout_ms, uint32_t now);
+    void on_reply(const CommandFrame_t& frame, uint32_t now);
+    void session_open(uint32_t now);
+    void session_ready(uint32_t now);
+    void baud_next(uint32_t now);
+    void baud_probe(uint32_t now);
+    void baud_rejoin(uint32_t now);
+    void session_done(uint32_t now);
+    void restore_lost(uint32_t now);
+    void wait_for_receiver(uint32_t now);
+    void send_window(uint32_t now);
+    bool send_packet(size_t index);
+    void send_eot(uint32_t now);
+    void transfer_done(uint32_t now);
+    void verify(SendStage stage, uint32_t now);
+    void finish(uint32_t now);
+    void fail(const std::string& error, uint32_t now);
+    uint8_t verify_target() const;
+
+    SerialPort& port_;
+    SendOptions options_;
+    SendProgress progress_;
+    SendResult result_;
+    SendStage stage_ = SendStage::Idle;
+    bool session_ = false;
+
+    const uint8_t* image_ = nullptr;
+    size_t size_ = 0;
+    size_t total_ = 0;
+    size_t base_ = 0;               // Oldest packet without an ACK
+    size_t next_ = 0;               // Next packet to put on the line
+    size_t drain_ = 0;              // Replies still due for packets sent behind a NAK
+    int retries_ = 0;
+    int cancels_ = 0;
+
+    unsigned base_baud_ = 0;        // Rate the session started at, the loader's
+    std::vector<unsigned> rates_;   // Rates still to try, fastest first
+    unsigned trial_baud_ = 0;
+    unsigned old_baud_ = 0;         // Rate the updater goes back to if trial_baud_ is not kept
+    int probes_ = 0;
+    uint32_t switch_time_ = 0;
+
+    CommandParser_t parser_;
+    uint8_t pending_ = 0;           // Command waiting for its reply
+    uint32_t deadline_ = 0;
+    uint32_t start_time_ = 0;
+    uint32_t stage_time_ = 0;       // Start of the current stage
+    uint32_t transfer_time_ = 0;
+    uint32_t eot_time_ = 0;
+};
+
+/**
+ * @brief  Drives senders from one poll() loop until every one is finished.
+ * @param  senders: [in] Started senders, each on its own port.
+ * @param  on_finished: [in] Called once sender i finishes, returns true if it was started again.
+ * @param  on_tick: [in] Called at least every 100 ms with the current time, may be empty.
+ */
+void send_loop(const std::vector<Sender*>& senders, const std::function<bool(size_t)>& on_finished,
+               const std::function<void(uint32_t)>& on_tick);
+
+// Milliseconds on the clock send_loop() passes to the senders
+uint32_t send_now_ms();
+
+#endif /* _SENDER_H */
@@ -0,0 +1,146 @@
+#include "serial_port.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace {
+
+struct BaudRate {
+    unsigned rate;
+    speed_t speed;
+};
+
+const BaudRate baud_rates[] = {
+    { 9600, B9600 }, { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+    { 115200, B115200 }, { 230400, B230400 }, { 460800, B460800 }, { 921600, B921600 },
+    { 1000000, B1000000 }, { 1500000, B1500000 }, { 2000000, B2000000 }, { 2500000, B2500000 },
+    { 3000000, B3000000 }, { 4000000, B4000000 },
+};
+
+speed_t find_speed(unsigned baud) {
+    for (const BaudRate& b : baud_rates) {
+        if (b.rate == baud) {
+            return b.speed;
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+SerialPort::~SerialPort() {
+    close();
+}
+
+bool SerialPort::open(const std::string& path, unsigned baud, bool rtscts) {
+    close();
+    path_ = path;
+
+    speed_t speed = find_speed(baud);
+    if (speed == 0) {
+        error_ = "unsupported baud rate " + std::to_string(baud);
+        return false;
+    }
+
+    fd_ = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd_ < 0) {
+        error_ = std::string("cannot open: ") + strerror(errno);
+        return false;
+    }
+
+    struct termios tio;
+    if (tcgetattr(fd_, &tio) != 0) {
+        error_ = std::string("not a terminal: ") + strerror(errno);
+        close();
+        return false;
+    }
+
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    if (rtscts) {
+        tio.c_cflag |= CRTSCTS;
+    }
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd_, TCSANOW, &tio) != 0) {
+        error_ = std::string("cannot configure: ") + strerror(errno);
+        close();
+        return false;
+    }
+
+    baud_ = baud;
+    flush_input();
+    return true;
+}
+
+bool SerialPort::set_baud(unsigned baud) {
+    speed_t speed = find_speed(baud);
+    if (speed == 0) {
+        error_ = "unsupported baud rate " + std::to_string(baud);
+        return false;
+    }
+
+    struct termios tio;
+    tcdrain(fd_);
+    if (tcgetattr(fd_, &tio) != 0) {
+        error_ = std::string("cannot configure: ") + strerror(errno);
+        return false;
+    }
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd_, TCSANOW, &tio) != 0) {
+        error_ = std::string("cannot configure: ") + strerror(errno);
+        return false;
+    }
+
+    baud_ = baud;
+    flush_input();
+    return true;
+}
+
+bool SerialPort::supports(unsigned baud) {
+    return find_speed(baud) != 0;
+}
+
+void SerialPort::close() {
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool SerialPort::write(const uint8_t* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(fd_, data, len);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                error_ = std::string("write failed: ") + strerror(errno);
+                return false;
+            }
+            struct pollfd pfd = { fd_, POLLOUT, 0 };
+            poll(&pfd, 1, 100);
+            continue;
+        }
+        data += n;
+        len -= (size_t)n;
+    }
+
+    return true;
+}
+
+size_t SerialPort::read(uint8_t* data, size_t len) {
+    ssize_t n = ::read(fd_, data, len);
+    return n > 0 ? (size_t)n : 0;
+}
+
+void SerialPort::flush_input() {
+    if (fd_ >= 0) {
+        tcflush(fd_, TCIFLUSH);
+    }
+}
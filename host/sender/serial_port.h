@@ -0,0 +1,71 @@
+/**
+ * @file   serial_port.h
+ * @brief  Raw POSIX serial port (or pty) for the update sender.
+ */
+#ifndef _SERIAL_PORT_H
+#define _SERIAL_PORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class SerialPort {
+public:
+    SerialPort() = default;
+    SerialPort(const SerialPort&) = delete;
+    SerialPort& operator=(const SerialPort&) = delete;
+    ~SerialPort();
+
+    /**
+     * @brief  Opens the port in raw 8N1 mode.
+     * @param  path: [in] Device path, a tty or the slave side of a pty.
+     * @param  baud: [in] Line rate, ignored by ptys.
+     * @param  rtscts: [in] RTS/CTS flow control, the driver stops sending while CTS is deasserted.
+     * @return true on success, error() says why otherwise.
+     */
+    bool open(const std::string& path, unsigned baud, bool rtscts = false);
+
+    void close();
+
+    /**
+     * @brief  Changes the line rate once queued output has gone out.
+     * @param  baud: [in] New rate.
+     * @return true on success, input received at the old rate is dropped.
+     */
+    bool set_baud(unsigned baud);
+
+    // true if open() and set_baud() take this rate
+    static bool supports(unsigned baud);
+
+    /**
+     * @brief  Writes all bytes, waiting for room in the output queue.
+     * @param  data: [in] Bytes to send.
+     * @param  len: [in] Number of bytes.
+     * @return true once every byte is queued.
+     */
+    bool write(const uint8_t* data, size_t len);
+
+    /**
+     * @brief  Reads what has arrived, without waiting.
+     * @param  data: [out] Buffer for the bytes.
+     * @param  len: [in] Buffer size.
+     * @return Number of bytes read, 0 if there were none or on error.
+     */
+    size_t read(uint8_t* data, size_t len);
+
+    // Drops input the driver holds
+    void flush_input();
+
+    int fd() const { return fd_; }
+    unsigned baud() const { return baud_; }
+    const std::string& path() const { return path_; }
+    const std::string& error() const { return error_; }
+
+private:
+    int fd_ = -1;
+    unsigned baud_ = 0;
+    std::string path_;
+    std::string error_;
+};
+
+#endif /* _SERIAL_PORT_H */
@@ -0,0 +1,155 @@
+/**
+ * @file   xmodem_send.cpp
+ * @brief  Sends a firmware image to one or more devices over serial ports.
+ *
+ * Usage: xmodem_send [-b baud] [-m max_baud] [-t target] [-w window] [-r] [-n] [-B] image port [port...]
+ *   -b  line rate the port is opened at (default: 115200)
+ *   -m  fastest rate to switch to once the updater answers, the fastest one that
+ *       passes an ECHO probe is used (default: stay at -b)
+ *   -t  loader, app, patch or direct (default: from the image header, app for an
+ *       encrypted container)
+ *   -w  packets sent ahead of their ACK (default: 2, 1 = stop-and-wait)
+ *   -r  RTS/CTS flow control, for firmware built with UPDATE_RTS_CTS
+ *   -n  no command session, start the receiver from the Updater menu by hand
+ *   -B  boot the application once the update is verified
+ *
+ * The image is sent as-is, plain or as an encrypt_firmware.py container. All ports are
+ * driven from one poll() loop, so a gang of devices is programmed in the time of the
+ * slowest one. With a session the Loader is asked to boot the Updater, the update is
+ * started by command and its result and the image CRC are checked before the port
+ * counts as done.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "mapped_file.h"
+#include "sender.h"
+
+static bool parse_target(const char* name, uint8_t& target) {
+    static const struct { const char* name; uint8_t target; } targets[] = {
+        { "loader", COMMAND_TARGET_LOADER },
+        { "app", COMMAND_TARGET_APP },
+        { "patch", COMMAND_TARGET_APP_PATCH },
+        { "direct", COMMAND_TARGET_APP_DIRECT },
+    };
+
+    for (const auto& t : targets) {
+        if (strcmp(name, t.name) == 0) {
+            target = t.target;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-b baud] [-m max_baud] [-t loader|app|patch|direct] [-w window] [-r] [-n] [-B] image port [port...]\n",
+            name);
+}
+
+int main(int argc, char** argv) {
+    SendOptions options;
+    unsigned baud = 115200;
+    bool rtscts = false;
+    bool target_given = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:m:t:w:rnB")) != -1) {
+        switch (opt) {
+            case 'b': baud = (unsigned)strtoul(optarg, nullptr, 0); break;
+            case 'm': options.max_baud = (unsigned)strtoul(optarg, nullptr, 0); break;
+            case 't':
+                if (!parse_target(optarg, options.target)) {
+                    usage(argv[0]);
+                    return 2;
+                }
+                target_given = true;
+                break;
+            case 'w': options.window = (unsigned)strtoul(optarg, nullptr, 0); break;
+            case 'r': rtscts = true; break;
+            case 'n': options.session = false; break;
+            case 'B': options.boot = true; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    if (argc - optind < 2 || options.window == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    MappedFile image;
+    if (!image.open(argv[optind])) {
+        fprintf(stderr, "%s: %s\n", argv[optind], image.error().c_str());
+        return 1;
+    }
+
+    ImageInfo info = image_detect(image.data(), image.size());
+    switch (info.format) {
+        case ImageFormat::Plain:
+            printf("%s: plain image, type %u, version %u.%u.%u%s\n", argv[optind], info.image_type,
+                   info.version[0], info.version[1], info.version[2], info.is_patch ? ", patch" : "");
+            break;
+        case ImageFormat::Encrypted:
+            printf("%s: encrypted container, %u bytes of image\n", argv[optind], info.payload_size);
+            break;
+        default:
+            fprintf(stderr, "%s: neither an image nor an encrypted container\n", argv[optind]);
+            return 1;
+    }
+
+    if (!target_given) {
+        options.target = image_default_target(info);
+        if (options.target == COMMAND_TARGET_NONE) {
+            fprintf(stderr, "%s: the Updater does not take this image\n", argv[optind]);
+            return 1;
+        }
+    }
+
+    std::vector<std::string> paths(argv + optind + 1, argv + argc);
+    std::vector<std::unique_ptr<SerialPort>> ports;
+    std::vector<std::unique_ptr<Sender>> senders;
+    std::vector<Sender*> running;
+    std::vector<unsigned> steps(paths.size(), 0);
+    std::vector<std::string> errors(paths.size());
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        ports.emplace_back(new SerialPort());
+        // Progress is printed every 10 %
+        senders.emplace_back(new Sender(*ports[i], [&, i](size_t done, size_t total) {
+            unsigned step = (unsigned)(done * 10 / total);
+            if (step != steps[i]) {
+                steps[i] = step;
+                printf("%s: %3u%% (%zu/%zu packets)\n", paths[i].c_str(), step * 10, done, total);
+                fflush(stdout);
+            }
+        }));
+        if (!ports[i]->open(paths[i], baud, rtscts)) {
+            errors[i] = ports[i]->error();
+            continue;
+        }
+        senders[i]->start(image.data(), image.size(), options, send_now_ms());
+        running.push_back(senders[i].get());
+    }
+
+    send_loop(running, [](size_t) { return false; }, nullptr);
+
+    int failed = 0;
+    for (size_t i = 0; i < paths.size(); i++) {
+        const SendResult& r = senders[i]->result();
+        if (r.ok) {
+            printf("%s: done, %zu packets in %.2f s (%.1f kB/s) at %u baud, %zu resent, %.2f s total\n",
+                   paths[i].c_str(), r.packets, r.transfer_ms / 1000.0,
+                   r.transfer_ms ? (double)image.size() / r.transfer_ms : 0.0, r.baud, r.retransmits, r.total_ms / 1000.0);
+        } else {
+            printf("%s: FAILED, %s\n", paths[i].c_str(), errors[i].empty() ? r.error.c_str() : errors[i].c_str());
+            failed++;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
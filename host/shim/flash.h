@@ -0,0 +1,10 @@
+#ifndef _FLASH_H
+#define _FLASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Host stand-in for common/inc/flash.h, only what simple_fileio needs
+int flash_write(uint32_t addr, const uint8_t* data, size_t len);
+
+#endif /* _FLASH_H */
@@ -0,0 +1,459 @@
+/**
+ * @file   updater_sim.c
+ * @brief  Runs the updater (updater/src/main.c, unchanged) as a Linux process.
+ *
+ * USART2 is bridged to a pseudo-terminal, so any XMODEM sender (sx from lrzsz,
+ * ExtraPuTTY via socat, the repo scripts) can be pointed at the slave device. The
+ * 1 MB flash is a file mapped at 0x08000000 with the device layout and NOR rules,
+ * and survives between runs like a powered-off board.
+ *
+ * The line is paced at the simulated baud rate in both directions (10 bits per
+ * byte) and the HAL tick follows wall-clock time, so sender timeouts and update
+ * times are as on the device. Flash and crypto run at host speed. A 1 ms SIGALRM
+ * timer stands in for the USART interrupt, so loops that wait for a key without
+ * touching the HAL still see one.
+ *
+ * Usage: updater_sim [-f flash.bin] [-b baud] [-l link] [-w file@addr]... [-c bytes] [-e]
+ *   -f  flash backing file (default updater_sim_flash.bin), created erased
+ *   -b  simulated baud rate the updater starts at, it follows the rate set by
+ *       SET_BAUD; 0 delivers bytes as fast as the updater reads them
+ *   -l  symlink to create for the pty slave, e.g. /tmp/ttySIM
+ *   -w  program a raw file into flash at addr before starting, may repeat
+ *   -c  cut power after this many received bytes (exit code 3, flash kept)
+ *   -e  erase the whole flash before loading
+ */
+#define _GNU_SOURCE
+// Before termios.h, which defines CR1..CR3 as output delay flags
+#include "stm32f4xx_hal.h"
+#include "stm32f4xx_ll_usart.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIM_DEFAULT_FLASH   "updater_sim_flash.bin"
+#define SIM_DEFAULT_BAUD    115200U
+#define SIM_BITS_PER_BYTE   10U
+#define SIM_QUEUE_SIZE      4096U
+#define SIM_IDLE_WAIT_MS    1
+#define SIM_IDLE_POLLS      4096U
+#define SIM_IRQ_PERIOD_US   1000
+#define SIM_EXIT_POWER_CUT  3
+
+typedef struct {
+    uint8_t data[SIM_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t count;
+} SimQueue_t;
+
+typedef struct {
+    int master;
+    int slave;                  // Held open so the master never sees a hang-up
+    const char* link;
+    uint32_t baud;
+    uint32_t baud_brr;          // USART2 divider the updater set up for baud
+    uint64_t start_us;
+    uint32_t tick_ms;           // Wall-clock ms already given to the HAL tick
+    uint64_t rx_line_free_us;   // When the receiver finishes the byte on the wire
+    uint64_t tx_line_free_us;
+    SimQueue_t rx;              // From the pty, waiting for the line
+    SimQueue_t tx;              // From USART2, waiting for the line
+    uint64_t rx_bytes;
+    uint64_t tx_bytes;
+    uint64_t stalls;            // Times a due byte found the data register still full
+    uint32_t idle_polls;        // HAL_GetTick() calls since a byte last moved
+    uint64_t cut_after;         // 0 = never
+    uint64_t first_rx_us;
+    uint64_t last_rx_us;
+} Sim_t;
+
+static Sim_t sim;
+static volatile sig_atomic_t sim_stop;
+
+// updater/src/main.c, compiled with main renamed
+extern int updater_main(void);
+
+/**
+ * @brief  Returns wall-clock time since start in microseconds.
+ */
+static uint64_t sim_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000U + (uint64_t)ts.tv_nsec / 1000U - sim.start_us;
+}
+
+/**
+ * @brief  Returns the time one byte occupies the line in microseconds, 0 if unpaced.
+ */
+static uint64_t sim_byte_us(void) {
+    uint32_t brr = USART2->BRR;
+    uint64_t baud = sim.baud;
+
+    // At 8x oversampling BRR holds the divider in 1/8ths, fraction in the low three bits
+    if (LL_USART_GetOverSampling(USART2) == LL_USART_OVERSAMPLING_8) {
+        brr = ((brr >> 4) << 3) | (brr & 0x7U);
+    }
+
+    // The first divider stands for -b, a later one scales it
+    if (sim.baud_brr == 0) {
+        sim.baud_brr = brr;
+    }
+    if (brr != 0 && brr != sim.baud_brr) {
+        baud = baud * sim.baud_brr / brr;
+    }
+
+    return baud ? (SIM_BITS_PER_BYTE * 1000000ULL + baud - 1) / baud : 0;
+}
+
+static int queue_put(SimQueue_t* q, uint8_t byte) {
+    if (q->count >= SIM_QUEUE_SIZE) {
+        return 0;
+    }
+    q->data[(q->head + q->count) % SIM_QUEUE_SIZE] = byte;
+    q->count++;
+    return 1;
+}
+
+static uint8_t queue_get(SimQueue_t* q) {
+    uint8_t byte = q->data[q->head];
+    q->head = (q->head + 1) % SIM_QUEUE_SIZE;
+    q->count--;
+    return byte;
+}
+
+/**
+ * @brief  Writes what is left in the TX queue and prints a transfer summary.
+ */
+static void sim_finish(const char* reason) {
+    while (sim.tx.count > 0) {
+        uint8_t byte = queue_get(&sim.tx);
+        if (write(sim.master, &byte, 1) < 0 && errno != EAGAIN) {
+            break;
+        }
+    }
+
+    double rx_s = (sim.last_rx_us - sim.first_rx_us) / 1e6;
+    fprintf(stderr, "\nupdater_sim: %s\n", reason);
+    fprintf(stderr, "updater_sim: rx %llu bytes, tx %llu bytes, %llu rx stalls\n",
+            (unsigned long long)sim.rx_bytes, (unsigned long long)sim.tx_bytes,
+            (unsigned long long)sim.stalls);
+    if (sim.rx_bytes > 1 && rx_s > 0) {
+        fprintf(stderr, "updater_sim: first to last received byte %.3f s, %.0f bytes/s\n",
+                rx_s, sim.rx_bytes / rx_s);
+    }
+
+    const HostNorStats_t* nor = host_nor_stats();
+    fprintf(stderr, "updater_sim: flash %u programs (%u bytes), %u sector erases, %u violations\n",
+            nor->programs, nor->program_bytes, nor->erases, nor->violations);
+
+    if (sim.link != NULL) {
+        unlink(sim.link);
+    }
+}
+
+/**
+ * @brief  Moves bytes between the pty and USART2 at line rate.
+ * @param  may_sleep: [in] Wait up to SIM_IDLE_WAIT_MS for the pty when nothing is due.
+ * @return Number of bytes moved in either direction.
+ * @note   Runs from the updater's HAL_GetTick()/HAL_Delay() calls, where it may sleep
+ *         so an idle updater does not spin a core, and from the SIGALRM timer.
+ *
+ *         Bytes are handed over in batches, every poll or timer tick, so a byte
+ *         that finds the data register still full waits for the firmware instead
+ *         of overrunning it. On the device it would have arrived a few bit times
+ *         later. Such waits are counted as stalls.
+ */
+static uint32_t sim_service(int may_sleep) {
+    uint32_t moved = 0;
+
+    uint64_t now = sim_now_us();
+    uint64_t byte_us = sim_byte_us();
+
+    if (sim_stop) {
+        sim_finish("stopped");
+        _exit(0);
+    }
+
+    // Tick follows wall-clock time
+    uint32_t now_ms = (uint32_t)(now / 1000U);
+    if (now_ms != sim.tick_ms) {
+        host_tick_advance(now_ms - sim.tick_ms);
+        sim.tick_ms = now_ms;
+    }
+
+    // Pull from the pty while there is room, the rest waits in the kernel
+    while (sim.rx.count < SIM_QUEUE_SIZE) {
+        uint8_t buffer[256];
+        size_t room = SIM_QUEUE_SIZE - sim.rx.count;
+        ssize_t n = read(sim.master, buffer, room < sizeof(buffer) ? room : sizeof(buffer));
+        if (n <= 0) {
+            break;
+        }
+        if (sim.rx.count == 0 && sim.rx_line_free_us < now) {
+            sim.rx_line_free_us = now;  // Line was idle, the first byte starts now
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            queue_put(&sim.rx, buffer[i]);
+        }
+    }
+
+    // Receive: a byte lands in the data register once its stop bit is on the wire
+    while (sim.rx.count > 0) {
+        if (byte_us != 0 && sim.rx_line_free_us + byte_us > now) {
+            break;
+        }
+        if (!host_usart_rx_ready()) {
+            sim.stalls++;
+            break;
+        }
+        if (byte_us != 0) {
+            sim.rx_line_free_us += byte_us;
+        }
+
+        host_usart_rx_push(queue_get(&sim.rx));
+        moved++;
+        if (sim.rx_bytes++ == 0) {
+            sim.first_rx_us = now;
+        }
+        sim.last_rx_us = now;
+
+        if (sim.cut_after != 0 && sim.rx_bytes >= sim.cut_after) {
+            sim_finish("power cut");
+            _exit(SIM_EXIT_POWER_CUT);
+        }
+    }
+
+    // Transmit at line rate
+    while (sim.tx.count > 0) {
+        if (byte_us != 0) {
+            if (sim.tx_line_free_us + byte_us > now) {
+                break;
+            }
+            sim.tx_line_free_us += byte_us;
+        }
+
+        uint8_t byte = sim.tx.data[sim.tx.head];
+        if (write(sim.master, &byte, 1) != 1) {
+            break;
+        }
+        queue_get(&sim.tx);
+        moved++;
+    }
+
+    if (may_sleep && sim.rx.count == 0 && sim.tx.count == 0) {
+        struct pollfd pfd = { .fd = sim.master, .events = POLLIN };
+        poll(&pfd, 1, SIM_IDLE_WAIT_MS);
+    }
+
+    return moved;
+}
+
+/**
+ * @brief  Poll hook, sleeps only once the updater has polled SIM_IDLE_POLLS times
+ *         without traffic, so bytes already in its ring buffer are drained at full speed.
+ */
+static void sim_poll(void* ctx) {
+    if (sim_service(sim.idle_polls >= SIM_IDLE_POLLS) != 0) {
+        sim.idle_polls = 0;
+    } else if (sim.idle_polls < SIM_IDLE_POLLS) {
+        sim.idle_polls++;
+    }
+}
+
+static void sim_alarm(int sig) {
+    int saved_errno = errno;
+    sim_service(0);
+    errno = saved_errno;
+}
+
+/**
+ * @brief  Queues a byte written to USART2 for the line.
+ * @note   The USART model empties the data register at once, so the queue is what
+ *         keeps TX at line rate. When it is full the byte goes out immediately.
+ */
+static void sim_tx(uint8_t byte, void* ctx) {
+    sim.tx_bytes++;
+
+    if (sim.tx.count == 0) {
+        uint64_t now = sim_now_us();
+        if (sim.tx_line_free_us < now) {
+            sim.tx_line_free_us = now;
+        }
+    }
+
+    if (!queue_put(&sim.tx, byte)) {
+        if (write(sim.master, &byte, 1) < 0) {
+            return;
+        }
+    }
+}
+
+/**
+ * @brief  Ends the simulation where the updater jumps to another image.
+ */
+static void sim_jump(uint32_t vector_table, uint32_t sp, void* ctx) {
+    char reason[64];
+    snprintf(reason, sizeof(reason), "jump to image at 0x%08lX", (unsigned long)vector_table);
+    sim_finish(reason);
+    exit(0);
+}
+
+/**
+ * @brief  Creates the pty and puts its slave side in raw mode.
+ * @return 1 on success, 0 on failure.
+ */
+static int sim_open_pty(void) {
+    sim.master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (sim.master < 0 || grantpt(sim.master) != 0 || unlockpt(sim.master) != 0) {
+        perror("posix_openpt");
+        return 0;
+    }
+
+    const char* name = ptsname(sim.master);
+    sim.slave = open(name, O_RDWR | O_NOCTTY);
+    if (sim.slave < 0) {
+        perror(name);
+        return 0;
+    }
+
+    struct termios tio;
+    tcgetattr(sim.slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(sim.slave, TCSANOW, &tio);
+
+    fcntl(sim.master, F_SETFL, fcntl(sim.master, F_GETFL) | O_NONBLOCK);
+
+    if (sim.link != NULL) {
+        unlink(sim.link);
+        if (symlink(name, sim.link) != 0) {
+            perror(sim.link);
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "updater_sim: USART2 on %s%s%s, %u baud\n", name,
+            sim.link ? " -> " : "", sim.link ? sim.link : "", sim.baud);
+    return 1;
+}
+
+/**
+ * @brief  Copies a raw file into flash, bypassing the NOR rules (like a programmer).
+ * @param  spec: [in] "file@addr".
+ * @return 1 on success, 0 on failure.
+ */
+static int sim_load(const char* spec) {
+    const char* at = strrchr(spec, '@');
+    if (at == NULL) {
+        fprintf(stderr, "Expected file@addr, got %s\n", spec);
+        return 0;
+    }
+
+    char path[512];
+    snprintf(path, sizeof(path), "%.*s", (int)(at - spec), spec);
+    uint32_t addr = (uint32_t)strtoul(at + 1, NULL, 0);
+
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return 0;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long length = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    if (addr < FLASH_BASE || length < 0 || addr - FLASH_BASE + (uint32_t)length > HOST_FLASH_SIZE) {
+        fprintf(stderr, "%s does not fit in flash at 0x%08lX\n", path, (unsigned long)addr);
+        fclose(f);
+        return 0;
+    }
+
+    size_t n = fread(host_nor_raw() + (addr - FLASH_BASE), 1, (size_t)length, f);
+    fclose(f);
+
+    fprintf(stderr, "updater_sim: loaded %s (%ld bytes) at 0x%08lX\n", path, length, (unsigned long)addr);
+    return n == (size_t)length;
+}
+
+static void sim_signal(int sig) {
+    sim_stop = 1;
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [-f flash.bin] [-b baud] [-l link] [-w file@addr]... [-c bytes] [-e]\n", name);
+}
+
+int main(int argc, char** argv) {
+    const char* flash_path = SIM_DEFAULT_FLASH;
+    const char* loads[16];
+    int load_count = 0;
+    int erase = 0;
+    int opt;
+
+    sim.baud = SIM_DEFAULT_BAUD;
+
+    while ((opt = getopt(argc, argv, "f:b:l:w:c:e")) != -1) {
+        switch (opt) {
+            case 'f': flash_path = optarg; break;
+            case 'b': sim.baud = (uint32_t)strtoul(optarg, NULL, 0); break;
+            case 'l': sim.link = optarg; break;
+            case 'w':
+                if (load_count < (int)(sizeof(loads) / sizeof(loads[0]))) {
+                    loads[load_count++] = optarg;
+                }
+                break;
+            case 'c': sim.cut_after = strtoull(optarg, NULL, 0); break;
+            case 'e': erase = 1; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+
+    host_system_reset();
+    if (!host_nor_init(flash_path)) {
+        return 1;
+    }
+    if (erase) {
+        host_nor_erase_all();
+    }
+    for (int i = 0; i < load_count; i++) {
+        if (!sim_load(loads[i])) {
+            return 1;
+        }
+    }
+
+    if (!sim_open_pty()) {
+        return 1;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    sim.start_us = (uint64_t)ts.tv_sec * 1000000U + (uint64_t)ts.tv_nsec / 1000U;
+
+    signal(SIGINT, sim_signal);
+    signal(SIGTERM, sim_signal);
+
+    host_usart_set_tx_sink(sim_tx, NULL);
+    host_set_poll_hook(sim_poll, NULL);
+    host_set_jump_hook(sim_jump, NULL);
+    host_irq_set_async(1);
+
+    struct sigaction sa = { .sa_handler = sim_alarm, .sa_flags = SA_RESTART };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGALRM, &sa, NULL);
+
+    struct itimerval timer = {
+        .it_interval = { .tv_sec = 0, .tv_usec = SIM_IRQ_PERIOD_US },
+        .it_value = { .tv_sec = 0, .tv_usec = SIM_IRQ_PERIOD_US }
+    };
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+    return updater_main();
+}
@@ -0,0 +1,498 @@
+/**
+ * @file   patch_paths_test.c
+ * @brief  Checks that a streamed and a staged delta patch leave the same slots behind.
+ *
+ * The same patch is applied twice on the host NOR model, from the same installed
+ * application:
+ *   staged    the patch image is placed in the staging area and applied with
+ *             handle_firmware_patch(), as the updater does after an XMODEM transfer
+ *   streamed  the encrypted patch is sent over USART2 by a modelled XMODEM-CRC
+ *             sender and applied on the fly by handle_firmware_patch_stream()
+ * The application slots (both of them with AB_SLOTS) are then compared byte for
+ * byte, and the patched data against the image the patch was built for.
+ *
+ * Patches are built here from a random edit script with every jdiff operator,
+ * escaped ESC bytes in the data and copies crossing flash sectors, so the test
+ * needs no input files.
+ *
+ * Usage: patch_paths_test [-r seed]
+ * The exit status is 1 if any case failed.
+ */
+#include "main.h"
+#include "transport.h"
+#include "uart_transport.h"
+#include "xmodem.h"
+#include "delta_update.h"
+#include "image.h"
+#include "crc.h"
+#include "host_hal.h"
+#include "host_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_CORE_CLOCK     90000000U   // Updater SYSCLK
+#define TEST_POLL_LIMIT     50000000U   // Tick reads before a hung transfer is given up
+#define TEST_MAX_GROWTH     13U         // New image at most 1.3 times the old one (x10)
+
+// jdiff operators, see janpatch.h
+#define JDIFF_ESC           0xA7
+#define JDIFF_MOD           0xA6
+#define JDIFF_INS           0xA5
+#define JDIFF_DEL           0xA4
+#define JDIFF_EQL           0xA3
+#define JDIFF_BKT           0xA2
+
+#ifdef AB_SLOTS
+    #define TEST_TARGET_ADDR    APP_B_ADDR
+    #define TEST_BACKUP_ADDR    (APP_B_ADDR + APP_SLOT_SIZE)
+    #define TEST_SLOTS_SIZE     (2U * APP_SLOT_SIZE)
+#else
+    #define TEST_TARGET_ADDR    APP_ADDR
+    #define TEST_BACKUP_ADDR    BACKUP_ADDR
+    #define TEST_SLOTS_SIZE     APP_SLOT_SIZE
+#endif
+
+typedef struct {
+    size_t old_size;                // Old image data, without header
+    int esc_heavy;                  // Data full of ESC and operator bytes
+} TestCase_t;
+
+static const TestCase_t TEST_CASES[] = {
+    { 40000, 0 },
+    { 60000, 1 },
+    { 150000, 0 },                  // Slot data crosses the first 128 KB sector
+};
+
+typedef enum {
+    SENDER_WAIT_C = 0,
+    SENDER_WAIT_ACK,
+    SENDER_WAIT_EOT_ACK,
+    SENDER_DONE,
+    SENDER_FAILED
+} SenderState_t;
+
+// XMODEM-CRC sender, one byte per tick read once the USART has taken the last one
+typedef struct {
+    const uint8_t* file;
+    size_t size;
+    SenderState_t state;
+    uint32_t block;                 // 1-based block being sent
+    uint32_t blocks;
+    uint8_t out[XMODEM_UNPACK_SIZE + 5];
+    size_t out_len;
+    size_t out_pos;
+    uint32_t polls;
+} TestSender_t;
+
+typedef struct {
+    uint8_t* data;
+    size_t len;
+} TestBuffer_t;
+
+static TestSender_t sender;
+static Transport_t uart_transport;
+static UARTTransport_Config_t uart_config;
+static XmodemManager_t xmodem_manager;
+static uint64_t rng;
+
+/**
+ * @brief  xorshift64*, deterministic for a given seed.
+ */
+static uint32_t test_random(void) {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+
+    return (uint32_t)((rng * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+/**
+ * @brief  Random value in [min, max].
+ */
+static size_t test_range(size_t min, size_t max) {
+    return min + test_random() % (max - min + 1);
+}
+
+/**
+ * @brief  Random data byte, with esc_heavy mostly ESC and operator codes.
+ */
+static uint8_t test_byte(int esc_heavy) {
+    if (esc_heavy && test_random() % 2 == 0) {
+        return (uint8_t)test_range(JDIFF_BKT, JDIFF_ESC);
+    }
+
+    return (uint8_t)test_random();
+}
+
+/* Patch builder -------------------------------------------------------------*/
+
+/**
+ * @brief  Writes an operator.
+ */
+static void patch_op(TestBuffer_t* patch, uint8_t op) {
+    patch->data[patch->len++] = JDIFF_ESC;
+    patch->data[patch->len++] = op;
+}
+
+/**
+ * @brief  Writes a length in the encoding janpatch find_length() reads.
+ */
+static void patch_length(TestBuffer_t* patch, size_t len) {
+    if (len <= 252) {
+        patch->data[patch->len++] = (uint8_t)(len - 1);
+    } else if (len <= 252 + 256) {
+        patch->data[patch->len++] = 252;
+        patch->data[patch->len++] = (uint8_t)(len - 253);
+    } else {
+        patch->data[patch->len++] = 253;
+        patch->data[patch->len++] = (uint8_t)(len >> 8);
+        patch->data[patch->len++] = (uint8_t)len;
+    }
+}
+
+/**
+ * @brief  Writes MOD or INS data with ESC escaped, and appends it to the new image.
+ */
+static void patch_data(TestBuffer_t* patch, TestBuffer_t* image, uint8_t op, size_t len, int esc_heavy) {
+    patch_op(patch, op);
+
+    for (size_t i = 0; i < len; i++) {
+        uint8_t byte = test_byte(esc_heavy);
+        if (byte == JDIFF_ESC) {
+            patch->data[patch->len++] = JDIFF_ESC;
+        }
+        patch->data[patch->len++] = byte;
+        image->data[image->len++] = byte;
+    }
+}
+
+/**
+ * @brief  Builds a random edit of old_data as a jdiff patch and the image it produces.
+ * @note   Runs are short next to the image, so every operator shows up many times
+ *         and copies often start in one flash sector and end in the next.
+ */
+static void build_patch(const uint8_t* old_data, size_t old_size, int esc_heavy,
+                        TestBuffer_t* patch, TestBuffer_t* image) {
+    size_t limit = old_size * TEST_MAX_GROWTH / 10U;
+    size_t src = 0;
+
+    while (src < old_size && image->len + 4096U < limit) {
+        uint32_t pick = test_random() % 100U;
+
+        if (pick < 55U) {
+            size_t len = test_range(1, 4000);
+            if (len > old_size - src) {
+                len = old_size - src;
+            }
+            patch_op(patch, JDIFF_EQL);
+            patch_length(patch, len);
+            memcpy(image->data + image->len, old_data + src, len);
+            image->len += len;
+            src += len;
+        } else if (pick < 70U) {
+            size_t len = test_range(1, 300);
+            if (len > old_size - src) {
+                len = old_size - src;
+            }
+            patch_data(patch, image, JDIFF_MOD, len, esc_heavy);
+            src += len;
+        } else if (pick < 82U) {
+            patch_data(patch, image, JDIFF_INS, test_range(1, 300), esc_heavy);
+        } else if (pick < 92U) {
+            size_t len = test_range(1, 600);
+            if (len > old_size - src) {
+                len = old_size - src;
+            }
+            patch_op(patch, JDIFF_DEL);
+            patch_length(patch, len);
+            src += len;
+        } else if (src > 0) {
+            size_t len = test_range(1, src < 3000U ? src : 3000U);
+            patch_op(patch, JDIFF_BKT);
+            patch_length(patch, len);
+            src -= len;
+        }
+    }
+}
+
+/* Sender --------------------------------------------------------------------*/
+
+/**
+ * @brief  Queues the current block, or EOT once all blocks are acknowledged.
+ */
+static void sender_queue(void) {
+    sender.out_pos = 0;
+
+    if (sender.state == SENDER_WAIT_EOT_ACK) {
+        sender.out[0] = XMODEM_EOT;
+        sender.out_len = 1;
+        return;
+    }
+
+    size_t offset = (size_t)(sender.block - 1) * XMODEM_UNPACK_SIZE;
+    size_t len = sender.size - offset < XMODEM_UNPACK_SIZE ? sender.size - offset : XMODEM_UNPACK_SIZE;
+    uint8_t* data = sender.out + 3;
+
+    memcpy(data, sender.file + offset, len);
+    memset(data + len, 0x1A, XMODEM_UNPACK_SIZE - len);    // CPMEOF padding, as sx does
+
+    uint16_t crc = host_image_crc16(data, XMODEM_UNPACK_SIZE);
+    sender.out[0] = XMODEM_SOH;
+    sender.out[1] = (uint8_t)sender.block;
+    sender.out[2] = (uint8_t)(0xFF - (uint8_t)sender.block);
+    data[XMODEM_UNPACK_SIZE] = (uint8_t)(crc >> 8);
+    data[XMODEM_UNPACK_SIZE + 1] = (uint8_t)crc;
+    sender.out_len = XMODEM_UNPACK_SIZE + 5;
+}
+
+/**
+ * @brief  USART2 transmit sink, reacts to C, ACK, NAK and CAN from the updater.
+ * @note   Progress text is ignored. None is sent between the first C and the
+ *         last ACK, and the staged run has no transfer to answer.
+ */
+static void sender_receive(uint8_t byte, void* ctx) {
+    if (sender.file == NULL) {
+        return;
+    }
+
+    switch (sender.state) {
+        case SENDER_WAIT_C:
+            if (byte == XMODEM_C) {
+                sender.state = SENDER_WAIT_ACK;
+                sender.block = 1;
+                sender_queue();
+            }
+            break;
+
+        case SENDER_WAIT_ACK:
+            if (byte == XMODEM_ACK) {
+                if (sender.block == sender.blocks) {
+                    sender.state = SENDER_WAIT_EOT_ACK;
+                } else {
+                    sender.block++;
+                }
+                sender_queue();
+            } else if (byte == XMODEM_NAK) {
+                sender_queue();
+            } else if (byte == XMODEM_CAN) {
+                sender.state = SENDER_FAILED;
+            }
+            break;
+
+        case SENDER_WAIT_EOT_ACK:
+            if (byte == XMODEM_ACK) {
+                sender.state = SENDER_DONE;
+            } else if (byte == XMODEM_NAK) {
+                sender_queue();
+            } else if (byte == XMODEM_CAN) {
+                sender.state = SENDER_FAILED;
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**
+ * @brief  Poll hook, runs whenever the firmware reads the tick.
+ * @note   Each read moves time on by 1 ms and hands the USART the next queued byte.
+ */
+static void sender_poll(void* ctx) {
+    if (++sender.polls > TEST_POLL_LIMIT) {
+        fprintf(stderr, "Transfer hung in state %d at block %u\n", sender.state, sender.block);
+        exit(1);
+    }
+
+    if (sender.out_pos < sender.out_len && host_usart_rx_ready()) {
+        host_usart_rx_push(sender.out[sender.out_pos++]);
+    }
+
+    host_tick_advance(1);
+}
+
+/* Runs ----------------------------------------------------------------------*/
+
+/**
+ * @brief  Resets the device with the old image installed and the transport up.
+ */
+static void test_reset(const uint8_t* old_image, size_t old_image_size) {
+    host_system_reset();
+    host_nor_erase_all();
+    memset(host_bkpsram, 0, sizeof(host_bkpsram));
+    memcpy(host_nor_raw() + (APP_ADDR - FLASH_BASE), old_image, old_image_size);
+
+    SystemCoreClock = TEST_CORE_CLOCK;
+    memset(&sender, 0, sizeof(sender));
+
+    uart_config.usart = USART2;
+    uart_config.baudrate = 115200;
+    uart_config.timeout = 1000;
+    uart_config.use_xmodem = 1;
+    uart_config.app_addr = APP_ADDR;
+    uart_config.updater_addr = UPDATER_ADDR;
+    uart_config.loader_addr = LOADER_ADDR;
+    uart_config.image_hdr_size = IMAGE_HDR_SIZE;
+    transport_init(&uart_transport, TRANSPORT_UART, &uart_config);
+
+    XmodemConfig_t xmodem_config = {
+        .app_addr = APP_ADDR,
+        .updater_addr = UPDATER_ADDR,
+        .loader_addr = LOADER_ADDR,
+        .image_hdr_size = IMAGE_HDR_SIZE,
+        .use_encryption = 1
+    };
+    xmodem_init(&xmodem_manager, &xmodem_config);
+}
+
+/**
+ * @brief  Applies the patch from the staging area.
+ * @return Result of handle_firmware_patch().
+ */
+static int run_staged(const uint8_t* old_image, size_t old_image_size, const uint8_t* patch_image,
+                      size_t patch_image_size) {
+    test_reset(old_image, old_image_size);
+    memcpy(host_nor_raw() + (PATCH_ADDR - FLASH_BASE), patch_image, patch_image_size);
+
+    int result = handle_firmware_patch(APP_ADDR, PATCH_ADDR, TEST_TARGET_ADDR, TEST_BACKUP_ADDR, IMAGE_HDR_SIZE);
+    xmodem_cleanup(&xmodem_manager);
+
+    return result;
+}
+
+/**
+ * @brief  Sends the encrypted patch over XMODEM and applies it as it arrives.
+ * @return Result of handle_firmware_patch_stream().
+ */
+static int run_streamed(const uint8_t* old_image, size_t old_image_size, const uint8_t* encrypted,
+                        size_t encrypted_size) {
+    test_reset(old_image, old_image_size);
+    sender.file = encrypted;
+    sender.size = encrypted_size;
+    sender.blocks = (uint32_t)((encrypted_size + XMODEM_UNPACK_SIZE - 1) / XMODEM_UNPACK_SIZE);
+
+    int result = handle_firmware_patch_stream(&xmodem_manager, APP_ADDR, TEST_TARGET_ADDR, TEST_BACKUP_ADDR,
+                                              IMAGE_HDR_SIZE);
+    xmodem_cleanup(&xmodem_manager);
+
+    return result;
+}
+
+/**
+ * @brief  Runs one case both ways and compares the slots.
+ * @return 1 if both paths succeeded and left identical slots holding the new image.
+ */
+static int test_case(int index, const TestCase_t* test) {
+    size_t old_size = test->old_size;
+    size_t new_cap = old_size * TEST_MAX_GROWTH / 10U + 4096U;
+    uint8_t* old_image = malloc(IMAGE_HDR_SIZE + old_size);
+    uint8_t* new_image = malloc(IMAGE_HDR_SIZE + new_cap);
+    uint8_t* patch_image = malloc(IMAGE_HDR_SIZE + 4U * new_cap);
+    uint8_t* staged_slots = malloc(TEST_SLOTS_SIZE);
+    uint8_t* encrypted = NULL;
+    int ok = 0;
+
+    if (old_image == NULL || new_image == NULL || patch_image == NULL || staged_slots == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        goto done;
+    }
+
+    // Old image: runs and noise, roughly like code and constants
+    uint8_t* old_data = old_image + IMAGE_HDR_SIZE;
+    for (size_t i = 0; i < old_size; i++) {
+        old_data[i] = (i % 64U < 16U) ? (uint8_t)(i >> 6) : test_byte(test->esc_heavy);
+    }
+    host_image_header((ImageHeader_t*)old_image, APP_ADDR, IMAGE_MAGIC_APP, IMAGE_TYPE_APP, old_data, (uint32_t)old_size);
+
+    TestBuffer_t patch = { patch_image + IMAGE_HDR_SIZE, 0 };
+    TestBuffer_t image = { new_image + IMAGE_HDR_SIZE, 0 };
+    build_patch(old_data, old_size, test->esc_heavy, &patch, &image);
+
+    // The patch carries the new image's header, marked as a patch
+    host_image_header((ImageHeader_t*)new_image, APP_ADDR, IMAGE_MAGIC_APP, IMAGE_TYPE_APP, image.data, (uint32_t)image.len);
+    ((ImageHeader_t*)new_image)->version_minor = 1;
+    memset(patch_image, 0xFF, IMAGE_HDR_SIZE);
+    memcpy(patch_image, new_image, sizeof(ImageHeader_t));
+    ((ImageHeader_t*)patch_image)->is_patch = IMAGE_PATCH_DELTA;
+
+    size_t patch_image_size = IMAGE_HDR_SIZE + patch.len;
+    uint8_t nonce[12];
+    for (size_t i = 0; i < sizeof(nonce); i++) {
+        nonce[i] = (uint8_t)test_random();
+    }
+    size_t encrypted_size = 0;
+    encrypted = host_image_encrypt(patch_image, patch_image_size, (uint32_t)patch_image_size, nonce, &encrypted_size);
+    if (encrypted == NULL) {
+        fprintf(stderr, "Encryption failed\n");
+        goto done;
+    }
+
+    printf("case %d: old %zu, new %zu, patch %zu bytes: ", index, old_size, image.len, patch.len);
+
+    int staged = run_staged(old_image, IMAGE_HDR_SIZE + old_size, patch_image, patch_image_size);
+    memcpy(staged_slots, host_nor_raw() + (APP_ADDR - FLASH_BASE), TEST_SLOTS_SIZE);
+
+    int streamed = run_streamed(old_image, IMAGE_HDR_SIZE + old_size, encrypted, encrypted_size);
+    const uint8_t* streamed_slots = host_nor_raw() + (APP_ADDR - FLASH_BASE);
+    const uint8_t* target = host_nor_raw() + (TEST_TARGET_ADDR - FLASH_BASE);
+
+    if (staged != 0 || streamed != 0) {
+        printf("FAIL (staged %d, streamed %d)\n", staged, streamed);
+    } else if (memcmp(staged_slots, streamed_slots, TEST_SLOTS_SIZE) != 0) {
+        size_t at = 0;
+        while (staged_slots[at] == streamed_slots[at]) {
+            at++;
+        }
+        printf("FAIL (slots differ at 0x%08zX)\n", (size_t)APP_ADDR + at);
+    } else if (memcmp(target + IMAGE_HDR_SIZE, image.data, image.len) != 0 ||
+               ((const ImageHeader_t*)target)->is_patch != IMAGE_PATCH_NONE) {
+        printf("FAIL (slot does not hold the new image)\n");
+    } else {
+        printf("ok\n");
+        ok = 1;
+    }
+
+done:
+    free(encrypted);
+    free(staged_slots);
+    free(patch_image);
+    free(new_image);
+    free(old_image);
+
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    uint64_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:")) != -1) {
+        switch (opt) {
+            case 'r': seed = strtoull(optarg, NULL, 0); break;
+            default:
+                fprintf(stderr, "Usage: %s [-r seed]\n", argv[0]);
+                return 2;
+        }
+    }
+
+    if (!host_nor_init(NULL)) {
+        return 1;
+    }
+    host_set_poll_hook(sender_poll, NULL);
+    host_usart_set_tx_sink(sender_receive, NULL);
+    crc_init();
+    rng = seed ? seed : 1;
+
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(TEST_CASES) / sizeof(TEST_CASES[0]); i++) {
+        if (!test_case((int)i, &TEST_CASES[i])) {
+            failures++;
+        }
+    }
+
+    host_nor_deinit();
+
+    return failures ? 1 : 0;
+}
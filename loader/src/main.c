@@ -14,6 +14,10 @@
 #include "uart_transport.h"
 #include "crc.h"
 #include "ring_buffer.h"
+#include "patch_journal.h"
+#include "boot_counter.h"
+#include "boot_trace.h"
+#include "command.h"
 
 /* Private define ------------------------------------------------------------*/
 #define BOOT_TIMEOUT_MS         10000
@@ -27,7 +31,7 @@ __attribute__((section(".image_hdr"))) const ImageHeader_t IMAGE_HEADER = {
   .version_major = 1,
   .version_minor = 0,
   .version_patch = 0,
-  ._padding = 0,
+  .flags = 0,
   .vector_addr = 0x08004200,
   .crc = 0,
   .data_size = 0
@@ -36,6 +40,8 @@ __attribute__((section(".image_hdr"))) const ImageHeader_t IMAGE_HEADER = {
 /* Global variables ----------------------------------------------------------*/
 static UARTTransport_Config_t uart_config;
 static Transport_t uart_transport;
+static CommandParser_t command_parser;
+static uint8_t command_session;    // A station said HELLO, no menus and no autoboot
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
@@ -43,6 +49,8 @@ static void MX_GPIO_Init(void);
 static void clear_screen(void);
 static void display_menu(void);
 static void clear_rx_buffer(void);
+static int is_app_present(const BootConfig_t* config);
+static void handle_command(const CommandFrame_t* frame, const BootConfig_t* config, BootOption_t* boot_option);
 
 // Loader banner - kept green
 const char* BOOT_BANNER = "\r\n\
@@ -61,6 +69,9 @@ Press \x1B[93m'U'\x1B[0m\x1B[92m to enter updater\x1B[0m\r\n";
   * @brief Clears the terminal screen using ANSI escape codes
   */
 static void clear_screen(void) {
+    if (command_session) {
+        return;
+    }
     transport_send(&uart_transport, (const uint8_t*)"\x1B[2J\x1B[1;1H", 10);
     HAL_Delay(10);
 }
@@ -70,6 +81,9 @@ static void clear_screen(void) {
   */
 static void display_menu(void) {
     char version_str[20];
+    if (command_session) {
+        return;
+    }
     clear_screen();
     
     // Send banner
@@ -97,6 +111,83 @@ static void clear_rx_buffer(void) {
     }
 }
 
+/**
+  * @brief Checks that an application slot holds an application image
+  * @param config Boot configuration
+  * @return 1 if any slot has a valid application header, 0 otherwise
+  */
+static int is_app_present(const BootConfig_t* config) {
+    if (is_firmware_valid(config->app_addr, config)) {
+        return 1;
+    }
+
+    return config->app_b_addr != 0 && is_firmware_valid(config->app_b_addr, config);
+}
+
+/**
+  * @brief Answer a command frame from a flashing station
+  * @param frame Received frame
+  * @param config Boot configuration
+  * @param boot_option Set when the command boots another image
+  */
+static void handle_command(const CommandFrame_t* frame, const BootConfig_t* config, BootOption_t* boot_option) {
+    uint8_t reply[COMMAND_MAX_FRAME];
+    size_t reply_len = command_answer_common(frame, config, &IMAGE_HEADER, reply);
+
+    if (frame->id == COMMAND_HELLO) {
+        command_session = 1;
+    }
+
+    if (reply_len == 0) {
+        uint8_t status = COMMAND_STATUS_OK;
+
+        switch (frame->id) {
+            case COMMAND_BOOT: {
+                uint8_t target = frame->length == 1 ? frame->payload[0] : COMMAND_TARGET_NONE;
+                if (target == COMMAND_TARGET_APP) {
+                    if (is_app_present(config)) {
+                        *boot_option = BOOT_OPTION_APPLICATION;
+                    } else {
+                        status = COMMAND_STATUS_FAILED;
+                    }
+                } else if (target == COMMAND_TARGET_UPDATER) {
+                    if (is_firmware_valid(UPDATER_ADDR, config)) {
+                        // The updater starts without its menu
+                        command_session_handoff(COMMAND_TARGET_NONE);
+                        *boot_option = BOOT_OPTION_UPDATER;
+                    } else {
+                        status = COMMAND_STATUS_FAILED;
+                    }
+                } else {
+                    status = COMMAND_STATUS_BAD_TARGET;
+                }
+                break;
+            }
+
+            case COMMAND_RESET: {
+                break;
+            }
+
+            default: {
+                // Updates are taken by the updater
+                status = COMMAND_STATUS_UNSUPPORTED;
+                break;
+            }
+        }
+
+        reply_len = command_build_reply(reply, frame->id, status, NULL, 0);
+    }
+
+    transport_send(&uart_transport, reply, reply_len);
+
+    if (frame->id == COMMAND_RESET) {
+        while (!uart_transport_is_tx_complete()) {
+            transport_process(&uart_transport);
+        }
+        NVIC_SystemReset();
+    }
+}
+
 /**
   * @brief Toggle LED
   * @param led_pin LED pin number (0-3)
@@ -133,11 +224,14 @@ static void toggle_led(uint8_t led_pin) {
   * @retval int
   */
 int main(void) {
+    boot_trace_mark(BOOT_TRACE_LOADER_START);
+
     /* Reset of all peripherals, Initializes the Flash interface and the Systick. */
     HAL_Init();
 
     /* Configure the system clock */
     SystemClock_Config();
+    boot_trace_mark(BOOT_TRACE_LOADER_CLOCK);
 
     /* Initialize all configured peripherals */
     MX_GPIO_Init();
@@ -147,17 +241,23 @@ int main(void) {
         .app_addr = APP_ADDR,
         .updater_addr = UPDATER_ADDR,
         .loader_addr = LOADER_ADDR,
-        .image_hdr_size = IMAGE_HDR_SIZE
+        .image_hdr_size = IMAGE_HDR_SIZE,
+#ifdef AB_SLOTS
+        .app_b_addr = APP_B_ADDR
+#endif
     };
     
     // Configure UART transport
-    uart_config.usart = USART2;
+    uart_config.usart = UPDATE_USART;
     uart_config.baudrate = 115200;
     uart_config.timeout = 1000;
     uart_config.app_addr = APP_ADDR;
     uart_config.updater_addr = UPDATER_ADDR;
     uart_config.loader_addr = LOADER_ADDR;
     uart_config.image_hdr_size = IMAGE_HDR_SIZE;
+#ifdef UPDATE_RTS_CTS
+    uart_config.flow_control = 1;
+#endif
     
     // Initialize transport
     transport_init(&uart_transport, TRANSPORT_UART, &uart_config);
@@ -168,17 +268,49 @@ int main(void) {
     // Initial clear for RX buffer
     clear_rx_buffer();
     
+    // A station that booted the previous image keeps its session, without the menu
+    uint8_t handoff_target = COMMAND_TARGET_NONE;
+    command_session = command_session_take(&handoff_target);
+    command_parser_init(&command_parser);
+    
     // Display menu
     display_menu();
-    
-    // Enable USART2 irq
-    NVIC_EnableIRQ(USART2_IRQn);
+    boot_trace_mark(BOOT_TRACE_LOADER_MENU);
     
     // Main variables
     BootOption_t boot_option = BOOT_OPTION_NONE;
     uint32_t led_toggle_time = HAL_GetTick();
     uint32_t autoboot_timer = HAL_GetTick();
     
+    // The application slot is half patched, only the updater can finish it
+    if (patch_journal_is_active() && is_firmware_valid(UPDATER_ADDR, &boot_config)) {
+        transport_send(&uart_transport, (const uint8_t*)"\x1B[36m\r\n Interrupted patch found, booting updater...\x1B[0m\r\n", 57);
+        boot_option = BOOT_OPTION_UPDATER;
+    }
+    
+    // The application was booted too many times without confirming itself
+    uint32_t trial_slot = select_app_slot(&boot_config);
+    if (boot_option == BOOT_OPTION_NONE && trial_slot != 0 &&
+        boot_counter_check(trial_slot, BOOT_COUNTER_MAX_ATTEMPTS) == BOOT_COUNTER_ROLLBACK) {
+#ifdef AB_SLOTS
+        // Drop the failing slot, autoboot falls back to the other one
+        transport_send(&uart_transport, (const uint8_t*)"\x1B[31m\r\n Application failed to confirm, rolling back to the other slot...\x1B[0m\r\n", 78);
+        invalidate_firmware(trial_slot);
+        boot_counter_clear();
+#else
+        // No previous image to fall back to, keep the counter so every reset lands in the updater
+        if (is_firmware_valid(UPDATER_ADDR, &boot_config)) {
+            transport_send(&uart_transport, (const uint8_t*)"\x1B[31m\r\n Application failed to confirm, booting updater...\x1B[0m\r\n", 63);
+            boot_option = BOOT_OPTION_UPDATER;
+        }
+#endif
+    }
+    
+    // The station asked the updater to boot the application
+    if (boot_option == BOOT_OPTION_NONE && handoff_target == COMMAND_TARGET_APP) {
+        boot_option = BOOT_OPTION_APPLICATION;
+    }
+    
     while (1) {
         // Process UART data
         transport_process(&uart_transport);
@@ -196,6 +328,16 @@ int main(void) {
             // Reset autoboot timer on any key press
             autoboot_timer = current_time;
             
+            // Framed commands from a flashing station share the line with the menu keys
+            CommandFrame_t frame;
+            CommandParse_t parsed = command_parse_byte(&command_parser, byte, current_time, &frame);
+            if (parsed == COMMAND_PARSE_FRAME) {
+                handle_command(&frame, &boot_config, &boot_option);
+            }
+            if (parsed != COMMAND_PARSE_IDLE) {
+                byte = 0;
+            }
+            
             switch (byte) {
                 case 'U':
                 case 'u': {
@@ -250,10 +392,20 @@ int main(void) {
                     
                     transport_send(&uart_transport, (const uint8_t*)"\r\n", 2);
                     
-                    // Application info
+                    // Application info, the slot that would be booted
+                    uint32_t app_slot = select_app_slot(&boot_config);
+                    if (app_slot == 0) {
+                        app_slot = APP_ADDR;
+                    }
+#ifdef AB_SLOTS
+                    transport_send(&uart_transport, (const uint8_t*)"\x1B[96mApplication (slot ", 23);
+                    transport_send(&uart_transport, (const uint8_t*)(app_slot == APP_B_ADDR ? "B" : "A"), 1);
+                    transport_send(&uart_transport, (const uint8_t*)"): \x1B[0m", 7);
+#else
                     transport_send(&uart_transport, (const uint8_t*)"\x1B[96mApplication: \x1B[0m", 24);
+#endif
                     
-                    if (get_firmware_header(APP_ADDR, &boot_config, &header)) {
+                    if (get_firmware_header(app_slot, &boot_config, &header)) {
                         char buffer[256];
                         
                         transport_send(&uart_transport, (const uint8_t*)"\x1B[32mValid\x1B[0m\r\n", 16);
@@ -274,7 +426,7 @@ int main(void) {
                         sprintf(buffer, "\x1B[92m  Is Patch: \x1B[93m%s\x1B[0m\r\n", header.is_patch ? "Yes" : "No");
                         transport_send(&uart_transport, (const uint8_t*)buffer, strlen(buffer));
                         
-                        sprintf(buffer, "\x1B[92m  Address: \x1B[93m0x%08lX\x1B[0m\r\n", APP_ADDR);
+                        sprintf(buffer, "\x1B[92m  Address: \x1B[93m0x%08lX\x1B[0m\r\n", app_slot);
                         transport_send(&uart_transport, (const uint8_t*)buffer, strlen(buffer));
                     } else {
                         transport_send(&uart_transport, (const uint8_t*)"\x1B[31mInvalid or Not Found\x1B[0m\r\n", 33);
@@ -324,6 +476,12 @@ int main(void) {
                     sprintf(buffer, "\x1B[92m  System uptime: \x1B[93m%u seconds\x1B[0m\r\n", HAL_GetTick() / 1000);
                     transport_send(&uart_transport, (const uint8_t*)buffer, strlen(buffer));
                     
+                    __HAL_RCC_PWR_CLK_ENABLE();
+                    uint32_t boot_cycles = (&RTC->BKP0R)[BOOT_CYCLES_BKP_REG];
+                    sprintf(buffer, "\x1B[92m  Boot stage hand-off: \x1B[93m%lu cycles (%lu us)\x1B[0m\r\n",
+                            boot_cycles, boot_cycles / BOOT_HSI_MHZ);
+                    transport_send(&uart_transport, (const uint8_t*)buffer, strlen(buffer));
+                    
                     transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[91mPress \x1B[31m'Esc'\x1B[0m \x1B[91mto return to menu...\x1B[0m\r\n", 59);
                     
                     uint8_t key;
@@ -344,7 +502,7 @@ int main(void) {
                     
                 case '\r':
                 case '\n': {
-                    if (is_firmware_valid(APP_ADDR, &boot_config)) {
+                    if (is_app_present(&boot_config)) {
                         transport_send(&uart_transport, (const uint8_t*)"\x1B[92m\r\n Booting application...\x1B[0m\r\n", 36);
                         boot_option = BOOT_OPTION_APPLICATION;
                     } else {
@@ -369,34 +527,68 @@ int main(void) {
         // Handle boot options
         switch (boot_option) {
             case BOOT_OPTION_APPLICATION: {
-                if (is_firmware_valid(APP_ADDR, &boot_config)) {
+                boot_trace_mark(BOOT_TRACE_LOADER_EXIT);
+                if (is_app_present(&boot_config)) {
                     // Wait for UART to finish
                     while (!uart_transport_is_tx_complete()) {
                         transport_process(&uart_transport);
                     }
                     clear_rx_buffer();
                     
-                    // Boot to app
+                    // Count the attempt, the application confirms it once healthy
+                    uint32_t app_slot = select_app_slot(&boot_config);
+                    if (app_slot != 0) {
+                        boot_counter_record_boot(app_slot);
+                    }
+
+                    // Boot to app (returns only if the image fails verification)
                     boot_application(&boot_config);
+
+                    clear_screen();
+                    transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mApplication CRC check failed, image is corrupted\x1B[0m\r\n", 61);
+
+                    // An update cut short leaves a header over a torn image, autoboot would
+                    // retry it forever and drop every key, the updater can take a new one
+                    if (is_firmware_valid(UPDATER_ADDR, &boot_config)) {
+                        if (command_session) {
+                            command_session_handoff(COMMAND_TARGET_NONE);
+                        }
+                        transport_send(&uart_transport, (const uint8_t*)"\x1B[36m\r\n Booting updater...\x1B[0m\r\n", 32);
+                        boot_option = BOOT_OPTION_UPDATER;
+                        break;
+                    }
+                    boot_option = BOOT_OPTION_NONE;
+                    HAL_Delay(1500);
+                    display_menu();
+                    autoboot_timer = HAL_GetTick();
                 } else {
                     clear_screen();
                     transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mApplication validation failed just before boot\x1B[0m\r\n", 62);
                     boot_option = BOOT_OPTION_NONE;
                     HAL_Delay(1500);
                     display_menu();
+                    autoboot_timer = HAL_GetTick();
                 }
                 break;
             }
                 
             case BOOT_OPTION_UPDATER: {
+                boot_trace_mark(BOOT_TRACE_LOADER_EXIT);
+
                 // Wait for UART to finish
                 while (!uart_transport_is_tx_complete()) {
                     transport_process(&uart_transport);
                 }
                 clear_rx_buffer();
                 
-                // Boot to updater
+                // Boot to updater (returns only if the image fails verification)
                 boot_updater(&boot_config);
+
+                clear_screen();
+                transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mUpdater CRC check failed, image is corrupted\x1B[0m\r\n", 57);
+                boot_option = BOOT_OPTION_NONE;
+                HAL_Delay(1500);
+                display_menu();
                 break;
             }
                 
@@ -406,11 +598,11 @@ int main(void) {
             }
         }
         
-        // Check for timeout
-        if (boot_option == BOOT_OPTION_NONE) {
+        // Check for timeout, a station decides itself when to boot
+        if (boot_option == BOOT_OPTION_NONE && !command_session) {
             uint32_t check_time = HAL_GetTick();
             if (check_time - autoboot_timer >= BOOT_TIMEOUT_MS) {
-                if (is_firmware_valid(APP_ADDR, &boot_config)) {
+                if (is_app_present(&boot_config)) {
                     transport_send(&uart_transport, (const uint8_t*)"\x1B[93m\r\n Auto-boot timeout reached. Booting application...\x1B[0m\r\n", 69);
                     
                     // Wait for UART to finish
@@ -3,10 +3,212 @@ import sys
 import argparse
 import subprocess
 import shutil
+import struct
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from merge_images import calculate_crc32
+import lzss
 
 HEADER_SIZE = 0x200
 
-def create_patch(old_firmware, new_firmware, output_patch, encrypt=False):
+# Delta generator from the host tools build (host/delta)
+DEFAULT_GENERATOR = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'build-host', 'delta_gen')
+
+# Patch kinds (header byte 7)
+IMAGE_PATCH_DELTA = 1
+IMAGE_PATCH_INPLACE = 2
+
+# Header flags (header byte 11)
+IMAGE_FLAG_COMPRESSED = 0x01
+
+# In-place annotation, see InplaceAnnotation_t in delta_update.h
+INPLACE_ANNOTATION_MAGIC = 0x31504C49
+INPLACE_MAX_SECTORS = 8
+INPLACE_SCRATCH_SLOTS = 2
+INPLACE_NONE = 0xFF
+INPLACE_ANNOTATION_FORMAT = '<IIIIIIB3x8s8s'
+
+# jdiff operators
+JDIFF_ESC = 0xA7
+JDIFF_MOD = 0xA6
+JDIFF_INS = 0xA5
+JDIFF_DEL = 0xA4
+JDIFF_EQL = 0xA3
+JDIFF_BKT = 0xA2
+
+def jdiff_copies(patch):
+    """
+    Walks a jdiff patch the same way janpatch does and returns the copy operations.
+    
+    Returns a list of (source_offset, target_offset, length) for every EQL run.
+    """
+    copies = []
+    pos = 0
+    src = 0
+    tgt = 0
+    
+    def read_length():
+        nonlocal pos
+        l = patch[pos]
+        pos += 1
+        if l <= 251:
+            return l + 1
+        if l == 252:
+            pos += 1
+            return l + patch[pos - 1] + 1
+        if l == 253:
+            pos += 2
+            return (patch[pos - 2] << 8) + patch[pos - 1]
+        if l == 254:
+            pos += 4
+            return int.from_bytes(patch[pos - 4:pos], 'big')
+        raise ValueError(f"Invalid length byte at offset {pos - 1}")
+    
+    def data_run(up_source):
+        # MOD/INS data runs until an ESC followed by an operator
+        nonlocal pos, src, tgt
+        while pos < len(patch):
+            m = patch[pos]
+            if m != JDIFF_ESC:
+                pos += 1
+                count = 1
+            elif pos + 1 >= len(patch):
+                pos += 1
+                return
+            elif patch[pos + 1] == JDIFF_ESC:
+                pos += 2
+                count = 1
+            elif JDIFF_BKT <= patch[pos + 1] <= JDIFF_MOD:
+                return
+            else:
+                pos += 2
+                count = 2
+            tgt += count
+            if up_source:
+                src += count
+    
+    while pos < len(patch):
+        if patch[pos] != JDIFF_ESC:
+            data_run(True)
+            continue
+        
+        if pos + 1 >= len(patch):
+            break
+        op = patch[pos + 1]
+        pos += 2
+        
+        if op == JDIFF_EQL:
+            length = read_length()
+            copies.append((src, tgt, length))
+            src += length
+            tgt += length
+        elif op == JDIFF_MOD:
+            data_run(True)
+        elif op == JDIFF_INS:
+            data_run(False)
+        elif op == JDIFF_BKT:
+            src -= read_length()
+        elif op == JDIFF_DEL:
+            src += read_length()
+        else:
+            raise ValueError(f"Invalid operator at offset {pos - 1}")
+    
+    return copies
+
+def inplace_plan_fits(last_use, unchanged, sector_count):
+    """
+    Replays the scratch allocation of the Updater (inplace_enter_sector).
+    """
+    owner = [INPLACE_NONE] * INPLACE_SCRATCH_SLOTS
+    
+    for sector in range(sector_count):
+        if unchanged[sector]:
+            continue
+        
+        for s in range(INPLACE_SCRATCH_SLOTS):
+            if owner[s] != INPLACE_NONE and last_use[owner[s]] < sector:
+                owner[s] = INPLACE_NONE
+        
+        if last_use[sector] != INPLACE_NONE and last_use[sector] >= sector:
+            if INPLACE_NONE not in owner:
+                return False
+            owner[owner.index(INPLACE_NONE)] = sector
+    
+    return True
+
+def create_inplace_annotation(old_image, new_image, patch_data, sector_size, slot_size, staged_data=None):
+    """
+    Builds the annotation the Updater needs to apply a patch inside the slot.
+    
+    staged_data is what follows the annotation in the staging area (the compressed
+    container for a compressed patch), the size and CRC cover those bytes.
+    
+    last_use[j] is the last new sector that copies from old sector j. Old sectors
+    still needed after they are overwritten are kept in scratch sectors; sectors
+    that are identical in both images are not touched at all.
+    """
+    sector_count = slot_size // sector_size
+    old_size = len(old_image) - HEADER_SIZE
+    new_size = len(new_image) - HEADER_SIZE
+    
+    if sector_count > INPLACE_MAX_SECTORS:
+        raise ValueError(f"Slot has {sector_count} sectors, at most {INPLACE_MAX_SECTORS} are supported")
+    if len(new_image) > slot_size or len(old_image) > slot_size:
+        raise ValueError("Image does not fit the slot")
+    
+    # Sectors whose bytes stay the same (sector 0 always changes, it holds the header)
+    new_end = len(new_image)
+    unchanged = [0] * sector_count
+    for i in range(1, sector_count):
+        start = i * sector_size
+        end = min(start + sector_size, new_end)
+        if start >= new_end:
+            unchanged[i] = 1
+        elif len(old_image) >= end and old_image[start:end] == new_image[start:end]:
+            unchanged[i] = 1
+    
+    last_use = [INPLACE_NONE] * sector_count
+    for src, tgt, length in jdiff_copies(patch_data):
+        src += HEADER_SIZE
+        tgt += HEADER_SIZE
+        while length > 0:
+            chunk = min(length, sector_size - src % sector_size, sector_size - tgt % sector_size)
+            source_sector = src // sector_size
+            target_sector = tgt // sector_size
+            
+            # Output for unchanged sectors is dropped, those copies need no source
+            if target_sector < sector_count and not unchanged[target_sector] and source_sector < sector_count:
+                if last_use[source_sector] == INPLACE_NONE or last_use[source_sector] < target_sector:
+                    last_use[source_sector] = target_sector
+            
+            src += chunk
+            tgt += chunk
+            length -= chunk
+    
+    if not inplace_plan_fits(last_use, unchanged, sector_count):
+        raise ValueError(f"Patch needs more than {INPLACE_SCRATCH_SLOTS} scratch sectors, use a regular patch")
+    
+    saved = sum(1 for j in range(sector_count) if not unchanged[j] and last_use[j] != INPLACE_NONE and last_use[j] >= j)
+    print(f"In-place plan: {sector_count - sum(unchanged)} sectors rewritten, {saved} copied to scratch")
+    
+    old_crc = struct.unpack_from('<I', old_image, 16)[0]
+    old_header_size = struct.unpack_from('<I', old_image, 20)[0]
+    if old_header_size != old_size:
+        raise ValueError("Old firmware header does not match its size")
+    
+    if staged_data is None:
+        staged_data = patch_data
+    
+    annotation = struct.pack(INPLACE_ANNOTATION_FORMAT,
+                             INPLACE_ANNOTATION_MAGIC, old_size, old_crc,
+                             len(staged_data), calculate_crc32(staged_data),
+                             sector_size, sector_count,
+                             bytes(last_use + [INPLACE_NONE] * (INPLACE_MAX_SECTORS - sector_count)),
+                             bytes(unchanged + [0] * (INPLACE_MAX_SECTORS - sector_count)))
+    return annotation + struct.pack('<I', calculate_crc32(annotation))
+
+def create_patch(old_firmware, new_firmware, output_patch, generator, encrypt=False, in_place=False,
+                 sector_size=0x20000, slot_size=0x60000, compress=False):
     script_dir = os.path.dirname(os.path.abspath(__file__))
     
     print(f"Creating patch from {old_firmware} to {new_firmware}")
@@ -28,7 +230,11 @@ def create_patch(old_firmware, new_firmware, output_patch, encrypt=False):
         
         # Set the patch flag even tho it should be set already (for CRC to pass)
         header_bytes = bytearray(new_header)
-        header_bytes[7] = 1  # Set is_patch flag
+        header_bytes[7] = IMAGE_PATCH_INPLACE if in_place else IMAGE_PATCH_DELTA  # Set is_patch flag
+        if compress:
+            header_bytes[11] |= IMAGE_FLAG_COMPRESSED
+        else:
+            header_bytes[11] &= ~IMAGE_FLAG_COMPRESSED & 0xFF
         new_header = bytes(header_bytes)
         
         # Create headerless binaries
@@ -48,20 +254,23 @@ def create_patch(old_firmware, new_firmware, output_patch, encrypt=False):
         print(f"Old firmware (no header): {old_size} bytes")
         print(f"New firmware (no header): {new_size} bytes")
         
-        # Run jdiff to create the patch
-        original_dir = os.getcwd()
-        os.chdir(script_dir)
-        jdiff_cmd = f"./jdiff -j {old_no_header} {new_no_header} {patch_file}"
-        print(f"Running: {jdiff_cmd}")
-
-        try:
-            result = os.system(jdiff_cmd)
-            print(f"jdiff completed with return code: {result}")
-        except Exception as e:
-            print(f"Exception while running jdiff: {e}")
+        # Run the delta generator to create the patch
+        if not os.path.isfile(generator):
+            print(f"Error: Delta generator not found at {generator}")
+            print("Build the host tools first: cmake -S host -B build-host && cmake --build build-host")
+            return False
+        
+        gen_cmd = [generator, '-v', old_no_header, new_no_header, patch_file]
+        print(f"Running: {' '.join(gen_cmd)}")
         
-        # Return to original directory
-        os.chdir(original_dir)
+        result = subprocess.run(gen_cmd, capture_output=True, text=True)
+        if result.stdout:
+            print(result.stdout.rstrip())
+        if result.returncode != 0:
+            print(f"Delta generator failed with return code {result.returncode}")
+            if result.stderr:
+                print(f"Error: {result.stderr}")
+            return False
         
         # Check if the patch file was created successfully
         if not os.path.exists(patch_file):
@@ -79,10 +288,32 @@ def create_patch(old_firmware, new_firmware, output_patch, encrypt=False):
         with open(patch_file, "rb") as f:
             patch_data = f.read()
         
-        # Write final patch (header + patch data)
+        # The Updater decompresses the patch while applying it
+        staged_data = patch_data
+        if compress:
+            staged_data = lzss.compress(patch_data)
+            print(f"Compressed patch: {len(patch_data)} -> {len(staged_data)} bytes "
+                  f"({100.0 * len(staged_data) / len(patch_data):.1f}%)")
+        
+        # In-place patches carry the sector plan between header and patch data
+        annotation = b''
+        if in_place:
+            with open(old_firmware, "rb") as f:
+                old_image = f.read()
+            with open(new_firmware, "rb") as f:
+                new_image = f.read()
+            try:
+                annotation = create_inplace_annotation(old_image, new_image, patch_data, sector_size, slot_size,
+                                                       staged_data)
+            except ValueError as e:
+                print(f"Error: {e}")
+                return False
+        
+        # Write final patch (header + annotation + patch data)
         with open(temp_final, "wb") as f:
             f.write(new_header)
-            f.write(patch_data)
+            f.write(annotation)
+            f.write(staged_data)
         
         # Encrypt if requested
         if encrypt:
@@ -145,6 +376,16 @@ def main():
                         help='Encrypt the patch after creation')
     parser.add_argument('-b', '--build-dir', action='store_true',
                         help='Place output in build directory automatically')
+    parser.add_argument('-g', '--generator', default=os.environ.get('DELTA_GEN', DEFAULT_GENERATOR),
+                        help='Path to the delta_gen host tool (default: build-host/delta_gen or $DELTA_GEN)')
+    parser.add_argument('-i', '--in-place', action='store_true',
+                        help='Annotate the patch so it can be applied without a full backup')
+    parser.add_argument('--sector-size', type=lambda x: int(x, 0), default=0x20000,
+                        help='Erase sector size of the target slot (default: 0x20000)')
+    parser.add_argument('--slot-size', type=lambda x: int(x, 0), default=0x60000,
+                        help='Size of the target slot (default: 0x60000)')
+    parser.add_argument('-z', '--compress', action='store_true',
+                        help='LZSS-compress the patch data, the Updater decompresses it while patching')
     
     args = parser.parse_args()
     
@@ -174,7 +415,8 @@ def main():
         os.makedirs(output_dir, exist_ok=True)
     
     # Create patch
-    if create_patch(args.old_firmware, args.new_firmware, output_path, args.encrypt):
+    if create_patch(args.old_firmware, args.new_firmware, output_path, os.path.abspath(args.generator), args.encrypt,
+                    args.in_place, args.sector_size, args.slot_size, args.compress):
         print("Patch creation completed successfully")
         return 0
     else:
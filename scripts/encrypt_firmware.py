@@ -7,6 +7,9 @@ import sys
 from Crypto.Cipher import AES
 from Crypto.Random import get_random_bytes
 
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from merge_images import compress_image_data
+
 DEFAULT_KEY = bytes([
     0x57, 0xE3, 0x05, 0x34, 0xDB, 0x19, 0x4B, 0x25, 
     0x09, 0x13, 0xB9, 0x64, 0x3A, 0x42, 0xE6, 0x9B 
@@ -17,14 +20,23 @@ DEFAULT_AAD = bytes([
     0x62, 0x65, 0x72, 0x70, 0x75, 0x6e, 0x6b, 0x32
 ])
 
-def encrypt_firmware(input_file, output_file, key=DEFAULT_KEY, aad=DEFAULT_AAD):
-    """Encrypt a firmware binary using AES-GCM"""
+def encrypt_firmware(input_file, output_file, key=DEFAULT_KEY, aad=DEFAULT_AAD, compress=False):
+    """Encrypt a firmware binary using AES-GCM, optionally compressing it first"""
     print(f"Reading firmware from {input_file}")
     with open(input_file, "rb") as f:
         firmware_data = f.read()
     
     print(f"Firmware size: {len(firmware_data)} bytes")
     
+    # Compress before encrypting, ciphertext does not compress
+    if compress:
+        try:
+            firmware_data = compress_image_data(firmware_data)
+        except ValueError as e:
+            print(f"Error: {e}")
+            return False
+        print(f"Compressed size: {len(firmware_data)} bytes")
+    
     # Generate random 12-byte IV key
     nonce = get_random_bytes(12)
     print(f"Generated nonce: {binascii.hexlify(nonce).decode()}")
@@ -120,6 +132,8 @@ def main():
     encrypt_parser = subparsers.add_parser("encrypt", help="Encrypt a firmware binary")
     encrypt_parser.add_argument("input", help="Input firmware binary file")
     encrypt_parser.add_argument("output", help="Output encrypted firmware file")
+    encrypt_parser.add_argument("-z", "--compress", action="store_true",
+                                help="LZSS-compress the image before encrypting it")
     
     # Decrypt command
     decrypt_parser = subparsers.add_parser("decrypt", help="Decrypt an encrypted firmware binary")
@@ -154,7 +168,7 @@ def main():
             print(f"Error: Input file {args.input} does not exist")
             return 1
         
-        if encrypt_firmware(args.input, args.output, key, aad):
+        if encrypt_firmware(args.input, args.output, key, aad, args.compress):
             return 0
         else:
             return 1
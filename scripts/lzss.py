@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""
+LZSS compressor for the bootloader's streaming decoder (common/src/lzss.c).
+
+Bitstream, MSB first:
+  1 + 8 bits                          literal byte
+  0 + window_bits + lookahead_bits    copy (count + 1) bytes from (index + 1) bytes back
+preceded by a 12-byte container header (LzssHeader_t).
+"""
+import argparse
+import struct
+import sys
+
+LZSS_MAGIC = 0x5A4C
+LZSS_HEADER_FORMAT = '<HBBII'
+LZSS_HEADER_SIZE = struct.calcsize(LZSS_HEADER_FORMAT)
+
+DEFAULT_WINDOW_BITS = 11
+DEFAULT_LOOKAHEAD_BITS = 5
+
+# Hash chain depth, more finds longer matches but is slower
+MAX_CHAIN = 48
+
+class BitWriter:
+    def __init__(self):
+        self.out = bytearray()
+        self.acc = 0
+        self.count = 0
+
+    def write(self, value, bits):
+        self.acc = (self.acc << bits) | value
+        self.count += bits
+        while self.count >= 8:
+            self.count -= 8
+            self.out.append((self.acc >> self.count) & 0xFF)
+        self.acc &= (1 << self.count) - 1
+
+    def flush(self):
+        if self.count:
+            self.out.append((self.acc << (8 - self.count)) & 0xFF)
+            self.acc = 0
+            self.count = 0
+        return bytes(self.out)
+
+def compress_stream(data, window_bits=DEFAULT_WINDOW_BITS, lookahead_bits=DEFAULT_LOOKAHEAD_BITS):
+    """
+    Returns the raw LZSS bitstream for data (no container header).
+
+    Greedy parsing with one step of lazy matching over 3-byte hash chains.
+    """
+    window = 1 << window_bits
+    max_len = 1 << lookahead_bits
+    copy_bits = 1 + window_bits + lookahead_bits
+    # Shortest copy that is smaller than the same bytes as literals
+    min_len = copy_bits // 9 + 1
+    n = len(data)
+
+    heads = {}
+    prev = [0] * n
+
+    def insert(i):
+        if i + 3 <= n:
+            key = data[i:i + 3]
+            prev[i] = heads.get(key, -1)
+            heads[key] = i
+
+    def longest(i):
+        best_len = 0
+        best_dist = 0
+        if i + 3 > n:
+            return 0, 0
+        limit = min(max_len, n - i)
+        candidate = heads.get(data[i:i + 3], -1)
+        chain = 0
+        while candidate >= 0 and i - candidate <= window and chain < MAX_CHAIN:
+            length = 3
+            while length < limit and data[candidate + length] == data[i + length]:
+                length += 1
+            if length > best_len:
+                best_len = length
+                best_dist = i - candidate
+                if length == limit:
+                    break
+            candidate = prev[candidate]
+            chain += 1
+        return best_len, best_dist
+
+    writer = BitWriter()
+    i = 0
+    pending = None
+    while i < n:
+        length, dist = pending if pending else longest(i)
+        pending = None
+
+        if length >= min_len and i + 1 < n:
+            # Lazy step: take a literal if the next position has a longer copy
+            insert(i)
+            next_len, next_dist = longest(i + 1)
+            if next_len > length:
+                writer.write(0x100 | data[i], 9)
+                i += 1
+                pending = (next_len, next_dist)
+                continue
+            writer.write(((dist - 1) << lookahead_bits) | (length - 1), copy_bits)
+            for j in range(i + 1, i + length):
+                insert(j)
+            i += length
+        elif length >= min_len:
+            writer.write(((dist - 1) << lookahead_bits) | (length - 1), copy_bits)
+            i += length
+        else:
+            writer.write(0x100 | data[i], 9)
+            insert(i)
+            i += 1
+
+    return writer.flush()
+
+def compress(data, window_bits=DEFAULT_WINDOW_BITS, lookahead_bits=DEFAULT_LOOKAHEAD_BITS):
+    """
+    Returns data as an LZSS container (header + bitstream).
+    """
+    payload = compress_stream(data, window_bits, lookahead_bits)
+    header = struct.pack(LZSS_HEADER_FORMAT, LZSS_MAGIC, window_bits, lookahead_bits, len(payload), len(data))
+    return header + payload
+
+def decompress(container):
+    """
+    Reference decoder, used to check the compressor output.
+    """
+    magic, window_bits, lookahead_bits, payload_size, raw_size = struct.unpack_from(LZSS_HEADER_FORMAT, container)
+    if magic != LZSS_MAGIC:
+        raise ValueError("Not an LZSS container")
+    payload = container[LZSS_HEADER_SIZE:LZSS_HEADER_SIZE + payload_size]
+
+    out = bytearray()
+    acc = 0
+    count = 0
+    pos = 0
+
+    def bits(k):
+        nonlocal acc, count, pos
+        while count < k:
+            acc = (acc << 8) | payload[pos]
+            pos += 1
+            count += 8
+        count -= k
+        return (acc >> count) & ((1 << k) - 1)
+
+    while len(out) < raw_size:
+        if bits(1):
+            out.append(bits(8))
+        else:
+            dist = bits(window_bits) + 1
+            length = bits(lookahead_bits) + 1
+            for _ in range(length):
+                out.append(out[-dist])
+
+    return bytes(out[:raw_size])
+
+def main():
+    parser = argparse.ArgumentParser(description='Compress a file into an LZSS container')
+    parser.add_argument('input', help='Input file')
+    parser.add_argument('output', help='Output file')
+    parser.add_argument('-w', '--window-bits', type=int, default=DEFAULT_WINDOW_BITS,
+                        help=f'log2 of the window size, 8..11 (default: {DEFAULT_WINDOW_BITS})')
+    parser.add_argument('-l', '--lookahead-bits', type=int, default=DEFAULT_LOOKAHEAD_BITS,
+                        help=f'log2 of the longest copy, 3..5 (default: {DEFAULT_LOOKAHEAD_BITS})')
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+
+    container = compress(data, args.window_bits, args.lookahead_bits)
+    with open(args.output, 'wb') as f:
+        f.write(container)
+
+    print(f"{len(data)} -> {len(container)} bytes ({100.0 * len(container) / max(len(data), 1):.1f}%)")
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
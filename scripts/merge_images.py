@@ -5,6 +5,8 @@ import struct
 import binascii
 import sys
 
+import lzss
+
 IMAGE_MAGIC_LOADER = 0xDEADC0DE
 IMAGE_MAGIC_UPDATER = 0xFEEDFACE
 IMAGE_MAGIC_APP = 0xC0FFEE00
@@ -20,6 +22,9 @@ APP_ADDR = 0x08020000
 
 HEADER_SIZE = 0x200
 
+# Header flags (header byte 11)
+IMAGE_FLAG_COMPRESSED = 0x01
+
 # CRC32
 def calculate_crc32(data):
     crc = 0xFFFFFFFF
@@ -62,7 +67,7 @@ def extract_header_fields(header_data):
     version_major = header_data[8]
     version_minor = header_data[9]
     version_patch = header_data[10]
-    padding = header_data[11]
+    flags = header_data[11]
     vector_addr = int.from_bytes(header_data[12:16], byteorder='little')
     crc = int.from_bytes(header_data[16:20], byteorder='little')
     data_size = int.from_bytes(header_data[20:24], byteorder='little')
@@ -76,7 +81,7 @@ def extract_header_fields(header_data):
         'version_major': version_major,
         'version_minor': version_minor,
         'version_patch': version_patch,
-        '_padding': padding,
+        'flags': flags,
         'vector_addr': vector_addr,
         'crc': crc,
         'data_size': data_size
@@ -106,7 +111,7 @@ def create_updated_header(header_dict, image_data, base_addr):
     header[8] = header_dict['version_major']
     header[9] = header_dict['version_minor']
     header[10] = header_dict['version_patch']
-    header[11] = header_dict['_padding']
+    header[11] = header_dict['flags']
     header[12:16] = header_dict['vector_addr'].to_bytes(4, byteorder='little')
     header[16:20] = header_dict['crc'].to_bytes(4, byteorder='little')
     header[20:24] = header_dict['data_size'].to_bytes(4, byteorder='little')
@@ -134,7 +139,7 @@ def create_new_header(image_type, magic, version, vector_addr, data, is_patch=Fa
     header[8] = version_major
     header[9] = version_minor
     header[10] = version_patch
-    header[11] = 0  # _padding
+    header[11] = 0  # flags
     header[12:16] = vector_addr.to_bytes(4, byteorder='little')
     header[16:20] = crc.to_bytes(4, byteorder='little')
     header[20:24] = data_size.to_bytes(4, byteorder='little')
@@ -232,6 +237,44 @@ def patch_binary(filename, image_type, version, base_addr, is_patch=False):
     print(f"Patched binary written to {output_filename}")
     return output_filename
 
+def compress_image_data(image):
+    """
+    Returns a headered image with the data replaced by an LZSS container.
+    
+    CRC and data_size keep describing the decompressed data, the Updater
+    decompresses while receiving and stages the plain image.
+    """
+    if len(image) < HEADER_SIZE or not is_header_present(image):
+        raise ValueError("Image has no header")
+    
+    header = bytearray(image[:HEADER_SIZE])
+    if header[7] != 0:
+        raise ValueError("Patches are compressed by create_patch.py -z")
+    if header[11] & IMAGE_FLAG_COMPRESSED:
+        raise ValueError("Image is already compressed")
+    
+    data = image[HEADER_SIZE:]
+    if struct.unpack_from('<I', header, 20)[0] != len(data):
+        raise ValueError("Header data_size does not match the image")
+    
+    header[11] |= IMAGE_FLAG_COMPRESSED
+    return bytes(header) + lzss.compress(data)
+
+def compress_image(filename, output_filename=None):
+    with open(filename, 'rb') as f:
+        image = f.read()
+    
+    compressed = compress_image_data(image)
+    
+    if output_filename is None:
+        output_filename = os.path.splitext(filename)[0] + "_compressed.bin"
+    with open(output_filename, 'wb') as f:
+        f.write(compressed)
+    
+    print(f"Compressed image written to {output_filename}: {len(image)} -> {len(compressed)} bytes "
+          f"({100.0 * len(compressed) / len(image):.1f}%)")
+    return output_filename
+
 def merge_binaries(boot_filename, loader_filename, updater_filename, app_filename, output_filename="merged_firmware.bin"):
     # Memory map offsets from base address 0x08000000
     LOADER_OFFSET = 0x4000 
@@ -301,6 +344,13 @@ def main():
     patch_parser.add_argument("--base-addr", type=lambda x: int(x, 0), 
                              help="Base address override (default: determined by type)")
     patch_parser.add_argument("--is-patch", action="store_true", help="Flag to indicate this is a delta patch")
+    patch_parser.add_argument("--compress", action="store_true",
+                             help="Also write an LZSS-compressed copy for XMODEM transfer (*_patched_compressed.bin)")
+
+    # Compress command
+    compress_parser = subparsers.add_parser("compress", help="Compress a patched image for XMODEM transfer")
+    compress_parser.add_argument("filename", help="Patched binary file (with header)")
+    compress_parser.add_argument("--output", help="Output filename (default: <name>_compressed.bin)")
 
     # Merge command
     merge_parser = subparsers.add_parser("merge", help="Merge multiple binaries into a single image")
@@ -334,7 +384,18 @@ def main():
         except ValueError:
             parser.error("Version components must be integers")
             
-        patch_binary(args.filename, args.type, version, args.base_addr, args.is_patch)
+        output = patch_binary(args.filename, args.type, version, args.base_addr, args.is_patch)
+        if args.compress:
+            if args.is_patch:
+                parser.error("Patches are compressed by create_patch.py -z")
+            compress_image(output)
+        
+    elif args.command == "compress":
+        try:
+            compress_image(args.filename, args.output)
+        except ValueError as e:
+            print(f"Error: {e}")
+            sys.exit(1)
         
     elif args.command == "merge":
         output = merge_binaries(args.boot, args.loader, args.updater, args.app)
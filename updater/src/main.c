@@ -16,6 +16,9 @@
 #include "crc.h"
 #include "ring_buffer.h"
 #include "delta_update.h"
+#include "boot_trace.h"
+#include "profile.h"
+#include "command.h"
 
 /* Private typedef -----------------------------------------------------------*/
 // State for XMODEM recovery after transfer complete
@@ -38,7 +41,7 @@ __attribute__((section(".image_hdr"))) const ImageHeader_t IMAGE_HEADER = {
   .version_major = 1,
   .version_minor = 0,
   .version_patch = 0,
-  ._padding = 0,
+  .flags = 0,
   .vector_addr = 0x08010200,
   .crc = 0,
   .data_size = 0
@@ -50,6 +53,17 @@ static UARTTransport_Config_t uart_config;
 static Transport_t uart_transport;
 static XmodemConfig_t xmodem_config;
 static XmodemManager_t xmodem_manager;
+static CommandParser_t command_parser;
+static uint8_t command_session;    // A station said HELLO, no menus are drawn
+static CommandProgressInfo_t update_progress;
+static uint32_t update_start_time;
+static uint32_t last_frame_time;
+static uint32_t baud_previous;      // Rate SET_BAUD goes back to unless confirmed, 0 if none pending
+static uint32_t baud_switch_time;
+
+/* Private macros ------------------------------------------------------------*/
+// Sends a string literal, its length counted by the compiler
+#define SEND_LITERAL(text) transport_send(&uart_transport, (const uint8_t*)(text), sizeof(text) - 1)
 
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
@@ -61,6 +75,16 @@ static uint32_t recover_from_xmodem(void);
 static int is_enter_blocked(uint32_t current_time);
 static void block_enter_temporarily(uint32_t current_time);
 static void send_cancel_sequence(void);
+static void report_patch_error(int result);
+static int finish_direct_update(uint32_t destination_addr);
+static void invalidate_partial_transfer(void);
+static void dump_boot_trace(void);
+static uint8_t handle_command(const CommandFrame_t* frame, const BootConfig_t* config);
+static int is_baudrate_offered(uint32_t baudrate);
+static void check_baud_fallback(uint32_t current_time);
+#ifdef AB_SLOTS
+static uint32_t get_inactive_slot(const BootConfig_t* config);
+#endif
 
 // Updater banner - orange colored
 const char* BOOT_BANNER = "\r\n\
@@ -73,12 +97,34 @@ const char* BOOT_BANNER = "\r\n\
 
 const char* UPDATER_OPTIONS_STR = "\x1B[96mPress \x1B[31m'Spacebar'\x1B[0m\x1B[96m to update firmware using XMODEM(CRC)\r\n\
 Press \x1B[31m'I'\x1B[0m\x1B[96m to get information about system state\r\n\
+Press \x1B[31m'T'\x1B[0m\x1B[96m to dump the boot time trace (CSV)\r\n\
 Press \x1B[31m'Q'\x1B[0m\x1B[96m to return to loader\x1B[0m\r\n";
 
+#ifdef AB_SLOTS
+/**
+  * @brief Get the application slot that is not booted
+  * @param config Boot configuration
+  * @return Address of the slot that updates are written to
+  */
+static uint32_t get_inactive_slot(const BootConfig_t* config) {
+    uint32_t active = select_app_slot(config);
+
+    // With no bootable image the first slot is filled first
+    if (active == 0 || active == config->app_b_addr) {
+        return config->app_addr;
+    }
+
+    return config->app_b_addr;
+}
+#endif
+
 /**
   * @brief Clears the terminal screen using ANSI escape codes
   */
 static void clear_screen(void) {
+    if (command_session) {
+        return;
+    }
     transport_send(&uart_transport, (const uint8_t*)"\x1B[2J\x1B[1;1H", 10);
     HAL_Delay(10);
 }
@@ -88,6 +134,9 @@ static void clear_screen(void) {
   */
 static void display_menu(void) {
     char version_str[20];
+    if (command_session) {
+        return;
+    }
     clear_screen();
     
     // Send banner
@@ -143,12 +192,129 @@ static void send_cancel_sequence(void) {
     HAL_Delay(1000);
 }
 
+/**
+  * @brief Print a detailed message for a delta patch error code
+  * @param result Error code returned by the patch handler
+  */
+static void report_patch_error(int result) {
+    switch(result) {
+        case 1:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mNo valid source firmware found!\x1B[0m\r\n", 44);
+            break;
+        case 2:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mNot a valid patch file!\x1B[0m\r\n", 36);
+            break;
+        case 3:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mInvalid backup sector!\x1B[0m\r\n", 35);
+            break;
+        case 4:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mFailed to erase backup sectors!\x1B[0m\r\n", 44);
+            break;
+        case 5:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mFailed to write backup!\x1B[0m\r\n", 36);
+            break;
+        case 6:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mFailed to erase target sectors!\x1B[0m\r\n", 44);
+            break;
+        case 7:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mFailed to write header!\x1B[0m\r\n", 36);
+            break;
+        case 8:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mFailed to apply delta patch!\x1B[0m\r\n", 41);
+            break;
+        case 9:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mCRC verification failed!\x1B[0m\r\n", 37);
+            break;
+        case DELTA_ERR_TRANSFER:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mPatch transfer failed or timed out!\x1B[0m\r\n", 48);
+            break;
+        case DELTA_ERR_AUTHENTICATION:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mPatch authentication failed!\x1B[0m\r\n", 41);
+            break;
+        case DELTA_ERR_SCRATCH:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mNot enough scratch sectors for in-place patch!\x1B[0m\r\n", 59);
+            break;
+        case DELTA_ERR_JOURNAL:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mFailed to write patch journal!\x1B[0m\r\n", 43);
+            break;
+        case DELTA_ERR_COMPRESSION:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mInvalid compressed patch!\x1B[0m\r\n", 38);
+            break;
+        case DELTA_ERR_INPLACE_UNSUPPORTED:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mIn-place patches are not used with A/B slots!\x1B[0m\r\n", 58);
+            break;
+        default:
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mUnknown error during patching!\x1B[0m\r\n", 43);
+            break;
+    }
+}
+
+/**
+  * @brief Verify a direct transfer in its slot and commit the held header
+  * @param destination_addr Slot the image was written to
+  * @return 1 if the image was committed, 0 otherwise
+  */
+static int finish_direct_update(uint32_t destination_addr) {
+    const ImageHeader_t* header = xmodem_get_held_header(&xmodem_manager);
+    uint32_t received = xmodem_manager.current_addr - destination_addr - IMAGE_HDR_SIZE;
+
+    if (header == NULL || !is_image_valid(header) || header->is_patch ||
+        header->image_type != IMAGE_TYPE_APP || header->vector_addr != destination_addr + IMAGE_HDR_SIZE) {
+        SEND_LITERAL("\r\n\x1B[31mInvalid image header!\x1B[0m\r\n");
+        return 0;
+    }
+
+    // The CRC may only cover data that was received into the slot
+    if (header->data_size == 0 || header->data_size > APP_SLOT_SIZE - IMAGE_HDR_SIZE || header->data_size > received) {
+        SEND_LITERAL("\r\n\x1B[31mInvalid image size!\x1B[0m\r\n");
+        return 0;
+    }
+
+    SEND_LITERAL("\r\n\x1B[93mVerifying firmware CRC...\x1B[0m\r\n");
+    if (crc_calculate_memory(destination_addr + IMAGE_HDR_SIZE, header->data_size) != header->crc) {
+        SEND_LITERAL("\r\n\x1B[31mCRC verification failed! Aborting.\x1B[0m\r\n");
+        return 0;
+    }
+
+    // Header goes in last, the image only becomes valid now
+    if (!xmodem_commit_header(&xmodem_manager)) {
+        SEND_LITERAL("\r\n\x1B[31mFailed to write header!\x1B[0m\r\n");
+        invalidate_firmware(destination_addr);
+        return 0;
+    }
+
+    verify_cache_store(destination_addr);
+    SEND_LITERAL("\r\n\x1B[32mFirmware written and verified in place.\x1B[0m\r\n");
+    return 1;
+}
+
+/**
+  * @brief Invalidate an application slot that a transfer stopped part way through
+  * @note A staging area target is left alone, its contents are checked before use
+  */
+static void invalidate_partial_transfer(void) {
+    uint32_t addr = xmodem_manager.target_addr;
+
+#ifdef AB_SLOTS
+    if (addr == APP_ADDR || addr == APP_B_ADDR) {
+#else
+    if (addr == APP_ADDR) {
+#endif
+        invalidate_firmware(addr);
+    }
+}
+
 /**
   * @brief Recover from XMODEM transfer (cleanup and show menu)
   * @return New time reference
   */
 static uint32_t recover_from_xmodem(void) {
     clear_rx_buffer();
+    
+    // A station waits for the ACK of its EOT, there is no terminal to settle
+    if (command_session) {
+        return HAL_GetTick();
+    }
     HAL_Delay(3000);
     
     // Clear screen
@@ -167,6 +333,189 @@ static uint32_t recover_from_xmodem(void) {
     return new_time;
 }
 
+/**
+  * @brief Send the boot time trace as CSV, one row per checkpoint
+  */
+static void dump_boot_trace(void) {
+    char row[64];
+    
+    transport_send(&uart_transport, (const uint8_t*)BOOT_TRACE_CSV_HEADER, strlen(BOOT_TRACE_CSV_HEADER));
+    for (uint32_t i = 0; i < boot_trace_count(); i++) {
+        size_t len = boot_trace_format_row(i, row, sizeof(row));
+        transport_send(&uart_transport, (const uint8_t*)row, len);
+        
+        // The TX ring buffer drops bytes when full, let it drain between rows
+        while (!uart_transport_is_tx_complete()) {
+            transport_process(&uart_transport);
+        }
+    }
+}
+
+/**
+  * @brief Check if a line rate can be offered to a station
+  * @param baudrate Requested rate
+  * @return 1 if UPDATE_USART generates it within COMMAND_BAUD_TOLERANCE, 0 otherwise
+  */
+static int is_baudrate_offered(uint32_t baudrate) {
+    uint32_t actual = uart_transport_actual_baudrate(baudrate);
+    uint32_t error = actual > baudrate ? actual - baudrate : baudrate - actual;
+    
+    return actual != 0 && (uint64_t)error * 1000U <= (uint64_t)baudrate * COMMAND_BAUD_TOLERANCE;
+}
+
+/**
+  * @brief Go back to a working line rate when a station no longer talks at this one
+  * @param current_time Current tick
+  * @note A SET_BAUD that is not confirmed in COMMAND_BAUD_CONFIRM_MS is undone, a
+  *       confirmed rate is kept until no frame came for COMMAND_BAUD_IDLE_MS.
+  */
+static void check_baud_fallback(uint32_t current_time) {
+    if (baud_previous != 0) {
+        if (current_time - baud_switch_time > COMMAND_BAUD_CONFIRM_MS) {
+            uart_transport_set_baudrate(baud_previous);
+            baud_previous = 0;
+        }
+    } else if (uart_transport_get_baudrate() != uart_config.baudrate &&
+               current_time - last_frame_time > COMMAND_BAUD_IDLE_MS) {
+        uart_transport_set_baudrate(uart_config.baudrate);
+    }
+}
+
+/**
+  * @brief Answer a command frame from a flashing station
+  * @param frame Received frame
+  * @param config Boot configuration
+  * @return Menu key that carries the command out, 0 if nothing is left to do
+  */
+static uint8_t handle_command(const CommandFrame_t* frame, const BootConfig_t* config) {
+    // Updates run through the same paths as the menu keys
+    static const uint8_t update_keys[] = {
+        [COMMAND_TARGET_LOADER] = '1',
+        [COMMAND_TARGET_APP] = '2',
+        [COMMAND_TARGET_APP_PATCH] = '3',
+        [COMMAND_TARGET_APP_DIRECT] = 'D'
+    };
+    uint8_t reply[COMMAND_MAX_FRAME];
+    size_t reply_len = command_answer_common(frame, config, &IMAGE_HEADER, reply);
+    uint32_t new_baudrate = 0;
+    uint8_t key = 0;
+
+    if (frame->id == COMMAND_HELLO) {
+        command_session = 1;
+    }
+
+    if (reply_len == 0) {
+        uint8_t status = COMMAND_STATUS_OK;
+        uint8_t target = frame->length == 1 ? frame->payload[0] : COMMAND_TARGET_NONE;
+
+        switch (frame->id) {
+            case COMMAND_START_UPDATE: {
+                // XMODEM starts once the reply is out
+                if (target < sizeof(update_keys) && update_keys[target] != 0) {
+                    key = update_keys[target];
+                    memset(&update_progress, 0, sizeof(update_progress));
+                    update_progress.state = COMMAND_PROGRESS_RECEIVING;
+                    update_progress.target = target;
+                    update_start_time = HAL_GetTick();
+                } else {
+                    status = COMMAND_STATUS_BAD_TARGET;
+                }
+                break;
+            }
+
+            case COMMAND_QUERY_PROGRESS: {
+                CommandProgressInfo_t progress = update_progress;
+                if (progress.state == COMMAND_PROGRESS_RECEIVING) {
+                    progress.packets = xmodem_get_packet_count(&xmodem_manager);
+                    progress.elapsed_ms = HAL_GetTick() - update_start_time;
+                }
+                reply_len = command_build_reply(reply, frame->id, status, &progress, sizeof(progress));
+                break;
+            }
+
+            case COMMAND_BOOT: {
+                // The application is booted by the loader, the session goes along
+                if (target != COMMAND_TARGET_LOADER && target != COMMAND_TARGET_APP) {
+                    status = COMMAND_STATUS_BAD_TARGET;
+                } else if (!is_firmware_valid(LOADER_ADDR, config)) {
+                    status = COMMAND_STATUS_FAILED;
+                } else {
+                    command_session_handoff(target == COMMAND_TARGET_APP ? COMMAND_TARGET_APP : COMMAND_TARGET_NONE);
+                    key = 'Q';
+                }
+                break;
+            }
+
+            case COMMAND_GET_BAUD: {
+                static const uint32_t candidates[] = COMMAND_BAUD_RATES;
+                uint32_t rates[1 + COMMAND_BAUD_MAX_RATES];
+                uint16_t count = 0;
+                
+                rates[count++] = uart_transport_get_baudrate();
+                for (uint32_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]) && count < 1 + COMMAND_BAUD_MAX_RATES; i++) {
+                    if (is_baudrate_offered(candidates[i])) {
+                        rates[count++] = candidates[i];
+                    }
+                }
+                reply_len = command_build_reply(reply, frame->id, status, rates, count * sizeof(uint32_t));
+                break;
+            }
+            
+            case COMMAND_SET_BAUD: {
+                // Answered at the old rate, switched once the reply is out
+                uint32_t baudrate;
+                if (frame->length != sizeof(baudrate)) {
+                    status = COMMAND_STATUS_BAD_LENGTH;
+                    break;
+                }
+                memcpy(&baudrate, frame->payload, sizeof(baudrate));
+                
+                if (baudrate == uart_transport_get_baudrate()) {
+                    // Confirmed by a station that hears us at it
+                    baud_previous = 0;
+                } else if (!is_baudrate_offered(baudrate)) {
+                    status = COMMAND_STATUS_BAD_RATE;
+                } else {
+                    if (baud_previous == 0) {
+                        baud_previous = uart_transport_get_baudrate();
+                    }
+                    new_baudrate = baudrate;
+                }
+                break;
+            }
+            
+            case COMMAND_RESET: {
+                break;
+            }
+
+            default: {
+                status = COMMAND_STATUS_UNSUPPORTED;
+                break;
+            }
+        }
+
+        if (reply_len == 0) {
+            reply_len = command_build_reply(reply, frame->id, status, NULL, 0);
+        }
+    }
+
+    transport_send(&uart_transport, reply, reply_len);
+
+    if (new_baudrate != 0) {
+        uart_transport_set_baudrate(new_baudrate);
+        baud_switch_time = HAL_GetTick();
+    }
+
+    if (frame->id == COMMAND_RESET) {
+        while (!uart_transport_is_tx_complete()) {
+            transport_process(&uart_transport);
+        }
+        NVIC_SystemReset();
+    }
+
+    return key;
+}
+
 /**
   * @brief Toggle LED
   * @param led_pin LED pin number (0-3)
@@ -239,11 +588,14 @@ static void set_led(uint8_t led_pin, uint8_t state) {
   * @retval int
   */
 int main(void) {
+    boot_trace_mark(BOOT_TRACE_UPDATER_START);
+
     /* Reset of all peripherals, Initializes the Flash interface and the Systick. */
     HAL_Init();
 
     /* Configure the system clock */
     SystemClock_Config();
+    boot_trace_mark(BOOT_TRACE_UPDATER_CLOCK);
 
     /* Initialize all configured peripherals */
     MX_GPIO_Init();
@@ -253,7 +605,10 @@ int main(void) {
         .app_addr = APP_ADDR,
         .updater_addr = UPDATER_ADDR,
         .loader_addr = LOADER_ADDR,
-        .image_hdr_size = IMAGE_HDR_SIZE
+        .image_hdr_size = IMAGE_HDR_SIZE,
+#ifdef AB_SLOTS
+        .app_b_addr = APP_B_ADDR
+#endif
     };
     
     // Configure XMODEM
@@ -266,7 +621,7 @@ int main(void) {
 #endif
     
     // Configure UART transport
-    uart_config.usart = USART2;
+    uart_config.usart = UPDATE_USART;
     uart_config.baudrate = 115200;
     uart_config.timeout = 1000;
     uart_config.use_xmodem = 1;
@@ -274,6 +629,9 @@ int main(void) {
     uart_config.updater_addr = UPDATER_ADDR;
     uart_config.loader_addr = LOADER_ADDR;
     uart_config.image_hdr_size = IMAGE_HDR_SIZE;
+#ifdef UPDATE_RTS_CTS
+    uart_config.flow_control = 1;
+#endif
     
     // Initialize transport
     transport_init(&uart_transport, TRANSPORT_UART, &uart_config);
@@ -284,18 +642,37 @@ int main(void) {
     // Initialize CRC module
     crc_init();
     
+#ifndef AB_SLOTS
+    // Finish an in-place patch that was cut off by a reset
+    if (patch_journal_is_active()) {
+        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mResuming interrupted in-place patch...\x1B[0m\r\n", 51);
+        int result = resume_firmware_patch_inplace(APP_ADDR, PATCH_ADDR, BACKUP_ADDR, IMAGE_HDR_SIZE);
+        if (result != 0) {
+            report_patch_error(result);
+            set_led(2, 1);  // Red LED
+        } else {
+            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[32mIn-place patch completed.\x1B[0m\r\n", 38);
+        }
+        HAL_Delay(2000);
+    }
+#endif
+    
     // Initial clear for RX buffer
     clear_rx_buffer();
     
+    // Booted by a station through the loader, it is already waiting for commands
+    uint8_t handoff_target;
+    command_session = command_session_take(&handoff_target);
+    command_parser_init(&command_parser);
+    
     // Display menu
     display_menu();
-    
-    // Enable USART2 IRQ
-    NVIC_EnableIRQ(USART2_IRQn);
+    boot_trace_mark(BOOT_TRACE_UPDATER_READY);
     
     // Main variables
     bool update_in_progress = false;
     uint32_t firmware_target = APP_ADDR;
+    uint32_t direct_target = 0;
     uint32_t led_toggle_time = HAL_GetTick();
     PostXmodemState_t post_xmodem_state = POST_XMODEM_COMPLETE;
     bool xmodem_error_occurred = false;
@@ -314,9 +691,16 @@ int main(void) {
         
         // Handle post XMODEM recovery
         if (post_xmodem_state == POST_XMODEM_RECOVERING) {
+            // Outcome of an update started by a station
+            if (update_progress.state == COMMAND_PROGRESS_RECEIVING) {
+                update_progress.state = xmodem_error_occurred ? COMMAND_PROGRESS_FAILED : COMMAND_PROGRESS_DONE;
+                update_progress.packets = xmodem_get_packet_count(&xmodem_manager);
+                update_progress.elapsed_ms = HAL_GetTick() - update_start_time;
+            }
             recover_from_xmodem();
             post_xmodem_state = POST_XMODEM_COMPLETE;
             update_in_progress = false;
+            last_frame_time = HAL_GetTick();
             continue;
         }
         
@@ -339,9 +723,21 @@ int main(void) {
         
         // Read and process user input if not updating
         if (!update_in_progress) {
+            check_baud_fallback(current_time);
+            
             uint8_t byte;
             if (transport_receive(&uart_transport, &byte, 1) > 0) {
                 
+                // Framed commands from a flashing station share the line with the menu keys
+                CommandFrame_t frame;
+                CommandParse_t parsed = command_parse_byte(&command_parser, byte, current_time, &frame);
+                if (parsed == COMMAND_PARSE_FRAME) {
+                    last_frame_time = current_time;
+                    byte = handle_command(&frame, &boot_config);
+                } else if (parsed != COMMAND_PARSE_IDLE) {
+                    byte = 0;
+                }
+                
                 switch (byte) {
                     case 'Q':
                     case 'q': {
@@ -364,6 +760,8 @@ int main(void) {
                         transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[96mUpdate firmware using XMODEM - select target:\x1B[0m\r\n", 58);
                         transport_send(&uart_transport, (const uint8_t*)"\x1B[92m[\x1B[33m1\x1B[92m] \x1B[32m- Loader\x1B[0m", 34);
                         transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[92m[\x1B[33m2\x1B[92m] \x1B[32m- Application\x1B[0m", 39);
+                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[92m[\x1B[33m3\x1B[92m] \x1B[32m- Application delta patch (streamed)\x1B[0m", 66);
+                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[92m[\x1B[33mD\x1B[92m] \x1B[32m- Application, direct to slot (no staging copy)\x1B[0m", 77);
                         break;
                     }
                         
@@ -373,6 +771,7 @@ int main(void) {
                         transport_send(&uart_transport, (const uint8_t*)"\x1B[92mUpdating loader...\x1B[0m\r\n", 30);
                         transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[91mSend file using XMODEM protocol with CRC-16. \x1B[0m\r\n\x1B[31mIf menu doesn't load after update is over, please press \x1B[91m'Esc'\x1B[0m\r\n", 131);
                         firmware_target = LOADER_ADDR;
+                        xmodem_set_staging(&xmodem_manager, 0);
                         xmodem_start(&xmodem_manager, firmware_target);
                         update_in_progress = true;
                         
@@ -395,6 +794,14 @@ int main(void) {
                         transport_send(&uart_transport, (const uint8_t*)"\x1B[92mUpdating application...\x1B[0m\r\n", 34);
                         transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[96mSend file using XMODEM protocol with CRC-16.\x1B[0m\r\n\x1B[91mIf menu doesn't load after update is over, please press \x1B[31m'Esc'\x1B[0m\r\n", 131);
                         firmware_target = APP_ADDR;
+#ifdef AB_SLOTS
+                        // Received straight into the slot that is not running, its old image is gone
+                        uint32_t inactive_slot = get_inactive_slot(&boot_config);
+                        verify_cache_invalidate(inactive_slot);
+                        xmodem_set_staging(&xmodem_manager, inactive_slot);
+#else
+                        xmodem_set_staging(&xmodem_manager, 0);
+#endif
                         xmodem_start(&xmodem_manager, firmware_target);
                         update_in_progress = true;
                         
@@ -411,6 +818,84 @@ int main(void) {
                         break;
                     }
                         
+                    case 'D':
+                    case 'd': {
+                        // Write the application straight into its slot, header last
+                        clear_screen();
+                        SEND_LITERAL("\x1B[92mUpdating application in place...\x1B[0m\r\n");
+                        SEND_LITERAL("\r\n\x1B[96mSend file using XMODEM protocol with CRC-16.\x1B[0m\r\n\x1B[91mIf menu doesn't load after update is over, please press \x1B[31m'Esc'\x1B[0m\r\n");
+                        firmware_target = APP_ADDR;
+#ifdef AB_SLOTS
+                        direct_target = get_inactive_slot(&boot_config);
+#else
+                        direct_target = APP_ADDR;
+#endif
+                        // The old image is gone once the transfer starts
+                        verify_cache_invalidate(direct_target);
+                        xmodem_set_direct(&xmodem_manager, direct_target);
+                        xmodem_start(&xmodem_manager, firmware_target);
+                        update_in_progress = true;
+                        
+                        set_led(0, 1);  // Green - system alive
+                        set_led(1, 1);  // Orange - XMODEM active
+                        set_led(2, 0);  // Red - no error
+                        set_led(3, 0);  // Blue - no data received yet
+                        
+                        // Spam initial 'C'
+                        if (xmodem_should_send_byte(&xmodem_manager)) {
+                            uint8_t response = xmodem_get_response(&xmodem_manager);
+                            transport_send(&uart_transport, &response, 1);
+                        }
+                        break;
+                    }
+                        
+                    case '3': {
+                        // Apply an application patch while it is being received
+                        clear_screen();
+                        transport_send(&uart_transport, (const uint8_t*)"\x1B[92mStreaming application patch...\x1B[0m\r\n", 41);
+                        
+                        set_led(0, 1);  // Green - system alive
+                        set_led(1, 1);  // Orange - XMODEM active
+                        set_led(2, 0);  // Red - no error
+                        set_led(3, 0);  // Blue - no data received yet
+                        
+                        // Blocks until the transfer and the patch are finished
+#ifdef AB_SLOTS
+                        uint32_t inactive_slot = get_inactive_slot(&boot_config);
+                        int result = handle_firmware_patch_stream(
+                            &xmodem_manager,
+                            select_app_slot(&boot_config),  // Source address (running slot)
+                            inactive_slot,                  // Target address (other slot)
+                            inactive_slot + APP_SLOT_SIZE,  // No backup, bounds the target slot
+                            IMAGE_HDR_SIZE                  // Header size
+                        );
+#else
+                        int result = handle_firmware_patch_stream(
+                            &xmodem_manager,
+                            APP_ADDR,       // Source address (current firmware)
+                            APP_ADDR,       // Target address (same as source)
+                            BACKUP_ADDR,    // Backup address
+                            IMAGE_HDR_SIZE  // Header size
+                        );
+#endif
+                        
+                        update_progress.patch_error = (int16_t)result;
+                        xmodem_error_occurred = (result != 0);
+                        if (result != 0) {
+                            char error_str[64];
+                            sprintf(error_str, "\r\n\x1B[31mPatch application failed! Error code: %d\x1B[0m\r\n", result);
+                            transport_send(&uart_transport, (const uint8_t*)error_str, strlen(error_str));
+                            report_patch_error(result);
+                            set_led(2, 1);  // Red LED
+                        } else {
+                            transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[32mPatch applied successfully!\x1B[0m\r\n", 40);
+                        }
+                        
+                        set_led(1, 0);
+                        post_xmodem_state = POST_XMODEM_RECOVERING;
+                        break;
+                    }
+                        
                     case 'I':
                     case 'i': {
                         // Show system information
@@ -450,10 +935,20 @@ int main(void) {
                         
                         transport_send(&uart_transport, (const uint8_t*)"\r\n", 2);
                         
-                        // Application info
+                        // Application info, the slot that would be booted
+                        uint32_t app_slot = select_app_slot(&boot_config);
+                        if (app_slot == 0) {
+                            app_slot = APP_ADDR;
+                        }
+#ifdef AB_SLOTS
+                        transport_send(&uart_transport, (const uint8_t*)"\x1B[96mApplication (slot ", 23);
+                        transport_send(&uart_transport, (const uint8_t*)(app_slot == APP_B_ADDR ? "B" : "A"), 1);
+                        transport_send(&uart_transport, (const uint8_t*)"): \x1B[0m", 7);
+#else
                         transport_send(&uart_transport, (const uint8_t*)"\x1B[96mApplication: \x1B[0m", 24);
+#endif
                         
-                        if (get_firmware_header(APP_ADDR, &boot_config, &header)) {
+                        if (get_firmware_header(app_slot, &boot_config, &header)) {
                             char buffer[256];
                             
                             transport_send(&uart_transport, (const uint8_t*)"\x1B[32mValid\x1B[0m\r\n", 16);
@@ -474,7 +969,7 @@ int main(void) {
                             sprintf(buffer, "\x1B[92m  Is Patch: \x1B[93m%s\x1B[0m\r\n", header.is_patch ? "Yes" : "No");
                             transport_send(&uart_transport, (const uint8_t*)buffer, strlen(buffer));
                             
-                            sprintf(buffer, "\x1B[92m  Address: \x1B[93m0x%08lX\x1B[0m\r\n", APP_ADDR);
+                            sprintf(buffer, "\x1B[92m  Address: \x1B[93m0x%08lX\x1B[0m\r\n", app_slot);
                             transport_send(&uart_transport, (const uint8_t*)buffer, strlen(buffer));
                         } else {
                             transport_send(&uart_transport, (const uint8_t*)"\x1B[31mInvalid or Not Found\x1B[0m\r\n", 33);
@@ -521,6 +1016,48 @@ int main(void) {
                         sprintf(buffer, "\x1B[92m  System uptime: \x1B[93m%u seconds\x1B[0m\r\n", HAL_GetTick() / 1000);
                         transport_send(&uart_transport, (const uint8_t*)buffer, strlen(buffer));
                         
+                        UARTTransport_Errors_t uart_errors;
+                        uart_transport_get_errors(&uart_errors);
+                        sprintf(buffer, "\x1B[92m  UART errors: \x1B[93m%lu overrun, %lu dropped, %lu framing, %lu noise, %lu parity\x1B[0m\r\n",
+                                uart_errors.overrun, uart_errors.dropped, uart_errors.framing, uart_errors.noise, uart_errors.parity);
+                        transport_send(&uart_transport, (const uint8_t*)buffer, strlen(buffer));
+                        
+#ifdef ENABLE_PROFILING
+                        // Hot-path counters of the last transfer
+                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[96mProfile (last transfer):\x1B[0m\r\n", 37);
+                        transport_send(&uart_transport, (const uint8_t*)PROFILE_REPORT_HEADER, strlen(PROFILE_REPORT_HEADER));
+                        for (uint32_t i = 0; i < PROFILE_COUNTER_COUNT; i++) {
+                            size_t len = profile_format_row(i, buffer, sizeof(buffer));
+                            
+                            // Let the TX ring buffer drain so no row is cut short
+                            while (!uart_transport_is_tx_complete()) {
+                                transport_process(&uart_transport);
+                            }
+                            transport_send(&uart_transport, (const uint8_t*)buffer, len);
+                        }
+#endif
+                        
+                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[91mPress \x1B[31m'Esc'\x1B[0m \x1B[91mto return to menu...\x1B[0m\r\n", 59);
+                        
+                        uint8_t key;
+                        while(1) {
+                            transport_process(&uart_transport);
+                            if (transport_receive(&uart_transport, &key, 1) > 0) {
+                                if (key == 0x1B) { // ESC key
+                                    break;
+                                }
+                            }
+                        }
+                        
+                        display_menu();
+                        break;
+                    }
+                        
+                    case 'T':
+                    case 't': {
+                        // Dump the boot time trace, plain CSV so it can be copied from the terminal
+                        clear_screen();
+                        dump_boot_trace();
                         transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[91mPress \x1B[31m'Esc'\x1B[0m \x1B[91mto return to menu...\x1B[0m\r\n", 59);
                         
                         uint8_t key;
@@ -577,9 +1114,23 @@ int main(void) {
                         xmodem_error_occurred = false;
                         // Wait for flash operations
                         HAL_Delay(100);
+                        
+                        // Direct transfer, the image is already in its slot without a header
+                        if (xmodem_manager.hold_header) {
+                            if (!finish_direct_update(direct_target)) {
+                                xmodem_error_occurred = true;
+                                set_led(2, 1);  // Red LED
+                            }
+                            xmodem_set_staging(&xmodem_manager, 0);
+                            post_xmodem_state = POST_XMODEM_RECOVERING;
+                            break;
+                        }
 
-                        transport_send(&uart_transport, (const uint8_t*)"\r\nDumping raw header bytes from PATCH_ADDR:\r\n", 44);
-                        uint8_t* raw_header = (uint8_t*)PATCH_ADDR;
+                        // Staging area, or the inactive slot for an A/B application
+                        uint32_t received_addr = xmodem_manager.target_addr;
+
+                        transport_send(&uart_transport, (const uint8_t*)"\r\nDumping raw header bytes from receive area:\r\n", 47);
+                        uint8_t* raw_header = (uint8_t*)received_addr;
                         char debug_bytes[100];
                         for (int i = 0; i < 32; i += 4) {
                             sprintf(debug_bytes, "%02X %02X %02X %02X\r\n", 
@@ -587,9 +1138,9 @@ int main(void) {
                             transport_send(&uart_transport, (const uint8_t*)debug_bytes, strlen(debug_bytes));
                         }
                         
-                        // Read the header from the staging area to determine what we received
+                        // Read the header from the receive area to determine what we received
                         ImageHeader_t received_header;
-                        memcpy(&received_header, (void*)PATCH_ADDR, sizeof(ImageHeader_t));
+                        memcpy(&received_header, (void*)received_addr, sizeof(ImageHeader_t));
                         
                         // Calculate the total size of the firmware we received
                         uint32_t received_size = received_header.data_size + IMAGE_HDR_SIZE;
@@ -604,15 +1155,39 @@ int main(void) {
                         if (received_header.is_patch) {
                             // Determine the target address based on image type
                             uint32_t target_addr;
+#ifdef AB_SLOTS
+                            // No backup area, the inactive slot is the scratch space
+                            uint32_t backup_addr = get_inactive_slot(&boot_config);
+#else
+                            uint32_t backup_addr = BACKUP_ADDR;
+#endif
+                            uint32_t source_addr;
                             
                             if (received_header.image_type == IMAGE_TYPE_APP) {
+#ifdef AB_SLOTS
+                                // Patch the running slot into the other one
+                                source_addr = select_app_slot(&boot_config);
+                                target_addr = backup_addr;
+                                backup_addr = target_addr + APP_SLOT_SIZE;
+                                if (source_addr == 0) {
+                                    report_patch_error(1);
+                                    xmodem_error_occurred = true;
+                                    set_led(2, 1);  // Red LED
+                                    post_xmodem_state = POST_XMODEM_RECOVERING;
+                                    break;
+                                }
+#else
                                 target_addr = APP_ADDR;
+                                source_addr = target_addr;
+#endif
                                 transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mReceived application patch\x1B[0m\r\n", 42);
                             } else if (received_header.image_type == IMAGE_TYPE_LOADER) {
                                 target_addr = LOADER_ADDR;
+                                source_addr = target_addr;
                                 transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mReceived loader patch\x1B[0m\r\n", 39);
                             } else if (received_header.image_type == IMAGE_TYPE_UPDATER) {
                                 target_addr = UPDATER_ADDR;
+                                source_addr = target_addr;
                                 transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mReceived updater patch\x1B[0m\r\n", 40);
                             } else {
                                 // Unknown image type
@@ -627,60 +1202,52 @@ int main(void) {
                             transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mApplying patch to firmware...\x1B[0m\r\n", 41);
 
                             // Output debug info
-                            sprintf(debug, "\r\nDebug: Target=0x%08lX, PATCH_ADDR=0x%08lX, BACKUP_ADDR=0x%08lX\r\n", 
-                                    target_addr, PATCH_ADDR, BACKUP_ADDR);
+                            sprintf(debug, "\r\nDebug: Source=0x%08lX, Target=0x%08lX, PATCH_ADDR=0x%08lX, Backup=0x%08lX\r\n", 
+                                    source_addr, target_addr, PATCH_ADDR, backup_addr);
                             transport_send(&uart_transport, (const uint8_t*)debug, strlen(debug));
 
                             // Apply the patch using our handle_firmware_patch function
-                            int result = handle_firmware_patch(
-                                target_addr,    // Source address (current firmware)
-                                PATCH_ADDR,     // Patch address (staging area)
-                                target_addr,    // Target address (same as source)
-                                BACKUP_ADDR,    // Backup address
-                                IMAGE_HDR_SIZE  // Header size
-                            );
+                            int result;
+                            if (received_header.is_patch == IMAGE_PATCH_INPLACE) {
+#ifdef AB_SLOTS
+                                // Patches always go to the other slot, nothing to patch in place
+                                result = DELTA_ERR_INPLACE_UNSUPPORTED;
+#else
+                                // Annotated patch, backup area is only used as scratch
+                                result = handle_firmware_patch_inplace(
+                                    target_addr,    // Slot to patch
+                                    PATCH_ADDR,     // Patch address (staging area)
+                                    backup_addr,    // Scratch sectors
+                                    IMAGE_HDR_SIZE  // Header size
+                                );
+#endif
+                            } else {
+                                result = handle_firmware_patch(
+                                    source_addr,    // Source address (current firmware)
+                                    PATCH_ADDR,     // Patch address (staging area)
+                                    target_addr,    // Target address (other slot or same as source)
+                                    backup_addr,    // Backup address
+                                    IMAGE_HDR_SIZE  // Header size
+                                );
+                            }
 
+                            update_progress.patch_error = (int16_t)result;
                             if (result != 0) {
                                 char error_str[64];
                                 sprintf(error_str, "\r\n\x1B[31mPatch application failed! Error code: %d\x1B[0m\r\n", result);
                                 transport_send(&uart_transport, (const uint8_t*)error_str, strlen(error_str));
                                 
-                                // Detailed error messages based on error code
-                                switch(result) {
-                                    case 1:
-                                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mNo valid source firmware found!\x1B[0m\r\n", 47);
-                                        break;
-                                    case 2:
-                                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mNot a valid patch file!\x1B[0m\r\n", 38);
-                                        break;
-                                    case 3:
-                                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mInvalid backup sector!\x1B[0m\r\n", 39);
-                                        break;
-                                    case 4:
-                                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mFailed to erase backup sectors!\x1B[0m\r\n", 48);
-                                        break;
-                                    case 5:
-                                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mFailed to write backup!\x1B[0m\r\n", 41);
-                                        break;
-                                    case 6:
-                                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mFailed to erase target sectors!\x1B[0m\r\n", 48);
-                                        break;
-                                    case 7:
-                                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mFailed to write header!\x1B[0m\r\n", 39);
-                                        break;
-                                    case 8:
-                                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mFailed to apply delta patch!\x1B[0m\r\n", 44);
-                                        break;
-                                    case 9:
-                                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mCRC verification failed!\x1B[0m\r\n", 39);
-                                        break;
-                                    default:
-                                        transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mUnknown error during patching!\x1B[0m\r\n", 45);
-                                        break;
-                                }
+                                report_patch_error(result);
                                 
-                                transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mFirmware invalidated.\x1B[0m\r\n", 38);
-                                transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mRestored from backup.\x1B[0m\r\n", 40);
+                                if (patch_journal_is_active()) {
+                                    // In-place patch stopped on a flash error, retried after reset
+                                    transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mPatch will be resumed on next start.\x1B[0m\r\n", 49);
+                                } else if (target_addr != source_addr) {
+                                    transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mTarget slot invalidated, running slot kept.\x1B[0m\r\n", 56);
+                                } else {
+                                    transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mFirmware invalidated.\x1B[0m\r\n", 38);
+                                    transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mRestored from backup.\x1B[0m\r\n", 40);
+                                }
                                 xmodem_error_occurred = true;
                                 set_led(2, 1);  // Red LED
                             } else {
@@ -702,7 +1269,12 @@ int main(void) {
                             
                             // Determine destination address based on image type
                             if (received_header.image_type == IMAGE_TYPE_APP) {
+#ifdef AB_SLOTS
+                                // Already in the inactive slot
+                                destination_addr = received_addr;
+#else
                                 destination_addr = APP_ADDR;
+#endif
                                 transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mReceived application firmware\x1B[0m\r\n", 45);
                             } else if (received_header.image_type == IMAGE_TYPE_LOADER) {
                                 destination_addr = LOADER_ADDR;
@@ -723,8 +1295,11 @@ int main(void) {
                             transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mVerifying firmware CRC...\x1B[0m\r\n", 39);
                             
                             // Verify the CRC first
-                            if (!verify_firmware_crc(PATCH_ADDR, IMAGE_HDR_SIZE)) {
+                            if (!verify_firmware_crc(received_addr, IMAGE_HDR_SIZE)) {
                                 transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mCRC verification failed! Aborting.\x1B[0m\r\n", 47);
+                                if (destination_addr == received_addr) {
+                                    invalidate_firmware(destination_addr);
+                                }
                                 xmodem_error_occurred = true;
                                 set_led(2, 1);  // Red LED
                                 post_xmodem_state = POST_XMODEM_RECOVERING;
@@ -733,6 +1308,22 @@ int main(void) {
                             
                             transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[32mCRC verification successful.\x1B[0m\r\n", 42);
                             
+                            if (destination_addr == received_addr) {
+                                // Received in its slot, it must be linked for it to be booted
+                                if (received_header.vector_addr != destination_addr + IMAGE_HDR_SIZE) {
+                                    transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mImage is linked for the other slot!\x1B[0m\r\n", 48);
+                                    invalidate_firmware(destination_addr);
+                                    xmodem_error_occurred = true;
+                                    set_led(2, 1);  // Red LED
+                                } else {
+                                    // Nothing to copy, the loader switches over once the image verifies
+                                    verify_cache_store(destination_addr);
+                                    transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[32mSlot updated, it boots if its version is the highest.\x1B[0m\r\n", 66);
+                                }
+                                post_xmodem_state = POST_XMODEM_RECOVERING;
+                                break;
+                            }
+                            
                             // Now copy to the destination
                             transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[93mCopying firmware to destination...\x1B[0m\r\n", 47);
                             
@@ -746,6 +1337,9 @@ int main(void) {
                                 break;
                             }
                             
+                            // Destination is about to change, drop its cached verification proof
+                            verify_cache_invalidate(destination_addr);
+
                             // Erase sectors at destination
                             flash_erase_sector(destination_addr);
                             if (received_size > 0x20000) { // If larger than one sector
@@ -753,7 +1347,7 @@ int main(void) {
                             }
                             
                             // Copy firmware from staging to destination
-                            if (!flash_write(destination_addr, (uint8_t*)PATCH_ADDR, received_size)) {
+                            if (!flash_write(destination_addr, (uint8_t*)received_addr, received_size)) {
                                 transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mFailed to copy firmware to destination!\x1B[0m\r\n", 54);
                                 
                                 // Invalidate destination
@@ -777,6 +1371,7 @@ int main(void) {
                                 set_led(2, 1);  // Red LED
                             } else {
                                 transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[32mDestination firmware verified successfully.\x1B[0m\r\n", 57);
+                                verify_cache_store(destination_addr);
                                 
                                 // Clean up staging area
                                 for (uint32_t addr = PATCH_ADDR; addr < PATCH_ADDR + PATCH_SIZE; addr += 0x20000) {
@@ -792,12 +1387,14 @@ int main(void) {
                     // Handle other XMODEM errors
                     case XMODEM_ERROR_CANCELLED:
                         transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mTransfer cancelled.\x1B[0m\r\n", 33);
+                        invalidate_partial_transfer();
                         xmodem_error_occurred = true;
                         post_xmodem_state = POST_XMODEM_RECOVERING;
                         break;
                         
                     case XMODEM_ERROR_TIMEOUT:
                         transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mTransfer timed out.\x1B[0m\r\n", 33);
+                        invalidate_partial_transfer();
                         xmodem_error_occurred = true;
                         set_led(2, 1);  // Red LED
                         post_xmodem_state = POST_XMODEM_RECOVERING;
@@ -818,6 +1415,7 @@ int main(void) {
                         send_cancel_sequence();
                         
                         transport_send(&uart_transport, (const uint8_t*)"\r\n\x1B[31mError writing to flash memory.\x1B[0m\r\n", 46);
+                        invalidate_partial_transfer();
                         
                         xmodem_error_occurred = true;
                         set_led(2, 1);  // Red LED
@@ -856,6 +1454,11 @@ int main(void) {
                         post_xmodem_state = POST_XMODEM_RECOVERING;
                         break;
                 }
+                
+                // What ended the transfer, for QUERY_PROGRESS
+                if (post_xmodem_state == POST_XMODEM_RECOVERING) {
+                    update_progress.transfer = (uint8_t)result;
+                }
             }
             
             // Check if need to send 'C'